@@ -78,6 +78,16 @@ OpticalParsetPageForm {
                 // SqlBrowserWindow {
                 //     id: sqlBrowserWindow
                 // }
+                CheckBox {
+                    id: preloadCheckBox
+                    text: "Preload"
+                    // Off by default: n/k data is loaded when a material is first used.
+                    enabled: model.checked && (model.name === "Solcore" || model.name === "Sopra")
+                    onCheckedChanged: {
+                        model.db_model.preload = checked
+                    }
+                }
+
                 Button {
                     id: dbImportButton
                     text: "Import"
@@ -116,6 +126,16 @@ OpticalParsetPageForm {
                         matListDialog.open()
                     }
                 }
+
+                Button {
+                    id: cancelButton
+                    text: "Cancel"
+                    // The progress only moves while an import loads n/k data.
+                    enabled: model.progress > 0 && model.progress < 1
+                    onClicked: {
+                        model.db_model.cancelImport()
+                    }
+                }
             }
 
             FileDialog {
@@ -199,6 +219,46 @@ OpticalParsetPageForm {
         }
     }
 
+    // Compiles the imported materials into a binary n/k store, which is opened again on startup.
+    Row {
+        id: storeRow
+        anchors.top: optLView.bottom
+        spacing: 10
+
+        TextField {
+            id: storePathTextField
+            width: 480
+            placeholderText: "Enter the Material Store Path"
+            text: DbSysModel.materialStorePath()
+        }
+
+        Button {
+            id: storeBuildButton
+            text: "Build Store"
+            enabled: storePathTextField.text.length > 0
+            onClicked: {
+                storeStatusText.text = DbSysModel.buildMaterialStore(storePathTextField.text) === 0
+                        ? "Material store is built and opened" : "Fail to build the material store"
+            }
+        }
+
+        Button {
+            id: storeOpenButton
+            text: "Open Store"
+            enabled: storePathTextField.text.length > 0
+            onClicked: {
+                storeStatusText.text = DbSysModel.openMaterialStore(storePathTextField.text) === 0
+                        ? "Material store is opened" : "Fail to open the material store"
+            }
+        }
+
+        Text {
+            id: storeStatusText
+            anchors.verticalCenter: parent.verticalCenter
+            text: ""
+        }
+    }
+
     function statusInfo(status) {
         switch (status) {
             case 0:
@@ -207,6 +267,8 @@ OpticalParsetPageForm {
                 return "Cannot find the path"
             case 2:
                 return "Fail to load the n/k data"
+            case 3:
+                return "Import is cancelled"
             default:
                 return "Invalid status"
         }
@@ -8,6 +8,7 @@
 #include "Preferences.h"
 #include "Profile.h"
 #include "SettingsStorage.h"
+#include "material/MaterialStore.h"
 
 using namespace std::string_literals;  // equivalent to std::literals::string_literals
 
@@ -24,4 +25,8 @@ Application::Application(int &argc, char **argv) : QApplication(argc, argv) {
     Profile::initInstance(profileDir, m_commandLineArgs.configName);
     SettingsStorage::initInstance();
     Preferences::initInstance();
+    // Serve the n/k data of imported materials from the store built in an earlier session, if any.
+    if (const QString storePath = Preferences::instance()->getMaterialStorePath(); not storePath.isEmpty()) {
+        MaterialStore::instance().open(storePath);
+    }
 }
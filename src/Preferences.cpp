@@ -44,3 +44,12 @@ void Preferences::freeInstance() {
 std::filesystem::path Preferences::getsUnitSystemPath() const {
     return value<std::filesystem::path>(u"Preferences/Downloads/UnitsSystemPath"_s);
 }
+
+// Materials Options
+QString Preferences::getMaterialStorePath() const {
+    return value<QString>(u"Preferences/Materials/StorePath"_s);
+}
+
+void Preferences::setMaterialStorePath(const QString &path) {
+    setValue(u"Preferences/Materials/StorePath"_s, path);
+}
@@ -21,6 +21,11 @@ public:
     // General options
     [[nodiscard]] std::filesystem::path getsUnitSystemPath() const;
 
+    // Materials options
+    // Compiled n/k store (see MaterialStore) opened on startup, empty for none
+    [[nodiscard]] QString getMaterialStorePath() const;
+    void setMaterialStorePath(const QString &path);
+
 private:
     static Preferences *m_instance;
 };
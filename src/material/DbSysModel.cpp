@@ -2,7 +2,12 @@
 // Created by Yihua Liu on 2024-06-17.
 //
 
+#include <algorithm>
+
 #include "DbSysModel.h"
+#include "MaterialResidency.h"
+#include "MaterialStore.h"
+#include "Preferences.h"
 
 DbSysModel* DbSysModel::m_instance = nullptr;
 
@@ -86,6 +91,46 @@ OpticMaterial<QList<double>> *DbSysModel::getMatByName(const QString &mat_name)
     return nullptr;
 }
 
+int DbSysModel::buildMaterialStore(const QString &store_path) {
+    QList<OpticMaterial<QList<double>> *> materials;
+    for (const MaterialDbModel *mat_db : m_db) {
+        if (mat_db->checked()) {
+            materials.append(mat_db->materials());
+        }
+    }
+    const qsizetype num_stored = MaterialStore::build(store_path, materials);
+    if (num_stored < 0) {
+        return 1;
+    }
+    qDebug() << num_stored << "of" << materials.size() << "materials stored in" << store_path;
+    return openMaterialStore(store_path);
+}
+
+int DbSysModel::openMaterialStore(const QString &store_path) {
+    if (not MaterialStore::instance().open(store_path)) {
+        return 1;
+    }
+    Preferences::instance()->setMaterialStorePath(store_path);  // to be opened again on startup
+    return 0;
+}
+
+QString DbSysModel::materialStorePath() const {
+    return Preferences::instance()->getMaterialStorePath();
+}
+
+void DbSysModel::setMaterialBudget(const qint64 budget_bytes) {
+    MaterialResidency<OpticMaterial<QList<double>>>::instance().set_budget(static_cast<std::size_t>(std::max<qint64>(budget_bytes, 0)));
+}
+
+QVariantMap DbSysModel::materialResidency() const {
+    const MaterialResidencyStats stats = MaterialResidency<OpticMaterial<QList<double>>>::instance().stats();
+    return {{"resident_bytes", static_cast<qulonglong>(stats.resident_bytes)},
+            {"budget", static_cast<qulonglong>(stats.budget)},
+            {"num_resident", static_cast<qulonglong>(stats.num_resident)},
+            {"loads", static_cast<qulonglong>(stats.loads)},
+            {"evictions", static_cast<qulonglong>(stats.evictions)}};
+}
+
 QHash<int, QByteArray> DbSysModel::roleNames() const {
     QHash<int, QByteArray> roles;
     roles[NameRole] = "name";
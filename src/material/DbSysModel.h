@@ -35,6 +35,20 @@ public:
     void addModel(MaterialDbModel *db_model);
 
     [[nodiscard]] OpticMaterial<QList<double>> *getMatByName(const QString &mat_name) const;
+    /*
+     * Compiles the materials of the checked databases into a MaterialStore file at store_path and opens it, so that
+     * later loads of n/k data are served from the store. An opened store is remembered in Preferences and opened
+     * again on startup. Returns 0 on success and 1 on failure.
+     */
+    Q_INVOKABLE int buildMaterialStore(const QString &store_path);
+    Q_INVOKABLE int openMaterialStore(const QString &store_path);
+    Q_INVOKABLE QString materialStorePath() const;
+    /*
+     * Memory budget of the n/k data of the imported materials (see MaterialResidency), and its current resident bytes,
+     * number of resident materials, loads, and evictions.
+     */
+    Q_INVOKABLE void setMaterialBudget(qint64 budget_bytes);
+    Q_INVOKABLE QVariantMap materialResidency() const;
 
 protected:
     [[nodiscard]] QHash<int, QByteArray> roleNames() const override;
@@ -244,8 +244,9 @@ Q_INVOKABLE void DeviceModel::calcRAT() {
     try {
         auto stack = par->side ? std::make_unique<OpticStack<QList<double>>>(std::move(structure), false, db_system->getMatByName(opt_material.back())) :
                 std::make_unique<OpticStack<QList<double>>>(std::move(structure), false, db_system->getMatByName(opt_material.front()));
-        // calculate_rat<QList<double>&>
-        const rat_dict<double> rat_out = calculate_rat(std::move(stack), wavelengths, 0, 's');
+        // calculate_rat_cached<void, QList<double>&>; sweeps that keep the optical stack reuse its R, A, and T
+        const rat_dict<double> rat_out = calculate_rat_cached(RatCache<double>::instance(), std::move(stack),
+                                                              wavelengths, 0, 's');
         const std::valarray<double> R_va = std::get<std::valarray<double>>(rat_out.at("R"));
         R = {std::begin(R_va), std::end(R_va)};
         const std::valarray<double> A_va = std::get<std::valarray<double>>(rat_out.at("A"));
@@ -2,10 +2,14 @@
 // Created by Yihua Liu on 2024/6/4.
 //
 
+#include <algorithm>
 #include <map>
 #include <stdexcept>
+#include <thread>
 #include <unordered_set>
 #include <utility>
+#include <vector>
+#include <QCoreApplication>
 #include <QDir>
 #include <QFile>
 #include <QProcessEnvironment>
@@ -139,6 +143,10 @@ QString findSolcoreUserConfig() {
 
 int MaterialDbModel::readSolcoreDb(const QString& db_path) {
     using namespace Qt::Literals::StringLiterals;
+    if (m_importing) {
+        qWarning("An import into %s is in progress.", qUtf8Printable(m_name));
+        return 1;
+    }
     const QUrl url(db_path);
     QString db_path_imported = db_path;
     if (url.isLocalFile()) {
@@ -173,21 +181,16 @@ int MaterialDbModel::readSolcoreDb(const QString& db_path) {
     const QMap<QString, QString> mat_map = solcore_config.loadGroup("Materials");
     const QMap<QString, QString> others_map = solcore_config.loadGroup("Others");
     ParameterSystem::SetInstance(solcore_config.loadGroup("Parameters"), ini_finfo.absolutePath());
+    QList<std::pair<QString, OpticMaterial<QList<double>> *>> imported;
+    imported.reserve(mat_map.size());
     for (QMap<QString, QString>::const_iterator it = mat_map.cbegin(); it not_eq mat_map.cend(); ++it) {
-        try {
-            const QString& mat_name = it.key();
-            QString mat_path = it.value();
-            mat_path.replace("SOLCORE_ROOT", ini_finfo.absolutePath());
-            auto *opt_mat = new OpticMaterial<QList<double>>(mat_name, DbType::SOLCORE, mat_path);
-            beginInsertRows(QModelIndex(), static_cast<int>(m_list.size()), static_cast<int>(m_list.size()));
-            m_list.insert(mat_name, opt_mat);
-            endInsertRows();
-            // emit dataChanged(index(0), index(static_cast<int>(m_list.size()) - 1));
-            setProgress(static_cast<double>(std::distance(mat_map.cbegin(), it) + 1) / static_cast<double>(mat_map.size()));
-        } catch (std::runtime_error& e) {
-            qWarning() << e.what();
-            return 2;
-        }
+        const QString& mat_name = it.key();
+        QString mat_path = it.value();
+        mat_path.replace("SOLCORE_ROOT", ini_finfo.absolutePath());
+        imported.emplace_back(mat_name, new OpticMaterial<QList<double>>(mat_name, DbType::SOLCORE, mat_path));
+    }
+    if (const int status = importMaterials(imported, m_preload); status not_eq 0) {
+        return status;
     }
     // read SOPRA db embedded in solcore
     if (others_map.contains("sopra")) {
@@ -205,8 +208,13 @@ int MaterialDbModel::readSolcoreDb(const QString& db_path) {
 
 // Optical Data from Sopra SA http://www.sspectra.com/sopra.html
 int MaterialDbModel::readSopraDb(const QString& db_path) {
+    if (m_importing) {
+        qWarning("An import into %s is in progress.", qUtf8Printable(m_name));
+        return 1;
+    }
     const QDir sopra_dir(db_path);
     QFile sopra_db(sopra_dir.filePath("SOPRA_DB_Updated.csv"));  // no operator= conversion
+    QList<std::pair<QString, OpticMaterial<QList<double>> *>> imported;
     try {
         if (not sopra_db.open(QIODevice::ReadOnly)) {
             throw std::runtime_error("Cannot open file " + QFileInfo(sopra_db).filePath().toStdString());
@@ -226,24 +234,20 @@ int MaterialDbModel::readSopraDb(const QString& db_path) {
             // info.at(2).emplace_back(ln_data.at(3));  // Wavelength (nm)
             // info.at(3).emplace_back(ln_data.back());  // File Info
             // info.back().emplace_back(path);  // File Path
-            try {
-                auto *opt_mat = new OpticMaterial<QList<double>>(mat_name, DbType::SOPRA, path);
-                beginInsertRows(QModelIndex(), static_cast<int>(m_list.size()), static_cast<int>(m_list.size()));
-                m_list.insert(mat_name, opt_mat);
-                endInsertRows();
-            } catch (std::runtime_error &e) {
-                qWarning() << e.what();
-                return 2;
-            }
+            imported.emplace_back(mat_name, new OpticMaterial<QList<double>>(mat_name, DbType::SOPRA, path));
         }
     } catch (std::runtime_error& e) {
         qWarning() << e.what();
         return 1;
     }
-    return 0;
+    return importMaterials(imported, m_preload);
 }
 
 int MaterialDbModel::readDfDb(const QString& db_path) {
+    if (m_importing) {
+        qWarning("An import into %s is in progress.", qUtf8Printable(m_name));
+        return 1;
+    }
     const QUrl url(db_path);
     QString db_path_imported = db_path;
     if (url.isLocalFile()) {
@@ -270,6 +274,7 @@ int MaterialDbModel::readDfDb(const QString& db_path) {
     // const int maxRow = wsheet->dimension().rowCount();  // qsizetype is long long (different from std::size_t)
     const int maxCol = wsheet->dimension().columnCount();
     std::unordered_set<QString> mat_name_set;
+    QList<std::pair<QString, OpticMaterial<QList<double>> *>> imported;
     // Scan the header first.
     for (int cc = 2; cc < maxCol; cc += 2) {
         // const QString mat_name = clList.at(cc).cell->readValue().toString();
@@ -299,14 +304,11 @@ int MaterialDbModel::readDfDb(const QString& db_path) {
             // You are using wls multiple times! Do not try to move wls to k_wl!
             // Otherwise, qlist.h inline T& last() { Q_ASSERT(!isEmpty()); return *(end()-1); } assertion will fail.
             // auto *opt_mat = new OpticMaterial<QList<double>>(it.key(), wls, std::move(n_series), wls, std::move(k_series));
-            auto *opt_mat = new OpticMaterial<QList<double>>(mat_name, DbType::DF, db_path_imported);
-            beginInsertRows(QModelIndex(), static_cast<int>(m_list.size()), static_cast<int>(m_list.size()));
-            m_list.insert(mat_name, opt_mat);
-            endInsertRows();
+            imported.emplace_back(mat_name, new OpticMaterial<QList<double>>(mat_name, DbType::DF, db_path_imported));
         }
-        setProgress(static_cast<double>(cc + 2) / static_cast<double>(maxCol));
     }
-    return 0;
+    // All materials share one workbook, which load_nk would parse once per material, so they stay lazily loaded.
+    return importMaterials(imported, false);
 }
 
 int MaterialDbModel::readGclDb(const QString& transfer_path) {
@@ -314,7 +316,67 @@ int MaterialDbModel::readGclDb(const QString& transfer_path) {
     return 0;
 }
 
+bool MaterialDbModel::preload() const {
+    return m_preload;
+}
+
+void MaterialDbModel::setPreload(const bool preload) {
+    if (m_preload not_eq preload) {
+        m_preload = preload;
+        emit preloadChanged();
+    }
+}
+
+void MaterialDbModel::cancelImport() {
+    m_cancel = true;
+}
+
+/*
+ * Preloads the n/k data of the imported materials if preload (see preload_nk), while the calling (GUI) thread reports
+ * the progress and keeps processing events, so that cancelImport() can be called. The materials are then merged into
+ * m_list at once, replacing those of the same names. On cancellation, the imported materials are deleted, m_list is
+ * left unchanged, and 3 is returned.
+ */
+int MaterialDbModel::importMaterials(const QList<std::pair<QString, OpticMaterial<QList<double>> *>> &imported,
+                                     const bool preload) {
+    m_cancel = false;
+    m_importing = true;
+    setProgress(0);
+    if (preload and not imported.empty()) {
+        std::vector<OpticMaterial<QList<double>> *> materials;
+        materials.reserve(imported.size());
+        for (const auto &[mat_name, opt_mat] : imported) {
+            materials.push_back(opt_mat);
+        }
+        preload_nk<QList<double>>(materials, std::max(1U, std::thread::hardware_concurrency()), m_cancel,
+                                  [this, &materials](const std::size_t num_done) {
+            setProgress(static_cast<double>(num_done) / static_cast<double>(materials.size()));
+            QCoreApplication::processEvents();
+        });
+    }
+    m_importing = false;
+    if (m_cancel) {
+        for (const auto &[mat_name, opt_mat] : imported) {
+            delete opt_mat;
+        }
+        m_cancel = false;
+        setProgress(0);
+        return 3;
+    }
+    beginResetModel();
+    {
+        const std::lock_guard lock(m_list_mutex);
+        for (const auto &[mat_name, opt_mat] : imported) {
+            m_list.insert(mat_name, opt_mat);
+        }
+    }
+    endResetModel();
+    setProgress(1);
+    return 0;
+}
+
 OpticMaterial<QList<double>> *MaterialDbModel::getMatByName(const QString &mat_name) const {
+    const std::lock_guard lock(m_list_mutex);
     if (m_list.find(mat_name) not_eq m_list.cend()) {
         OpticMaterial<QList<double>> *opt_mat = m_list[mat_name];
         return opt_mat;
@@ -322,3 +384,8 @@ OpticMaterial<QList<double>> *MaterialDbModel::getMatByName(const QString &mat_n
     qDebug() << mat_name << "not found in MaterialDbModel" << m_name;
     return nullptr;
 }
+
+QList<OpticMaterial<QList<double>> *> MaterialDbModel::materials() const {
+    const std::lock_guard lock(m_list_mutex);
+    return m_list.values();
+}
@@ -5,6 +5,10 @@
 #ifndef SUISAPP_MATERIALDBMODEL_H
 #define SUISAPP_MATERIALDBMODEL_H
 
+#include <atomic>
+#include <mutex>
+#include <utility>
+
 #include <QAbstractListModel>
 
 #include "OpticMaterial.h"
@@ -16,6 +20,9 @@ class MaterialDbModel : public QAbstractListModel {
     Q_PROPERTY(QString name READ name)
     Q_PROPERTY(bool checked READ checked WRITE setChecked NOTIFY checkedChanged)
     Q_PROPERTY(QString path READ path WRITE setPath NOTIFY pathChanged)
+    // Whether readSolcoreDb and readSopraDb load the n/k data of all materials on import (see preload_nk), rather
+    // than of each material when it is first used. Off by default.
+    Q_PROPERTY(bool preload READ preload WRITE setPreload NOTIFY preloadChanged)
 
 public:
     enum ModelRoles {
@@ -38,30 +45,43 @@ public:
     void setChecked(bool checked);
     [[nodiscard]] QString path() const;
     void setPath(const QString &path);
+    [[nodiscard]] bool preload() const;
+    void setPreload(bool preload);
 
     Q_INVOKABLE int readSolcoreDb(const QString& db_path);
     Q_INVOKABLE int readSopraDb(const QString& db_path);
     Q_INVOKABLE int readDfDb(const QString& db_path);
     Q_INVOKABLE int readGclDb(const QString& transfer_path);
+    // Asks the running import to stop; it then returns 3 and leaves the model unchanged.
+    Q_INVOKABLE void cancelImport();
 
     [[nodiscard]] OpticMaterial<QList<double>> *getMatByName(const QString &mat_name) const;
+    [[nodiscard]] QList<OpticMaterial<QList<double>> *> materials() const;
 
 signals:
     void progressChanged();
     void checkedChanged();
     void pathChanged();
+    void preloadChanged();
 
 protected:
     [[nodiscard]] QHash<int, QByteArray> roleNames() const override;
 
 private:
+    int importMaterials(const QList<std::pair<QString, OpticMaterial<QList<double>> *>> &imported, bool preload);
+
     // If using QObject, the values should be a pointer
+    // m_list is only written on the GUI thread; m_list_mutex guards it against readers on other threads.
     QMap<QString, OpticMaterial<QList<double>> *> m_list;
+    mutable std::mutex m_list_mutex;
+    std::atomic_bool m_cancel{};
+    bool m_importing{};
 
     double m_progress;
     QString m_name;
     bool m_checked{};
     QString m_path;
+    bool m_preload{};
 };
 
 #endif  // SUISAPP_MATERIALDBMODEL_H
@@ -0,0 +1,121 @@
+#ifndef SUISAPP_MATERIALRESIDENCY_H
+#define SUISAPP_MATERIALRESIDENCY_H
+
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+struct MaterialResidencyStats {
+    std::size_t resident_bytes = 0;  // n/k lists and interpolated indices of the resident materials
+    std::size_t budget = 0;
+    std::size_t num_resident = 0;
+    std::size_t loads = 0;  // materials that became resident, including reloads after eviction
+    std::size_t evictions = 0;
+};
+
+/*
+ * Bounds the memory held by the n/k data of materials, e.g., OpticMaterials. Every material reports its resident
+ * bytes whenever its data is loaded or used, which makes it the most recently used one; while the total exceeds the
+ * budget, the data of the least recently used materials is dropped, to be loaded again on demand. A material in use
+ * by another thread (i.e., whose lock is held) is skipped rather than waited for, and the material being touched is
+ * never evicted, so that the budget cannot deadlock or starve a calculation.
+ * Resident provides bool try_unload_nk(), which drops the data unless it is in use and returns whether it did, and
+ * must forget itself before it is destroyed. Being a template on Resident only, it can be tested without Qt.
+ */
+template<typename Resident>
+class MaterialResidency {
+public:
+    explicit MaterialResidency(const std::size_t budget = std::size_t{256} << 20) : budget(budget) {}  // 256 MiB
+
+    /*
+     * Process-wide manager, used by every Resident, e.g., OpticMaterial<T>
+     */
+    static auto instance() -> MaterialResidency & {
+        static MaterialResidency residency;
+        return residency;
+    }
+
+    /*
+     * Records that material, holding bytes, was just used, and evicts colder materials beyond the budget. The caller
+     * holds the lock of material.
+     */
+    void touch(Resident *material, const std::size_t bytes) {
+        const std::lock_guard lock(mutex);
+        if (const auto it = index.find(material); it not_eq index.end()) {
+            resident_bytes -= it->second->second;
+            it->second->second = bytes;
+            entries.splice(entries.begin(), entries, it->second);
+        } else {
+            entries.emplace_front(material, bytes);
+            index.emplace(material, entries.begin());
+            loads++;
+        }
+        resident_bytes += bytes;
+        evict();
+    }
+
+    /*
+     * Stops tracking material, e.g., when it is deleted.
+     */
+    void forget(Resident *material) {
+        const std::lock_guard lock(mutex);
+        if (const auto it = index.find(material); it not_eq index.end()) {
+            resident_bytes -= it->second->second;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    /*
+     * std::numeric_limits<std::size_t>::max() disables eviction.
+     */
+    void set_budget(const std::size_t new_budget) {
+        const std::lock_guard lock(mutex);
+        budget = new_budget;
+        evict();
+    }
+
+    [[nodiscard]] auto stats() const -> MaterialResidencyStats {
+        const std::lock_guard lock(mutex);
+        return {resident_bytes, budget, entries.size(), loads, evictions};
+    }
+
+private:
+    using Entry = std::pair<Resident *, std::size_t>;
+
+    /*
+     * Drops the data of the least recently used materials, except the most recently used one, until the budget is
+     * met or only materials in use are left. The caller holds the lock, and a material lock is only ever tried here,
+     * never waited for, as touch is called with a material lock held.
+     */
+    void evict() {
+        if (entries.empty()) {
+            return;
+        }
+        auto it = std::prev(entries.end());
+        while (resident_bytes > budget and it not_eq entries.begin()) {
+            const auto warmer = std::prev(it);
+            if (it->first->try_unload_nk()) {
+                resident_bytes -= it->second;
+                index.erase(it->first);
+                entries.erase(it);
+                evictions++;
+            }
+            it = warmer;
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::size_t budget;
+    std::size_t resident_bytes = 0;
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<Resident *, typename std::list<Entry>::iterator> index;
+    std::atomic<std::size_t> loads = 0;
+    std::atomic<std::size_t> evictions = 0;
+};
+
+#endif  // SUISAPP_MATERIALRESIDENCY_H
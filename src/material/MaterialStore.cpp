@@ -0,0 +1,95 @@
+#include <QDebug>
+#include <QFileInfo>
+
+#include "MaterialStore.h"
+
+auto MaterialStore::instance() -> MaterialStore & {
+    static MaterialStore store;
+    return store;
+}
+
+auto MaterialStore::build(const QString &filename,
+                          const QList<OpticMaterial<QList<double>> *> &materials) -> qsizetype {
+    MaterialStoreWriter writer(std::filesystem::path(filename.toStdU16String()));
+    for (OpticMaterial<QList<double>> *material : materials) {
+        if (material == nullptr) {
+            continue;
+        }
+        const std::lock_guard material_lock(material->nk_mutex);
+        try {
+            material->ensure_nk();  // it may have been evicted
+        } catch (std::runtime_error &e) {
+            qWarning() << "Material" << material->name() << "is not stored: " << e.what();
+            continue;
+        }
+        // The columns view the lists, which the material lock keeps alive until they are written.
+        MaterialStoreEntry entry{material->nk_source, {}, {}, {}};
+        for (const auto &[list, series] : {std::pair{&material->wavelengths, &entry.wavelengths},
+                                           std::pair{&material->n_data, &entry.n_data},
+                                           std::pair{&material->k_data, &entry.k_data}}) {
+            for (const auto &[fraction, values] : *list) {
+                series->push_back({fraction, {values.constData(), static_cast<std::size_t>(values.size())}});
+            }
+        }
+        if (not writer.add(material->store_key().toStdString(), entry)) {
+            break;
+        }
+    }
+    {
+        // A mapped file cannot be replaced on Windows, so the store is closed first, to be opened again by the caller.
+        MaterialStore &store = instance();
+        const std::lock_guard lock(store.mutex);
+        if (store.map and QFileInfo(store.file) == QFileInfo(filename)) {
+            store.unmap();
+        }
+    }
+    if (not writer.finish()) {
+        qWarning() << "Cannot write material store" << filename;
+        return -1;
+    }
+    return static_cast<qsizetype>(writer.size());
+}
+
+auto MaterialStore::open(const QString &filename) -> bool {
+    const std::lock_guard lock(mutex);
+    unmap();
+    file.setFileName(filename);
+    if (not file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open material store" << filename;
+        return false;
+    }
+    map = file.map(0, file.size());
+    std::optional<MaterialStoreIndex> parsed;
+    if (map) {
+        parsed = parse_material_store({reinterpret_cast<const std::byte *>(map), static_cast<std::size_t>(file.size())});
+    }
+    if (not parsed) {
+        qWarning() << "Invalid material store" << filename;
+        unmap();
+        return false;
+    }
+    index = std::move(*parsed);
+    return true;
+}
+
+void MaterialStore::close() {
+    const std::lock_guard lock(mutex);
+    unmap();
+}
+
+auto MaterialStore::is_open() const -> bool {
+    const std::lock_guard lock(mutex);
+    return map not_eq nullptr;
+}
+
+/*
+ * Drops the index before the mapping it points into. The caller holds the lock.
+ */
+void MaterialStore::unmap() {
+    index.clear();
+    if (map) {
+        file.unmap(map);
+        map = nullptr;
+    }
+    file.close();
+}
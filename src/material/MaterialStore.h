@@ -0,0 +1,74 @@
+#ifndef SUISAPP_MATERIALSTORE_H
+#define SUISAPP_MATERIALSTORE_H
+
+#include <cstdint>
+#include <mutex>
+
+#include <QFile>
+#include <QList>
+#include <QString>
+
+#include "MaterialStoreFile.h"
+#include "OpticMaterial.h"
+
+/*
+ * Compiled binary n/k store (see MaterialStoreFile.h), built once from the imported databases and then
+ * memory-mapped, so that OpticMaterial::load_nk copies contiguous columns instead of parsing Sopra .MAT files,
+ * Solcore n/k text files, or DriftFusion spreadsheets. Every entry records the fingerprint of its source files, and
+ * an entry whose files have changed since the build is ignored, so that the material is parsed again.
+ */
+class MaterialStore {
+public:
+    /*
+     * Process-wide store, consulted by OpticMaterial::load_nk
+     */
+    static auto instance() -> MaterialStore &;
+
+    /*
+     * Writes the n/k data of materials to filename, loading it if necessary; materials that cannot be loaded are
+     * skipped with a warning. Returns the number of materials written, or -1 if the file cannot be written.
+     */
+    static auto build(const QString &filename, const QList<OpticMaterial<QList<double>> *> &materials) -> qsizetype;
+
+    /*
+     * Maps filename and replaces the current store; on failure, the store is left closed and false is returned.
+     */
+    auto open(const QString &filename) -> bool;
+    void close();
+    [[nodiscard]] auto is_open() const -> bool;
+
+    /*
+     * Replaces the lists with the columns of key and returns true, or returns false if key is not in the store or
+     * was built from source files of another fingerprint.
+     */
+    template<FloatingList T>
+    auto read(const QString &key, const std::uint64_t fingerprint, QList<std::pair<double, T>> &wavelengths,
+              QList<std::pair<double, T>> &n_data, QList<std::pair<double, T>> &k_data) const -> bool {
+        const std::lock_guard lock(mutex);
+        const auto it = index.find(key.toStdString());
+        if (it == index.cend() or it->second.fingerprint not_eq fingerprint) {
+            return false;
+        }
+        const auto assign = [](QList<std::pair<double, T>> &list, const std::vector<MaterialStoreSeries> &series) {
+            list.clear();
+            list.reserve(static_cast<qsizetype>(series.size()));
+            for (const auto &[fraction, values] : series) {
+                list.emplace_back(fraction, T(values.begin(), values.end()));
+            }
+        };
+        assign(wavelengths, it->second.wavelengths);
+        assign(n_data, it->second.n_data);
+        assign(k_data, it->second.k_data);
+        return true;
+    }
+
+private:
+    void unmap();
+
+    mutable std::mutex mutex;
+    QFile file;
+    uchar *map = nullptr;
+    MaterialStoreIndex index;
+};
+
+#endif  // SUISAPP_MATERIALSTORE_H
@@ -0,0 +1,179 @@
+#include <array>
+#include <cstring>
+#include <utility>
+
+#include "MaterialStoreFile.h"
+
+namespace {
+    constexpr std::array<char, 8> store_magic = {'S', 'U', 'I', 'S', 'N', 'K', 'D', 'B'};
+    constexpr std::uint32_t store_version = 2;  // 2 adds the source fingerprints
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+    // magic, version, byte-order mark, number of materials, a reserved word, and the offset of the index
+    constexpr std::size_t header_size = 8 + 4 + 4 + 4 + 4 + 8;
+    constexpr std::size_t num_materials_offset = 16;
+
+    template<typename V>
+    void write_value(std::ofstream &file, const V value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    /*
+     * Bounds-checked reader of the index
+     */
+    class IndexReader {
+    public:
+        IndexReader(const std::span<const std::byte> data, const std::size_t pos) : data(data), pos(pos) {}
+
+        template<typename V>
+        auto read(V &value) -> bool {
+            if (pos > data.size() or data.size() - pos < sizeof value) {
+                return false;
+            }
+            std::memcpy(&value, data.data() + pos, sizeof value);
+            pos += sizeof value;
+            return true;
+        }
+
+        auto read_string(std::string &str) -> bool {
+            std::uint32_t length;
+            if (not read(length) or data.size() - pos < length) {
+                return false;
+            }
+            str.assign(reinterpret_cast<const char *>(data.data() + pos), length);
+            pos += length;
+            return true;
+        }
+
+    private:
+        std::span<const std::byte> data;
+        std::size_t pos;
+    };
+}
+
+MaterialStoreWriter::MaterialStoreWriter(std::filesystem::path filename) : filename(std::move(filename)) {
+    temp_filename = this->filename;
+    temp_filename += ".tmp";
+    out.open(temp_filename, std::ios::binary | std::ios::trunc);
+    out.write(store_magic.data(), store_magic.size());
+    write_value(out, store_version);
+    write_value(out, byte_order_mark);
+    write_value(out, std::uint32_t{0});  // patched by finish
+    write_value(out, std::uint32_t{0});
+    write_value(out, std::uint64_t{0});  // patched by finish
+    ok = out.good();
+}
+
+MaterialStoreWriter::~MaterialStoreWriter() {
+    if (not finished) {
+        out.close();
+        std::error_code error;
+        std::filesystem::remove(temp_filename, error);
+    }
+}
+
+auto MaterialStoreWriter::add(const std::string_view key, const MaterialStoreEntry &entry) -> bool {
+    if (not ok or finished) {
+        return false;
+    }
+    Record record{std::string(key), entry.fingerprint, {}};
+    const std::array<const std::vector<MaterialStoreSeries> *, 3> lists = {&entry.wavelengths, &entry.n_data,
+                                                                             &entry.k_data};
+    for (std::size_t i = 0; i < lists.size(); i++) {
+        for (const auto &[fraction, values] : *lists.at(i)) {
+            // The header and every column are multiples of 8 bytes, so every column stays 8-byte aligned.
+            record.columns[i].push_back({fraction, values.size(), static_cast<std::uint64_t>(out.tellp())});
+            out.write(reinterpret_cast<const char *>(values.data()),
+                      static_cast<std::streamsize>(values.size_bytes()));
+        }
+    }
+    ok = out.good();
+    if (ok) {
+        records.push_back(std::move(record));
+    }
+    return ok;
+}
+
+auto MaterialStoreWriter::finish() -> bool {
+    if (finished) {
+        return false;
+    }
+    finished = true;
+    const auto index_offset = static_cast<std::uint64_t>(out.tellp());
+    for (const Record &record : records) {
+        write_value(out, static_cast<std::uint32_t>(record.key.size()));
+        out.write(record.key.data(), static_cast<std::streamsize>(record.key.size()));
+        write_value(out, record.fingerprint);
+        for (const std::vector<Column> &columns : record.columns) {
+            write_value(out, static_cast<std::uint32_t>(columns.size()));
+            for (const Column &column : columns) {
+                write_value(out, column.fraction);
+                write_value(out, column.num_points);
+                write_value(out, column.offset);
+            }
+        }
+    }
+    // Patch the number of materials and the offset of the index into the header.
+    out.seekp(num_materials_offset);
+    write_value(out, static_cast<std::uint32_t>(records.size()));
+    write_value(out, std::uint32_t{0});
+    write_value(out, index_offset);
+    out.close();
+    ok = ok and not out.fail();
+    std::error_code error;
+    if (ok) {
+        std::filesystem::rename(temp_filename, filename, error);
+        ok = not error;
+    }
+    if (not ok) {
+        std::filesystem::remove(temp_filename, error);
+    }
+    return ok;
+}
+
+auto MaterialStoreWriter::size() const -> std::size_t {
+    return records.size();
+}
+
+auto parse_material_store(const std::span<const std::byte> data) -> std::optional<MaterialStoreIndex> {
+    if (data.size() < header_size or reinterpret_cast<std::uintptr_t>(data.data()) % alignof(double) not_eq 0 or
+        std::memcmp(data.data(), store_magic.data(), store_magic.size()) not_eq 0) {
+        return std::nullopt;
+    }
+    IndexReader header(data, store_magic.size());
+    std::uint32_t version, bom, num_materials, reserved;
+    std::uint64_t index_offset;
+    if (not header.read(version) or not header.read(bom) or not header.read(num_materials) or
+        not header.read(reserved) or not header.read(index_offset) or version not_eq store_version or
+        bom not_eq byte_order_mark or index_offset < header_size or index_offset > data.size()) {
+        return std::nullopt;
+    }
+    MaterialStoreIndex index;
+    IndexReader reader(data, index_offset);
+    for (std::uint32_t m = 0; m < num_materials; m++) {
+        std::string key;
+        MaterialStoreEntry entry;
+        if (not reader.read_string(key) or not reader.read(entry.fingerprint)) {
+            return std::nullopt;
+        }
+        for (std::vector<MaterialStoreSeries> *series : {&entry.wavelengths, &entry.n_data, &entry.k_data}) {
+            std::uint32_t num_series;
+            if (not reader.read(num_series)) {
+                return std::nullopt;
+            }
+            for (std::uint32_t s = 0; s < num_series; s++) {
+                double fraction;
+                std::uint64_t num_points, offset;
+                // Columns lie between the header and the index.
+                if (not reader.read(fraction) or not reader.read(num_points) or not reader.read(offset) or
+                    offset % alignof(double) not_eq 0 or offset < header_size or offset > index_offset or
+                    num_points > (index_offset - offset) / sizeof(double)) {
+                    return std::nullopt;
+                }
+                series->push_back({fraction, {reinterpret_cast<const double *>(data.data() + offset),
+                                              static_cast<std::size_t>(num_points)}});
+            }
+        }
+        index.insert_or_assign(std::move(key), std::move(entry));
+    }
+    return index;
+}
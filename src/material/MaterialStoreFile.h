@@ -0,0 +1,89 @@
+#ifndef SUISAPP_MATERIALSTOREFILE_H
+#define SUISAPP_MATERIALSTOREFILE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Reader and writer of the compiled binary n/k store behind MaterialStore, free of Qt so that the format can be
+ * tested on its own.
+ * File layout (native byte order, checked on open): the "SUISNKDB" magic, the format version, a byte-order mark, the
+ * number of materials, a reserved word, and the offset of the index; then the float64 columns, each 8-byte aligned;
+ * then the index. For every material, the index holds its key (see OpticMaterial::store_key), the fingerprint of its
+ * source files, and, for the wavelength, n, and k lists in turn, the number of compositions and, per composition, the
+ * fraction, the number of points, and the offset of its column.
+ */
+struct MaterialStoreSeries {
+    double fraction;
+    std::span<const double> values;
+};
+
+struct MaterialStoreEntry {
+    std::uint64_t fingerprint = 0;  // of the files the data was parsed from, see OpticMaterial::source_fingerprint
+    std::vector<MaterialStoreSeries> wavelengths;
+    std::vector<MaterialStoreSeries> n_data;
+    std::vector<MaterialStoreSeries> k_data;
+};
+
+using MaterialStoreIndex = std::unordered_map<std::string, MaterialStoreEntry>;
+
+/*
+ * Writes a store one material at a time, so that only one material needs to be resident while building. The file is
+ * written next to filename and only replaces it on a successful finish, so that a failed build never leaves a
+ * truncated store behind and a store mapped by a reader is not truncated under it.
+ */
+class MaterialStoreWriter {
+public:
+    explicit MaterialStoreWriter(std::filesystem::path filename);
+    ~MaterialStoreWriter();
+    MaterialStoreWriter(const MaterialStoreWriter &) = delete;
+    auto operator=(const MaterialStoreWriter &) -> MaterialStoreWriter & = delete;
+
+    /*
+     * Appends the columns of entry under key. Returns false once any write has failed.
+     */
+    auto add(std::string_view key, const MaterialStoreEntry &entry) -> bool;
+    /*
+     * Writes the index and moves the file to filename. Returns false, removing the partial file, if any write failed.
+     */
+    auto finish() -> bool;
+    [[nodiscard]] auto size() const -> std::size_t;
+
+private:
+    struct Column {
+        double fraction;
+        std::uint64_t num_points;
+        std::uint64_t offset;
+    };
+
+    struct Record {
+        std::string key;
+        std::uint64_t fingerprint;
+        std::array<std::vector<Column>, 3> columns;  // wavelengths, n, and k
+    };
+
+    std::filesystem::path filename;
+    std::filesystem::path temp_filename;
+    std::ofstream out;
+    std::vector<Record> records;
+    bool ok;
+    bool finished = false;
+};
+
+/*
+ * Index of the store held by data, e.g., a memory map, whose series point into data; data must be 8-byte aligned and
+ * outlive the index. Returns std::nullopt if data is not a valid store: a wrong magic, version, or byte order, a
+ * truncated index, or any column outside the data.
+ */
+[[nodiscard]] auto parse_material_store(std::span<const std::byte> data) -> std::optional<MaterialStoreIndex>;
+
+#endif  // SUISAPP_MATERIALSTOREFILE_H
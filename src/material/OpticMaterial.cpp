@@ -2,6 +2,12 @@
 // Created by Yihua Liu on 2024/3/31.
 //
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 #ifdef __cpp_lib_format
 #include <format>
 #endif
@@ -13,36 +19,51 @@
 #include "xlsxdocument.h"
 #include "xlsxworkbook.h"
 
+#include "MaterialStore.h"
 #include "OpticMaterial.h"
 #include "ParameterSystem.h"
 
+template<FloatingList T>
+OpticMaterial<T>::~OpticMaterial() {
+    MaterialResidency<OpticMaterial<T>>::instance().forget(this);
+}
+
 template<FloatingList T>
 QString OpticMaterial<T>::name() const {
     return mat_name;
 }
 
 template<FloatingList T>
-T OpticMaterial<T>::wl() const {
-    if (wavelengths.empty()) {
-        qWarning() << "Material" << mat_name << "does not have wavelengths defined.";
+T OpticMaterial<T>::wl() {
+    const std::lock_guard lock(nk_mutex);
+    try {
+        ensure_nk();
+    } catch (std::runtime_error& e) {
+        qWarning() << "Material" << mat_name << "does not have wavelengths defined: " << e.what();
         return {};
     }
     return wavelengths.back().second;
 }
 
 template<FloatingList T>
-T OpticMaterial<T>::nData() const {
-    if (n_data.empty()) {
-        qWarning() << "Material" << mat_name << "does not have n data defined.";
+T OpticMaterial<T>::nData() {
+    const std::lock_guard lock(nk_mutex);
+    try {
+        ensure_nk();
+    } catch (std::runtime_error& e) {
+        qWarning() << "Material" << mat_name << "does not have n data defined: " << e.what();
         return {};
     }
     return n_data.back().second;
 }
 
 template<FloatingList T>
-T OpticMaterial<T>::kData() const {
-    if (k_data.empty()) {
-        qWarning() << "Material" << mat_name << "does not have k data defined.";
+T OpticMaterial<T>::kData() {
+    const std::lock_guard lock(nk_mutex);
+    try {
+        ensure_nk();
+    } catch (std::runtime_error& e) {
+        qWarning() << "Material" << mat_name << "does not have k data defined: " << e.what();
         return {};
     }
     return k_data.back().second;
@@ -53,8 +74,79 @@ T OpticMaterial<T>::kData() const {
  * The situation that n_data is empty while k_data is full or vice versa is seldom, and can be neglected.
  * Thus, to always load n and k at the same time seems reasonable, also to allow reloading is safer.
  */
+template<FloatingList T>
+std::uint64_t OpticMaterial<T>::data_version() const {
+    return nk_version;
+}
+
+template<FloatingList T>
+QString OpticMaterial<T>::store_key() const {
+    switch (db_type) {
+        case DbType::SOLCORE:
+            return "SOLCORE/" + mat_name;
+        case DbType::SOPRA:
+            return "SOPRA/" + mat_name;
+        case DbType::DF:
+            return "DF/" + mat_name;
+        case DbType::GCL:
+            return "GCL/" + mat_name;
+        default:
+            return "UNDEFINED/" + mat_name;
+    }
+}
+
 template <FloatingList T>
 void OpticMaterial<T>::load_nk() {
+    const std::lock_guard lock(nk_mutex);
+    read_nk();
+    MaterialResidency<OpticMaterial<T>>::instance().touch(this, resident_bytes());
+}
+
+template<FloatingList T>
+void OpticMaterial<T>::ensure_nk() {
+    if (wavelengths.empty() or n_data.empty() or k_data.empty()) {
+        read_nk();
+    }
+    MaterialResidency<OpticMaterial<T>>::instance().touch(this, resident_bytes());
+}
+
+template<FloatingList T>
+std::size_t OpticMaterial<T>::resident_bytes() const {
+    std::size_t bytes = 0;
+    for (const QList<std::pair<double, T>> *data : {&wavelengths, &n_data, &k_data}) {
+        for (const auto &[fraction, values] : *data) {
+            bytes += values.size() * sizeof(typename T::value_type);
+        }
+    }
+    return bytes + index_cache.bytes();
+}
+
+template<FloatingList T>
+bool OpticMaterial<T>::try_unload_nk() {
+    const std::unique_lock lock(nk_mutex, std::try_to_lock);
+    if (not lock.owns_lock()) {
+        return false;
+    }
+    wavelengths = {};
+    n_data = {};
+    k_data = {};
+    index_cache.clear();
+    return true;
+}
+
+template <FloatingList T>
+void OpticMaterial<T>::read_nk() {
+    // Start over, so that neither a reload nor a load after a failed one appends to stale lists.
+    wavelengths.clear();
+    n_data.clear();
+    k_data.clear();
+    index_cache.clear();
+    // A compiled store replaces the parsing of the database files below, unless the files have changed since.
+    nk_source = source_fingerprint();
+    if (MaterialStore::instance().read(store_key(), nk_source, wavelengths, n_data, k_data)) {
+        update_data_version();
+        return;
+    }
     QString line;
     QStringList ln_data;
     if (db_type == DbType::SOPRA) {
@@ -111,7 +203,8 @@ void OpticMaterial<T>::load_nk() {
         // Load Solcore's n data
         const QDir mat_dir(path);
         const ParameterSystem *par_sys = ParameterSystem::GetInstance();
-        static const QRegularExpression ws_regexp("\\s+");
+        // One per thread, as materials are loaded in parallel on import
+        static thread_local const QRegularExpression ws_regexp("\\s+");
         // Note that same Solcore material has the same n_wl and k_wl even for different compositions, so there is
         // no need to store many n_wl and k_wl for one material.
         if (par_sys->isComposition(mat_name, "x")) {
@@ -286,7 +379,116 @@ void OpticMaterial<T>::load_nk() {
     } else {
         throw std::runtime_error("Unknown database type.");
     }
+    update_data_version();
+}
+
+template<FloatingList T>
+void OpticMaterial<T>::update_data_version() {
+    // FNV-1a over the 64-bit words of the fractions and the values of the loaded data
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const QList<std::pair<double, T>> *data : {&wavelengths, &n_data, &k_data}) {
+        for (const auto &[fraction, values] : *data) {
+            hash ^= std::bit_cast<std::uint64_t>(fraction);
+            hash *= 1099511628211ULL;
+            for (const double value : values) {
+                hash ^= std::bit_cast<std::uint64_t>(value);
+                hash *= 1099511628211ULL;
+            }
+        }
+    }
+    nk_version = hash;
+}
+
+/*
+ * A missing file hashes differently from any existing one, so that a store entry built before a file was removed is
+ * not used either.
+ */
+template<FloatingList T>
+std::uint64_t OpticMaterial<T>::source_fingerprint() const {
+    QFileInfoList files;
+    if (db_type == DbType::SOLCORE) {
+        // n.txt and k.txt, or the n and k folders of a composition material
+        const QDir mat_dir(path);
+        files << QFileInfo(mat_dir.filePath("n.txt")) << QFileInfo(mat_dir.filePath("k.txt"));
+        files << QDir(mat_dir.filePath("n")).entryInfoList(QDir::Files, QDir::Name);
+        files << QDir(mat_dir.filePath("k")).entryInfoList(QDir::Files, QDir::Name);
+    } else if (db_type == DbType::SOPRA and not QFileInfo(path).isFile()) {
+        // read_nk falls back on <mat_name>.MAT in the subdirectories of path.
+        QDirIterator dit(path, {mat_name + ".MAT"}, QDir::Files, QDirIterator::Subdirectories);
+        if (dit.hasNext()) {
+            files << QFileInfo(dit.next());
+        }
+    } else {
+        files << QFileInfo(path);
+    }
+    // FNV-1a as in update_data_version, which unlike qHash is not seeded per process
+    std::uint64_t hash = 14695981039346656037ULL;
+    const auto mix = [&hash](const QByteArray &bytes) {
+        for (const char byte : bytes) {
+            hash ^= static_cast<unsigned char>(byte);
+            hash *= 1099511628211ULL;
+        }
+    };
+    for (const QFileInfo &info : files) {
+        mix(info.absoluteFilePath().toUtf8() + '\0');  // so that the path cannot run into the size
+        mix(info.exists() ? QByteArray::number(info.size()) + '@' +
+                            QByteArray::number(info.lastModified().toMSecsSinceEpoch()) : QByteArray("missing"));
+    }
+    return hash;
 }
 
+template<FloatingList T>
+std::size_t preload_nk(const std::span<OpticMaterial<T> *const> materials, std::size_t num_threads,
+                       const std::atomic_bool &cancel, const std::function<void(std::size_t)> &poll) {
+    num_threads = std::min(num_threads, materials.size());
+    std::atomic_size_t next = 0;
+    std::atomic_size_t num_done = 0;
+    std::atomic_size_t num_loaded = 0;
+    std::atomic_bool full = false;
+    std::size_t num_finished = 0;
+    std::mutex finished_mutex;
+    std::condition_variable finished_cv;
+    std::vector<std::jthread> workers;
+    workers.reserve(num_threads);
+    for (std::size_t t = 0; t < num_threads; t++) {
+        workers.emplace_back([&] {
+            for (std::size_t i = next++; i < materials.size() and not cancel and not full; i = next++) {
+                if (const MaterialResidencyStats stats = MaterialResidency<OpticMaterial<T>>::instance().stats();
+                    stats.resident_bytes >= stats.budget) {
+                    full = true;
+                    break;
+                }
+                try {
+                    materials[i]->load_nk();
+                    num_loaded++;
+                } catch (std::runtime_error &e) {
+                    // Loaded again, and warned about, when the material is used
+                    qWarning() << "Material" << materials[i]->name() << "is not preloaded: " << e.what();
+                }
+                num_done++;
+            }
+            {
+                const std::lock_guard lock(finished_mutex);
+                num_finished++;
+            }
+            finished_cv.notify_one();
+        });
+    }
+    while (true) {
+        {
+            std::unique_lock lock(finished_mutex);
+            if (finished_cv.wait_for(lock, std::chrono::milliseconds(50),
+                                     [&] { return num_finished == num_threads; })) {
+                break;
+            }
+        }
+        if (poll) {
+            poll(num_done);
+        }
+    }
+    return num_loaded;
+}
 
 template class OpticMaterial<QList<double>>;
+template std::size_t preload_nk(std::span<OpticMaterial<QList<double>> *const> materials, std::size_t num_threads,
+                                const std::atomic_bool &cancel, const std::function<void(std::size_t)> &poll);
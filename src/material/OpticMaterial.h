@@ -5,11 +5,22 @@
 #ifndef SUISAPP_OPTIC_MATERIAL_H
 #define SUISAPP_OPTIC_MATERIAL_H
 
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
 #include <QDebug>
 #include <QList>
 #include <QString>
 
 #include "Global.h"
+#include "MaterialResidency.h"
 #include "utils/Math.h"
 
 enum class DbType {
@@ -33,6 +44,8 @@ concept PairVector = requires(T1 a) {
     { Pair<decltype(a.back()), T2> };
 };
 
+class MaterialStore;
+
 // It seems that there is no need to make it a QObject
 // See https://doc.qt.io/qt-6/qtquick-modelviewsdata-cppmodels.html
 template<FloatingList T>
@@ -41,57 +54,131 @@ public:
     OpticMaterial(QString mat_name, const DbType db_type, QString path) : mat_name(std::move(mat_name)),
                                                                           db_type(db_type),
                                                                           path(std::move(path)) {}
+    ~OpticMaterial();
 
     [[nodiscard]] QString name() const;
-    // The three member functions below are const so do not try to remedy loading n/k data in these functions.
-    [[nodiscard]] T wl() const;
-    [[nodiscard]] T nData() const;
-    [[nodiscard]] T kData() const;
+    // The three member functions below load the n/k data if it is not resident, e.g., after an eviction by
+    // MaterialResidency, and return empty lists if it cannot be loaded.
+    [[nodiscard]] T wl();
+    [[nodiscard]] T nData();
+    [[nodiscard]] T kData();
+    // Content hash of the loaded wavelength, n, and k data (0 before load_nk), e.g., for keying cached results on
+    // the data rather than on the name of the material.
+    [[nodiscard]] std::uint64_t data_version() const;
+
+    // Key of the material in MaterialStore: the database type and the name, as materials of different databases may
+    // share a name.
+    [[nodiscard]] QString store_key() const;
 
     // The original Python implementation does really late evaluations. When executing calculate_rat, it evaluates
     // the get_indices() function, which evaluates the interpolation methods depending on wavelengths n_interpolated
     // and k_interpolated of the material class. In the interpolation methods, it loads n_data (a vstack of wl and n)
     // and k_data (a vstack of wl and k) from the TXT files and then does interpolation.
+    // Loads (or reloads) the n/k data.
     void load_nk();
 
     template<FloatingList U>
     T n_interpolated(U &&x) {
-        if (wavelengths.empty() or n_data.empty()) {
-            try {
-                load_nk();
-            } catch (std::runtime_error& e) {
-                qWarning() << "Material" << mat_name << "does not have n-data defined. Returning \"ones\": " << e.what();
-                T ret(x.size(), 1);
-                return ret;
-            }
+        const std::lock_guard lock(nk_mutex);
+        try {
+            ensure_nk();
+        } catch (std::runtime_error& e) {
+            qWarning() << "Material" << mat_name << "does not have n-data defined. Returning \"ones\": " << e.what();
+            T ret(x.size(), 1);
+            return ret;
         }
         return Utils::Math::interp1_linear(wavelengths.back().second, n_data.back().second, std::forward<U>(x));
     }
 
     template<FloatingList U>
     T k_interpolated(U &&x) {
-        if (wavelengths.empty() or k_data.empty()) {
-            try {
-                load_nk();
-            } catch (std::runtime_error& e) {
-                qWarning() << "Material" << mat_name << "does not have k-data defined. Returning \"zeros\": " << e.what();
-                T ret(x.size(), 0);
-                return ret;
-            }
+        const std::lock_guard lock(nk_mutex);
+        try {
+            ensure_nk();
+        } catch (std::runtime_error& e) {
+            qWarning() << "Material" << mat_name << "does not have k-data defined. Returning \"zeros\": " << e.what();
+            T ret(x.size(), 0);
+            return ret;
         }
         return Utils::Math::interp1_linear(wavelengths.back().second, k_data.back().second, std::forward<U>(x));
     }
 
+    /*
+     * Complex refractive index n + ik interpolated on the wavelength grid x, e.g., a row of OpticStack::get_indices.
+     * Each distinct grid is interpolated once and cached, keyed by the grid itself so that grids never collide,
+     * until the n/k data is reloaded; a material that cannot load n/k data gets n = 1 and k = 0 without caching.
+     * n and k are interpolated in one pass over brackets computed once (see Utils::Math::interp1_brackets).
+     */
+    template<FloatingList U>
+    std::valarray<std::complex<typename T::value_type>> indices(U &&x) {
+        using V = typename T::value_type;
+        std::vector<V> grid(std::begin(x), std::end(x));
+        const std::lock_guard lock(nk_mutex);
+        if (const std::valarray<std::complex<V>> *cached = index_cache.find(grid, nk_version)) {
+            MaterialResidency<OpticMaterial>::instance().touch(this, resident_bytes());
+            return *cached;
+        }
+        try {
+            ensure_nk();
+        } catch (std::runtime_error& e) {
+            qWarning() << "Material" << mat_name << "does not have n/k-data defined. Returning \"ones\": " << e.what();
+            return std::valarray<std::complex<V>>(1, grid.size());
+        }
+        // n and k share the wavelengths, so they share the brackets too.
+        const Utils::Math::Interp1Brackets<V> brackets = Utils::Math::interp1_brackets(wavelengths.back().second, grid);
+        std::vector<V> n, k;
+        Utils::Math::interp1_apply(brackets, n_data.back().second, n);
+        Utils::Math::interp1_apply(brackets, k_data.back().second, k);
+        std::valarray<std::complex<V>> nk(grid.size());
+        for (std::size_t i = 0; i < grid.size(); i++) {
+            nk[i] = {n[i], k[i]};
+        }
+        const std::valarray<std::complex<V>> &cached = index_cache.insert(std::move(grid), nk_version, std::move(nk));
+        MaterialResidency<OpticMaterial>::instance().touch(this, resident_bytes());
+        return cached;
+    }
+
 private:
+    friend class MaterialStore;  // builds the store from the loaded lists
+    friend class MaterialResidency<OpticMaterial>;  // evicts the lists of cold materials
+
+    // Drops the n/k data (but keeps data_version) unless it is in use; the caller holds the lock of MaterialResidency.
+    bool try_unload_nk();
+    // The caller holds nk_mutex for the functions below.
+    void read_nk();
+    // Loads the n/k data if it is not resident and reports it to MaterialResidency as just used.
+    void ensure_nk();
+    [[nodiscard]] std::size_t resident_bytes() const;
+    void update_data_version();
+    // Hash of the paths, sizes, and modification times of the files that read_nk parses
+    [[nodiscard]] std::uint64_t source_fingerprint() const;
+
     QString mat_name;
     DbType db_type;
     QString path;
     // Design tradeoff: one-time file I/O and no searching time cost but higher memory space cost
     // Alternative design: lazy loading n/k data when interpolation needed
     // No matter using the raw data or the interpolated data, we have to store the raw data.
+    // MaterialResidency bounds the memory cost by dropping the lists of cold materials, which are loaded again lazily.
     QList<std::pair<double, T>> wavelengths;
     QList<std::pair<double, T>> n_data;
     QList<std::pair<double, T>> k_data;
+    std::atomic<std::uint64_t> nk_version = 0;  // read by data_version() without the lock
+    std::uint64_t nk_source = 0;  // source_fingerprint() when the lists were loaded, recorded by MaterialStore::build
+    std::mutex nk_mutex;  // guards the lists above and the index cache below
+    // Indices interpolated on the last few wavelength grids, for the current nk_version
+    Utils::Math::GridCache<typename T::value_type, std::valarray<std::complex<typename T::value_type>>> index_cache;
 };
 
+/*
+ * Loads the n/k data of materials on up to num_threads worker threads, e.g., to preload an imported database, and
+ * returns the number of materials loaded. Preloading stops once cancel is set, or once the resident n/k data reaches
+ * the MaterialResidency budget, beyond which every load would evict an earlier one; the other materials are left to be
+ * loaded lazily. A material that cannot be loaded is skipped with a warning. The calling thread waits, calling poll
+ * with the number of materials done about every 50 ms, e.g., to report the progress and process events.
+ */
+template<FloatingList T>
+std::size_t preload_nk(std::span<OpticMaterial<T> *const> materials, std::size_t num_threads,
+                       const std::atomic_bool &cancel, const std::function<void(std::size_t)> &poll = {});
+
 #endif  // SUISAPP_OPTIC_MATERIAL_H
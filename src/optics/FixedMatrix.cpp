@@ -17,12 +17,6 @@ FixedMatrix<T, N, M>::FixedMatrix(const T num) {
     }
 }
 
-template<typename T, std::size_t N, std::size_t M>
-FixedMatrix<T, N, M>::FixedMatrix(const FixedMatrix &other) : data(other.data) {}
-
-template<typename T, std::size_t N, std::size_t M>
-FixedMatrix<T, N, M>::FixedMatrix(FixedMatrix &&other) noexcept : data(std::move(other.data)) {}
-
 template<typename T, std::size_t N, std::size_t M>
 FixedMatrix<T, N, M>::FixedMatrix(const std::array<std::array<T, M>, N> &data) : data(data) {}
 
@@ -119,22 +113,6 @@ auto FixedMatrix<T, N, M>::operator=(const T num) -> FixedMatrix & {
     return *this;
 }
 
-template<typename T, std::size_t N, std::size_t M>
-auto FixedMatrix<T, N, M>::operator=(const FixedMatrix &other) -> FixedMatrix & {
-    if (this != &other) {
-        data = other.data;
-    }
-    return *this;
-}
-
-template<typename T, std::size_t N, std::size_t M>
-auto FixedMatrix<T, N, M>::operator=(FixedMatrix &&other) noexcept -> FixedMatrix & {
-    if (this != &other) {
-        data = std::move(other.data);
-    }
-    return *this;
-}
-
 template<typename T, std::size_t N, std::size_t M>
 auto FixedMatrix<T, N, M>::operator=(const std::array<std::array<T, M>, N> &data_) -> FixedMatrix & {
     if (&data != &data_) {
@@ -233,6 +211,8 @@ template class FixedMatrix<double, 2, 1>;
 template class FixedMatrix<std::complex<double>, 2, 1>;
 template class FixedMatrix<double, 2, 2>;
 template class FixedMatrix<std::complex<double>, 2, 2>;
+template class FixedMatrix<std::complex<float>, 2, 1>;
+template class FixedMatrix<std::complex<float>, 2, 2>;
 
 template auto dot(const FixedMatrix<double, 2, 2> &matrix1,
                   const FixedMatrix<double, 2, 1> &matrix2) -> FixedMatrix<double, 2, 1>;
@@ -242,3 +222,7 @@ template auto dot(const FixedMatrix<double, 2, 2> &matrix1,
                   const FixedMatrix<double, 2, 2> &matrix2) -> FixedMatrix<double, 2, 2>;
 template auto dot(const FixedMatrix<std::complex<double>, 2, 2> &matrix1,
                   const FixedMatrix<std::complex<double>, 2, 2> &matrix2) -> FixedMatrix<std::complex<double>, 2, 2>;
+template auto dot(const FixedMatrix<std::complex<float>, 2, 2> &matrix1,
+                  const FixedMatrix<std::complex<float>, 2, 1> &matrix2) -> FixedMatrix<std::complex<float>, 2, 1>;
+template auto dot(const FixedMatrix<std::complex<float>, 2, 2> &matrix1,
+                  const FixedMatrix<std::complex<float>, 2, 2> &matrix2) -> FixedMatrix<std::complex<float>, 2, 2>;
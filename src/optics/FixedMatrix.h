@@ -6,8 +6,15 @@
 #define FIXEDMATRIX_H
 
 #include <array>
+#include <complex>
+#include <concepts>
 #include <cstddef>
+#include <span>
 #include <stdexcept>
+#include <type_traits>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 // This matrix class is very coarse. Refer to Bjarne Stroustrup's "The C++ Programming Language" next time.
 template<typename T, std::size_t N, std::size_t M>
@@ -17,8 +24,9 @@ private:
 public:
     FixedMatrix() = default;
     explicit FixedMatrix(T num);
-    FixedMatrix(const FixedMatrix &other);
-    FixedMatrix(FixedMatrix &&other) noexcept;
+    // Defaulted (and thus trivially inlined and constexpr) so that matrices can be passed around in hot loops.
+    constexpr FixedMatrix(const FixedMatrix &other) = default;
+    constexpr FixedMatrix(FixedMatrix &&other) noexcept = default;
     explicit FixedMatrix(const std::array<std::array<T, M>, N> &data);
     explicit FixedMatrix(std::array<std::array<T, M>, N> data) noexcept;
     // Different from traditional C-style arrays that can be brace-initialized by {{1, 0}, {0, 1}}
@@ -69,12 +77,19 @@ public:
     // inline function used but never defined.
     auto operator[](std::size_t i) -> RowProxy;
     auto operator[](std::size_t i) const -> const RowProxy;
+    // Unchecked access for hot loops, usable in constant expressions; i < N and j < M are up to the caller.
+    constexpr auto operator()(const std::size_t i, const std::size_t j) noexcept -> T & {
+        return data[i][j];
+    }
+    constexpr auto operator()(const std::size_t i, const std::size_t j) const noexcept -> const T & {
+        return data[i][j];
+    }
     auto operator/(const T &scalar) const -> FixedMatrix<T, N, M>;
     // In-place matrix multiplication is generally not supported.
     void operator/=(const T &scalar);
     auto operator=(T num) -> FixedMatrix&;
-    auto operator=(const FixedMatrix &other) -> FixedMatrix&;
-    auto operator=(FixedMatrix &&other) noexcept -> FixedMatrix&;
+    constexpr auto operator=(const FixedMatrix &other) -> FixedMatrix& = default;
+    constexpr auto operator=(FixedMatrix &&other) noexcept -> FixedMatrix& = default;
     auto operator=(const std::array<std::array<T, M>, N> &data_) -> FixedMatrix&;
     auto operator=(std::array<std::array<T, M>, N> &&data_) noexcept -> FixedMatrix&;
     auto operator=(std::initializer_list<std::initializer_list<T>> init_list) -> FixedMatrix&;
@@ -112,4 +127,102 @@ auto dot(const FixedMatrix<T, N, M> &matrix1, const FixedMatrix<T, M, P> &matrix
 template<typename T, std::size_t N, std::size_t M, std::size_t P>
 auto operator*(const FixedMatrix<T, N, M> &mat1, const FixedMatrix<T, M, P> &mat2) -> FixedMatrix<T, N, P>;
 
+/*
+ * Specialized 2x2 complex products for the transfer-matrix chain, without bounds checking or the generic triple loop
+ * of dot. They are defined here so that they are inlined into the caller.
+ * (a + 1j * b) * (c + 1j * d) = (a * c - b * d) + 1j * (b * c + a * d), so with the real and imaginary parts of a
+ * complex number interleaved in a register, a product is a multiplication by the duplicated real part c, a swap of
+ * the other factor, a multiplication by the duplicated imaginary part d, and an addsub.
+ * For std::complex<double>, a row of the product is computed at once with AVX (each __m256d holds a row of b) when
+ * the translation unit is compiled for it (e.g., -march=native or /arch:AVX), and an entry at once with SSE2 on any
+ * other x86-64 target, where the addsub is a sign flip of the real lane. Elsewhere and in constant evaluation, the
+ * same formula is written out on the real and imaginary parts. Unlike operator* of std::complex, the products do
+ * not recover infinities from NaN (C99 Annex G), which the transfer-matrix method never relies on.
+ */
+template<std::floating_point T>
+constexpr auto multiply_2x2(const FixedMatrix<std::complex<T>, 2, 2> &a,
+                            const FixedMatrix<std::complex<T>, 2, 2> &b) -> FixedMatrix<std::complex<T>, 2, 2> {
+    FixedMatrix<std::complex<T>, 2, 2> c;
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+    if constexpr (std::is_same_v<T, double>) {
+        if (not std::is_constant_evaluated()) {
+            static_assert(sizeof(FixedMatrix<std::complex<double>, 2, 2>) == 4 * sizeof(std::complex<double>));
+            const double *pa = reinterpret_cast<const double *>(&a(0, 0));
+            const double *pb = reinterpret_cast<const double *>(&b(0, 0));
+            double *pc = reinterpret_cast<double *>(&c(0, 0));
+#ifdef __AVX__
+            const __m256d b0 = _mm256_loadu_pd(pb);  // [b00, b01]
+            const __m256d b1 = _mm256_loadu_pd(pb + 4);  // [b10, b11]
+            const __m256d b0_swap = _mm256_permute_pd(b0, 0b0101);
+            const __m256d b1_swap = _mm256_permute_pd(b1, 0b0101);
+            for (std::size_t i = 0; i < 2; i++) {
+                // c_i = a_i0 * [b00, b01] + a_i1 * [b10, b11]
+                const __m256d ai0 = _mm256_broadcast_pd(reinterpret_cast<const __m128d *>(pa + 4 * i));
+                const __m256d ai1 = _mm256_broadcast_pd(reinterpret_cast<const __m128d *>(pa + 4 * i + 2));
+                const __m256d p0 = _mm256_addsub_pd(_mm256_mul_pd(_mm256_movedup_pd(ai0), b0),
+                                                    _mm256_mul_pd(_mm256_permute_pd(ai0, 0b1111), b0_swap));
+                const __m256d p1 = _mm256_addsub_pd(_mm256_mul_pd(_mm256_movedup_pd(ai1), b1),
+                                                    _mm256_mul_pd(_mm256_permute_pd(ai1, 0b1111), b1_swap));
+                _mm256_storeu_pd(pc + 4 * i, _mm256_add_pd(p0, p1));
+            }
+#else
+            const __m128d negate_real = _mm_set_pd(0.0, -0.0);
+            const auto mul = [negate_real](const __m128d x, const __m128d y) -> __m128d {
+                const __m128d swapped = _mm_mul_pd(_mm_shuffle_pd(x, x, 0b01), _mm_unpackhi_pd(y, y));
+                return _mm_add_pd(_mm_mul_pd(x, _mm_unpacklo_pd(y, y)), _mm_xor_pd(swapped, negate_real));
+            };
+            for (std::size_t i = 0; i < 2; i++) {
+                const __m128d ai0 = _mm_loadu_pd(pa + 4 * i);
+                const __m128d ai1 = _mm_loadu_pd(pa + 4 * i + 2);
+                for (std::size_t j = 0; j < 2; j++) {
+                    _mm_storeu_pd(pc + 4 * i + 2 * j, _mm_add_pd(mul(ai0, _mm_loadu_pd(pb + 2 * j)),
+                                                                 mul(ai1, _mm_loadu_pd(pb + 4 + 2 * j))));
+                }
+            }
+#endif
+            return c;
+        }
+    }
+#endif
+    for (std::size_t i = 0; i < 2; i++) {
+        for (std::size_t j = 0; j < 2; j++) {
+            const std::complex<T> x0 = a(i, 0), x1 = a(i, 1), y0 = b(0, j), y1 = b(1, j);
+            c(i, j) = {x0.real() * y0.real() - x0.imag() * y0.imag() + x1.real() * y1.real() - x1.imag() * y1.imag(),
+                       x0.imag() * y0.real() + x0.real() * y0.imag() + x1.imag() * y1.real() + x1.real() * y1.imag()};
+        }
+    }
+    return c;
+}
+
+/*
+ * a @ x for a 2-vector x, e.g., the {v, w} amplitudes propagated through a layer.
+ */
+template<std::floating_point T>
+constexpr auto multiply_2x2(const FixedMatrix<std::complex<T>, 2, 2> &a,
+                            const FixedMatrix<std::complex<T>, 2, 1> &x) -> FixedMatrix<std::complex<T>, 2, 1> {
+    FixedMatrix<std::complex<T>, 2, 1> y;
+    for (std::size_t i = 0; i < 2; i++) {
+        const std::complex<T> a0 = a(i, 0), a1 = a(i, 1), x0 = x(0, 0), x1 = x(1, 0);
+        y(i, 0) = {a0.real() * x0.real() - a0.imag() * x0.imag() + a1.real() * x1.real() - a1.imag() * x1.imag(),
+                   a0.imag() * x0.real() + a0.real() * x0.imag() + a1.imag() * x1.real() + a1.real() * x1.imag()};
+    }
+    return y;
+}
+
+/*
+ * c[k] = a[k] @ b[k] over arrays of matrices, e.g., the matrices of a layer at many wavelengths.
+ * c may alias a or b.
+ */
+template<std::floating_point T>
+constexpr void multiply_2x2_batch(const std::span<const FixedMatrix<std::complex<T>, 2, 2>> a,
+                                  const std::span<const FixedMatrix<std::complex<T>, 2, 2>> b,
+                                  const std::span<FixedMatrix<std::complex<T>, 2, 2>> c) {
+    if (a.size() not_eq b.size() or a.size() not_eq c.size()) {
+        throw std::invalid_argument("a, b, and c must have the same number of matrices");
+    }
+    for (std::size_t k = 0; k < c.size(); k++) {
+        c[k] = multiply_2x2(a[k], b[k]);
+    }
+}
+
 #endif //FIXEDMATRIX_H
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(_M_X64)
+#define MATRIX_BATCH_X86
+#include <immintrin.h>
+#endif
+
+#include "MatrixBatch.h"
+#include "src/utils/VectorMath.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MATRIX_BATCH_INLINE [[gnu::always_inline]] inline
+// The generic kernels below only hold AVX registers once inlined into the AVX2 entry points, so the calling
+// convention of their (never emitted) out-of-line AVX instantiations does not matter.
+#if not defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+#else
+#define MATRIX_BATCH_INLINE __forceinline
+#endif
+
+namespace {
+    // Portable fallback; with optimization enabled, compilers usually auto-vectorize it with SSE2/NEON anyway.
+    template<typename T>
+    struct ScalarOps {
+        using reg = T;
+        static constexpr std::size_t width = 1;
+        static auto load(const T *p) -> reg { return *p; }
+        static void store(T *p, const reg v) { *p = v; }
+        static auto mul(const reg a, const reg b) -> reg { return a * b; }
+        // a * b + c
+        static auto fmadd(const reg a, const reg b, const reg c) -> reg { return a * b + c; }
+        // c - a * b
+        static auto fnmadd(const reg a, const reg b, const reg c) -> reg { return c - a * b; }
+    };
+
+    /*
+     * c = a @ b for lanes [begin, end) in steps of Ops::width; c may alias a or b because every lane is fully loaded
+     * before it is stored.
+     * (a0 + 1j * b0) * (c0 + 1j * d0) + (a1 + 1j * b1) * (c1 + 1j * d1)
+     * = (a0 * c0 - b0 * d0 + a1 * c1 - b1 * d1) + 1j * (a0 * d0 + b0 * c0 + a1 * d1 + b1 * c1)
+     * The kernels are always inlined, so that they take the instruction set of the function they are expanded in,
+     * e.g., the AVX2 entry points below.
+     */
+    template<typename Ops, typename T>
+    MATRIX_BATCH_INLINE void multiply_lanes(const T *a, const T *b, T *c, const std::size_t n,
+                                            const std::size_t begin, const std::size_t end) {
+        using reg = typename Ops::reg;
+        for (std::size_t j = begin; j + Ops::width <= end; j += Ops::width) {
+            const reg a00r = Ops::load(a + j), a00i = Ops::load(a + n + j);
+            const reg a01r = Ops::load(a + 2 * n + j), a01i = Ops::load(a + 3 * n + j);
+            const reg a10r = Ops::load(a + 4 * n + j), a10i = Ops::load(a + 5 * n + j);
+            const reg a11r = Ops::load(a + 6 * n + j), a11i = Ops::load(a + 7 * n + j);
+            const reg b00r = Ops::load(b + j), b00i = Ops::load(b + n + j);
+            const reg b01r = Ops::load(b + 2 * n + j), b01i = Ops::load(b + 3 * n + j);
+            const reg b10r = Ops::load(b + 4 * n + j), b10i = Ops::load(b + 5 * n + j);
+            const reg b11r = Ops::load(b + 6 * n + j), b11i = Ops::load(b + 7 * n + j);
+            Ops::store(c + j, Ops::fnmadd(a01i, b10i, Ops::fmadd(a01r, b10r, Ops::fnmadd(a00i, b00i, Ops::mul(a00r, b00r)))));
+            Ops::store(c + n + j, Ops::fmadd(a01i, b10r, Ops::fmadd(a01r, b10i, Ops::fmadd(a00i, b00r, Ops::mul(a00r, b00i)))));
+            Ops::store(c + 2 * n + j, Ops::fnmadd(a01i, b11i, Ops::fmadd(a01r, b11r, Ops::fnmadd(a00i, b01i, Ops::mul(a00r, b01r)))));
+            Ops::store(c + 3 * n + j, Ops::fmadd(a01i, b11r, Ops::fmadd(a01r, b11i, Ops::fmadd(a00i, b01r, Ops::mul(a00r, b01i)))));
+            Ops::store(c + 4 * n + j, Ops::fnmadd(a11i, b10i, Ops::fmadd(a11r, b10r, Ops::fnmadd(a10i, b00i, Ops::mul(a10r, b00r)))));
+            Ops::store(c + 5 * n + j, Ops::fmadd(a11i, b10r, Ops::fmadd(a11r, b10i, Ops::fmadd(a10i, b00r, Ops::mul(a10r, b00i)))));
+            Ops::store(c + 6 * n + j, Ops::fnmadd(a11i, b11i, Ops::fmadd(a11r, b11r, Ops::fnmadd(a10i, b01i, Ops::mul(a10r, b01r)))));
+            Ops::store(c + 7 * n + j, Ops::fmadd(a11i, b11r, Ops::fmadd(a11r, b11i, Ops::fmadd(a10i, b01r, Ops::mul(a10r, b01i)))));
+        }
+    }
+
+    // x = a @ x for lanes [begin, end)
+    template<typename Ops, typename T>
+    MATRIX_BATCH_INLINE void apply_lanes(const T *a, T *x, const std::size_t n, const std::size_t begin,
+                                         const std::size_t end) {
+        using reg = typename Ops::reg;
+        for (std::size_t j = begin; j + Ops::width <= end; j += Ops::width) {
+            const reg a00r = Ops::load(a + j), a00i = Ops::load(a + n + j);
+            const reg a01r = Ops::load(a + 2 * n + j), a01i = Ops::load(a + 3 * n + j);
+            const reg a10r = Ops::load(a + 4 * n + j), a10i = Ops::load(a + 5 * n + j);
+            const reg a11r = Ops::load(a + 6 * n + j), a11i = Ops::load(a + 7 * n + j);
+            const reg x0r = Ops::load(x + j), x0i = Ops::load(x + n + j);
+            const reg x1r = Ops::load(x + 2 * n + j), x1i = Ops::load(x + 3 * n + j);
+            Ops::store(x + j, Ops::fnmadd(a01i, x1i, Ops::fmadd(a01r, x1r, Ops::fnmadd(a00i, x0i, Ops::mul(a00r, x0r)))));
+            Ops::store(x + n + j, Ops::fmadd(a01i, x1r, Ops::fmadd(a01r, x1i, Ops::fmadd(a00i, x0r, Ops::mul(a00r, x0i)))));
+            Ops::store(x + 2 * n + j, Ops::fnmadd(a11i, x1i, Ops::fmadd(a11r, x1r, Ops::fnmadd(a10i, x0i, Ops::mul(a10r, x0r)))));
+            Ops::store(x + 3 * n + j, Ops::fmadd(a11i, x1r, Ops::fmadd(a11r, x1i, Ops::fmadd(a10i, x0r, Ops::mul(a10r, x0i)))));
+        }
+    }
+
+    template<typename T>
+    struct SimdWidth {
+        static constexpr std::size_t value = 1;
+    };
+
+#ifdef MATRIX_BATCH_X86
+    const bool use_avx2 = Utils::Math::has_avx2_fma();
+
+    template<>
+    struct SimdWidth<double> {
+        static constexpr std::size_t value = 4;
+    };
+
+    template<>
+    struct SimdWidth<float> {
+        static constexpr std::size_t value = 8;
+    };
+
+// The AVX2 kernels are compiled for AVX2 and FMA regardless of the compiler flags and only called if use_avx2.
+// MSVC accepts the intrinsics in any function.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+    template<typename T>
+    struct Avx2Ops;
+
+    template<>
+    struct Avx2Ops<double> {
+        using reg = __m256d;
+        static constexpr std::size_t width = 4;
+        static auto load(const double *p) -> reg { return _mm256_loadu_pd(p); }
+        static void store(double *p, const reg v) { _mm256_storeu_pd(p, v); }
+        static auto mul(const reg a, const reg b) -> reg { return _mm256_mul_pd(a, b); }
+        static auto fmadd(const reg a, const reg b, const reg c) -> reg { return _mm256_fmadd_pd(a, b, c); }
+        static auto fnmadd(const reg a, const reg b, const reg c) -> reg { return _mm256_fnmadd_pd(a, b, c); }
+    };
+
+    template<>
+    struct Avx2Ops<float> {
+        using reg = __m256;
+        static constexpr std::size_t width = 8;
+        static auto load(const float *p) -> reg { return _mm256_loadu_ps(p); }
+        static void store(float *p, const reg v) { _mm256_storeu_ps(p, v); }
+        static auto mul(const reg a, const reg b) -> reg { return _mm256_mul_ps(a, b); }
+        static auto fmadd(const reg a, const reg b, const reg c) -> reg { return _mm256_fmadd_ps(a, b, c); }
+        static auto fnmadd(const reg a, const reg b, const reg c) -> reg { return _mm256_fnmadd_ps(a, b, c); }
+    };
+
+    template<typename T>
+    void multiply_avx2(const T *a, const T *b, T *c, const std::size_t n, const std::size_t end) {
+        multiply_lanes<Avx2Ops<T>>(a, b, c, n, 0, end);
+    }
+
+    template<typename T>
+    void apply_avx2(const T *a, T *x, const std::size_t n, const std::size_t end) {
+        apply_lanes<Avx2Ops<T>>(a, x, n, 0, end);
+    }
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
+
+    /*
+     * The AVX2 lanes where supported, and the scalar lanes for the rest
+     */
+    template<typename T>
+    void multiply(const T *a, const T *b, T *c, const std::size_t n) {
+        std::size_t simd_end = 0;
+#ifdef MATRIX_BATCH_X86
+        if (use_avx2) {
+            simd_end = n - n % SimdWidth<T>::value;
+            multiply_avx2(a, b, c, n, simd_end);
+        }
+#endif
+        multiply_lanes<ScalarOps<T>>(a, b, c, n, simd_end, n);
+    }
+
+    template<typename T>
+    void apply_batch(const T *a, T *x, const std::size_t n) {
+        std::size_t simd_end = 0;
+#ifdef MATRIX_BATCH_X86
+        if (use_avx2) {
+            simd_end = n - n % SimdWidth<T>::value;
+            apply_avx2(a, x, n, simd_end);
+        }
+#endif
+        apply_lanes<ScalarOps<T>>(a, x, n, simd_end, n);
+    }
+}
+
+template<std::floating_point T>
+ComplexMatrix2Batch<T>::ComplexMatrix2Batch(const std::size_t n) : n(n), data(8 * n) {}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::resize(const std::size_t n_) {
+    n = n_;
+    data.resize(8 * n_);
+}
+
+template<std::floating_point T>
+auto ComplexMatrix2Batch<T>::size() const noexcept -> std::size_t {
+    return n;
+}
+
+template<std::floating_point T>
+auto ComplexMatrix2Batch<T>::get(const std::size_t entry, const std::size_t j) const -> std::complex<T> {
+    return {data.at(2 * entry * n + j), data.at((2 * entry + 1) * n + j)};
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::set(const std::size_t entry, const std::size_t j, const std::complex<T> value) {
+    data.at(2 * entry * n + j) = value.real();
+    data.at((2 * entry + 1) * n + j) = value.imag();
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::set_identity() {
+    std::ranges::fill(data, 0);
+    std::fill_n(data.begin(), n, 1);
+    std::fill_n(data.begin() + 6 * n, n, 1);
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::set_layer(const std::span<const std::complex<T>> delta,
+                                       const std::span<const std::complex<T>> r,
+                                       const std::span<const std::complex<T>> t) {
+    if (delta.size() not_eq n or r.size() not_eq n or t.size() not_eq n) {
+        throw std::invalid_argument("delta, r, and t must have the same size as the batch.");
+    }
+    for (std::size_t j = 0; j < n; j++) {
+        // exp(-1j * delta) / t and exp(1j * delta) / t
+        const std::complex<T> ef = std::exp(std::complex<T>(delta[j].imag(), -delta[j].real())) / t[j];
+        const std::complex<T> eb = std::exp(std::complex<T>(-delta[j].imag(), delta[j].real())) / t[j];
+        set(0, j, ef);
+        set(1, j, ef * r[j]);
+        set(2, j, eb * r[j]);
+        set(3, j, eb);
+    }
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::set_interface(const std::span<const std::complex<T>> r,
+                                           const std::span<const std::complex<T>> t) {
+    if (r.size() not_eq n or t.size() not_eq n) {
+        throw std::invalid_argument("r and t must have the same size as the batch.");
+    }
+    for (std::size_t j = 0; j < n; j++) {
+        const std::complex<T> inv_t = static_cast<T>(1) / t[j];
+        set(0, j, inv_t);
+        set(1, j, r[j] * inv_t);
+        set(2, j, r[j] * inv_t);
+        set(3, j, inv_t);
+    }
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::right_multiply(const ComplexMatrix2Batch &other) {
+    if (other.n not_eq n) {
+        throw std::invalid_argument("Batch sizes mismatch.");
+    }
+    multiply(data.data(), other.data.data(), data.data(), n);
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::left_multiply(const ComplexMatrix2Batch &other) {
+    if (other.n not_eq n) {
+        throw std::invalid_argument("Batch sizes mismatch.");
+    }
+    multiply(other.data.data(), data.data(), data.data(), n);
+}
+
+template<std::floating_point T>
+void ComplexMatrix2Batch<T>::apply(const std::span<T> x) const {
+    if (x.size() not_eq 4 * n) {
+        throw std::invalid_argument("x must have 4 blocks of the batch size.");
+    }
+    apply_batch(data.data(), x.data(), n);
+}
+
+
+template<std::floating_point T>
+auto ComplexMatrix2Batch<T>::simd_lanes() -> std::size_t {
+#ifdef MATRIX_BATCH_X86
+    if (use_avx2) {
+        return SimdWidth<T>::value;
+    }
+#endif
+    return 1;
+}
+
+template class ComplexMatrix2Batch<double>;
+template class ComplexMatrix2Batch<float>;
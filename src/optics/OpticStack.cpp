@@ -38,6 +38,34 @@ U OpticStack<T>::get_widths() {
     }
 }
 
+template<FloatingList T>
+void OpticStack<T>::append_cache_key(RatCacheKey &key) {
+    const auto append_material = [&key](OpticMaterial<T> *material) {
+        if (material == nullptr) {
+            key.append_string({});
+            return;
+        }
+        if (material->data_version() == 0) {
+            try {
+                material->load_nk();
+            } catch (std::runtime_error &e) {
+                // get_indices falls back to n = 1 and k = 0, which version 0 stands for.
+                qWarning() << "Material" << material->name() << "cannot load n/k data: " << e.what();
+            }
+        }
+        key.append_string(material->name().toStdString());
+        key.append(material->data_version());
+    };
+    key.append(no_back_reflection);
+    append_material(incidence);
+    append_material(substrate);
+    key.append(static_cast<std::uint64_t>(structure.size()));
+    for (const auto &[material, thickness] : structure) {
+        append_material(material);
+        key.append(thickness);
+    }
+}
+
 /*
  * k value of the back highly absorbing layer. It is the maximum between the
         bottom layer of the stack or a finite, small value that will absorb all light
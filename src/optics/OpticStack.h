@@ -6,11 +6,14 @@
 #define SUISAPP_OPTICSTACK_H
 
 #include <complex>
+#include <stdexcept>
+#include <unordered_map>
 #include <valarray>
 #include <vector>
 
 #include "utils/Math.h"
 #include "material/OpticMaterial.h"
+#include "RatCache.h"
 
 /*
  * Class that contains an optical structure: a sequence of layers with a thickness
@@ -93,39 +96,30 @@ public:
     U get_indices(T_WL &&wavelength) {
         const std::size_t sz_wl = wavelength.size();
         U indices(1, sz_wl * (num_mat_layers + 1));
-        if (incidence) {
-            const QList<double> n_data = incidence->n_interpolated(wavelength);
-            const QList<double> k_data = incidence->k_interpolated(wavelength);
-            if (sz_wl not_eq n_data.size() or sz_wl not_eq k_data.size()) {
+        // Every layer is a row interpolated once per wavelength grid by its material (see OpticMaterial::indices).
+        const auto assign_row = [&indices, sz_wl](const std::size_t layer, const U &row) -> bool {
+            if (row.size() not_eq sz_wl) {
                 qWarning("n_data size does not match k_data size");
-                return {};
-            }
-            for (qsizetype i = 0; i < sz_wl; i++) {
-                indices[i] = {n_data.at(i), k_data.at(i)};
+                return false;
             }
+            indices[std::slice(layer * sz_wl, sz_wl, 1)] = row;
+            return true;
+        };
+        if (incidence and not assign_row(0, incidence->indices(wavelength))) {
+            return {};
         }
-        if (substrate) {
-            const QList<double> n_data = substrate->n_interpolated(wavelength);
-            const QList<double> k_data = substrate->k_interpolated(wavelength);
-            if (sz_wl not_eq n_data.size() or sz_wl not_eq k_data.size()) {
-                qWarning("n_data size does not match k_data size");
-                return {};
-            }
-            for (qsizetype i = 0; i < sz_wl; i++) {
-                indices[(num_mat_layers - 1) * sz_wl + i] = {n_data.at(i), k_data.at(i)};
-            }
+        if (substrate and not assign_row(num_mat_layers - 1, substrate->indices(wavelength))) {
+            return {};
         }
         for (std::size_t i = 0; i < structure.size(); i++) {
-            for (qsizetype j = 0; j < sz_wl; j++) {
-                const QList<double> n_data = structure.at(i).first->n_interpolated(wavelength);
-                const QList<double> k_data = structure.at(i).first->k_interpolated(wavelength);
-                indices[(i + 1) * sz_wl + j] = {n_data.at(j), k_data.at(j)};
+            if (not assign_row(i + 1, structure.at(i).first->indices(wavelength))) {
+                return {};
             }
         }
         // substrate irrelevant if no_back_reflection = True
         if (no_back_reflection) {
+            const T absorbing_k = k_absorbing(std::forward<T>(wavelength));
             for (qsizetype i = 0; i < sz_wl; i++) {
-                const T absorbing_k = k_absorbing(std::forward<T>(wavelength));
                 indices[(num_mat_layers - 1) * sz_wl + i] = absorbing_k[i];
             }
         }
@@ -137,49 +131,96 @@ public:
     U get_indices(T_WL &&wavelength) {
         const std::size_t sz_wl = wavelength.size();
         U indices(num_mat_layers, std::valarray<std::complex<typename T::value_type>>(1, sz_wl));
-        if (incidence) {
-            const QList<double> n_data = incidence->n_interpolated(wavelength);
-            const QList<double> k_data = incidence->k_interpolated(wavelength);
-            if (sz_wl not_eq n_data.size() or sz_wl not_eq k_data.size()) {
+        const auto assign_row = [&indices, sz_wl](const std::size_t layer,
+                                                  std::valarray<std::complex<typename T::value_type>> &&row) -> bool {
+            if (row.size() not_eq sz_wl) {
                 qWarning("n_data size does not match k_data size");
+                return false;
+            }
+            indices.at(layer) = std::move(row);
+            return true;
+        };
+        if (incidence and not assign_row(0, incidence->indices(wavelength))) {
+            return {};
+        }
+        if (substrate and not assign_row(num_mat_layers - 1, substrate->indices(wavelength))) {
+            return {};
+        }
+        for (std::size_t i = 0; i < structure.size(); i++) {
+            if (not assign_row(i + 1, structure.at(i).first->indices(wavelength))) {
                 return {};
             }
+        }
+        // substrate irrelevant if no_back_reflection = True
+        if (no_back_reflection) {
+            const T absorbing_k = k_absorbing(std::forward<T>(wavelength));
             for (qsizetype i = 0; i < sz_wl; i++) {
-                indices.front()[i] = {n_data.at(i), k_data.at(i)};
+                indices.back()[i] = absorbing_k[i];
             }
         }
-        if (substrate) {
-            const QList<double> n_data = substrate->n_interpolated(wavelength);
-            const QList<double> k_data = substrate->k_interpolated(wavelength);
-            if (sz_wl not_eq n_data.size() or sz_wl not_eq k_data.size()) {
-                qWarning("n_data size does not match k_data size");
-                return {};
+        return indices;
+    }
+
+    /*
+     * Pooled form of get_indices for many stacks over the same wavelength grid, e.g., in calculate_rat_batch.
+     * Every material is added to the pool once: its indices are appended to pool on first use and their row is
+     * recorded in rows_of (the null material stands for the unit index of a missing incidence or substrate).
+
+        :return: The row of pool of every layer, in the order of get_indices.
+     */
+    template<FloatingList T_WL>
+    std::vector<std::size_t> get_index_rows(T_WL &&wavelength,
+                                            std::vector<std::valarray<std::complex<typename T::value_type>>> &pool,
+                                            std::unordered_map<const OpticMaterial<T> *, std::size_t> &rows_of) {
+        const std::size_t sz_wl = wavelength.size();
+        const auto row_of = [&](OpticMaterial<T> *material) -> std::size_t {
+            if (const auto it = rows_of.find(material); it not_eq rows_of.end()) {
+                return it->second;
             }
-            for (qsizetype i = 0; i < sz_wl; i++) {
-                indices.back()[i] = {n_data.at(i), k_data.at(i)};
+            if (material) {
+                pool.emplace_back(material->indices(wavelength));
+                if (pool.back().size() not_eq sz_wl) {
+                    pool.pop_back();
+                    throw std::runtime_error("n_data size does not match k_data size");
+                }
+            } else {
+                pool.emplace_back(1, sz_wl);
             }
+            rows_of.emplace(material, pool.size() - 1);
+            return pool.size() - 1;
+        };
+        std::vector<std::size_t> rows(num_mat_layers, row_of(nullptr));
+        if (incidence) {
+            rows.front() = row_of(incidence);
+        }
+        if (substrate) {
+            rows.back() = row_of(substrate);
         }
         for (std::size_t i = 0; i < structure.size(); i++) {
-            for (qsizetype j = 0; j < sz_wl; j++) {
-                const QList<double> n_data = structure.at(i).first->n_interpolated(wavelength);
-                const QList<double> k_data = structure.at(i).first->k_interpolated(wavelength);
-                indices.at(i + 1)[j] = {n_data.at(j), k_data.at(j)};
-            }
+            rows.at(i + 1) = row_of(structure.at(i).first);
         }
-        // substrate irrelevant if no_back_reflection = True
+        // substrate irrelevant if no_back_reflection = True; the absorbing layer depends on the whole stack.
         if (no_back_reflection) {
+            const T absorbing_k = k_absorbing(std::forward<T>(wavelength));
+            std::valarray<std::complex<typename T::value_type>> &indices = pool.emplace_back(sz_wl);
             for (qsizetype i = 0; i < sz_wl; i++) {
-                const T absorbing_k = k_absorbing(std::forward<T>(wavelength));
-                indices.back()[i] = absorbing_k[i];
+                indices[i] = absorbing_k[i];
             }
+            rows.back() = pool.size() - 1;
         }
-        return indices;
+        return rows;
     }
 
     template<FloatingList U>
     requires std::same_as<typename U::value_type, typename T::value_type>
     U get_widths();
 
+    /*
+     * Appends the identity of the stack to a key of RatCache: the name and the n/k data version of every material
+     * (loading the data if necessary), the thicknesses, and whether back reflection is suppressed.
+     */
+    void append_cache_key(RatCacheKey &key);
+
 private:
     // electrodes, layer, active, layer, electrode; no interface
     std::vector<std::pair<OpticMaterial<T> *, double>> structure;
@@ -0,0 +1,315 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include "RatCache.h"
+
+namespace {
+    constexpr char rat_magic[8] = {'S', 'U', 'I', 'S', 'R', 'A', 'T', 'C'};
+
+    template<typename V>
+    void write_value(std::ofstream &file, const V value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    template<typename V>
+    auto read_value(std::ifstream &file) -> V {
+        V value{};
+        file.read(reinterpret_cast<char *>(&value), sizeof value);
+        return value;
+    }
+
+    template<typename T>
+    void write_array(std::ofstream &file, const std::valarray<T> &array) {
+        write_value<std::uint64_t>(file, array.size());
+        file.write(reinterpret_cast<const char *>(std::begin(array)),
+                   static_cast<std::streamsize>(array.size() * sizeof(T)));
+    }
+
+    template<typename T>
+    auto read_array(std::ifstream &file, const std::uintmax_t file_size) -> std::valarray<T> {
+        const auto size = read_value<std::uint64_t>(file);
+        if (not file or size > file_size / sizeof(T)) {  // do not allocate for a corrupted size
+            file.setstate(std::ios::failbit);
+            return {};
+        }
+        std::valarray<T> array(size);
+        file.read(reinterpret_cast<char *>(std::begin(array)), static_cast<std::streamsize>(size * sizeof(T)));
+        return array;
+    }
+}
+
+/*
+ * Name of the file of the on-disk tier, the digest in hexadecimal
+ */
+auto RatCacheKey::filename() const -> std::string {
+    char name[24];
+    std::snprintf(name, sizeof name, "%016llx.rat", static_cast<unsigned long long>(digest()));
+    return name;
+}
+
+void RatCacheKey::append_string(const std::string_view str) {
+    append(static_cast<std::uint64_t>(str.size()));
+    bytes.append(str);
+}
+
+auto RatCacheKey::digest() const -> std::uint64_t {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const char byte : bytes) {
+        hash ^= static_cast<unsigned char>(byte);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template<std::floating_point T>
+RatCache<T>::RatCache(const std::size_t capacity, std::filesystem::path directory) : capacity(capacity),
+                                                                                     directory(std::move(directory)) {
+    if (not this->directory.empty()) {
+        std::filesystem::create_directories(this->directory);
+    }
+}
+
+template<std::floating_point T>
+auto RatCache<T>::instance() -> RatCache & {
+    static RatCache cache;
+    return cache;
+}
+
+template<std::floating_point T>
+auto RatCache<T>::find(const RatCacheKey &key) -> std::optional<rat_dict<T>> {
+    std::filesystem::path filename;
+    {
+        const std::lock_guard lock(mutex);
+        if (const auto it = index.find(key.str()); it not_eq index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            hits++;
+            return it->second->second;
+        }
+        if (not directory.empty()) {
+            filename = directory / key.filename();
+        }
+    }
+    // The file is read without holding the lock; a concurrent insert of the same key is harmless.
+    if (not filename.empty()) {
+        if (std::optional<rat_dict<T>> rat = read_file(filename, key)) {
+            disk_hits++;
+            const std::lock_guard lock(mutex);
+            if (not index.contains(key.str())) {
+                insert_memory(key.str(), *rat);
+            }
+            return rat;
+        }
+    }
+    misses++;
+    return std::nullopt;
+}
+
+template<std::floating_point T>
+void RatCache<T>::insert(const RatCacheKey &key, const rat_dict<T> &rat) {
+    std::filesystem::path filename;
+    {
+        const std::lock_guard lock(mutex);
+        if (const auto it = index.find(key.str()); it not_eq index.end()) {
+            it->second->second = rat;
+            entries.splice(entries.begin(), entries, it->second);
+        } else {
+            insert_memory(key.str(), rat);
+        }
+        if (not directory.empty()) {
+            filename = directory / key.filename();
+        }
+    }
+    if (not filename.empty() and not write_file(filename, key, rat)) {
+        disk_errors++;
+    }
+}
+
+template<std::floating_point T>
+void RatCache<T>::clear() {
+    const std::lock_guard lock(mutex);
+    index.clear();
+    entries.clear();
+}
+
+template<std::floating_point T>
+void RatCache<T>::set_capacity(const std::size_t new_capacity) {
+    const std::lock_guard lock(mutex);
+    capacity = new_capacity;
+    while (entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+template<std::floating_point T>
+void RatCache<T>::set_directory(const std::filesystem::path &new_directory) {
+    if (not new_directory.empty()) {
+        std::filesystem::create_directories(new_directory);
+    }
+    const std::lock_guard lock(mutex);
+    directory = new_directory;
+}
+
+template<std::floating_point T>
+auto RatCache<T>::stats() const -> RatCacheStats {
+    std::size_t size;
+    {
+        const std::lock_guard lock(mutex);
+        size = entries.size();
+    }
+    return {hits, disk_hits, misses, evictions, disk_errors, size};
+}
+
+/*
+ * Inserts a new key as the most recently used entry and evicts the least recently used ones beyond capacity.
+ * The caller holds the lock.
+ */
+template<std::floating_point T>
+void RatCache<T>::insert_memory(std::string key, rat_dict<T> rat) {
+    if (capacity == 0) {
+        return;
+    }
+    entries.emplace_front(std::move(key), std::move(rat));
+    index.emplace(entries.front().first, entries.begin());
+    while (entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+/*
+ * File layout: the "SUISRATC" magic, sizeof(T), the key, and the number of arrays of the dictionary, then for each
+ * one its name, the alternative of the variant, and its arrays, every array as its length followed by native Ts.
+ */
+template<std::floating_point T>
+auto RatCache<T>::read_file(const std::filesystem::path &filename,
+                            const RatCacheKey &key) const -> std::optional<rat_dict<T>> {
+    std::error_code error;
+    const std::uintmax_t file_size = std::filesystem::file_size(filename, error);
+    if (error) {
+        return std::nullopt;  // not cached on disk
+    }
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof rat_magic];
+    file.read(magic, sizeof magic);
+    const auto precision = read_value<std::uint32_t>(file);
+    const auto key_size = read_value<std::uint64_t>(file);
+    if (not file or std::memcmp(magic, rat_magic, sizeof magic) not_eq 0 or precision not_eq sizeof(T)) {
+        disk_errors++;
+        return std::nullopt;
+    }
+    if (key_size not_eq key.str().size()) {  // a digest collision is a miss, not an error
+        return std::nullopt;
+    }
+    std::string file_key(key_size, '\0');
+    file.read(file_key.data(), static_cast<std::streamsize>(key_size));
+    if (not file) {
+        disk_errors++;
+        return std::nullopt;
+    }
+    if (file_key not_eq key.str()) {
+        return std::nullopt;
+    }
+    rat_dict<T> rat;
+    const auto num_items = read_value<std::uint64_t>(file);
+    for (std::uint64_t item = 0; file and item < num_items; item++) {
+        const auto name_size = read_value<std::uint64_t>(file);
+        if (not file or name_size > file_size) {
+            file.setstate(std::ios::failbit);
+            break;
+        }
+        std::string name(name_size, '\0');
+        file.read(name.data(), static_cast<std::streamsize>(name_size));
+        const auto alternative = read_value<std::uint8_t>(file);
+        if (alternative == 0) {
+            rat.insert_or_assign(name, read_array<T>(file, file_size));
+            continue;
+        }
+        const auto num_arrays = read_value<std::uint64_t>(file);
+        if (not file or num_arrays > file_size / sizeof(std::uint64_t)) {
+            file.setstate(std::ios::failbit);
+            break;
+        }
+        if (alternative == 1) {
+            std::valarray<std::valarray<T>> arrays(num_arrays);
+            for (std::valarray<T> &array : arrays) {
+                array = read_array<T>(file, file_size);
+            }
+            rat.insert_or_assign(name, std::move(arrays));
+        } else if (alternative == 2) {
+            std::vector<std::valarray<T>> arrays(num_arrays);
+            for (std::valarray<T> &array : arrays) {
+                array = read_array<T>(file, file_size);
+            }
+            rat.insert_or_assign(name, std::move(arrays));
+        } else {
+            file.setstate(std::ios::failbit);
+        }
+    }
+    if (not file) {
+        disk_errors++;
+        return std::nullopt;
+    }
+    return rat;
+}
+
+/*
+ * Writes to a temporary file of the calling thread first and renames it, so that a concurrent reader never sees a
+ * partial file. The temporary file is removed if the write or the rename fails.
+ */
+template<std::floating_point T>
+auto RatCache<T>::write_file(const std::filesystem::path &filename, const RatCacheKey &key,
+                             const rat_dict<T> &rat) const -> bool {
+    std::filesystem::path temp_filename = filename;
+    temp_filename += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    std::error_code error;
+    {
+        std::ofstream file(temp_filename, std::ios::binary);
+        if (not file) {
+            std::filesystem::remove(temp_filename, error);
+            return false;
+        }
+        file.write(rat_magic, sizeof rat_magic);
+        write_value<std::uint32_t>(file, sizeof(T));
+        write_value<std::uint64_t>(file, key.str().size());
+        file.write(key.str().data(), static_cast<std::streamsize>(key.str().size()));
+        write_value<std::uint64_t>(file, rat.size());
+        for (const auto &[name, value] : rat) {
+            write_value<std::uint64_t>(file, name.size());
+            file.write(name.data(), static_cast<std::streamsize>(name.size()));
+            write_value<std::uint8_t>(file, value.index());
+            std::visit([&file]<typename V>(const V &arrays) {
+                if constexpr (std::same_as<V, std::valarray<T>>) {
+                    write_array(file, arrays);
+                } else {
+                    write_value<std::uint64_t>(file, arrays.size());
+                    for (const std::valarray<T> &array : arrays) {
+                        write_array(file, array);
+                    }
+                }
+            }, value);
+        }
+        if (not file) {
+            // e.g., a full disk; the partial file is closed before it is removed, as Windows requires.
+            file.close();
+            std::filesystem::remove(temp_filename, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp_filename, filename, error);
+    if (error) {
+        std::error_code remove_error;
+        std::filesystem::remove(temp_filename, remove_error);
+        return false;
+    }
+    return true;
+}
+
+template class RatCache<double>;
+template class RatCache<float>;
@@ -0,0 +1,121 @@
+#ifndef RATCACHE_H
+#define RATCACHE_H
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "tmm.h"
+
+/*
+ * Content-addressed key of a calculate_rat evaluation: the bytes of everything the result depends on (material
+ * identities and n/k data versions, thicknesses, coherency list, angle, polarization, and wavelength grid), appended
+ * in a fixed order. The whole byte string is compared on lookup, so a collision of the 64-bit digest can never
+ * return a wrong result; the digest only names the file of the on-disk tier.
+ */
+class RatCacheKey {
+public:
+    template<typename V>
+    requires std::is_arithmetic_v<V>
+    void append(const V value) {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    // Length-prefixed, so that consecutive strings cannot run into each other
+    void append_string(std::string_view str);
+
+    template<std::ranges::input_range R>
+    requires std::is_arithmetic_v<std::ranges::range_value_t<R>>
+    void append_range(const R &range) {
+        append(static_cast<std::uint64_t>(std::ranges::distance(range)));
+        for (const auto value : range) {
+            append(value);
+        }
+    }
+
+    [[nodiscard]] auto str() const -> const std::string & {
+        return bytes;
+    }
+    /*
+     * FNV-1a over the key bytes
+     */
+    [[nodiscard]] auto digest() const -> std::uint64_t;
+    [[nodiscard]] auto filename() const -> std::string;
+
+private:
+    std::string bytes;
+};
+
+struct RatCacheStats {
+    std::size_t hits = 0;  // served from memory
+    std::size_t disk_hits = 0;  // served from the on-disk tier (and promoted to memory)
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t disk_errors = 0;  // unreadable, mismatched, or unwritable cache files, treated as misses
+    std::size_t size = 0;  // entries in memory
+};
+
+/*
+ * Cache of calculate_rat results (see calculate_rat_cached in TransferMatrix.h), so that parameter sweeps that only
+ * vary the electrical parameters do not recompute the optics of an unchanged stack.
+ * The in-memory tier is an LRU of at most capacity entries. If a directory is set, every inserted result is also
+ * written to <directory>/<digest>.rat, which is looked up on a memory miss and outlives the process; the file
+ * stores the whole key and the precision of T, so a stale or foreign file is never mistaken for a hit.
+ * The counters are atomic, so stats() can be polled for monitoring without contending with the calculations.
+ */
+template<std::floating_point T>
+class RatCache {
+public:
+    explicit RatCache(std::size_t capacity = 32, std::filesystem::path directory = {});
+
+    /*
+     * Process-wide cache, e.g., for DeviceModel::calcRAT
+     */
+    static auto instance() -> RatCache &;
+
+    auto find(const RatCacheKey &key) -> std::optional<rat_dict<T>>;
+    void insert(const RatCacheKey &key, const rat_dict<T> &rat);
+    /*
+     * Drops the in-memory entries; the files of the on-disk tier are kept.
+     */
+    void clear();
+    void set_capacity(std::size_t new_capacity);
+    /*
+     * Enables (or, with an empty path, disables) the on-disk tier; the directory is created if necessary.
+     */
+    void set_directory(const std::filesystem::path &new_directory);
+    [[nodiscard]] auto stats() const -> RatCacheStats;
+
+private:
+    using Entry = std::pair<std::string, rat_dict<T>>;
+
+    void insert_memory(std::string key, rat_dict<T> rat);
+    [[nodiscard]] auto read_file(const std::filesystem::path &filename,
+                                 const RatCacheKey &key) const -> std::optional<rat_dict<T>>;
+    [[nodiscard]] auto write_file(const std::filesystem::path &filename, const RatCacheKey &key,
+                                  const rat_dict<T> &rat) const -> bool;
+
+    mutable std::mutex mutex;
+    std::size_t capacity;
+    std::filesystem::path directory;
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index;  // views into the keys of entries
+    std::atomic<std::size_t> hits = 0;
+    std::atomic<std::size_t> disk_hits = 0;
+    std::atomic<std::size_t> misses = 0;
+    std::atomic<std::size_t> evictions = 0;
+    mutable std::atomic<std::size_t> disk_errors = 0;
+};
+
+#endif  // RATCACHE_H
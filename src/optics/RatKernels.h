@@ -0,0 +1,466 @@
+#ifndef SUISAPP_RATKERNELS_H
+#define SUISAPP_RATKERNELS_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <ranges>
+#include <stdexcept>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "tmm.h"
+#include "Spectrum.h"
+
+/*
+ * Kernels of calculate_rat and its batched and angle-resolved variants, which work on interpolated refractive
+ * indices rather than on an OpticStack, so that they do not depend on the material database, and the Jsc and
+ * photon-flux reductions of their output.
+ */
+
+/*
+ * Replaces gradient with the mean of gradient and other, e.g., the unpolarized derivatives of the s and p ones.
+ */
+template<std::floating_point T>
+void average_gradient(CohTmmVecGradient<T> &gradient, const CohTmmVecGradient<T> &other) {
+    for (std::valarray<T> CohTmmVecGradient<T>::*field : {&CohTmmVecGradient<T>::dR_dd, &CohTmmVecGradient<T>::dR_dn,
+                                                          &CohTmmVecGradient<T>::dR_dk, &CohTmmVecGradient<T>::dT_dd,
+                                                          &CohTmmVecGradient<T>::dT_dn, &CohTmmVecGradient<T>::dT_dk}) {
+        gradient.*field = (gradient.*field + other.*field) / static_cast<T>(2);
+    }
+    for (std::vector<std::valarray<std::valarray<T>>> CohTmmVecGradient<T>::*field : {&CohTmmVecGradient<T>::dA_dd,
+                                                                                      &CohTmmVecGradient<T>::dA_dn,
+                                                                                      &CohTmmVecGradient<T>::dA_dk}) {
+        for (std::size_t p = 0; p < (gradient.*field).size(); p++) {
+            for (std::size_t i = 0; i < (gradient.*field).at(p).size(); i++) {
+                (gradient.*field).at(p)[i] = ((gradient.*field).at(p)[i] + (other.*field).at(p)[i]) / static_cast<T>(2);
+            }
+        }
+    }
+}
+
+/*
+ * Largest layer count for which calculate_rat_indices takes coh_tmm_fixed: beyond it, the SIMD matrix batch of coh_tmm
+ * is as fast or faster (see bench_rat_dispatch).
+ */
+inline constexpr std::size_t rat_fixed_max_layers = 5;
+
+/*
+ * Calculates R, A, T, and A_per_layer from the interpolated indices of a stack.
+ * This is the kernel of calculate_rat; every wavelength is independent, so it can run on any slice of lam_vac.
+ * Coherent stacks of coh_tmm_fixed_min_layers to rat_fixed_max_layers layers are evaluated by coh_tmm_fixed for 's'
+ * and 'p', and every coherent stack by the fused coh_tmm_unpolarized for 'u'.
+ * If derivatives is given, it is filled with the derivatives of R, T, and A_per_layer with respect to the thickness
+ * and the index of every layer (see CohTmmVecGradient; the mean of s and p for 'u'). This takes the full coh_tmm
+ * instead of coh_tmm_fixed and costs O(num_layers^2 * num_wl); incoherent stacks throw std::invalid_argument.
+ */
+template<std::floating_point T>
+rat_dict<T> calculate_rat_indices(const std::vector<std::valarray<std::complex<T>>> &n_list,
+                                  const std::vector<T> &d_list,
+                                  const std::valarray<LayerType> &coherency_va,
+                                  const std::complex<T> th_0,
+                                  const std::valarray<T> &lam_vac,
+                                  const char pol,
+                                  const bool coherent,
+                                  CohTmmVecGradient<T> *derivatives = nullptr) {
+    if (derivatives and not coherent) {
+        throw std::invalid_argument("Derivatives are only available for coherent stacks");
+    }
+    rat_dict<T> rat_out;
+    if (pol == 's' or pol == 'p') {
+        if (coherent) {
+            CohTmmVecResult<T> out;
+            // Stacks of a precompiled layer count take the unrolled allocation-free kernel, which has no derivatives.
+            // Only R, T, and the absorption are read, so neither kernel stores the amplitudes.
+            if (derivatives) {
+                coh_tmm(pol, n_list, d_list, th_0, lam_vac, out, *derivatives);
+            } else if (n_list.size() > rat_fixed_max_layers or
+                       not coh_tmm_fixed_dispatch(pol, n_list, d_list, th_0, lam_vac, out, CohTmmOutput::Absorption)) {
+                coh_tmm(pol, n_list, d_list, th_0, lam_vac, out, CohTmmOutput::Absorption);
+            }
+            rat_out.emplace("R", out.R);
+            rat_out.emplace("T", out.Tr);
+            rat_out.emplace("A", 1 - out.R - out.Tr);
+            rat_out.emplace("A_per_layer", absorp_in_each_layer(out));
+        } else {
+            const std::valarray<T> d_va(d_list.data(), d_list.size());
+            const inc_tmm_vec_dict<T> out = inc_tmm(pol, n_list, d_va, coherency_va, th_0, lam_vac);
+            rat_out.emplace("R", std::get<std::valarray<T>>(out.at("R")));
+            rat_out.emplace("T", std::get<std::valarray<T>>(out.at("T")));
+            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(out.at("R")) - std::get<std::valarray<T>>(out.at("T")));
+            rat_out.emplace("A_per_layer", inc_absorp_in_each_layer(out));
+        }
+    } else {
+        if (coherent) {
+            CohTmmVecResult<T> out_p;
+            CohTmmVecResult<T> out_s;
+            // The fused pass shares the angles and phases of s and p, which beats two coh_tmm_fixed passes at every
+            // precompiled layer count (see bench_rat_dispatch), so 'u' never takes coh_tmm_fixed.
+            if (derivatives) {
+                CohTmmVecGradient<T> gradient_s;
+                coh_tmm_unpolarized<T, std::complex<T>>(n_list, d_list, th_0, lam_vac, out_s, out_p, &gradient_s,
+                                                        derivatives, CohTmmOutput::Fields);
+                average_gradient(*derivatives, gradient_s);
+            } else {
+                coh_tmm_unpolarized<T, std::complex<T>>(n_list, d_list, th_0, lam_vac, out_s, out_p, nullptr, nullptr,
+                                                        CohTmmOutput::Absorption);
+            }
+            rat_out.emplace("R", (out_p.R + out_s.R) / 2);
+            rat_out.emplace("T", (out_p.Tr + out_s.Tr) / 2);
+            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(rat_out.at("R")) - std::get<std::valarray<T>>(rat_out.at("T")));
+            rat_out.emplace("A_per_layer", (absorp_in_each_layer(out_p) + absorp_in_each_layer(out_s)) / std::valarray<T>(2, lam_vac.size()));
+            // A_per_layer_s and A_per_layer_p
+        } else {
+            const std::valarray<T> d_va(d_list.data(), d_list.size());
+            const inc_tmm_vec_dict<T> out_p = inc_tmm('p', n_list, d_va, coherency_va, th_0, lam_vac);
+            const inc_tmm_vec_dict<T> out_s = inc_tmm('s', n_list, d_va, coherency_va, th_0, lam_vac);
+            rat_out.emplace("R", (std::get<std::valarray<T>>(out_p.at("R")) + std::get<std::valarray<T>>(out_s.at("R"))) / 2);
+            rat_out.emplace("T", (std::get<std::valarray<T>>(out_p.at("T")) + std::get<std::valarray<T>>(out_s.at("T"))) / 2);
+            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(rat_out.at("R")) - std::get<std::valarray<T>>(rat_out.at("T")));
+            std::vector<std::valarray<T>> A_per_layer;
+#ifdef __cpp_lib_ranges_zip
+            for (const auto [p, s] : std::views::zip(inc_absorp_in_each_layer(out_p), inc_absorp_in_each_layer(out_s))) {
+#else
+            auto inc_s = inc_absorp_in_each_layer(out_s);
+            auto inc_p = inc_absorp_in_each_layer(out_p);
+            for (auto i = 0; i < inc_s.size(); ++i) {
+                auto s = inc_s[i];
+                auto p = inc_p[i];
+#endif
+                A_per_layer.emplace_back((p + s) / 2);
+            }
+            rat_out.emplace("A_per_layer", A_per_layer);
+        }
+    }
+    return rat_out;
+}
+
+/*
+ * Number of wavelengths per chunk of the parallel calculate_rat. With the per-layer buffers of coh_tmm
+ * (indices, angles, kz, delta, interface coefficients, matrix batches, v, and w), a chunk of a typical
+ * 5-10 layer stack stays within a per-core L2 cache.
+ */
+inline constexpr std::size_t rat_chunk_size = 128;
+
+/*
+ * Tiles the wavelength axis into chunks of rat_chunk_size, runs calculate_rat_indices on the chunks with
+ * num_threads worker threads, and stitches the results in wavelength order.
+ * Every wavelength is calculated independently, so the result equals the serial path up to rounding: a wavelength
+ * may fall into the SIMD lanes of a MatrixBatch in one path and into its scalar tail in the other.
+ */
+template<std::floating_point T>
+rat_dict<T> calculate_rat_parallel(const std::vector<std::valarray<std::complex<T>>> &n_list,
+                                   const std::vector<T> &d_list,
+                                   const std::valarray<LayerType> &coherency_va,
+                                   const std::complex<T> th_0,
+                                   const std::valarray<T> &lam_vac,
+                                   const char pol,
+                                   const bool coherent,
+                                   std::size_t num_threads,
+                                   CohTmmVecGradient<T> *derivatives = nullptr) {
+    const std::size_t num_wl = lam_vac.size();
+    const std::size_t num_chunks = (num_wl + rat_chunk_size - 1) / rat_chunk_size;
+    num_threads = std::min(num_threads, num_chunks);
+    if (num_threads <= 1) {
+        return calculate_rat_indices(n_list, d_list, coherency_va, th_0, lam_vac, pol, coherent, derivatives);
+    }
+    std::vector<rat_dict<T>> chunk_out(num_chunks);
+    std::vector<CohTmmVecGradient<T>> chunk_derivatives(derivatives ? num_chunks : 0);
+    std::vector<std::exception_ptr> errors(num_chunks);
+    std::atomic<std::size_t> next_chunk = 0;
+    const auto worker = [&]() -> void {
+        for (std::size_t c = next_chunk++; c < num_chunks; c = next_chunk++) {
+            const std::slice chunk(c * rat_chunk_size, std::min(rat_chunk_size, num_wl - c * rat_chunk_size), 1);
+            std::vector<std::valarray<std::complex<T>>> chunk_n_list;
+            chunk_n_list.reserve(n_list.size());
+            for (const std::valarray<std::complex<T>> &n : n_list) {
+                chunk_n_list.emplace_back(n[chunk]);
+            }
+            try {
+                chunk_out.at(c) = calculate_rat_indices(chunk_n_list, d_list, coherency_va, th_0,
+                                                        std::valarray<T>(lam_vac[chunk]), pol, coherent,
+                                                        derivatives ? &chunk_derivatives.at(c) : nullptr);
+            } catch (...) {
+                errors.at(c) = std::current_exception();
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(num_threads);
+        for (std::size_t i = 0; i < num_threads; i++) {
+            pool.emplace_back(worker);
+        }
+    }  // joins the pool
+    for (const std::exception_ptr &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    rat_dict<T> rat_out;
+    for (const char *key : {"R", "T", "A"}) {
+        std::valarray<T> stitched(num_wl);
+        for (std::size_t c = 0; c < num_chunks; c++) {
+            const std::valarray<T> &part = std::get<std::valarray<T>>(chunk_out.at(c).at(key));
+            stitched[std::slice(c * rat_chunk_size, part.size(), 1)] = part;
+        }
+        rat_out.emplace(key, std::move(stitched));
+    }
+    // A_per_layer is std::valarray<std::valarray<T>> (coh) or std::vector<std::valarray<T>> (inc); keep its type.
+    rat_out.emplace("A_per_layer", std::visit([&chunk_out, num_wl, num_chunks](const auto &first) -> typename rat_dict<T>::mapped_type {
+        using A_T = std::remove_cvref_t<decltype(first)>;
+        if constexpr (std::is_same_v<A_T, std::valarray<T>>) {
+            throw std::logic_error("A_per_layer must be per layer.");
+        } else {
+            A_T stitched(first.size());
+            for (std::size_t i = 0; i < first.size(); i++) {
+                stitched[i].resize(num_wl);
+                for (std::size_t c = 0; c < num_chunks; c++) {
+                    const std::valarray<T> &part = std::get<A_T>(chunk_out.at(c).at("A_per_layer"))[i];
+                    stitched[i][std::slice(c * rat_chunk_size, part.size(), 1)] = part;
+                }
+            }
+            return stitched;
+        }
+    }, chunk_out.front().at("A_per_layer")));
+    if (derivatives) {
+        // Layer-major fields hold the chunk of layer p at p * chunk size + j.
+        const std::size_t num_layers = chunk_derivatives.front().num_layers;
+        derivatives->num_layers = num_layers;
+        derivatives->num_wl = num_wl;
+        for (std::valarray<T> CohTmmVecGradient<T>::*field : {&CohTmmVecGradient<T>::dR_dd, &CohTmmVecGradient<T>::dR_dn,
+                                                              &CohTmmVecGradient<T>::dR_dk, &CohTmmVecGradient<T>::dT_dd,
+                                                              &CohTmmVecGradient<T>::dT_dn, &CohTmmVecGradient<T>::dT_dk}) {
+            (derivatives->*field).resize(num_layers * num_wl);
+            for (std::size_t c = 0; c < num_chunks; c++) {
+                const std::size_t chunk_wl = chunk_derivatives.at(c).num_wl;
+                for (std::size_t p = 0; p < num_layers; p++) {
+                    (derivatives->*field)[std::slice(p * num_wl + c * rat_chunk_size, chunk_wl, 1)] =
+                            (chunk_derivatives.at(c).*field)[std::slice(p * chunk_wl, chunk_wl, 1)];
+                }
+            }
+        }
+        for (std::vector<std::valarray<std::valarray<T>>> CohTmmVecGradient<T>::*field : {&CohTmmVecGradient<T>::dA_dd,
+                                                                                          &CohTmmVecGradient<T>::dA_dn,
+                                                                                          &CohTmmVecGradient<T>::dA_dk}) {
+            (derivatives->*field).assign(num_layers, std::valarray<std::valarray<T>>(std::valarray<T>(num_wl), num_layers));
+            for (std::size_t c = 0; c < num_chunks; c++) {
+                for (std::size_t p = 0; p < num_layers; p++) {
+                    for (std::size_t i = 0; i < num_layers; i++) {
+                        const std::valarray<T> &part = (chunk_derivatives.at(c).*field).at(p)[i];
+                        (derivatives->*field).at(p)[i][std::slice(c * rat_chunk_size, part.size(), 1)] = part;
+                    }
+                }
+            }
+        }
+    }
+    return rat_out;
+}
+
+/*
+ * Angle-resolved calculate_rat_indices: element a of the result is calculate_rat_indices at th_0[a], with the same
+ * keys and layouts, i.e., R, A, and T indexed by [wavelength] and A_per_layer by [layer][wavelength].
+ * Coherent stacks are evaluated in a single angle-vectorized coh_tmm pass per polarization (see coh_tmm_angles).
+ */
+template<std::floating_point T>
+std::vector<rat_dict<T>> calculate_rat_angles_indices(const std::vector<std::valarray<std::complex<T>>> &n_list,
+                                                      const std::vector<T> &d_list,
+                                                      const std::valarray<LayerType> &coherency_va,
+                                                      const std::valarray<std::complex<T>> &th_0,
+                                                      const std::valarray<T> &lam_vac,
+                                                      const char pol,
+                                                      const bool coherent) {
+    const std::size_t num_angles = th_0.size();
+    const std::size_t num_wl = lam_vac.size();
+    std::vector<rat_dict<T>> rat_out(num_angles);
+    if (not coherent) {
+        // inc_tmm takes a single angle, but the interpolated indices are still shared.
+        for (std::size_t a = 0; a < num_angles; a++) {
+            rat_out.at(a) = calculate_rat_indices(n_list, d_list, coherency_va, th_0[a], lam_vac, pol, coherent);
+        }
+        return rat_out;
+    }
+    const std::vector<char> pols = pol == 's' or pol == 'p' ? std::vector<char>{pol} : std::vector<char>{'p', 's'};
+    std::valarray<T> R(0.0, num_angles * num_wl);
+    std::valarray<T> Tr(0.0, num_angles * num_wl);
+    std::valarray<std::valarray<T>> A_per_layer;  // [layer][angle * num_wl + wavelength], as coh_tmm_angles
+    CohTmmVecResult<T> out;
+    for (const char p : pols) {
+        coh_tmm_angles(p, n_list, d_list, th_0, lam_vac, out);
+        R += out.R;
+        Tr += out.Tr;
+        if (A_per_layer.size() == 0) {
+            A_per_layer = absorp_in_each_layer(out);
+        } else {
+            A_per_layer += absorp_in_each_layer(out);
+        }
+    }
+    const auto num_pols = static_cast<T>(pols.size());
+    for (std::size_t a = 0; a < num_angles; a++) {
+        const std::slice angle_slice(a * num_wl, num_wl, 1);
+        std::valarray<T> R_a = R[angle_slice];
+        R_a /= num_pols;
+        std::valarray<T> T_a = Tr[angle_slice];
+        T_a /= num_pols;
+        std::valarray<std::valarray<T>> A_per_layer_a(A_per_layer.size());
+        for (std::size_t i = 0; i < A_per_layer.size(); i++) {
+            A_per_layer_a[i] = std::valarray<T>(A_per_layer[i][angle_slice]);
+            A_per_layer_a[i] /= num_pols;
+        }
+        rat_out.at(a).emplace("A", 1 - R_a - T_a);
+        rat_out.at(a).emplace("R", std::move(R_a));
+        rat_out.at(a).emplace("T", std::move(T_a));
+        rat_out.at(a).emplace("A_per_layer", std::move(A_per_layer_a));
+    }
+    return rat_out;
+}
+
+/*
+ * Output tensor of calculate_rat_batch.
+ * R, A, and Tr hold (stack s, wavelength j) at s * num_wl + j; A_per_layer[s] is layer-major for stack s, i.e.,
+ * (layer i, wavelength j) at i * num_wl + j, with the layers of A_per_layer of calculate_rat.
+ */
+template<std::floating_point T>
+struct RatBatchResult {
+    std::size_t num_stacks = 0;
+    std::size_t num_wl = 0;
+    std::valarray<T> R;
+    std::valarray<T> A;
+    std::valarray<T> Tr;
+    std::vector<std::valarray<T>> A_per_layer;
+};
+
+/*
+ * Evaluates many stacks over a shared wavelength grid in a single tiled pass.
+ * n_pool holds every distinct row of refractive indices once; stack s has the layers n_pool[n_rows[s][i]] and the
+ * thicknesses d_lists[s]. Every (stack, chunk of wavelengths) pair is a tile of calculate_rat_indices, where a chunk
+ * is the whole grid if there are at least as many stacks as threads and rat_chunk_size wavelengths otherwise;
+ * num_threads workers take the tiles in turn and write them into disjoint parts of the output tensor, so the pass
+ * scales with the cores rather than with the number of calls.
+ */
+template<std::floating_point T>
+RatBatchResult<T> calculate_rat_batch_indices(const std::vector<std::valarray<std::complex<T>>> &n_pool,
+                                              const std::vector<std::vector<std::size_t>> &n_rows,
+                                              const std::vector<std::vector<T>> &d_lists,
+                                              const std::vector<std::valarray<LayerType>> &coherency_vas,
+                                              const std::complex<T> th_0,
+                                              const std::valarray<T> &lam_vac,
+                                              const char pol,
+                                              const bool coherent,
+                                              std::size_t num_threads) {
+    const std::size_t num_stacks = n_rows.size();
+    if (d_lists.size() not_eq num_stacks or coherency_vas.size() not_eq num_stacks) {
+        throw std::invalid_argument("n_rows, d_lists, and coherency_vas must have one element per stack");
+    }
+    const std::size_t num_wl = lam_vac.size();
+    RatBatchResult<T> out{num_stacks, num_wl, std::valarray<T>(num_stacks * num_wl),
+                          std::valarray<T>(num_stacks * num_wl), std::valarray<T>(num_stacks * num_wl),
+                          std::vector<std::valarray<T>>(num_stacks)};
+    num_threads = std::max(num_threads, 1UZ);
+    // With a stack per thread or more, whole-spectrum tiles keep every thread busy at the lowest per-call overhead.
+    const std::size_t chunk_size = num_stacks >= num_threads ? std::max(num_wl, 1UZ) : rat_chunk_size;
+    const std::size_t num_chunks = (num_wl + chunk_size - 1) / chunk_size;
+    const std::size_t num_tiles = num_stacks * num_chunks;
+    std::vector<std::once_flag> allocated(num_stacks);  // A_per_layer[s] is sized by the first finished tile of s
+    std::vector<std::exception_ptr> errors(num_tiles);
+    std::atomic<std::size_t> next_tile = 0;
+    const auto worker = [&]() -> void {
+        for (std::size_t tile = next_tile++; tile < num_tiles; tile = next_tile++) {
+            const std::size_t s = tile / num_chunks;
+            const std::size_t offset = tile % num_chunks * chunk_size;
+            const std::slice chunk(offset, std::min(chunk_size, num_wl - offset), 1);
+            try {
+                std::vector<std::valarray<std::complex<T>>> chunk_n_list;
+                chunk_n_list.reserve(n_rows.at(s).size());
+                for (const std::size_t row : n_rows.at(s)) {
+                    chunk_n_list.emplace_back(n_pool.at(row)[chunk]);
+                }
+                const rat_dict<T> rat = calculate_rat_indices(chunk_n_list, d_lists.at(s), coherency_vas.at(s), th_0,
+                                                              std::valarray<T>(lam_vac[chunk]), pol, coherent);
+                out.R[std::slice(s * num_wl + offset, chunk.size(), 1)] = std::get<std::valarray<T>>(rat.at("R"));
+                out.A[std::slice(s * num_wl + offset, chunk.size(), 1)] = std::get<std::valarray<T>>(rat.at("A"));
+                out.Tr[std::slice(s * num_wl + offset, chunk.size(), 1)] = std::get<std::valarray<T>>(rat.at("T"));
+                // std::valarray<std::valarray<T>> (coh) or std::vector<std::valarray<T>> (inc)
+                std::visit([&](const auto &A_per_layer) -> void {
+                    if constexpr (std::is_same_v<std::remove_cvref_t<decltype(A_per_layer)>, std::valarray<T>>) {
+                        throw std::logic_error("A_per_layer must be per layer.");
+                    } else {
+                        std::call_once(allocated.at(s), [&] {
+                            out.A_per_layer.at(s).resize(A_per_layer.size() * num_wl);
+                        });
+                        for (std::size_t i = 0; i < A_per_layer.size(); i++) {
+                            out.A_per_layer.at(s)[std::slice(i * num_wl + offset, chunk.size(), 1)] = A_per_layer[i];
+                        }
+                    }
+                }, rat.at("A_per_layer"));
+            } catch (...) {
+                errors.at(tile) = std::current_exception();
+            }
+        }
+    };
+    num_threads = std::min(num_threads, num_tiles);
+    if (num_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::jthread> pool;
+        pool.reserve(num_threads);
+        for (std::size_t i = 0; i < num_threads; i++) {
+            pool.emplace_back(worker);
+        }
+    }  // joins the pool
+    for (const std::exception_ptr &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return out;
+}
+
+/*
+ * Maximum achievable Jsc [A m-2] of calculate_rat output for the photon flux weights of SpectrumLibrary::photon_flux
+ * on the same wavelength grid.
+ */
+template<typename T>
+auto calculate_jsc(const rat_dict<T> &rat, const std::valarray<T> &weights) -> T {
+    const std::valarray<T> &A = std::get<std::valarray<T>>(rat.at("A"));
+    if (A.size() not_eq weights.size()) {
+        throw std::invalid_argument("The photon flux weights and the wavelength grid of rat do not match");
+    }
+    return static_cast<T>(SpectrumLibrary::q) * (weights * A).sum();
+}
+
+/*
+ * calculate_jsc of calculate_rat_angles output, one value per angle.
+ */
+template<typename T>
+auto calculate_jsc(const std::vector<rat_dict<T>> &rat, const std::valarray<T> &weights) -> std::valarray<T> {
+    std::valarray<T> out(rat.size());
+    for (std::size_t a = 0; a < rat.size(); a++) {
+        out[a] = calculate_jsc(rat.at(a), weights);
+    }
+    return out;
+}
+
+/*
+ * Absorbed photon flux [m-2 s-1] in each layer of calculate_rat output, for the photon flux weights of
+ * SpectrumLibrary::photon_flux on the same wavelength grid.
+ */
+template<typename T>
+auto calculate_absorbed_photon_flux(const rat_dict<T> &rat, const std::valarray<T> &weights) -> std::valarray<T> {
+    return std::visit([&weights]<typename V>(const V &A_per_layer) -> std::valarray<T> {
+        if constexpr (std::is_same_v<V, std::valarray<T>>) {
+            throw std::invalid_argument("A_per_layer must be a list of layers");
+        } else {
+            for (const std::valarray<T> &A_layer : A_per_layer) {
+                if (A_layer.size() not_eq weights.size()) {
+                    throw std::invalid_argument("The photon flux weights and the wavelength grid of rat do not match");
+                }
+            }
+            return SpectrumLibrary::absorbed_photon_flux(weights, A_per_layer);
+        }
+    }, rat.at("A_per_layer"));
+}
+
+#endif  // SUISAPP_RATKERNELS_H
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "Spectrum.h"
+#include "utils/CSV.h"
+
+namespace {
+    constexpr char spectrum_magic[8] = {'S', 'U', 'I', 'S', 'S', 'P', 'E', 'C'};
+}
+
+SpectrumLibrary::SpectrumLibrary(const std::size_t cache_capacity) : cache_capacity(cache_capacity) {}
+
+void SpectrumLibrary::add_irradiance(const std::string &name, const std::vector<double> &wavelength,
+                                     const std::vector<double> &irradiance) {
+    if (wavelength.size() not_eq irradiance.size()) {
+        throw std::invalid_argument("wavelength and irradiance must have the same length");
+    }
+    if (wavelength.size() < 2) {
+        throw std::invalid_argument("A spectrum must have at least two points");
+    }
+    if (not std::ranges::is_sorted(wavelength)) {
+        throw std::invalid_argument("wavelength must be ascending");
+    }
+    Spectrum spectrum{wavelength, std::vector<double>(wavelength.size()), std::vector<double>(wavelength.size())};
+    for (std::size_t i = 0; i < wavelength.size(); i++) {
+        // E / (h c / lambda), lambda in nm
+        spectrum.flux.at(i) = irradiance.at(i) * wavelength.at(i) * 1e-9 / (h * c);
+    }
+    for (std::size_t i = 1; i < wavelength.size(); i++) {
+        spectrum.cumulative.at(i) = spectrum.cumulative.at(i - 1) + (spectrum.flux.at(i - 1) + spectrum.flux.at(i)) *
+                                    (wavelength.at(i) - wavelength.at(i - 1)) / 2;
+    }
+    insert(name, std::move(spectrum));
+}
+
+void SpectrumLibrary::add_line(const std::string &name, const double wavelength, const double power) {
+    if (wavelength <= 0) {
+        throw std::invalid_argument("The wavelength of a line must be positive");
+    }
+    // A zero-width segment: the running integral steps from 0 to the whole photon flux at the wavelength.
+    insert(name, {{wavelength, wavelength}, {0, 0}, {0, power * wavelength * 1e-9 / (h * c)}});
+}
+
+void SpectrumLibrary::load_csv(const std::string &name, const std::string &filename) {
+    std::vector<double> wavelength;
+    std::vector<double> irradiance;
+    for (const std::vector<std::string> &row : Utils::CSV::readCSV(filename)) {
+        if (row.size() < 2) {
+            continue;
+        }
+        try {
+            const double lambda = std::stod(row.at(0));
+            const double value = std::stod(row.at(1));
+            wavelength.emplace_back(lambda);
+            irradiance.emplace_back(value);
+        } catch (const std::logic_error &) {  // std::invalid_argument or std::out_of_range
+            continue;
+        }
+    }
+    if (wavelength.empty()) {
+        throw std::runtime_error("No spectrum data in " + filename);
+    }
+    add_irradiance(name, wavelength, irradiance);
+}
+
+void SpectrumLibrary::save_binary(const std::string &name, const std::string &filename) const {
+    const std::lock_guard lock(mutex);
+    const Spectrum &spectrum = spectra.at(name);
+    std::ofstream file(filename, std::ios::binary);
+    if (not file) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    const std::uint64_t size = spectrum.wavelength.size();
+    file.write(spectrum_magic, sizeof spectrum_magic);
+    file.write(reinterpret_cast<const char *>(&size), sizeof size);
+    for (const std::vector<double> *array : {&spectrum.wavelength, &spectrum.flux, &spectrum.cumulative}) {
+        file.write(reinterpret_cast<const char *>(array->data()), static_cast<std::streamsize>(size * sizeof(double)));
+    }
+}
+
+void SpectrumLibrary::load_binary(const std::string &name, const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (not file) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    char magic[sizeof spectrum_magic];
+    std::uint64_t size = 0;
+    file.read(magic, sizeof magic);
+    file.read(reinterpret_cast<char *>(&size), sizeof size);
+    if (not file or std::memcmp(magic, spectrum_magic, sizeof magic) not_eq 0 or size < 2) {
+        throw std::runtime_error(filename + " is not a spectrum file");
+    }
+    Spectrum spectrum{std::vector<double>(size), std::vector<double>(size), std::vector<double>(size)};
+    for (std::vector<double> *array : {&spectrum.wavelength, &spectrum.flux, &spectrum.cumulative}) {
+        file.read(reinterpret_cast<char *>(array->data()), static_cast<std::streamsize>(size * sizeof(double)));
+    }
+    if (not file) {
+        throw std::runtime_error(filename + " is truncated");
+    }
+    insert(name, std::move(spectrum));
+}
+
+auto SpectrumLibrary::contains(const std::string &name) const -> bool {
+    const std::lock_guard lock(mutex);
+    return spectra.contains(name);
+}
+
+auto SpectrumLibrary::photon_flux(const std::string &name,
+                                  const std::valarray<double> &lam_vac) -> std::valarray<double> {
+    const std::size_t num_wl = lam_vac.size();
+    if (num_wl == 0) {
+        throw std::invalid_argument("lam_vac is empty");
+    }
+    const std::lock_guard lock(mutex);
+    const Spectrum &spectrum = spectra.at(name);
+    CacheKey key{name, grid_hash(lam_vac)};
+    const auto it = cache_index.find(key);
+    if (it not_eq cache_index.end() and it->second->grid.size() == num_wl and
+        std::ranges::equal(it->second->grid, lam_vac)) {
+        cache.splice(cache.begin(), cache, it->second);
+        return it->second->weights;
+    }
+    std::valarray<double> weights(num_wl);
+    // The lower edge of the first bin is inclusive, so that a line at lam_vac.front() is not lost.
+    double lower = lam_vac[0] > spectrum.wavelength.front() ? integral_to(spectrum, lam_vac[0]) : 0;
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const double edge = j + 1 < num_wl ? (lam_vac[j] + lam_vac[j + 1]) / 2 : lam_vac[j];
+        const double upper = integral_to(spectrum, edge);
+        weights[j] = upper - lower;
+        lower = upper;
+    }
+    if (it not_eq cache_index.end()) {  // a hash collision replaces the older grid
+        cache.erase(it->second);
+        cache_index.erase(it);
+    }
+    if (cache_capacity == 0) {
+        return weights;
+    }
+    cache.emplace_front(std::move(key), lam_vac, std::move(weights));
+    cache_index.emplace(cache.front().key, cache.begin());
+    while (cache.size() > cache_capacity) {
+        cache_index.erase(cache.back().key);
+        cache.pop_back();
+    }
+    return cache.front().weights;
+}
+
+void SpectrumLibrary::set_cache_capacity(const std::size_t new_capacity) {
+    const std::lock_guard lock(mutex);
+    cache_capacity = new_capacity;
+    while (cache.size() > cache_capacity) {
+        cache_index.erase(cache.back().key);
+        cache.pop_back();
+    }
+}
+
+auto SpectrumLibrary::cache_size() const -> std::size_t {
+    const std::lock_guard lock(mutex);
+    return cache.size();
+}
+
+auto SpectrumLibrary::jsc(const std::valarray<double> &weights, const std::valarray<double> &A) -> double {
+    if (weights.size() not_eq A.size()) {
+        throw std::invalid_argument("weights and A must have the same size");
+    }
+    return q * (weights * A).sum();
+}
+
+/*
+ * Integral of the photon flux from the start of the spectrum to wavelength, exact for the piecewise-linear flux.
+ */
+auto SpectrumLibrary::integral_to(const Spectrum &spectrum, const double wavelength) -> double {
+    const std::vector<double> &x = spectrum.wavelength;
+    const std::size_t k = std::ranges::upper_bound(x, wavelength) - x.begin();  // first point after wavelength
+    if (k == 0) {
+        return 0;
+    }
+    if (k == x.size()) {
+        return spectrum.cumulative.back();
+    }
+    const double dx = wavelength - x.at(k - 1);
+    const double f0 = spectrum.flux.at(k - 1);
+    const double slope = (spectrum.flux.at(k) - f0) / (x.at(k) - x.at(k - 1));
+    return spectrum.cumulative.at(k - 1) + f0 * dx + slope * dx * dx / 2;
+}
+
+/*
+ * FNV-1a over the bytes of the grid
+ */
+auto SpectrumLibrary::grid_hash(const std::valarray<double> &lam_vac) -> std::size_t {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const double lambda : lam_vac) {
+        const auto bits = std::bit_cast<std::uint64_t>(lambda);
+        for (std::size_t byte = 0; byte < sizeof bits; byte++) {
+            hash ^= (bits >> (8 * byte)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return static_cast<std::size_t>(hash);
+}
+
+void SpectrumLibrary::insert(const std::string &name, Spectrum &&spectrum) {
+    const std::lock_guard lock(mutex);
+    spectra.insert_or_assign(name, std::move(spectrum));
+    // Drop the resampled weights of a replaced spectrum
+    std::erase_if(cache_index, [&name](const auto &entry) -> bool {
+        return entry.first.first == name;
+    });
+    std::erase_if(cache, [&name](const CacheEntry &entry) -> bool {
+        return entry.key.first == name;
+    });
+}
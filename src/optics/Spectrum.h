@@ -0,0 +1,108 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <valarray>
+#include <vector>
+
+/*
+ * Library of reference photon-flux spectra (e.g., "AM15" or a "laser" line, cf. light_source1 and light_source2 of
+ * ParameterClass) for Jsc and generation calculations over many devices.
+ * A spectrum is stored once as wavelength [nm] and photon flux [m-2 s-1 nm-1] together with its running integral,
+ * so the photon flux in any wavelength bin is obtained exactly (for the piecewise-linear spectrum) without
+ * re-interpolating the source data. Resampled weights are cached per (spectrum, wavelength grid), keyed by a hash of
+ * the grid, in an LRU of at most cache_capacity grids, and can be used directly as the photon_flux of
+ * generation_profile or the weights of jsc.
+ * A wavelength grid lam_vac (ascending) is binned at the midpoints of consecutive wavelengths, and the first and the
+ * last bins end at lam_vac.front() and lam_vac.back(), so the weights sum to the photon flux over the grid.
+ */
+class SpectrumLibrary {
+public:
+    static constexpr double h = 6.62607015e-34;  // Planck constant [J s]
+    static constexpr double c = 299792458;  // Speed of light [m s-1]
+    static constexpr double q = 1.602176634e-19;  // Elementary charge [C]
+
+    explicit SpectrumLibrary(std::size_t cache_capacity = 64);
+
+    /*
+     * Adds a spectrum from wavelength [nm] (ascending) and spectral irradiance [W m-2 nm-1].
+     */
+    void add_irradiance(const std::string &name, const std::vector<double> &wavelength,
+                        const std::vector<double> &irradiance);
+    /*
+     * Adds a monochromatic line (e.g., a laser at laser_lambda) of power [W m-2] at wavelength [nm].
+     * Its whole photon flux falls into the bin containing the wavelength.
+     */
+    void add_line(const std::string &name, double wavelength, double power);
+    /*
+     * Reads a CSV file of wavelength [nm] and spectral irradiance [W m-2 nm-1] columns; non-numeric rows (headers)
+     * are skipped.
+     */
+    void load_csv(const std::string &name, const std::string &filename);
+    /*
+     * Compact binary form: a "SUISSPEC" magic, the number of points, and the wavelength, photon flux, and running
+     * integral arrays as native doubles, so loading is a single read without parsing or integration.
+     */
+    void save_binary(const std::string &name, const std::string &filename) const;
+    void load_binary(const std::string &name, const std::string &filename);
+
+    [[nodiscard]] auto contains(const std::string &name) const -> bool;
+    /*
+     * Photon flux [m-2 s-1] in each bin of lam_vac, cached per wavelength grid.
+     */
+    auto photon_flux(const std::string &name, const std::valarray<double> &lam_vac) -> std::valarray<double>;
+    void set_cache_capacity(std::size_t new_capacity);
+    /*
+     * Number of cached (spectrum, wavelength grid) weights
+     */
+    [[nodiscard]] auto cache_size() const -> std::size_t;
+
+    /*
+     * Maximum achievable short-circuit current density q * sum_j weights[j] * A[j] [A m-2] for absorptance A.
+     */
+    [[nodiscard]] static auto jsc(const std::valarray<double> &weights, const std::valarray<double> &A) -> double;
+    /*
+     * Absorbed photon flux [m-2 s-1] in each layer, sum_j weights[j] * A_per_layer[i][j].
+     */
+    template<typename LAYERS_T>
+    [[nodiscard]] static auto absorbed_photon_flux(const std::valarray<double> &weights,
+                                                   const LAYERS_T &A_per_layer) -> std::valarray<double> {
+        std::valarray<double> flux(A_per_layer.size());
+        for (std::size_t i = 0; i < A_per_layer.size(); i++) {
+            flux[i] = (weights * A_per_layer[i]).sum();
+        }
+        return flux;
+    }
+
+private:
+    struct Spectrum {
+        std::vector<double> wavelength;
+        std::vector<double> flux;
+        std::vector<double> cumulative;  // trapezoidal running integral of flux
+    };
+
+    using CacheKey = std::pair<std::string, std::size_t>;  // (name, grid hash)
+
+    struct CacheEntry {
+        CacheKey key;
+        std::valarray<double> grid;  // kept to rule out hash collisions
+        std::valarray<double> weights;
+    };
+
+    [[nodiscard]] static auto integral_to(const Spectrum &spectrum, double wavelength) -> double;
+    [[nodiscard]] static auto grid_hash(const std::valarray<double> &lam_vac) -> std::size_t;
+    void insert(const std::string &name, Spectrum &&spectrum);
+
+    mutable std::mutex mutex;
+    std::map<std::string, Spectrum> spectra;
+    std::size_t cache_capacity;
+    std::list<CacheEntry> cache;  // most recently used first
+    std::map<CacheKey, std::list<CacheEntry>::iterator> cache_index;
+};
+
+#endif  // SPECTRUM_H
@@ -6,58 +6,32 @@
 #define SUISAPP_TRANSFERMATRIX_H
 
 #include <numbers>
+#include <optional>
 #include <ranges>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <variant>
 
 #include "tmm.h"
 #include "OpticStack.h"
+#include "RatCache.h"
+#include "RatKernels.h"
 
 /*
- * R: std::valarray<T>
- * A: std::valarray<T>
- * T: std::valarray<T>
- * A_per_layer: std::valarray<std::valarray<T>> (coh) / std::vector<std::valarray<T>> (inc)
- */
-template<typename T>
-using rat_dict = std::unordered_map<std::string, std::variant<std::valarray<T>, std::valarray<std::valarray<T>>,
-        std::vector<std::valarray<T>>>>;
-
-/*
- * Calculates the reflected, absorbed, and transmitted intensity of the structure
-    for the wavelengths and angles defined.
-
-    :param structure: A Structure object with layers and materials or a
-        OpticStack object.
-    :param wavelength: Wavelengths (in m) in which calculate the data. An array.
-    :param angle: Angle (in degrees) of the incident light.
-        Default: 0 (normal incidence).
-    :param pol: Polarization of the light: 's', 'p', or 'u'. Default: 'u' (unpolarized).
-    :param coherent: If the light is coherent or not. If not, a coherency list
-        must be added.
-    :param coherency_list: A list indicating in which layers light should be treated as
-        coherent ('c') and in which incoherent ('i'). It needs as many elements as
-        layers in the structure.
-    :param no_back_reflection: If reflection from the back must be suppressed.
-        Default=True.
-    :return: A dictionary with the R, A, and T at the specified wavelengths and angle.
+ * Translates the coherency list of calculate_rat into the layer types of inc_tmm, including the incidence medium,
+ * the substrate, and the extra incoherent layer of no_back_reflection.
  */
 template<typename U>
-rat_dict<typename std::remove_reference_t<U>::value_type> calculate_rat(std::unique_ptr<OpticStack<std::remove_reference_t<U>>> stack,
-                                                                        U &&wavelength,
-                                                                        double angle = 0,
-                                                                        char pol = 'u',
-                                                                        bool coherent = true,
-                                                                        const std::vector<char> &coherency_list = {}) {
-    using T = typename std::remove_reference_t<U>::value_type;
-    constexpr double degree = std::numbers::pi_v<typename std::remove_reference_t<U>::value_type> / 180;
-    std::valarray<LayerType> coherency_va(stack->num_mat_layers + 2);
+auto coherency_layer_types(const OpticStack<U> &stack, const bool coherent,
+                           const std::vector<char> &coherency_list) -> std::valarray<LayerType> {
+    std::valarray<LayerType> coherency_va(stack.num_mat_layers + 2);
     if (not coherent) {
         if (not coherency_list.empty()) {
-            if (coherency_list.size() not_eq stack->num_mat_layers) {
+            if (coherency_list.size() not_eq stack.num_mat_layers) {
                 const std::string error_info = "Error: The coherency list must have as many elements " +
                                                std::to_string(coherency_list.size()) +
-                                               " as the number of layers " + std::to_string(stack->num_mat_layers);
+                                               " as the number of layers " + std::to_string(stack.num_mat_layers);
                 throw std::runtime_error(error_info);
             }
             coherency_va[0] = LayerType::Incoherent;
@@ -69,10 +43,10 @@ rat_dict<typename std::remove_reference_t<U>::value_type> calculate_rat(std::uni
 #endif
                 coherency_va[i] = layer_type == 'c' ? LayerType::Coherent : LayerType::Incoherent;
             }
-            coherency_va[stack->num_mat_layers + 1] = LayerType::Incoherent;
-            if (stack->no_back_reflection) {
-                coherency_va.resize(stack->num_mat_layers + 3);
-                coherency_va[stack->num_mat_layers + 2] = LayerType::Incoherent;
+            coherency_va[stack.num_mat_layers + 1] = LayerType::Incoherent;
+            if (stack.no_back_reflection) {
+                coherency_va.resize(stack.num_mat_layers + 3);
+                coherency_va[stack.num_mat_layers + 2] = LayerType::Incoherent;
             }
         } else {
             const std::string error_info = "Error: For incoherent or partly incoherent calculations you must "
@@ -81,83 +55,198 @@ rat_dict<typename std::remove_reference_t<U>::value_type> calculate_rat(std::uni
             throw std::runtime_error(error_info);
         }
     }
-    rat_dict<T> rat_out;
+    return coherency_va;
+}
+
+/*
+ * Calculates the reflected, absorbed, and transmitted intensity of the structure
+    for the wavelengths and angles defined.
+
+    :param structure: A Structure object with layers and materials or a
+        OpticStack object.
+    :param wavelength: Wavelengths (in m) in which calculate the data. An array.
+    :param angle: Angle (in degrees) of the incident light.
+        Default: 0 (normal incidence).
+    :param pol: Polarization of the light: 's', 'p', or 'u'. Default: 'u' (unpolarized).
+    :param coherent: If the light is coherent or not. If not, a coherency list
+        must be added.
+    :param coherency_list: A list indicating in which layers light should be treated as
+        coherent ('c') and in which incoherent ('i'). It needs as many elements as
+        layers in the structure.
+    :param no_back_reflection: If reflection from the back must be suppressed.
+        Default=True.
+    :param num_threads: Number of threads over which the wavelength axis is split.
+        0 uses all hardware threads. Default: 1 (serial).
+    :param derivatives: If given, filled with the derivatives of R, T, and A_per_layer with respect to the thickness
+        and the index of every layer of a coherent stack (see calculate_rat_indices). Default: nullptr.
+    :tparam F: Floating-point type of the TMM calculation, e.g., calculate_rat<float>(...) for screening, where
+        single precision is accurate to ~1e-6 in R, A, and T (see test_coh_tmm_precision). Default (void): the
+        value type of the stack.
+    :return: A dictionary with the R, A, and T at the specified wavelengths and angle.
+ */
+template<typename F = void, typename U>
+rat_dict<std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>> calculate_rat(
+        std::unique_ptr<OpticStack<std::remove_reference_t<U>>> stack,
+        U &&wavelength,
+        double angle = 0,
+        char pol = 'u',
+        bool coherent = true,
+        const std::vector<char> &coherency_list = {},
+        std::size_t num_threads = 1,
+        CohTmmVecGradient<std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>> *derivatives = nullptr) {
+    using S = typename std::remove_reference_t<U>::value_type;
+    using T = std::conditional_t<std::is_void_v<F>, S, F>;
+    constexpr double degree = std::numbers::pi_v<double> / 180;
+    const std::valarray<LayerType> coherency_va = coherency_layer_types(*stack, coherent, coherency_list);
     std::valarray<T> lam_vac(wavelength.size());
     std::ranges::copy(wavelength, std::begin(lam_vac));
-    if (pol == 's' or pol == 'p') {
-        if (coherent) {
-            // Don't want to add a template for get_widths() to deal with std::vector<T> so just use the
-            // std::valarray<T> version of coh_tmm
-            const coh_tmm_vec_dict<T> out = coh_tmm(pol,
-                                                    stack->template get_indices<std::valarray<std::complex<T>>>(std::forward<U>(wavelength)),
-                                                    stack->template get_widths<std::valarray<T>>(),
-                                                    std::complex<T>(angle * degree),
-                                                    lam_vac);
-            rat_out.emplace("R", std::get<std::valarray<T>>(out.at("R")));
-            rat_out.emplace("T", std::get<std::valarray<T>>(out.at("T")));
-            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(out.at("R")) - std::get<std::valarray<T>>(out.at("T")));
-            rat_out.emplace("A_per_layer", absorp_in_each_layer(out));
-        } else {
-            const inc_tmm_vec_dict<double> out = inc_tmm(pol,
-                                                         stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength)),
-                                                         stack->template get_widths<std::valarray<T>>(),
-                                                         coherency_va,
-                                                         std::complex<T>(angle * degree),
-                                                         lam_vac);
-            rat_out.emplace("R", std::get<std::valarray<T>>(out.at("R")));
-            rat_out.emplace("T", std::get<std::valarray<T>>(out.at("T")));
-            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(out.at("R")) - std::get<std::valarray<T>>(out.at("T")));
-            rat_out.emplace("A_per_layer", inc_absorp_in_each_layer(out));
-        }
-    } else {
-        if (coherent) {
-            const coh_tmm_vecn_dict<double> out_p = coh_tmm('p',
-                                                            stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength)),
-                                                            stack->template get_widths<std::vector<T>>(),
-                                                            std::complex<T>(angle * degree),
-                                                            lam_vac);
-            const coh_tmm_vecn_dict<double> out_s = coh_tmm('s',
-                                                            stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength)),
-                                                            stack->template get_widths<std::vector<T>>(),
-                                                            std::complex<T>(angle * degree),
-                                                            lam_vac);
-            rat_out.emplace("R", (std::get<std::valarray<T>>(out_p.at("R")) + std::get<std::valarray<T>>(out_s.at("R"))) / 2);
-            rat_out.emplace("T", (std::get<std::valarray<T>>(out_p.at("T")) + std::get<std::valarray<T>>(out_s.at("T"))) / 2);
-            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(rat_out.at("R")) - std::get<std::valarray<T>>(rat_out.at("T")));
-            rat_out.emplace("A_per_layer", (absorp_in_each_layer(out_p) + absorp_in_each_layer(out_s)) / std::valarray<T>(2));
-            // A_per_layer_s and A_per_layer_p
-        } else {
-            const inc_tmm_vec_dict<double> out_p = inc_tmm('p',
-                                                           stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength)),
-                                                           stack->template get_widths<std::valarray<T>>(),
-                                                           coherency_va,
-                                                           std::complex<T>(angle * degree),
-                                                           lam_vac);
-            const inc_tmm_vec_dict<double> out_s = inc_tmm('s',
-                                                           stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength)),
-                                                           stack->template get_widths<std::valarray<T>>(),
-                                                           coherency_va,
-                                                           std::complex<T>(angle * degree),
-                                                           lam_vac);
-            rat_out.emplace("R", (std::get<std::valarray<T>>(out_p.at("R")) + std::get<std::valarray<T>>(out_s.at("R"))) / 2);
-            rat_out.emplace("T", (std::get<std::valarray<T>>(out_p.at("T")) + std::get<std::valarray<T>>(out_s.at("T"))) / 2);
-            rat_out.emplace("A", 1 - std::get<std::valarray<T>>(rat_out.at("R")) - std::get<std::valarray<T>>(rat_out.at("T")));
-            std::vector<std::valarray<T>> A_per_layer;
-#ifdef __cpp_lib_ranges_zip
-            for (const auto [p, s] : std::views::zip(inc_absorp_in_each_layer(out_p), inc_absorp_in_each_layer(out_s))) {
-#else
-            auto inc_s = inc_absorp_in_each_layer(out_s);
-            auto inc_p = inc_absorp_in_each_layer(out_p);
-            for (auto i = 0; i < inc_s.size(); ++i) {
-                auto s = inc_s[i];
-                auto p = inc_p[i];
-#endif
-                A_per_layer.emplace_back((p + s) / 2);
-            }
-            rat_out.emplace("A_per_layer", A_per_layer);
-        }
+    const std::vector<std::valarray<std::complex<S>>> stack_n_list = stack->template get_indices<std::vector<std::valarray<std::complex<S>>>>(std::forward<U>(wavelength));
+    const std::vector<S> stack_d_list = stack->template get_widths<std::vector<S>>();
+    std::vector<std::valarray<std::complex<T>>> n_list;
+    n_list.reserve(stack_n_list.size());
+    for (const std::valarray<std::complex<S>> &n : stack_n_list) {
+        std::valarray<std::complex<T>> &converted = n_list.emplace_back(n.size());
+        std::ranges::transform(n, std::begin(converted), [](const std::complex<S> z) -> std::complex<T> {
+            return {static_cast<T>(z.real()), static_cast<T>(z.imag())};
+        });
+    }
+    const std::vector<T> d_list(stack_d_list.begin(), stack_d_list.end());
+    if (num_threads == 0) {
+        num_threads = std::max(1U, std::thread::hardware_concurrency());
     }
+    return calculate_rat_parallel(n_list, d_list, coherency_va, std::complex<T>(static_cast<T>(angle * degree)),
+                                  lam_vac, pol, coherent, num_threads, derivatives);
+}
+
+/*
+ * calculate_rat in front of a RatCache: a stack whose materials (and their n/k data), thicknesses, coherency list,
+    angle, polarization, and wavelength grid were all evaluated before is served from the cache, so that sweeps over
+    the electrical parameters of a device do not recompute its optics. num_threads does not affect the result and
+    is not part of the key.
+
+    :param cache: The cache, e.g., RatCache<T>::instance().
+    :return: The same dictionary as calculate_rat.
+ */
+template<typename F = void, typename U>
+rat_dict<std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>> calculate_rat_cached(
+        RatCache<std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>> &cache,
+        std::unique_ptr<OpticStack<std::remove_reference_t<U>>> stack,
+        U &&wavelength,
+        double angle = 0,
+        char pol = 'u',
+        bool coherent = true,
+        const std::vector<char> &coherency_list = {},
+        std::size_t num_threads = 1) {
+    using T = std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>;
+    RatCacheKey key;
+    stack->append_cache_key(key);
+    key.append_range(wavelength);
+    key.append(angle);
+    key.append(pol);
+    key.append(coherent);
+    if (not coherent) {
+        key.append_range(coherency_list);
+    }
+    key.append(static_cast<std::uint32_t>(sizeof(T)));
+    if (std::optional<rat_dict<T>> cached = cache.find(key)) {
+        return *std::move(cached);
+    }
+    rat_dict<T> rat_out = calculate_rat<F>(std::move(stack), std::forward<U>(wavelength), angle, pol, coherent,
+                                           coherency_list, num_threads);
+    cache.insert(key, rat_out);
     return rat_out;
 }
 
+/*
+ * Batched calculate_rat for screening many devices, e.g., a material database, over a shared wavelength grid.
+    Each material used by any of the stacks is interpolated only once (see OpticStack::get_index_rows), and all the
+    stacks are evaluated in one tiled parallel pass (see calculate_rat_batch_indices) instead of one call each.
+
+    :param stacks: The stacks; they may differ in materials, thicknesses, and the number of layers.
+    :param coherency_lists: One coherency list per stack if not coherent; otherwise empty.
+    :param num_threads: Number of worker threads over the (stack, wavelength chunk) tiles.
+        0 uses all hardware threads. Default: 0.
+    :return: R, A, and T as a stack x wavelength tensor, and A_per_layer per stack; stack s equals
+        calculate_rat(stacks[s], wavelength, angle, pol, coherent, coherency_lists[s]).
+ */
+template<typename F = void, typename U>
+RatBatchResult<std::conditional_t<std::is_void_v<F>, typename std::remove_reference_t<U>::value_type, F>> calculate_rat_batch(
+        std::vector<std::unique_ptr<OpticStack<std::remove_reference_t<U>>>> stacks,
+        U &&wavelength,
+        double angle = 0,
+        char pol = 'u',
+        bool coherent = true,
+        const std::vector<std::vector<char>> &coherency_lists = {},
+        std::size_t num_threads = 0) {
+    using L = std::remove_reference_t<U>;
+    using S = typename L::value_type;
+    using T = std::conditional_t<std::is_void_v<F>, S, F>;
+    constexpr double degree = std::numbers::pi_v<double> / 180;
+    if (not coherent and coherency_lists.size() not_eq stacks.size()) {
+        throw std::invalid_argument("Incoherent calculations need one coherency list per stack");
+    }
+    std::valarray<T> lam_vac(wavelength.size());
+    std::ranges::copy(wavelength, std::begin(lam_vac));
+    std::vector<std::valarray<std::complex<S>>> stack_pool;
+    std::unordered_map<const OpticMaterial<L> *, std::size_t> rows_of;
+    std::vector<std::vector<std::size_t>> n_rows;
+    std::vector<std::vector<T>> d_lists;
+    std::vector<std::valarray<LayerType>> coherency_vas;
+    n_rows.reserve(stacks.size());
+    d_lists.reserve(stacks.size());
+    coherency_vas.reserve(stacks.size());
+    for (std::size_t s = 0; s < stacks.size(); s++) {
+        OpticStack<L> &stack = *stacks.at(s);
+        coherency_vas.emplace_back(coherency_layer_types(stack, coherent,
+                                                         coherent ? std::vector<char>{} : coherency_lists.at(s)));
+        n_rows.emplace_back(stack.get_index_rows(wavelength, stack_pool, rows_of));
+        const std::vector<S> stack_d_list = stack.template get_widths<std::vector<S>>();
+        d_lists.emplace_back(stack_d_list.begin(), stack_d_list.end());
+    }
+    std::vector<std::valarray<std::complex<T>>> n_pool;
+    n_pool.reserve(stack_pool.size());
+    for (const std::valarray<std::complex<S>> &n : stack_pool) {
+        std::valarray<std::complex<T>> &converted = n_pool.emplace_back(n.size());
+        std::ranges::transform(n, std::begin(converted), [](const std::complex<S> z) -> std::complex<T> {
+            return {static_cast<T>(z.real()), static_cast<T>(z.imag())};
+        });
+    }
+    if (num_threads == 0) {
+        num_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    return calculate_rat_batch_indices(n_pool, n_rows, d_lists, coherency_vas,
+                                       std::complex<T>(static_cast<T>(angle * degree)), lam_vac, pol, coherent,
+                                       num_threads);
+}
+
+/*
+ * Angle-resolved calculate_rat: calculates R, A, and T for every pair of angles x wavelength with the refractive
+    indices interpolated only once. Coherent stacks are evaluated in a single angle-vectorized coh_tmm pass.
+
+    :param angles: Angles (in degrees) of the incident light.
+    :return: One dictionary per angle, each the same as calculate_rat at that angle, i.e., R, A, and T indexed by
+        [wavelength] and A_per_layer by [layer][wavelength]; the result is thus indexed by
+        [angle][layer][wavelength] (see calculate_rat_angles_indices).
+ */
+template<typename U>
+std::vector<rat_dict<typename std::remove_reference_t<U>::value_type>> calculate_rat_angles(std::unique_ptr<OpticStack<std::remove_reference_t<U>>> stack,
+                                                                                            U &&wavelength,
+                                                                                            const std::valarray<double> &angles,
+                                                                                            char pol = 'u',
+                                                                                            bool coherent = true,
+                                                                                            const std::vector<char> &coherency_list = {}) {
+    using T = typename std::remove_reference_t<U>::value_type;
+    constexpr double degree = std::numbers::pi_v<typename std::remove_reference_t<U>::value_type> / 180;
+    const std::valarray<LayerType> coherency_va = coherency_layer_types(*stack, coherent, coherency_list);
+    std::valarray<T> lam_vac(wavelength.size());
+    std::ranges::copy(wavelength, std::begin(lam_vac));
+    const std::vector<std::valarray<std::complex<T>>> n_list = stack->template get_indices<std::vector<std::valarray<std::complex<T>>>>(std::forward<U>(wavelength));
+    const std::vector<T> d_list = stack->template get_widths<std::vector<T>>();
+    std::valarray<std::complex<T>> th_0(angles.size());
+    for (std::size_t a = 0; a < angles.size(); a++) {
+        th_0[a] = angles[a] * degree;
+    }
+    return calculate_rat_angles_indices(n_list, d_list, coherency_va, th_0, lam_vac, pol, coherent);
+}
+
 #endif  // SUISAPP_TRANSFERMATRIX_H
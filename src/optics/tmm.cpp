@@ -113,6 +113,7 @@ auto is_forward_angle(const std::complex<T> n, const std::complex<T> theta) -> b
 }
 
 template auto is_forward_angle(const std::complex<double> n, const std::complex<double> theta) -> bool;
+template auto is_forward_angle(const std::complex<float> n, const std::complex<float> theta) -> bool;
 
 /*
  * return angle theta in layer 2 with refractive index n_2, assuming
@@ -221,6 +222,7 @@ auto R_from_r(const std::complex<T> r) -> T {
 }
 
 template auto R_from_r(const std::complex<double> r) -> double;
+template auto R_from_r(const std::complex<float> r) -> float;
 
 /*
  * Calculate transmitted power T, starting with transmission amplitude t.
@@ -265,10 +267,11 @@ template<typename T>
 auto power_entering_from_r(const char pol, const std::complex<T> r, const std::complex<T> n_i,
                            const std::complex<T> th_i) -> T {
     if (pol == 's') {
-        return (n_i * std::cos(th_i) * (1.0 + std::conj(r)) * (1.0 - r)).real() / (n_i * std::cos(th_i)).real();
+        return (n_i * std::cos(th_i) * (static_cast<T>(1) + std::conj(r)) * (static_cast<T>(1) - r)).real() /
+               (n_i * std::cos(th_i)).real();
     }
     if (pol == 'p') {
-        return (n_i * std::conj(std::cos(th_i)) * (1.0 + r) * (1.0 - std::conj(r))).real() /
+        return (n_i * std::conj(std::cos(th_i)) * (static_cast<T>(1) + r) * (static_cast<T>(1) - std::conj(r))).real() /
                (n_i * std::conj(std::cos(th_i))).real();
     }
     throw std::invalid_argument("Polarization must be 's' or 'p'");
@@ -276,6 +279,8 @@ auto power_entering_from_r(const char pol, const std::complex<T> r, const std::c
 
 template auto power_entering_from_r(const char pol, const std::complex<double> r, const std::complex<double> n_i,
                                     const std::complex<double> th_i) -> double;
+template auto power_entering_from_r(const char pol, const std::complex<float> r, const std::complex<float> n_i,
+                                    const std::complex<float> th_i) -> float;
 
 /*
  * Fraction of light intensity reflected at an interface.
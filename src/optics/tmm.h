@@ -3,11 +3,17 @@
 
 #include <array>
 #include <complex>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string>
 #include <unordered_map>
 #include <valarray>
 #include <variant>
 #include <vector>
 
+#include "MatrixBatch.h"
+
 /*
  * r: std::complex<T>
  * t: std::complex<T>
@@ -132,6 +138,168 @@ using inc_tmm_vec_dict = std::unordered_map<std::string, std::variant<std::valar
         std::vector<coh_tmm_vecn_dict<T>>, std::vector<std::vector<T>>, std::vector<std::vector<std::size_t>>,
         std::vector<std::vector<std::valarray<std::complex<T>>>>, std::valarray<std::array<std::valarray<T>, 2>>>>;
 
+/*
+ * Output of calculate_rat (TransferMatrix.h)
+ * R: std::valarray<T>
+ * A: std::valarray<T>
+ * T: std::valarray<T>
+ * A_per_layer: std::valarray<std::valarray<T>> (coh) / std::vector<std::valarray<T>> (inc)
+ */
+template<typename T>
+using rat_dict = std::unordered_map<std::string, std::variant<std::valarray<T>, std::valarray<std::valarray<T>>,
+        std::vector<std::valarray<T>>>>;
+
+/*
+ * Fields of the vectorized coh_tmm that a caller reads, so that the work for the others can be skipped.
+ * RT: r, t, R, Tr, power_entering, and the per-layer n_list, th_list, and kz_list. The backward recursion of the
+ *     v/w amplitudes is skipped, and v_list and w_list are left empty.
+ * Absorption: RT plus absorp_list, the absorp_in_each_layer of the result, reduced from the amplitudes during the
+ *     recursion without storing them. v_list and w_list are left empty.
+ * Fields: everything, including v_list and w_list for position_resolved and the profiles.
+ */
+enum class CohTmmOutput {
+    RT,
+    Absorption,
+    Fields
+};
+
+/*
+ * Typed struct-of-arrays result of the vectorized coh_tmm.
+ * Every per-layer quantity is stored as one contiguous layer-major buffer of
+ * num_layers * num_wl elements, i.e., (layer i, wavelength j) is at i * num_wl + j,
+ * so that consumers can read any field by reference without std::get and copies.
+ * v_list and w_list replace the {v, w} pairs of the dictionary's vw_list;
+ * v_list[0] and w_list[0] are 0, and w_list[num_layers - 1] is 0 as well.
+ */
+template<typename T>
+struct CohTmmVecResult {
+    char pol = 's';
+    std::size_t num_layers = 0;
+    // Batch size of every per-wavelength field; equal to num_angles * lam_vac.size() of the input
+    std::size_t num_wl = 0;
+    // Number of incidence angles of an angle-vectorized calculation (see coh_tmm_angles); the batch is angle-major.
+    std::size_t num_angles = 1;
+    std::valarray<std::complex<T>> r;
+    std::valarray<std::complex<T>> t;
+    std::valarray<T> R;
+    std::valarray<T> Tr;
+    std::valarray<T> power_entering;
+    std::valarray<std::complex<T>> v_list;
+    std::valarray<std::complex<T>> w_list;
+    std::valarray<std::complex<T>> kz_list;
+    std::valarray<std::complex<T>> th_list;
+    std::valarray<std::complex<T>> n_list;
+    std::vector<T> d_list;
+    std::valarray<std::complex<T>> th_0;
+    std::valarray<T> lam_vac;
+    // Fields that were filled; see CohTmmOutput
+    CohTmmOutput output = CohTmmOutput::Fields;
+    // Only with CohTmmOutput::Absorption: the absorption in layer i at wavelength j at i * num_wl + j
+    std::valarray<T> absorp_list;
+
+    /*
+     * View of layer "layer" of a layer-major field such as kz_list, th_list, n_list, v_list, or w_list.
+     */
+    [[nodiscard]] auto layer(const std::valarray<std::complex<T>> &field,
+                             std::size_t i) const -> std::span<const std::complex<T>>;
+    /*
+     * Compatibility adapter for code that still consumes the dictionary form.
+     * th_0 is stored as std::valarray<std::complex<T>>. vw_list is omitted unless output is CohTmmOutput::Fields.
+     */
+    [[nodiscard]] auto to_dict() const -> coh_tmm_vecn_dict<T>;
+};
+
+/*
+ * Analytic derivatives of a coherent coh_tmm pass, computed in forward mode from the same matrix chain.
+ * Layer-major fields hold the derivative with respect to a parameter of layer p at wavelength j at p * num_wl + j:
+ * the thickness d (in the unit of d_list), or the real part n or the imaginary part k of the refractive index.
+ * Derivatives with respect to the semi-infinite media are not computed and are left 0.
+ * dA_dx[p] has the shape of absorp_in_each_layer, i.e., dA_dx[p][i][j] is the derivative of the absorption in
+ * layer i at wavelength j with respect to parameter x of layer p.
+ * Forward mode sweeps the chain once per parameter, so for L layers and W wavelengths a pass costs O(L^2 * W) time
+ * on top of the O(L * W) of coh_tmm, and dA_dd, dA_dn, and dA_dk hold 3 * L^2 * W values.
+ */
+template<typename T>
+struct CohTmmVecGradient {
+    std::size_t num_layers = 0;
+    std::size_t num_wl = 0;
+    std::valarray<T> dR_dd;
+    std::valarray<T> dR_dn;
+    std::valarray<T> dR_dk;
+    std::valarray<T> dT_dd;
+    std::valarray<T> dT_dn;
+    std::valarray<T> dT_dk;
+    std::vector<std::valarray<std::valarray<T>>> dA_dd;
+    std::vector<std::valarray<std::valarray<T>>> dA_dn;
+    std::vector<std::valarray<std::valarray<T>>> dA_dk;
+};
+
+/*
+ * Reusable scratch buffers of the vectorized coh_tmm, e.g., for optimization loops that call it millions of times.
+ * Every buffer is only resized when the number of layers or wavelengths changes, so calls that pass the same
+ * workspace and the same CohTmmVecResult with unchanged sizes do not allocate on the heap at all.
+ * A workspace must not be shared by concurrent calls.
+ */
+template<typename T>
+struct CohTmmWorkspace {
+    // Per layer over the wavelengths: cos(theta) and the clamped phase thicknesses of the interior layers
+    std::vector<std::valarray<std::complex<T>>> cos_th_list;
+    std::vector<std::valarray<std::complex<T>>> delta;
+    // Coefficients of the interfaces i -> i + 1
+    std::vector<std::valarray<std::complex<T>>> r_list;
+    std::vector<std::valarray<std::complex<T>>> t_list;
+    std::vector<ComplexMatrix2Batch<T>> M_list;
+    ComplexMatrix2Batch<T> Mtilde;
+    ComplexMatrix2Batch<T> A;
+    std::vector<T> vw;
+};
+
+/*
+ * Incremental coherent TMM for sweeping the thickness of one designated layer, e.g., in thickness optimizations.
+ * The characteristic matrices of the other layers do not depend on that thickness, so the chain is cached per
+ * wavelength as prefix = A_0 @ M_1 @ ... @ M_{layer - 1} and suffix = M_{layer + 1} @ ... @ M_{num_layers - 2}.
+ * set_thickness() then only rebuilds M_layer and multiplies it between the two, which costs O(num_wl) instead of
+ * O(num_layers * num_wl). v/w of the other layers, needed only by absorp_in_each_layer, are rebuilt lazily from
+ * cached partial products without any further exp or trigonometric evaluation.
+ */
+template<std::floating_point T>
+class CohTmmIncremental {
+public:
+    CohTmmIncremental(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                      std::complex<T> th_0, const std::valarray<T> &lam_vac, std::size_t layer);
+
+    /*
+     * Throws std::invalid_argument if d is negative, infinite, or NaN; the layer is left at its previous thickness.
+     */
+    void set_thickness(T d);
+    [[nodiscard]] auto thickness() const -> T;
+    [[nodiscard]] auto R() const -> const std::valarray<T> &;
+    [[nodiscard]] auto Tr() const -> const std::valarray<T> &;
+    /*
+     * The same result as coh_tmm at the current thickness, including v_list and w_list.
+     */
+    [[nodiscard]] auto result() -> const CohTmmVecResult<T> &;
+    [[nodiscard]] auto A_per_layer() -> std::valarray<std::valarray<T>>;
+
+private:
+    std::size_t layer;
+    CohTmmVecResult<T> state;
+    std::vector<std::valarray<std::complex<T>>> n_list;
+    // Interface coefficients of layer -> layer + 1
+    std::valarray<std::complex<T>> r_layer;
+    std::valarray<std::complex<T>> t_layer;
+    ComplexMatrix2Batch<T> M_layer;
+    ComplexMatrix2Batch<T> prefix;
+    ComplexMatrix2Batch<T> suffix;
+    // head[i] = M_i @ ... @ M_{layer - 1} for 0 < i < layer
+    std::vector<ComplexMatrix2Batch<T>> head;
+    // tail[i] = M_i @ ... @ M_{num_layers - 2} @ (1, 0) for layer < i < num_layers, as [re0 | im0 | re1 | im1]
+    std::vector<std::vector<T>> tail;
+    bool vw_valid = false;
+
+    void update_vw();
+};
+
 enum class LayerType { Coherent, Incoherent };
 
 /*
@@ -307,10 +475,119 @@ requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<
 auto coh_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
              const TH_T &th_0, const std::valarray<T> &lam_vac) -> coh_tmm_vecn_dict<T>;
 
+/*
+ * Same as above, but writes into a typed CohTmmVecResult instead of building a dictionary.
+ * The buffers of result are reused when their sizes already match.
+ * With output RT or Absorption, only the fields listed in CohTmmOutput are filled, e.g., for R/T sweeps.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             CohTmmOutput output = CohTmmOutput::Fields);
+
+/*
+ * Same as above, and additionally fills gradient with the analytic derivatives of R, T, and absorp_in_each_layer.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             CohTmmVecGradient<T> &gradient);
+
+/*
+ * Same as the CohTmmVecResult overload, with the scratch buffers taken from workspace.
+ * In steady state (same workspace, same result, same sizes) the call does not allocate.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             CohTmmWorkspace<T> &workspace, CohTmmOutput output = CohTmmOutput::Fields);
+
+/*
+ * Mixed-precision coh_tmm for callers that keep their data in T (e.g., float): n_list, d_list, th_0, and lam_vac are
+ * widened to ACC (e.g., double), the whole coh_tmm runs in ACC, and its result is rounded to T. This is a
+ * double-compute wrapper: it keeps the accuracy of ACC for thick or opaque layers, where the phases exceed 1e3 rad
+ * or the chain would overflow T, but it neither saves memory nor time over calling coh_tmm in ACC, as the widened
+ * inputs and every intermediate buffer are held in ACC. See test_coh_tmm_precision for the accuracy envelope.
+ */
+template<typename T, typename ACC, typename TH_T>
+requires (std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>) and
+         (sizeof(ACC) >= sizeof(T))
+void coh_tmm_mixed(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                   const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result);
+
+/*
+ * Fused unpolarized coh_tmm: list_snell, kz_list, cos(theta), and the phase thicknesses are computed once and shared
+ * by the 's' and 'p' passes, which write into result_s and result_p, respectively.
+ * The gradients are filled as well when gradient_s and gradient_p are given, which requires CohTmmOutput::Fields.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm_unpolarized(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                         const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result_s,
+                         CohTmmVecResult<T> &result_p, CohTmmVecGradient<T> *gradient_s = nullptr,
+                         CohTmmVecGradient<T> *gradient_p = nullptr, CohTmmOutput output = CohTmmOutput::Fields);
+
+/*
+ * Layer counts (including the semi-infinite media) for which coh_tmm_fixed is precompiled, e.g., the ETL, HTL, PVK,
+ * INT1, and INT2 layers of a device plus two electrodes between air and glass.
+ */
+inline constexpr std::size_t coh_tmm_fixed_min_layers = 3;
+inline constexpr std::size_t coh_tmm_fixed_max_layers = 10;
+
+/*
+ * coh_tmm for a stack of exactly N layers, filling the same fields of result as coh_tmm for output.
+ * Each wavelength is evaluated on its own with the layer loops unrolled at compile time and the characteristic
+ * matrices kept on the stack as FixedMatrix<std::complex<T>, 2, 2>, so nothing is allocated on the heap apart from
+ * sizing the fields of result (which are reused when their sizes already match). With CohTmmOutput::Absorption, the
+ * amplitudes of a wavelength are reduced to its absorp_list as they are propagated and never stored.
+ * n_list[i] views the refractive indices of layer i over lam_vac.
+ */
+template<std::size_t N, std::floating_point T>
+void coh_tmm_fixed(char pol, const std::array<std::span<const std::complex<T>>, N> &n_list,
+                   const std::array<T, N> &d_list, std::complex<T> th_0, const std::valarray<T> &lam_vac,
+                   CohTmmVecResult<T> &result, CohTmmOutput output = CohTmmOutput::Fields);
+
+/*
+ * Runs coh_tmm_fixed<n_list.size()> if n_list.size() is one of the precompiled layer counts and returns true;
+ * otherwise returns false without touching result, so that the caller can fall back to coh_tmm.
+ */
+template<std::floating_point T>
+auto coh_tmm_fixed_dispatch(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                            const std::vector<T> &d_list, std::complex<T> th_0, const std::valarray<T> &lam_vac,
+                            CohTmmVecResult<T> &result, CohTmmOutput output = CohTmmOutput::Fields) -> bool;
+
+/*
+ * Angle-vectorized coh_tmm: replicates n_list and lam_vac once per angle and evaluates every pair of th_0 x lam_vac
+ * in a single coh_tmm pass over the flattened batch, instead of calling coh_tmm once per angle. Nothing is shared
+ * between the angles beyond the call; the batch costs as much per element as coh_tmm and holds num_angles copies of
+ * n_list. n_list elements have the size of lam_vac. The batch of result is angle-major, i.e., element a * lam_vac.size() + j
+ * of every per-wavelength field corresponds to th_0[a] and lam_vac[j], and result.num_angles is th_0.size().
+ */
+template<std::floating_point T>
+void coh_tmm_angles(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                    const std::valarray<std::complex<T>> &th_0, const std::valarray<T> &lam_vac,
+                    CohTmmVecResult<T> &result);
+
 template<std::floating_point T>
 auto coh_tmm_reverse(char pol, const std::valarray<std::complex<T>> &n_list, const std::valarray<T> &d_list,
                      std::complex<T> th_0, const std::valarray<T> &lam_vac) -> coh_tmm_vec_dict<T>;
 
+/*
+ * coh_tmm of light incident from layer 0 into result and, as coh_tmm_reverse, of light incident from the last layer
+ * into reverse_result, whose layers are in reversed order. The reverse pass reuses the angles, kz, interface
+ * coefficients, and layer matrices of the forward one: r' and t' follow from Mtilde and the amplitudes from the
+ * inverse layer matrices, instead of a second coh_tmm on the reversed stack.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm_forward_reverse(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                             const std::vector<T> &d_list, const TH_T &th_0, const std::valarray<T> &lam_vac,
+                             CohTmmVecResult<T> &result, CohTmmVecResult<T> &reverse_result,
+                             CohTmmWorkspace<T> &workspace);
+
 template<typename T>
 auto ellips(const std::valarray<std::complex<T>> &n_list, const std::valarray<T> &d_list, std::complex<T> th_0,
             T lam_vac) -> std::unordered_map<std::string, T>;
@@ -336,6 +613,31 @@ template<typename T>
 auto position_resolved(std::size_t layer, const std::valarray<T> &distance,
                        const coh_tmm_vec_dict<T> &coh_tmm_data) -> std::unordered_map<std::string, std::variant<std::valarray<T>, std::valarray<std::complex<T>>>>;
 
+template<typename T>
+auto position_resolved(std::size_t layer, T distance,
+                       const CohTmmVecResult<T> &coh_tmm_data) -> std::unordered_map<std::string, std::variant<std::valarray<T>, std::valarray<std::complex<T>>>>;
+
+/*
+ * Fields of position_resolved at one depth of a layer over all wavelengths.
+ * For 's', Ex and Ez are 0; for 'p', Ey is 0 (a single 0 in the dictionary form).
+ */
+template<typename T>
+struct PositionResolvedVecResult {
+    std::valarray<T> poyn;
+    std::valarray<T> absor;
+    std::valarray<std::complex<T>> Ex;
+    std::valarray<std::complex<T>> Ey;
+    std::valarray<std::complex<T>> Ez;
+};
+
+/*
+ * Same as above, but writes into result, whose buffers are reused when their sizes already match, so sweeping the
+ * depth with the same result does not allocate.
+ */
+template<typename T>
+void position_resolved(std::size_t layer, T distance, const CohTmmVecResult<T> &coh_tmm_data,
+                       PositionResolvedVecResult<T> &result);
+
 template<typename T>
 auto find_in_structure(const std::valarray<T> &d_list,
                        const std::valarray<T> &dist) -> std::pair<std::valarray<typename std::iterator_traits<T *>::difference_type>, std::valarray<T>>;
@@ -356,6 +658,63 @@ auto absorp_in_each_layer(const coh_tmm_vec_dict<T> &coh_tmm_data) -> std::valar
 template<typename T>
 auto absorp_in_each_layer(const coh_tmm_vecn_dict<T> &coh_tmm_data) -> std::valarray<std::valarray<T>>;
 
+/*
+ * With CohTmmOutput::Absorption, unpacks absorp_list; with CohTmmOutput::RT, throws std::invalid_argument.
+ */
+template<typename T>
+auto absorp_in_each_layer(const CohTmmVecResult<T> &coh_tmm_data) -> std::valarray<std::valarray<T>>;
+
+/*
+ * Fused spectrally-integrated absorption profile, e.g., the generation rate G(x) on the drift-diffusion mesh.
+ * Returns G[m] = sum_j photon_flux[j] * a_j(x[m]), where a_j is the analytic absorption (the "absor" of
+ * position_resolved) at wavelength j, so G is in the unit of photon_flux per unit of d_list.
+ * photon_flux must already include the quadrature weights of lam_vac, e.g., the AM1.5 photon flux times d lambda.
+ * x is measured from the start of layer 1 in the unit of d_list; points outside the finite layers get 0.
+ * The four-exponential coefficients are evaluated per layer and wavelength and accumulated directly at the points in
+ * that layer, so memory is O(x.size()) instead of the O(x.size() * num_wl) of position_resolved.
+ */
+template<typename T>
+auto generation_profile(const CohTmmVecResult<T> &coh_tmm_data, const std::valarray<T> &photon_flux,
+                        const std::valarray<T> &x) -> std::valarray<T>;
+
+// Default tile of the map generators: the five fields of 32 points x 256 wavelengths take 512 KiB in double.
+inline constexpr std::size_t map_tile_z = 32;
+inline constexpr std::size_t map_tile_wl = 256;
+
+/*
+ * One tile of a position x wavelength map, covering the points [z_begin, z_begin + num_z) and the wavelengths
+ * [wl_begin, wl_begin + num_wl). Every field is point-major, i.e., (point z_begin + m, wavelength wl_begin + j) is at
+ * m * num_wl + j, and is only valid during the call of the sink; the buffers are reused for the next tile.
+ * Fields that a generator does not compute are empty.
+ */
+template<typename T>
+struct FieldMapTile {
+    std::size_t z_begin = 0;
+    std::size_t num_z = 0;
+    std::size_t wl_begin = 0;
+    std::size_t num_wl = 0;
+    std::span<const T> poyn;
+    std::span<const T> absor;
+    std::span<const std::complex<T>> Ex;
+    std::span<const std::complex<T>> Ey;
+    std::span<const std::complex<T>> Ez;
+};
+
+template<typename T>
+using FieldMapSink = std::function<void(const FieldMapTile<T> &)>;
+
+/*
+ * Tiled position_resolved over the points x and all wavelengths, streamed tile by tile to sink, e.g., into a file or
+ * a reduction over the wavelengths, so that the peak memory is O(tile_z * tile_wl) whatever the size of the map.
+ * x is measured from the start of layer 1 in the unit of d_list, as in generation_profile; a point on an interface
+ * belongs to the layer before it, points at or before 0 are in layer 0, and points beyond the finite layers are in the
+ * last layer. The tiles walk the wavelengths within each block of tile_z points.
+ */
+template<typename T>
+void position_resolved_map(const CohTmmVecResult<T> &coh_tmm_data, const std::valarray<T> &x,
+                           const FieldMapSink<T> &sink, std::size_t tile_z = map_tile_z,
+                           std::size_t tile_wl = map_tile_wl);
+
 template<typename T>
 auto inc_group_layers(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::valarray<T> &d_list,
                       const std::valarray<LayerType> &c_list) -> inc_tmm_vec_dict<T>;
@@ -369,6 +728,15 @@ auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list
              const std::valarray<LayerType> &c_list, std::complex<T> th_0,
              const std::valarray<T> &lam_vac) -> inc_tmm_vec_dict<T>;
 
+/*
+ * Same as above, with each coherent sub-stack evaluated in both directions by a single coh_tmm_forward_reverse in the
+ * scratch buffers of workspace, which can be reused across calls.
+ */
+template<std::floating_point T>
+auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::valarray<T> &d_list,
+             const std::valarray<LayerType> &c_list, std::complex<T> th_0, const std::valarray<T> &lam_vac,
+             CohTmmWorkspace<T> &workspace) -> inc_tmm_vec_dict<T>;
+
 template<typename T>
 auto inc_absorp_in_each_layer(const inc_tmm_dict<T> &inc_data) -> std::vector<T>;
 
@@ -384,8 +752,50 @@ auto inc_position_resolved(std::valarray<std::size_t> &&layer, const std::valarr
                            const std::valarray<std::valarray<T>> &alphas,
                            T zero_threshold = 1e-6) -> std::valarray<std::valarray<T>>;
 
+/*
+ * Tiled inc_position_resolved: the absorption of the same (layer, dist) points, streamed to sink in blocks of tile_z
+ * points with all wavelengths and only the absor field. The per-layer coefficients are computed once for the whole
+ * map, so that the tiles assemble into exactly the result of inc_position_resolved.
+ */
+template<typename T>
+void inc_position_resolved_map(const std::valarray<std::size_t> &layer, const std::valarray<T> &dist,
+                               const inc_tmm_vec_dict<T> &inc_tmm_data, const std::valarray<LayerType> &coherency_list,
+                               const std::valarray<std::valarray<T>> &alphas, const FieldMapSink<T> &sink,
+                               std::size_t tile_z = map_tile_z, T zero_threshold = 1e-6);
+
 template<typename T>
 auto beer_lambert(const std::valarray<T> &alphas, const std::valarray<T> &fraction, const std::valarray<T> &dist,
                   const std::valarray<T> &A_total) -> std::valarray<std::valarray<T>>;
 
+/*
+ * Beer-Lambert generation profile (the optical_model of ParameterClass) of a fixed mesh and spectrum, precomputed for
+ * both illumination sides so that a light-intensity change, e.g., at every step of a transient, is a scaling of the
+ * stored profile instead of a new sum of exponentials.
+ * x is the mesh measured from the start of the first layer, in the unit of d_list, which holds the thicknesses of the
+ * finite layers only; a point on an interface belongs to the layer before it, and points outside the layers get 0.
+ * alphas[l][j] is the absorption coefficient of layer l at wavelength j in the inverse unit of d_list, and
+ * photon_flux[j] the incident photon flux at wavelength j including its quadrature weight (see SpectrumLibrary).
+ * The generation at intensity 1 is G[m] = sum_j photon_flux[j] * t_l[j] * alphas[l][j] * exp(-alphas[l][j] * z_m),
+ * where z_m is the depth of point m into its layer l from the illuminated side and t_l[j] is the transmission
+ * exp(-alphas[k][j] * d_list[k]) accumulated over the layers k in front of l. The exponentials of all wavelengths of
+ * a point are evaluated at once by Utils::Math::exp_scaled.
+ */
+template<typename T>
+class BeerLambertGeneration {
+public:
+    BeerLambertGeneration(const std::valarray<T> &x, const std::vector<T> &d_list,
+                          const std::vector<std::valarray<T>> &alphas, const std::valarray<T> &photon_flux);
+
+    /*
+     * Generation at "intensity" times photon_flux, illuminated from the left (side false) or the right (side true),
+     * as for the side of ParameterClass. G is resized if necessary.
+     */
+    void generation(T intensity, bool side, std::valarray<T> &G) const;
+    [[nodiscard]] auto generation(T intensity, bool side) const -> std::valarray<T>;
+    [[nodiscard]] auto unit_generation(bool side) const -> const std::valarray<T> &;
+
+private:
+    std::array<std::valarray<T>, 2> unit;  // generation at intensity 1 from the left and from the right
+};
+
 #endif // TMM_H
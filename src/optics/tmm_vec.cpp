@@ -8,6 +8,7 @@
 #include <functional>
 #include <numbers>
 #include <numeric>
+#include <optional>
 #ifdef _MSC_VER  // Silence the warning from boost uBLAS
 #define _SILENCE_CXX17_ITERATOR_BASE_CLASS_DEPRECATION_WARNING
 #endif
@@ -16,12 +17,27 @@
 #include <boost/numeric/ublas/assignment.hpp>  // operator<<=
 #include <boost/numeric/ublas/matrix.hpp>
 #include <boost/numeric/ublas/vector.hpp>
+#include "FixedMatrix.h"
+#include "MatrixBatch.h"
 #include "tmm.h"
 #include "src/utils/Math.h"
 #include "src/utils/Range.h"
+#include "src/utils/VectorMath.h"
 
 using namespace std::complex_literals;
 
+namespace {
+    /*
+     * Resizes a buffer only if its size differs, so that reused results and workspaces keep their allocations.
+     */
+    template<typename C>
+    void fit(C &field, const std::size_t size) {
+        if (field.size() not_eq size) {
+            field.resize(size);
+        }
+    }
+}
+
 template<typename T>
 AbsorpAnalyticVecFn<T>::AbsorpAnalyticVecFn(const AbsorpAnalyticVecFn &other) : A3(other.A3), a1(other.a1),
                                                                                    a3(other.a3), A1(other.A1),
@@ -663,108 +679,70 @@ auto coh_tmm(const char pol, const std::valarray<std::complex<T>> &n_list, const
     std::ranges::transform(std::begin(delta) + num_wl, std::begin(delta) + (num_layers - 1) * num_wl, std::begin(delta) + num_wl, [](const std::complex<T> delta_i) {
         return delta_i.imag() > 100 ? delta_i.real() + 100i : delta_i;
     });
-    std::vector<std::vector<std::valarray<std::complex<T>>>> t_list(num_layers, std::vector<std::valarray<std::complex<T>>>(num_layers, std::valarray<std::complex<T>>(num_wl)));
-    std::vector<std::vector<std::valarray<std::complex<T>>>> r_list(num_layers, std::vector<std::valarray<std::complex<T>>>(num_layers, std::valarray<std::complex<T>>(num_wl)));
+    // Only the adjacent interfaces i -> i + 1 exist, so t_list and r_list hold num_layers - 1 contiguous blocks of
+    // num_wl coefficients, interface-major, instead of a num_layers x num_layers table.
+    std::valarray<std::complex<T>> t_list((num_layers - 1) * num_wl);
+    std::valarray<std::complex<T>> r_list((num_layers - 1) * num_wl);
     for (std::size_t i = 0; i < num_layers - 1; i++) {
+        const std::slice interface(i * num_wl, num_wl, 1);
 #ifdef _MSC_VER
-        t_list.at(i).at(i + 1) = interface_t(pol, n_list[std::slice(i * num_wl, num_wl, 1)],
-                                             n_list[std::slice((i + 1) * num_wl, num_wl, 1)],
-                                             th_list[std::slice(i * num_wl, num_wl, 1)],
-                                             th_list[std::slice((i + 1) * num_wl, num_wl, 1)]);
-        r_list.at(i).at(i + 1) = interface_r(pol, n_list[std::slice(i * num_wl, num_wl, 1)],
-                                             n_list[std::slice((i + 1) * num_wl, num_wl, 1)],
-                                             th_list[std::slice(i * num_wl, num_wl, 1)],
-                                             th_list[std::slice((i + 1) * num_wl, num_wl, 1)]);
+        t_list[interface] = interface_t(pol, n_list[std::slice(i * num_wl, num_wl, 1)],
+                                        n_list[std::slice((i + 1) * num_wl, num_wl, 1)],
+                                        th_list[std::slice(i * num_wl, num_wl, 1)],
+                                        th_list[std::slice((i + 1) * num_wl, num_wl, 1)]);
+        r_list[interface] = interface_r(pol, n_list[std::slice(i * num_wl, num_wl, 1)],
+                                        n_list[std::slice((i + 1) * num_wl, num_wl, 1)],
+                                        th_list[std::slice(i * num_wl, num_wl, 1)],
+                                        th_list[std::slice((i + 1) * num_wl, num_wl, 1)]);
 #else
-        t_list.at(i).at(i + 1) = interface_t(pol, std::valarray<std::complex<T>>(n_list[std::slice(i * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(n_list[std::slice((i + 1) * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(th_list[std::slice(i * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(th_list[std::slice((i + 1) * num_wl, num_wl, 1)]));
-        r_list.at(i).at(i + 1) = interface_r(pol, std::valarray<std::complex<T>>(n_list[std::slice(i * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(n_list[std::slice((i + 1) * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(th_list[std::slice(i * num_wl, num_wl, 1)]),
-                                             std::valarray<std::complex<T>>(th_list[std::slice((i + 1) * num_wl, num_wl, 1)]));
+        t_list[interface] = interface_t(pol, std::valarray<std::complex<T>>(n_list[std::slice(i * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(n_list[std::slice((i + 1) * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(th_list[std::slice(i * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(th_list[std::slice((i + 1) * num_wl, num_wl, 1)]));
+        r_list[interface] = interface_r(pol, std::valarray<std::complex<T>>(n_list[std::slice(i * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(n_list[std::slice((i + 1) * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(th_list[std::slice(i * num_wl, num_wl, 1)]),
+                                        std::valarray<std::complex<T>>(th_list[std::slice((i + 1) * num_wl, num_wl, 1)]));
 #endif
     }
-    // boost::numeric::ublas::tensor<std::complex<T>, boost::numeric::ublas::last_order> M_list(boost::numeric::ublas::shape{num_layers, num_wl, 2, 2});
-    // boost 1.74.0 or to 1.81.0 does not accept the following code:
-    // /usr/include/boost/numeric/ublas/storage.hpp:79:30: error: ‘class std::allocator<std::complex<double> >’ has no member named ‘construct’
-    //   79 |                       alloc_.construct(d, value_type());
-    //      |                       ~~~~~~~^~~~~~~~~
-    // We have to initialize by zero_matrix if not setting every value.
-    // The default matrix constructor does not initialize to 0 + 0i but around 1e-6 + 1e-6i
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> M_list(boost::numeric::ublas::zero_matrix<std::complex<T>>(2, 2), num_elems);
-    for (std::size_t i = 1; i < num_layers - 1; i++) {
-        // Array Layout j=\sum_{r=1}^p{i_r\cdot w_r} with 1\leq i_r\leq n_r for 1\leq r\leq p.
-        // First-order layout: w1 = 1, wk = nk-1 * wk-1 => j = i1 + i2n1 + i3n1n2 + ... + ipn1n2...np-1
-        // Last-order layout: wp = 1, wk = nk+1 * wk+1 => j = i1n2...np + i2n3...np + ... + ip-1np + ip
-        // For C-style 2D array, a[i][j] = a[i * num_cols + j] (stored by rows), i.e., j = i1n2 + i2 (last-order).
-        // (two dimensions) format_t | column_major | first-order | MATLAB/Fortran
-        // (two dimensions) format_t | row_major    | last-order  | C/C++
-        // Default storage_type: std::vector<value_t>
-        // boost::numeric::ublas::tensor<std::complex<T>, boost::numeric::ublas::last_order> A(boost::numeric::ublas::shape{num_wl, 2, 2});
-        // boost::numeric::ublas::tensor<std::complex<T>, boost::numeric::ublas::last_order> B(boost::numeric::ublas::shape{num_wl, 2, 2});
-        // Unfortunately, <boost/numeric/ublas/assignment.hpp> operator<<= only supports vector and matrix.
-        // Note on at() method: for a 3D tensor T, T.at(0, 0), T.at(0, 1), T.at(1, 0), and T.at(1, 1) are
-        // T.at(0, 0, 0), T.at(0, 1, 0), T.at(1, 0, 0), and T.at(1, 1, 0)
-        // Unfortunately, boost ublas tensor does not support range or slice of a tensor,
-        // which makes it extremely difficult to use.
-        std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> A(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-        std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> B(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-        for (std::size_t j = 0; j < num_wl; j++) {
-            A[j](0, 0) = std::exp(-1i * delta[i * num_wl + j]);
-            A[j](0, 1) = 0;
-            A[j](1, 0) = 0;
-            A[j](1, 1) = std::exp(1i * delta[i * num_wl + j]);
-            B[j](0, 0) = 1;
-            B[j](0, 1) = r_list.at(i).at(i + 1)[j];
-            B[j](1, 0) = r_list.at(i).at(i + 1)[j];
-            B[j](1, 1) = 1;
-            M_list[i * num_wl + j] = boost::numeric::ublas::prod(A[j], B[j]) / t_list.at(i).at(i + 1)[j];
-        }
-        // The matrix multiplication of a matrix M1 and a matrix M2 is einsum('...ij,...jk', A, B)
-        // where ellipses are used to enable and control broadcasting.
-    }
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> Mtilde(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-    // https://stackoverflow.com/questions/48821973/constant-matrix-with-boost-ublas
-    for (std::size_t i = 0; i < num_wl; i++) {
-        Mtilde[i] <<= 1, 0,
-                      0, 1;
-    }
+    // M_list[i] is the batch of the characteristic matrices of layer i over all wavelengths.
+    // The matrix multiplication of a matrix M1 and a matrix M2 is einsum('...ij,...jk', A, B)
+    // where ellipses are used to enable and control broadcasting.
+    std::vector<ComplexMatrix2Batch<T>> M_list(num_layers);
+    ComplexMatrix2Batch<T> Mtilde(num_wl);
+    Mtilde.set_identity();
     for (std::size_t i = 1; i < num_layers - 1; i++) {
-        for (std::size_t j = 0; j < num_wl; j++) {
-            Mtilde[j] = boost::numeric::ublas::prod(Mtilde[j], M_list[i * num_wl + j]);
-        }
-    }
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> A(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-    for (std::size_t i = 0; i < num_wl; i++) {
-        A[i] <<= 1                          , r_list.at(0).at(1)[i],
-                 r_list.at(0).at(1)[i], 1;
-        Mtilde[i] = boost::numeric::ublas::prod(A[i], Mtilde[i]) / t_list.at(0).at(1)[i];
-    }
+        M_list.at(i).resize(num_wl);
+        M_list.at(i).set_layer({std::begin(delta) + i * num_wl, num_wl}, {std::begin(r_list) + i * num_wl, num_wl},
+                               {std::begin(t_list) + i * num_wl, num_wl});
+        Mtilde.right_multiply(M_list.at(i));
+    }
+    ComplexMatrix2Batch<T> A(num_wl);
+    A.set_interface({std::begin(r_list), num_wl}, {std::begin(t_list), num_wl});
+    Mtilde.left_multiply(A);
     std::valarray<std::complex<T>> r(num_wl);
     std::valarray<std::complex<T>> t(num_wl);
     for (std::size_t i = 0; i < num_wl; i++) {
-        r[i] = Mtilde[i](1, 0) / Mtilde[i](0, 0);
-        t[i] = 1.0 / Mtilde[i](0, 0);
+        r[i] = Mtilde.get(2, i) / Mtilde.get(0, i);
+        t[i] = static_cast<T>(1) / Mtilde.get(0, i);
     }
     // boost::multi_array<std::complex<T>, 3> vw_list(boost::extents[num_layers][num_wl][2]);
     // It is not necessary to use <boost/multi_array.hpp> here.
     std::valarray<std::vector<std::array<std::complex<T>, 2>>> vw_list(std::vector<std::array<std::complex<T>, 2>>(num_wl), num_layers);
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> vw(boost::numeric::ublas::zero_matrix<std::complex<T>>(2, 2), num_wl);
+    // Both columns of vw start as {t, 0} and stay equal, so only one column is propagated,
+    // as vw = [re(v) | im(v) | re(w) | im(w)].
+    std::vector<T> vw(4 * num_wl);
     for (std::size_t i = 0; i < num_wl; i++) {
-        vw[i](0, 0) = t[i];
-        vw[i](0, 1) = t[i];
-    }
-    for (std::size_t i = 0; i < num_wl; i++) {
-        vw_list[num_layers - 1].at(i).at(0) = vw[i](0, 0);
-        vw_list[num_layers - 1].at(i).at(1) = vw[i](0, 1);
+        vw.at(i) = t[i].real();
+        vw.at(num_wl + i) = t[i].imag();
+        vw_list[num_layers - 1].at(i).at(0) = t[i];
+        vw_list[num_layers - 1].at(i).at(1) = t[i];
     }
     for (std::size_t i = num_layers - 2; i > 0; --i) {
+        M_list.at(i).apply(vw);
         for (std::size_t j = 0; j < num_wl; j++) {
-            vw[j] = boost::numeric::ublas::prod(M_list[i * num_wl + j], vw[j]);
-            vw_list[i].at(j).at(0) = vw[j](0, 1);
-            vw_list[i].at(j).at(1) = vw[j](1, 1);
+            vw_list[i].at(j).at(0) = {vw.at(j), vw.at(num_wl + j)};
+            vw_list[i].at(j).at(1) = {vw.at(2 * num_wl + j), vw.at(3 * num_wl + j)};
         }
     }
     // It should be better if using plain for-loop.
@@ -816,10 +794,53 @@ template auto coh_tmm(char pol, const std::valarray<std::complex<double>> &n_lis
                       const std::valarray<double> &d_list, const std::complex<double> &th_0,
                       const std::valarray<double> &lam_vac) -> coh_tmm_vec_dict<double>;
 
+template<typename T>
+auto CohTmmVecResult<T>::layer(const std::valarray<std::complex<T>> &field,
+                               const std::size_t i) const -> std::span<const std::complex<T>> {
+    return {std::begin(field) + i * num_wl, num_wl};
+}
+
+template<typename T>
+auto CohTmmVecResult<T>::to_dict() const -> coh_tmm_vecn_dict<T> {
+    std::valarray<std::vector<std::array<std::complex<T>, 2>>> vw_list(std::vector<std::array<std::complex<T>, 2>>(num_wl), num_layers);
+    std::vector<std::valarray<std::complex<T>>> kz_list_n;
+    std::vector<std::valarray<std::complex<T>>> th_list_n;
+    std::vector<std::valarray<std::complex<T>>> n_list_n;
+    const bool has_amplitudes = output == CohTmmOutput::Fields;
+    for (std::size_t i = 0; i < num_layers and has_amplitudes; i++) {
+        for (std::size_t j = 0; j < num_wl; j++) {
+            vw_list[i].at(j) = {v_list[i * num_wl + j], w_list[i * num_wl + j]};
+        }
+    }
+    for (std::size_t i = 0; i < num_layers; i++) {
+        kz_list_n.emplace_back(kz_list[std::slice(i * num_wl, num_wl, 1)]);
+        th_list_n.emplace_back(th_list[std::slice(i * num_wl, num_wl, 1)]);
+        n_list_n.emplace_back(n_list[std::slice(i * num_wl, num_wl, 1)]);
+    }
+    coh_tmm_vecn_dict<T> coh_tmm_data{{"r", r},
+                                      {"t", t},
+                                      {"R", R},
+                                      {"T", Tr},
+                                      {"power_entering", power_entering},
+                                      {"kz_list", std::move(kz_list_n)},
+                                      {"th_list", std::move(th_list_n)},
+                                      {"pol", pol},
+                                      {"n_list", std::move(n_list_n)},
+                                      {"d_list", d_list},
+                                      {"th_0", th_0},
+                                      {"lam_vac", lam_vac}};
+    if (has_amplitudes) {
+        coh_tmm_data.insert_or_assign("vw_list", std::move(vw_list));
+    }
+    return coh_tmm_data;
+}
+
+template struct CohTmmVecResult<double>;
+
 template<typename T, typename TH_T>
 requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
-auto coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
-             const TH_T &th_0, const std::valarray<T> &lam_vac) -> coh_tmm_vecn_dict<T> {
+void coh_tmm_check_inputs(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                          const TH_T &th_0, const std::valarray<T> &lam_vac) {
     const std::size_t num_wl = lam_vac.size();
     const std::size_t num_layers = n_list.size();
     if constexpr (std::is_same_v<TH_T, std::valarray<std::complex<T>>>) {
@@ -835,7 +856,6 @@ auto coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
         throw std::invalid_argument("d_list must start and end with inf!");
     }
 #if (defined __GNUC__ && __GNUC__ < 13)
-    std::valarray<T> test_va(num_wl);
     for (std::size_t i = 0; i < num_wl; ++i) {
         if constexpr (std::same_as<TH_T, std::complex<T>>) {
             if (std::abs(std::imag(n_list.front()[i] * std::sin(th_0))) > Utils::Math::TOL * Utils::Math::EPSILON<T>) {
@@ -848,133 +868,1116 @@ auto coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
         }
     }
 #else
-#ifdef _MSC_VER
-    if (std::ranges::any_of(n_list.front() * std::sin(th_0) |
-#else
-    if (std::ranges::any_of(std::valarray<std::complex<T>>(n_list.front() * std::sin(th_0)) |
-#endif
-                            std::views::transform(std::bind_front<T (*)(const std::complex<T> &)>(std::imag)),
+    // Element by element, so that the check does not allocate a temporary n_list.front() * std::sin(th_0)
+    const auto imag_n_sin = [&n_list, &th_0](const std::size_t i) -> T {
+        if constexpr (std::same_as<TH_T, std::complex<T>>) {
+            return std::imag(n_list.front()[i] * std::sin(th_0));
+        } else {
+            return std::imag(n_list.front()[i] * std::sin(th_0[i]));
+        }
+    };
+    if (std::ranges::any_of(std::views::iota(0UZ, n_list.front().size()) | std::views::transform(imag_n_sin),
             // Note the order of front-binding!
                             std::bind_front(std::less_equal<>(), Utils::Math::TOL * Utils::Math::EPSILON<T>))) {
         throw std::invalid_argument("Error in n0 or th0!");
     }
 #endif
-    std::vector<std::valarray<std::complex<T>>> th_list = list_snell(n_list, th_0);
-    std::valarray<std::complex<T>> comp_lam_vac(num_wl);
-    std::ranges::transform(lam_vac, std::begin(comp_lam_vac), [](const T real) -> std::complex<T> {
-        return real;
-    });
-    std::vector<std::valarray<std::complex<T>>> kz_list(num_layers, std::valarray<std::complex<T>>(num_wl));
-    for (std::size_t i : std::views::iota(0U, num_layers)) {
-        kz_list.at(i) = 2 * std::numbers::pi_v<T> * n_list.at(i) * std::cos(th_list.at(i)) / comp_lam_vac;
+}
+
+/*
+ * Polarization-independent part of coh_tmm: fills n_list, th_list, kz_list, d_list, th_0, and lam_vac of result,
+ * and the per-layer cos(theta) and the clamped phase thicknesses delta of the interior layers of workspace.
+ * Snell's law, cos(theta), and kz are evaluated wavelength by wavelength straight into the buffers, which are only
+ * resized when the sizes change.
+ */
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm_prepare(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                     const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+                     CohTmmWorkspace<T> &workspace) {
+    const std::size_t num_wl = lam_vac.size();
+    const std::size_t num_layers = n_list.size();
+    const std::size_t num_elems = num_layers * num_wl;
+    if constexpr (std::is_same_v<TH_T, std::valarray<std::complex<T>>>) {
+        if (th_0.size() not_eq num_wl) {
+            throw std::runtime_error("n_list elements' size mismatches th_0's size.");
+        }
     }
-    std::valarray<std::complex<T>> comp_d_list(num_layers);
-    std::ranges::transform(d_list, std::begin(comp_d_list), [](const T real) -> std::complex<T> {
-        return real;
-    });
-    std::vector<std::valarray<std::complex<T>>> delta(num_layers, std::valarray<std::complex<T>>(num_wl));
+    result.num_angles = 1;
+    result.num_layers = num_layers;
+    result.num_wl = num_wl;
+    fit(result.n_list, num_elems);
+    fit(result.th_list, num_elems);
+    fit(result.kz_list, num_elems);
+    fit(result.th_0, num_wl);
+    fit(result.lam_vac, num_wl);
+    // n_0 * sin(th_0), the invariant of Snell's law
+    const auto n_sin_th_0 = [&n_list, &th_0](const std::size_t j) -> std::complex<T> {
+        if constexpr (std::is_same_v<TH_T, std::complex<T>>) {
+            return n_list.front()[j] * std::sin(th_0);
+        } else {
+            return n_list.front()[j] * std::sin(th_0[j]);
+        }
+    };
+    workspace.cos_th_list.resize(num_layers);
+    workspace.delta.resize(num_layers);
+    bool opaque_warned = false;
     for (std::size_t i = 0; i < num_layers; i++) {
-        delta.at(i) = kz_list.at(i) * comp_d_list[i];
-    }
-    for (std::size_t i : std::views::iota(1U, num_layers - 1)) {
-        if (std::ranges::any_of(delta.at(i), [](const std::complex<T> delta_i) -> bool {
-            return delta_i.imag() > 35;
-        })) {
-            std::ranges::transform(delta.at(i), std::begin(delta.at(i)), [](const std::complex<T> delta_i) {
-                return delta_i.real() + 35i;
-            });
-            try {
-                throw std::runtime_error("Warning: Layers that are almost perfectly opaque "
-                                         "are modified to be slightly transmissive, "
-                                         "allowing 1 photon in 10^30 to pass through. It's "
-                                         "for numerical stability. This warning will not "
-                                         "be shown again.");
-            } catch (const std::runtime_error &coh_value_warning) {
-                std::cerr << coh_value_warning.what() << '\n';
+        const std::valarray<std::complex<T>> &n = n_list.at(i);
+        std::valarray<std::complex<T>> &cos_th = workspace.cos_th_list.at(i);
+        std::valarray<std::complex<T>> &delta = workspace.delta.at(i);
+        fit(cos_th, num_wl);
+        fit(delta, num_wl);
+        // Only the angles in the semi-infinite media need to be flipped to the forward direction (see list_snell).
+        const bool semi_infinite = i == 0 or i == num_layers - 1;
+        for (std::size_t j = 0; j < num_wl; j++) {
+            std::complex<T> th = std::asin(n_sin_th_0(j) / n[j]);
+            if (semi_infinite and not is_forward_angle(n[j], th)) {
+                th = std::numbers::pi_v<T> - th;
             }
+            cos_th[j] = std::cos(th);
+            const std::complex<T> kz = 2 * std::numbers::pi_v<T> * n[j] * cos_th[j] / std::complex<T>(lam_vac[j]);
+            result.n_list[i * num_wl + j] = n[j];
+            result.th_list[i * num_wl + j] = th;
+            result.kz_list[i * num_wl + j] = kz;
+            // delta is only needed by the interior layers, where it is clamped.
+            delta[j] = semi_infinite ? std::complex<T>() : kz * std::complex<T>(d_list.at(i));
+            if (delta[j].imag() > 35) {
+                delta[j] = {delta[j].real(), 35};
+                opaque_warned = true;
+            }
+        }
+    }
+    if (opaque_warned) {
+        try {
+            throw std::runtime_error("Warning: Layers that are almost perfectly opaque "
+                                     "are modified to be slightly transmissive, "
+                                     "allowing 1 photon in 10^30 to pass through. It's "
+                                     "for numerical stability. This warning will not "
+                                     "be shown again.");
+        } catch (const std::runtime_error &coh_value_warning) {
+            std::cerr << coh_value_warning.what() << '\n';
         }
     }
-    std::vector<std::vector<std::valarray<std::complex<T>>>> t_list(num_layers, std::vector<std::valarray<std::complex<T>>>(num_layers, std::valarray<std::complex<T>>(num_wl)));
-    std::vector<std::vector<std::valarray<std::complex<T>>>> r_list(num_layers, std::vector<std::valarray<std::complex<T>>>(num_layers, std::valarray<std::complex<T>>(num_wl)));
+    result.th_0 = th_0;  // filled with a scalar th_0 or copied in place, as the sizes match
+    result.d_list.assign(d_list.begin(), d_list.end());
+    result.lam_vac = lam_vac;
+}
+
+/*
+ * Interface coefficients r_list[i] and t_list[i] of the interfaces i -> i + 1 of polarization pol.
+ * Same formulas as interface_r and interface_t, but with the cos(theta) shared by both polarizations.
+ * r_list and t_list are only resized when the sizes change.
+ */
+template<typename T>
+void coh_tmm_interfaces(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                        const std::vector<std::valarray<std::complex<T>>> &cos_th_list,
+                        std::vector<std::valarray<std::complex<T>>> &r_list,
+                        std::vector<std::valarray<std::complex<T>>> &t_list) {
+    if (pol not_eq 's' and pol not_eq 'p') {
+        throw std::invalid_argument("Polarization must be 's' or 'p'");
+    }
+    const std::size_t num_layers = n_list.size();
+    const std::size_t num_wl = n_list.front().size();
+    r_list.resize(num_layers - 1);
+    t_list.resize(num_layers - 1);
     for (std::size_t i = 0; i < num_layers - 1; i++) {
-        t_list.at(i).at(i + 1) = interface_t(pol, n_list.at(i), n_list.at(i + 1), th_list.at(i), th_list.at(i + 1));
-        r_list.at(i).at(i + 1) = interface_r(pol, n_list.at(i), n_list.at(i + 1), th_list.at(i), th_list.at(i + 1));
+        fit(r_list.at(i), num_wl);
+        fit(t_list.at(i), num_wl);
+        for (std::size_t j = 0; j < num_wl; j++) {
+            const std::complex<T> ii = n_list.at(i)[j] * cos_th_list.at(i)[j];
+            if (pol == 's') {
+                const std::complex<T> ff = n_list.at(i + 1)[j] * cos_th_list.at(i + 1)[j];
+                const std::complex<T> denominator = ii + ff;
+                r_list.at(i)[j] = (ii - ff) / denominator;
+                t_list.at(i)[j] = static_cast<T>(2) * ii / denominator;
+            } else {
+                const std::complex<T> fi = n_list.at(i + 1)[j] * cos_th_list.at(i)[j];
+                const std::complex<T> if_ = n_list.at(i)[j] * cos_th_list.at(i + 1)[j];
+                const std::complex<T> denominator = fi + if_;
+                r_list.at(i)[j] = (fi - if_) / denominator;
+                t_list.at(i)[j] = static_cast<T>(2) * ii / denominator;
+            }
+        }
     }
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> M_list(boost::numeric::ublas::zero_matrix<std::complex<T>>(2, 2), num_layers * num_wl);
+}
+
+/*
+ * Forward-mode derivatives of R, T, and absorp_in_each_layer of a coh_tmm_chain pass with respect to the thickness
+ * and the complex refractive index of every finite layer.
+ * With C_0 = A and C_i = M_list[i], u_i = C_i @ ... @ C_{num_layers - 2} @ (1, 0), so that t = 1 / u_0[0],
+ * r = u_0[1] * t, and {v_i, w_i} = t * u_i. A parameter of layer k only changes C_{k - 1} and C_k, so
+ * du_i = C_i @ du_{i + 1} + dC_i @ u_{i + 1} is swept from i = k down to 0 and is 0 above k.
+ * Everything in the chain is holomorphic in the index, so du is computed once per layer and scaled by the
+ * direction (1 for n, 1j for k) before the non-holomorphic |.|^2 and conj() of R, T, and the Poynting vector.
+ */
+template<typename T>
+void coh_tmm_gradient(const std::vector<std::valarray<std::complex<T>>> &n_list,
+                      const std::vector<std::valarray<std::complex<T>>> &cos_th_list,
+                      const std::vector<std::valarray<std::complex<T>>> &delta,
+                      const std::vector<std::valarray<std::complex<T>>> &t_list,
+                      const ComplexMatrix2Batch<T> &A, const std::vector<ComplexMatrix2Batch<T>> &M_list,
+                      const CohTmmVecResult<T> &result, CohTmmVecGradient<T> &gradient) {
+    const char pol = result.pol;
+    const std::size_t num_wl = result.num_wl;
+    const std::size_t num_layers = result.num_layers;
+    const auto C = [&A, &M_list](const std::size_t i) -> const ComplexMatrix2Batch<T> & {
+        return i == 0 ? A : M_list.at(i);
+    };
+    // Split [re0 | im0 | re1 | im1] 2-vectors over the batch, as ComplexMatrix2Batch::apply() expects.
+    const auto get = [num_wl](const std::vector<T> &x, const std::size_t row, const std::size_t j) -> std::complex<T> {
+        return {x.at(2 * row * num_wl + j), x.at((2 * row + 1) * num_wl + j)};
+    };
+    const auto add = [num_wl](std::vector<T> &x, const std::size_t row, const std::size_t j,
+                              const std::complex<T> value) -> void {
+        x.at(2 * row * num_wl + j) += value.real();
+        x.at((2 * row + 1) * num_wl + j) += value.imag();
+    };
+    std::vector<std::vector<T>> u(num_layers, std::vector<T>(4 * num_wl));
+    std::fill_n(u.back().begin(), num_wl, static_cast<T>(1));
+    for (std::size_t i = num_layers - 1; i-- > 0;) {
+        u.at(i) = u.at(i + 1);
+        C(i).apply(u.at(i));
+    }
+    // eta_i is n_i cos(th_i) ('s') or n_i conj(cos(th_i)) ('p') in the Poynting vector of position_resolved.
+    std::vector<std::valarray<std::complex<T>>> eta(num_layers, std::valarray<std::complex<T>>(num_wl));
+    for (std::size_t i = 0; i < num_layers; i++) {
+        if (pol == 's') {
+            eta.at(i) = n_list.at(i) * cos_th_list.at(i);
+        } else {
+            eta.at(i) = n_list.at(i) * cos_th_list.at(i).apply([](const std::complex<T> c) -> std::complex<T> {
+                return std::conj(c);
+            });
+        }
+    }
+    const auto poyn = [pol](const std::complex<T> eta_i, const std::complex<T> S, const std::complex<T> D) -> T {
+        return pol == 's' ? (eta_i * std::conj(S) * D).real() : (eta_i * S * std::conj(D)).real();
+    };
+    const auto d_poyn = [pol](const std::complex<T> eta_i, const std::complex<T> d_eta, const std::complex<T> S,
+                              const std::complex<T> D, const std::complex<T> dS, const std::complex<T> dD) -> T {
+        return pol == 's' ? (d_eta * std::conj(S) * D + eta_i * (std::conj(dS) * D + std::conj(S) * dD)).real()
+                          : (d_eta * S * std::conj(D) + eta_i * (dS * std::conj(D) + S * std::conj(dD))).real();
+    };
+    // Raw absorption of absorp_in_each_layer; its derivative is 0 where it is clamped to 0.
+    std::valarray<std::valarray<T>> A_raw(std::valarray<T>(num_wl), num_layers);
+    {
+        std::valarray<std::valarray<T>> power(std::valarray<T>(num_wl), num_layers);
+        power[0] = 1;
+        power[1] = result.power_entering;
+        power[num_layers - 1] = result.Tr;
+        for (std::size_t i = 2; i < num_layers - 1; i++) {
+            for (std::size_t j = 0; j < num_wl; j++) {
+                const std::complex<T> v = result.v_list[i * num_wl + j];
+                const std::complex<T> w = result.w_list[i * num_wl + j];
+                power[i][j] = poyn(eta.at(i)[j], v + w, v - w) / eta.front()[j].real();
+            }
+        }
+        for (std::size_t i = 0; i < num_layers - 1; i++) {
+            A_raw[i] = power[i] - power[i + 1];
+        }
+        A_raw[num_layers - 1] = power[num_layers - 1];
+    }
+    // Derivatives of r and t of the interface i -> i + 1 with respect to n_i (initial) or n_{i + 1}.
+    // r = (a - b) / (a + b), t = 2 c / (a + b), d(n cos(th)) / dn = 1 / cos(th), and d cos(th) / dn = sin^2(th) / (n cos(th)).
+    const auto interface_derivative = [&n_list, &cos_th_list, pol](const std::size_t i, const bool initial,
+                                                                   const std::size_t j) -> std::pair<std::complex<T>, std::complex<T>> {
+        const std::complex<T> n_i = n_list.at(i)[j];
+        const std::complex<T> n_f = n_list.at(i + 1)[j];
+        const std::complex<T> c_i = cos_th_list.at(i)[j];
+        const std::complex<T> c_f = cos_th_list.at(i + 1)[j];
+        std::complex<T> a, b, c, da, db, dc;
+        if (pol == 's') {
+            a = n_i * c_i;
+            b = n_f * c_f;
+            c = a;
+            da = initial ? static_cast<T>(1) / c_i : 0;
+            db = initial ? 0 : static_cast<T>(1) / c_f;
+            dc = da;
+        } else {
+            a = n_f * c_i;
+            b = n_i * c_f;
+            c = n_i * c_i;
+            da = initial ? n_f * (static_cast<T>(1) - c_i * c_i) / (n_i * c_i) : c_i;
+            db = initial ? c_f : n_i * (static_cast<T>(1) - c_f * c_f) / (n_f * c_f);
+            dc = initial ? static_cast<T>(1) / c_i : 0;
+        }
+        const std::complex<T> sum = a + b;
+        return {static_cast<T>(2) * (b * da - a * db) / (sum * sum),
+                static_cast<T>(2) * dc / sum - static_cast<T>(2) * c * (da + db) / (sum * sum)};
+    };
+    // dC_i @ u_{i + 1} for the changes dr, dt of the interface i -> i + 1 and d_delta of layer i.
+    // C_i @ x = P(delta_i) @ [[1, r], [r, 1]] @ x / t with P = diag(exp(-1j delta), exp(1j delta)) and C_i @ u_{i + 1} = u_i.
+    const auto source = [&](std::vector<T> &g, const std::size_t i, const std::size_t j, const std::complex<T> dr,
+                            const std::complex<T> dt, const std::complex<T> d_delta) -> void {
+        const std::complex<T> x0 = get(u.at(i + 1), 0, j);
+        const std::complex<T> x1 = get(u.at(i + 1), 1, j);
+        const std::complex<T> u0 = get(u.at(i), 0, j);
+        const std::complex<T> u1 = get(u.at(i), 1, j);
+        const std::complex<T> t = t_list.at(i)[j];
+        const std::complex<T> phase = i == 0 ? std::complex<T>(1) : std::exp(-std::complex<T>(0, 1) * delta.at(i)[j]);
+        add(g, 0, j, phase * dr * x1 / t - dt / t * u0 - std::complex<T>(0, 1) * d_delta * u0);
+        add(g, 1, j, dr * x0 / (t * phase) - dt / t * u1 + std::complex<T>(0, 1) * d_delta * u1);
+    };
+    gradient.num_layers = num_layers;
+    gradient.num_wl = num_wl;
+    for (std::valarray<T> *field : {&gradient.dR_dd, &gradient.dR_dn, &gradient.dR_dk,
+                                    &gradient.dT_dd, &gradient.dT_dn, &gradient.dT_dk}) {
+        field->resize(num_layers * num_wl);
+    }
+    for (std::vector<std::valarray<std::valarray<T>>> *field : {&gradient.dA_dd, &gradient.dA_dn, &gradient.dA_dk}) {
+        field->assign(num_layers, std::valarray<std::valarray<T>>(std::valarray<T>(num_wl), num_layers));
+    }
+    std::vector<std::vector<T>> du(num_layers, std::vector<T>(4 * num_wl));
+    for (std::size_t k = 1; k < num_layers - 1; k++) {
+        for (const bool index : {false, true}) {
+            // du_i for i <= k, swept down from the source at layer k
+            for (std::size_t i = k + 1; i-- > 0;) {
+                if (i == k) {
+                    std::ranges::fill(du.at(i), 0);
+                } else {
+                    du.at(i) = du.at(i + 1);
+                    C(i).apply(du.at(i));
+                }
+                for (std::size_t j = 0; j < num_wl; j++) {
+                    if (not index and i == k) {
+                        const std::complex<T> kz = result.kz_list[k * num_wl + j];
+                        // Clamped opaque layers keep only the real part of delta proportional to d.
+                        const bool clamped = (kz * result.d_list.at(k)).imag() > 35;
+                        source(du.at(i), i, j, 0, 0, clamped ? kz.real() : kz);
+                    } else if (index and i == k) {
+                        const auto [dr, dt] = interface_derivative(k, true, j);
+                        const std::complex<T> kz = result.kz_list[k * num_wl + j];
+                        const bool clamped = (kz * result.d_list.at(k)).imag() > 35;
+                        const std::complex<T> d_delta = clamped ? 0 : result.d_list.at(k) * 2 * std::numbers::pi_v<T> /
+                                                                      (result.lam_vac[j] * cos_th_list.at(k)[j]);
+                        source(du.at(i), i, j, dr, dt, d_delta);
+                    } else if (index and i == k - 1) {
+                        const auto [dr, dt] = interface_derivative(k - 1, false, j);
+                        source(du.at(i), i, j, dr, dt, 0);
+                    }
+                }
+            }
+            const std::vector<std::complex<T>> directions = index ? std::vector<std::complex<T>>{1, std::complex<T>(0, 1)}
+                                                                  : std::vector<std::complex<T>>{1};
+            for (std::size_t h = 0; h < directions.size(); h++) {
+                const std::complex<T> dir = directions.at(h);
+                std::valarray<T> &dR = not index ? gradient.dR_dd : h == 0 ? gradient.dR_dn : gradient.dR_dk;
+                std::valarray<T> &dT = not index ? gradient.dT_dd : h == 0 ? gradient.dT_dn : gradient.dT_dk;
+                std::valarray<std::valarray<T>> &dA = not index ? gradient.dA_dd.at(k) : h == 0 ? gradient.dA_dn.at(k) : gradient.dA_dk.at(k);
+                for (std::size_t j = 0; j < num_wl; j++) {
+                    const std::complex<T> t = result.t[j];
+                    const std::complex<T> r = result.r[j];
+                    const std::complex<T> dt = -dir * get(du.front(), 0, j) * t * t;
+                    const std::complex<T> dr = dir * get(du.front(), 1, j) * t + get(u.front(), 1, j) * dt;
+                    const T eta_0 = eta.front()[j].real();
+                    std::vector<T> d_power(num_layers);
+                    d_power.at(1) = d_poyn(eta.front()[j], 0, static_cast<T>(1) + r, static_cast<T>(1) - r, dr, -dr) / eta_0;
+                    for (std::size_t i = 2; i < num_layers - 1; i++) {
+                        const std::complex<T> du0 = i <= k ? dir * get(du.at(i), 0, j) : 0;
+                        const std::complex<T> du1 = i <= k ? dir * get(du.at(i), 1, j) : 0;
+                        const std::complex<T> v = result.v_list[i * num_wl + j];
+                        const std::complex<T> w = result.w_list[i * num_wl + j];
+                        const std::complex<T> dv = dt * get(u.at(i), 0, j) + t * du0;
+                        const std::complex<T> dw = dt * get(u.at(i), 1, j) + t * du1;
+                        std::complex<T> d_eta = 0;
+                        if (index and i == k) {
+                            const std::complex<T> n = n_list.at(k)[j];
+                            const std::complex<T> c = cos_th_list.at(k)[j];
+                            d_eta = pol == 's' ? dir / c : dir * std::conj(c) + n * std::conj(dir * (static_cast<T>(1) - c * c) / (n * c));
+                        }
+                        d_power.at(i) = d_poyn(eta.at(i)[j], d_eta, v + w, v - w, dv + dw, dv - dw) / eta_0;
+                    }
+                    dR[k * num_wl + j] = 2 * (std::conj(r) * dr).real();
+                    // T_from_t normalizes by Re(n cos(th)) for both polarizations.
+                    dT[k * num_wl + j] = 2 * (std::conj(t) * dt).real() *
+                                         (n_list.back()[j] * cos_th_list.back()[j]).real() /
+                                         (n_list.front()[j] * cos_th_list.front()[j]).real();
+                    d_power.back() = dT[k * num_wl + j];
+                    for (std::size_t i = 0; i < num_layers; i++) {
+                        const T d_absorp = i < num_layers - 1 ? d_power.at(i) - d_power.at(i + 1) : d_power.at(i);
+                        dA[i][j] = A_raw[i][j] < 0 ? 0 : d_absorp;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Polarization-dependent part of coh_tmm: the interface coefficients, the matrix chain, r, t, v/w, R, T, and
+ * power_entering of polarization pol, from the output of coh_tmm_prepare in workspace.
+ * Only the fields of output are filled (see CohTmmOutput); the gradient requires CohTmmOutput::Fields.
+ */
+template<typename T>
+void coh_tmm_chain(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                   CohTmmWorkspace<T> &workspace, CohTmmVecResult<T> &result,
+                   const CohTmmOutput output = CohTmmOutput::Fields, CohTmmVecGradient<T> *gradient = nullptr) {
+    if (gradient and output not_eq CohTmmOutput::Fields) {
+        throw std::invalid_argument("The gradient of coh_tmm requires CohTmmOutput::Fields.");
+    }
+    const std::size_t num_wl = result.num_wl;
+    const std::size_t num_layers = result.num_layers;
+    const std::vector<std::valarray<std::complex<T>>> &delta = workspace.delta;
+    const std::vector<std::valarray<std::complex<T>>> &r_list = workspace.r_list;
+    const std::vector<std::valarray<std::complex<T>>> &t_list = workspace.t_list;
+    coh_tmm_interfaces(pol, n_list, workspace.cos_th_list, workspace.r_list, workspace.t_list);
+    result.pol = pol;
+    result.output = output;
+    const auto as_span = [](const std::valarray<std::complex<T>> &arr) -> std::span<const std::complex<T>> {
+        return {std::begin(arr), arr.size()};
+    };
+    // M_list[i] is the batch of the characteristic matrices of layer i over all wavelengths.
+    // Without the v/w recursion, they are only needed for the product, so M_list[1] is reused for every layer.
+    const bool recursion = output not_eq CohTmmOutput::RT;
+    std::vector<ComplexMatrix2Batch<T>> &M_list = workspace.M_list;
+    ComplexMatrix2Batch<T> &Mtilde = workspace.Mtilde;
+    M_list.resize(num_layers);
+    Mtilde.resize(num_wl);
+    Mtilde.set_identity();
     for (std::size_t i = 1; i < num_layers - 1; i++) {
-        std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> A(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-        std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> B(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-        for (std::size_t j = 0; j < num_wl; j++) {
-            A[j](0, 0) = std::exp(-1i * delta.at(i)[j]);
-            A[j](0, 1) = 0;
-            A[j](1, 0) = 0;
-            A[j](1, 1) = std::exp(1i * delta.at(i)[j]);
-            B[j](0, 0) = 1;
-            B[j](0, 1) = r_list.at(i).at(i + 1)[j];
-            B[j](1, 0) = r_list.at(i).at(i + 1)[j];
-            B[j](1, 1) = 1;
-            M_list[i * num_wl + j] = boost::numeric::ublas::prod(A[j], B[j]) / t_list.at(i).at(i + 1)[j];
-        }
-    }
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> Mtilde(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
+        ComplexMatrix2Batch<T> &M = M_list.at(recursion ? i : 1);
+        M.resize(num_wl);
+        M.set_layer(as_span(delta.at(i)), as_span(r_list.at(i)), as_span(t_list.at(i)));
+        Mtilde.right_multiply(M);
+    }
+    ComplexMatrix2Batch<T> &A = workspace.A;
+    A.resize(num_wl);
+    A.set_interface(as_span(r_list.at(0)), as_span(t_list.at(0)));
+    Mtilde.left_multiply(A);
+    fit(result.r, num_wl);
+    fit(result.t, num_wl);
     for (std::size_t i = 0; i < num_wl; i++) {
-        Mtilde[i] <<= 1, 0,
-                      0, 1;
+        result.r[i] = Mtilde.get(2, i) / Mtilde.get(0, i);
+        result.t[i] = static_cast<T>(1) / Mtilde.get(0, i);
+    }
+    // v_list[i * num_wl + j] and w_list[i * num_wl + j] are the {v, w} pair of layer i at wavelength j.
+    const bool store_amplitudes = output == CohTmmOutput::Fields;
+    fit(result.v_list, store_amplitudes ? num_layers * num_wl : 0);
+    fit(result.w_list, store_amplitudes ? num_layers * num_wl : 0);
+    // With CohTmmOutput::Absorption, absorp_list first holds the power entering each layer, i.e., the Poynting
+    // vector at the start of the layer, as in absorp_in_each_layer, and is differenced below.
+    fit(result.absorp_list, output == CohTmmOutput::Absorption ? num_layers * num_wl : 0);
+    if (store_amplitudes) {
+        // v and w of layer 0 and w of the last layer are 0; a reused result may hold other values there.
+        std::fill_n(std::begin(result.v_list), num_wl, std::complex<T>());
+        std::fill_n(std::begin(result.w_list), num_wl, std::complex<T>());
+        std::fill_n(std::begin(result.w_list) + (num_layers - 1) * num_wl, num_wl, std::complex<T>());
+    }
+    if (output == CohTmmOutput::Absorption) {
+        // The block of layer 0 holds the normalization of the Poynting vector until the recursion is done.
+        for (std::size_t j = 0; j < num_wl; j++) {
+            const std::complex<T> cos_th_0 = std::cos(result.th_0[j]);
+            result.absorp_list[j] = (n_list.front()[j] * (pol == 's' ? cos_th_0 : std::conj(cos_th_0))).real();
+        }
     }
-    for (std::size_t i = 1; i < num_layers - 1; i++) {
+    if (recursion) {
+        // Both columns of vw start as {t, 0} and stay equal, so only one column is propagated,
+        // as vw = [re(v) | im(v) | re(w) | im(w)].
+        std::vector<T> &vw = workspace.vw;
+        vw.assign(4 * num_wl, 0);
+        for (std::size_t i = 0; i < num_wl; i++) {
+            vw.at(i) = result.t[i].real();
+            vw.at(num_wl + i) = result.t[i].imag();
+            if (store_amplitudes) {
+                result.v_list[(num_layers - 1) * num_wl + i] = result.t[i];
+            }
+        }
+        // The power entering layer 1 is power_entering, so the absorption stops at layer 2.
+        for (std::size_t i = num_layers - 2; i > (store_amplitudes ? 0 : 1); --i) {
+            M_list.at(i).apply(vw);
+            for (std::size_t j = 0; j < num_wl; j++) {
+                const std::complex<T> v(vw.at(j), vw.at(num_wl + j));
+                const std::complex<T> w(vw.at(2 * num_wl + j), vw.at(3 * num_wl + j));
+                if (store_amplitudes) {
+                    result.v_list[i * num_wl + j] = v;
+                    result.w_list[i * num_wl + j] = w;
+                    continue;
+                }
+                // The poyn of position_resolved at distance 0
+                const std::complex<T> n = n_list.at(i)[j];
+                const std::complex<T> cos_th = workspace.cos_th_list.at(i)[j];
+                result.absorp_list[i * num_wl + j] = (pol == 's' ? n * cos_th * std::conj(v + w) * (v - w) :
+                                                      n * std::conj(cos_th) * (v + w) * std::conj(v - w)).real() /
+                                                     result.absorp_list[j];
+            }
+        }
+    }
+    // R_from_r, T_from_t, and power_entering_from_r, wavelength by wavelength into the buffers of result
+    fit(result.R, num_wl);
+    fit(result.Tr, num_wl);
+    fit(result.power_entering, num_wl);
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const std::complex<T> r = result.r[j];
+        const std::complex<T> cos_th_i = std::cos(result.th_0[j]);
+        const std::complex<T> cos_th_f = std::cos(result.th_list[(num_layers - 1) * num_wl + j]);
+        result.R[j] = std::norm(r);
+        // T_from_t takes Re(n cos(theta)) for both polarizations, as Re(conj(z)) == Re(z).
+        result.Tr[j] = std::norm(result.t[j]) * (n_list.back()[j] * cos_th_f).real() /
+                       (n_list.front()[j] * cos_th_i).real();
+        if (pol == 's') {
+            const std::complex<T> denominator = n_list.front()[j] * cos_th_i;
+            result.power_entering[j] = (denominator * (static_cast<T>(1) + std::conj(r)) *
+                                        (static_cast<T>(1) - r)).real() / denominator.real();
+        } else {
+            const std::complex<T> denominator = n_list.front()[j] * std::conj(cos_th_i);
+            result.power_entering[j] = (denominator * (static_cast<T>(1) + r) *
+                                        (static_cast<T>(1) - std::conj(r))).real() / denominator.real();
+        }
+    }
+    if (output == CohTmmOutput::Absorption) {
+        std::valarray<T> &absorp_list = result.absorp_list;
+        std::fill_n(std::begin(absorp_list), num_wl, static_cast<T>(1));
         for (std::size_t j = 0; j < num_wl; j++) {
-            Mtilde[j] = boost::numeric::ublas::prod(Mtilde[j], M_list[i * num_wl + j]);
+            absorp_list[num_wl + j] = result.power_entering[j];
+            absorp_list[(num_layers - 1) * num_wl + j] = result.Tr[j];
+        }
+        // The absorption in layer i is the power entering layer i minus that entering layer i + 1, clipped at 0.
+        for (std::size_t k = 0; k < num_layers * num_wl; k++) {
+            const T absorp = k < (num_layers - 1) * num_wl ? absorp_list[k] - absorp_list[k + num_wl] : absorp_list[k];
+            absorp_list[k] = absorp < 0 ? 0 : absorp;
         }
     }
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> A(boost::numeric::ublas::matrix<std::complex<T>>(2, 2), num_wl);
-    for (std::size_t i = 0; i < num_wl; i++) {
-        A[i] <<= 1                    , r_list.at(0).at(1)[i],
-                 r_list.at(0).at(1)[i], 1;
-        Mtilde[i] = boost::numeric::ublas::prod(A[i], Mtilde[i]) / t_list.at(0).at(1)[i];
+    if (gradient) {
+        coh_tmm_gradient(n_list, workspace.cos_th_list, delta, t_list, A, M_list, result, *gradient);
     }
-    std::valarray<std::complex<T>> r(num_wl);
-    std::valarray<std::complex<T>> t(num_wl);
-    for (std::size_t i = 0; i < num_wl; i++) {
-        r[i] = Mtilde[i](1, 0) / Mtilde[i](0, 0);
-        t[i] = 1.0 / Mtilde[i](0, 0);
+}
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             CohTmmWorkspace<T> &workspace, const CohTmmOutput output) {
+    coh_tmm_check_inputs(n_list, d_list, th_0, lam_vac);
+    coh_tmm_prepare(n_list, d_list, th_0, lam_vac, result, workspace);
+    coh_tmm_chain(pol, n_list, workspace, result, output);
+}
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             const CohTmmOutput output) {
+    CohTmmWorkspace<T> workspace;
+    coh_tmm(pol, n_list, d_list, th_0, lam_vac, result, workspace, output);
+}
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result,
+             CohTmmVecGradient<T> &gradient) {
+    coh_tmm_check_inputs(n_list, d_list, th_0, lam_vac);
+    CohTmmWorkspace<T> workspace;
+    coh_tmm_prepare(n_list, d_list, th_0, lam_vac, result, workspace);
+    coh_tmm_chain(pol, n_list, workspace, result, CohTmmOutput::Fields, &gradient);
+}
+
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::complex<double> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::valarray<std::complex<double>> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::complex<double> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                      CohTmmVecGradient<double> &gradient);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::valarray<std::complex<double>> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                      CohTmmVecGradient<double> &gradient);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::vector<float> &d_list, const std::complex<float> &th_0,
+                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::vector<float> &d_list, const std::complex<float> &th_0,
+                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                      CohTmmVecGradient<float> &gradient);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::vector<float> &d_list, const std::valarray<std::complex<float>> &th_0,
+                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::complex<double> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                      CohTmmWorkspace<double> &workspace, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::vector<double> &d_list, const std::valarray<std::complex<double>> &th_0,
+                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                      CohTmmWorkspace<double> &workspace, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::vector<float> &d_list, const std::complex<float> &th_0,
+                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                      CohTmmWorkspace<float> &workspace, CohTmmOutput output);
+template void coh_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::vector<float> &d_list, const std::valarray<std::complex<float>> &th_0,
+                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                      CohTmmWorkspace<float> &workspace, CohTmmOutput output);
+
+template<typename T, typename ACC, typename TH_T>
+requires (std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>) and
+         (sizeof(ACC) >= sizeof(T))
+void coh_tmm_mixed(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                   const std::vector<T> &d_list, const TH_T &th_0, const std::valarray<T> &lam_vac,
+                   CohTmmVecResult<T> &result) {
+    const auto widen = [](const std::valarray<std::complex<T>> &arr) -> std::valarray<std::complex<ACC>> {
+        std::valarray<std::complex<ACC>> wide(arr.size());
+        std::ranges::transform(arr, std::begin(wide), [](const std::complex<T> z) -> std::complex<ACC> {
+            return {z.real(), z.imag()};
+        });
+        return wide;
+    };
+    const auto narrow = [](const std::valarray<std::complex<ACC>> &arr) -> std::valarray<std::complex<T>> {
+        std::valarray<std::complex<T>> narrowed(arr.size());
+        std::ranges::transform(arr, std::begin(narrowed), [](const std::complex<ACC> z) -> std::complex<T> {
+            return {static_cast<T>(z.real()), static_cast<T>(z.imag())};
+        });
+        return narrowed;
+    };
+    const auto narrow_real = [](const std::valarray<ACC> &arr) -> std::valarray<T> {
+        std::valarray<T> narrowed(arr.size());
+        std::ranges::transform(arr, std::begin(narrowed), [](const ACC x) -> T {
+            return static_cast<T>(x);
+        });
+        return narrowed;
+    };
+    std::vector<std::valarray<std::complex<ACC>>> wide_n_list;
+    wide_n_list.reserve(n_list.size());
+    for (const std::valarray<std::complex<T>> &n : n_list) {
+        wide_n_list.emplace_back(widen(n));
+    }
+    std::valarray<ACC> wide_lam_vac(lam_vac.size());
+    std::ranges::copy(lam_vac, std::begin(wide_lam_vac));
+    CohTmmVecResult<ACC> wide;
+    if constexpr (std::is_same_v<TH_T, std::complex<T>>) {
+        coh_tmm(pol, wide_n_list, std::vector<ACC>(d_list.begin(), d_list.end()), std::complex<ACC>(th_0),
+                wide_lam_vac, wide);
+    } else {
+        coh_tmm(pol, wide_n_list, std::vector<ACC>(d_list.begin(), d_list.end()), widen(th_0), wide_lam_vac, wide);
+    }
+    result.pol = wide.pol;
+    result.output = wide.output;
+    result.num_layers = wide.num_layers;
+    result.num_wl = wide.num_wl;
+    result.num_angles = wide.num_angles;
+    result.r = narrow(wide.r);
+    result.t = narrow(wide.t);
+    result.R = narrow_real(wide.R);
+    result.Tr = narrow_real(wide.Tr);
+    result.power_entering = narrow_real(wide.power_entering);
+    result.v_list = narrow(wide.v_list);
+    result.w_list = narrow(wide.w_list);
+    result.kz_list = narrow(wide.kz_list);
+    result.th_list = narrow(wide.th_list);
+    result.n_list = narrow(wide.n_list);
+    result.d_list = d_list;
+    result.th_0 = narrow(wide.th_0);
+    result.lam_vac = lam_vac;
+}
+
+template void coh_tmm_mixed<float, double>(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                           const std::vector<float> &d_list, const std::complex<float> &th_0,
+                                           const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result);
+template void coh_tmm_mixed<float, double>(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                           const std::vector<float> &d_list,
+                                           const std::valarray<std::complex<float>> &th_0,
+                                           const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result);
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm_unpolarized(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+                         const TH_T &th_0, const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result_s,
+                         CohTmmVecResult<T> &result_p, CohTmmVecGradient<T> *gradient_s,
+                         CohTmmVecGradient<T> *gradient_p, const CohTmmOutput output) {
+    coh_tmm_check_inputs(n_list, d_list, th_0, lam_vac);
+    CohTmmWorkspace<T> workspace;
+    coh_tmm_prepare(n_list, d_list, th_0, lam_vac, result_s, workspace);
+    result_p.num_angles = result_s.num_angles;
+    result_p.num_layers = result_s.num_layers;
+    result_p.num_wl = result_s.num_wl;
+    result_p.n_list = result_s.n_list;
+    result_p.th_list = result_s.th_list;
+    result_p.kz_list = result_s.kz_list;
+    result_p.d_list = result_s.d_list;
+    result_p.th_0 = result_s.th_0;
+    result_p.lam_vac = result_s.lam_vac;
+    coh_tmm_chain('s', n_list, workspace, result_s, output, gradient_s);
+    coh_tmm_chain('p', n_list, workspace, result_p, output, gradient_p);
+}
+
+template void coh_tmm_unpolarized(const std::vector<std::valarray<std::complex<double>>> &n_list,
+                                  const std::vector<double> &d_list, const std::complex<double> &th_0,
+                                  const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result_s,
+                                  CohTmmVecResult<double> &result_p, CohTmmVecGradient<double> *gradient_s,
+                                  CohTmmVecGradient<double> *gradient_p, CohTmmOutput output);
+template void coh_tmm_unpolarized(const std::vector<std::valarray<std::complex<double>>> &n_list,
+                                  const std::vector<double> &d_list, const std::valarray<std::complex<double>> &th_0,
+                                  const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result_s,
+                                  CohTmmVecResult<double> &result_p, CohTmmVecGradient<double> *gradient_s,
+                                  CohTmmVecGradient<double> *gradient_p, CohTmmOutput output);
+template void coh_tmm_unpolarized(const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                  const std::vector<float> &d_list, const std::complex<float> &th_0,
+                                  const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result_s,
+                                  CohTmmVecResult<float> &result_p, CohTmmVecGradient<float> *gradient_s,
+                                  CohTmmVecGradient<float> *gradient_p, CohTmmOutput output);
+
+/*
+ * Calls func(std::integral_constant<std::size_t, I>()) for I = 0, ..., N - 1 in order, unrolled at compile time.
+ */
+template<std::size_t N, typename F>
+constexpr void static_for(F &&func) {
+    [&func]<std::size_t... I>(std::index_sequence<I...>) -> void {
+        (func(std::integral_constant<std::size_t, I>()), ...);
+    }(std::make_index_sequence<N>());
+}
+
+template<std::size_t N, std::floating_point T>
+void coh_tmm_fixed(const char pol, const std::array<std::span<const std::complex<T>>, N> &n_list,
+                   const std::array<T, N> &d_list, const std::complex<T> th_0, const std::valarray<T> &lam_vac,
+                   CohTmmVecResult<T> &result, const CohTmmOutput output) {
+    static_assert(N >= 2, "A stack has at least the incidence medium and the substrate");
+    using Matrix = FixedMatrix<std::complex<T>, 2, 2>;
+    const std::size_t num_wl = lam_vac.size();
+    if (pol not_eq 's' and pol not_eq 'p') {
+        throw std::invalid_argument("Polarization must be 's' or 'p'");
     }
-    std::valarray<std::vector<std::array<std::complex<T>, 2>>> vw_list(std::vector<std::array<std::complex<T>, 2>>(num_wl), num_layers);
-    std::valarray<boost::numeric::ublas::matrix<std::complex<T>>> vw(boost::numeric::ublas::zero_matrix<std::complex<T>>(2, 2), num_wl);
-    for (std::size_t i = 0; i < num_wl; i++) {
-        vw[i](0, 0) = t[i];  // vw[i](1, 0) = 0
-        vw[i](0, 1) = t[i];  // vw[i](1, 1) = 0
+    if (not std::isinf(d_list.front()) or not std::isinf(d_list.back())) {
+        throw std::invalid_argument("d_list must start and end with inf!");
     }
-    for (std::size_t i = 0; i < num_wl; i++) {
-        vw_list[num_layers - 1].at(i).at(0) = vw[i](0, 0);
-        vw_list[num_layers - 1].at(i).at(1) = vw[i](0, 1);
+    if (std::ranges::any_of(n_list, [num_wl](const std::span<const std::complex<T>> n) -> bool {
+        return n.size() not_eq num_wl;
+    })) {
+        throw std::invalid_argument("Every layer of n_list must have the size of lam_vac");
+    }
+    result.pol = pol;
+    result.output = output;
+    result.num_angles = 1;
+    result.num_layers = N;
+    result.num_wl = num_wl;
+    for (std::valarray<std::complex<T>> *field : {&result.r, &result.t, &result.th_0}) {
+        fit(*field, num_wl);
+    }
+    for (std::valarray<T> *field : {&result.R, &result.Tr, &result.power_entering, &result.lam_vac}) {
+        fit(*field, num_wl);
+    }
+    for (std::valarray<std::complex<T>> *field : {&result.kz_list, &result.th_list, &result.n_list}) {
+        fit(*field, N * num_wl);
+    }
+    const bool store_amplitudes = output == CohTmmOutput::Fields;
+    fit(result.v_list, store_amplitudes ? N * num_wl : 0);
+    fit(result.w_list, store_amplitudes ? N * num_wl : 0);
+    fit(result.absorp_list, output == CohTmmOutput::Absorption ? N * num_wl : 0);
+    result.d_list.assign(d_list.begin(), d_list.end());
+    result.th_0 = th_0;
+    result.lam_vac = lam_vac;
+    bool opaque_warned = false;
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const std::complex<T> n_sin = n_list.front()[j] * std::sin(th_0);
+        if (std::abs(n_sin.imag()) >= Utils::Math::TOL * Utils::Math::EPSILON<T>) {
+            throw std::invalid_argument("Error in n0 or th0!");
+        }
+        // Snell's law as list_snell, with the forward angle chosen in the semi-infinite media
+        std::array<std::complex<T>, N> cos_th;
+        static_for<N>([&](auto index) -> void {
+            constexpr std::size_t i = decltype(index)::value;
+            const std::complex<T> n = n_list[i][j];
+            std::complex<T> th = std::asin(n_sin / n);
+            if constexpr (i == 0 or i == N - 1) {
+                if (not is_forward_angle(n, th)) {
+                    th = std::numbers::pi_v<T> - th;
+                }
+            }
+            cos_th[i] = std::cos(th);
+            result.n_list[i * num_wl + j] = n;
+            result.th_list[i * num_wl + j] = th;
+            result.kz_list[i * num_wl + j] = 2 * std::numbers::pi_v<T> * n * cos_th[i] / lam_vac[j];
+        });
+        // A (the first interface) and M_list[i] = P(delta_i) @ [[1, r_i], [r_i, 1]] / t_i of the interior layers,
+        // with the interface coefficients of coh_tmm_interfaces
+        Matrix A;
+        std::array<Matrix, N> M_list;
+        static_for<N - 1>([&](auto index) -> void {
+            constexpr std::size_t i = decltype(index)::value;
+            const std::complex<T> n_i = n_list[i][j];
+            const std::complex<T> n_f = n_list[i + 1][j];
+            const std::complex<T> ii = n_i * cos_th[i];
+            const std::complex<T> a = pol == 's' ? ii : n_f * cos_th[i];
+            const std::complex<T> b = pol == 's' ? n_f * cos_th[i + 1] : n_i * cos_th[i + 1];
+            // t = 2 ii / (a + b) is only needed as 1 / t.
+            const std::complex<T> r = (a - b) / (a + b);
+            const std::complex<T> inv_t = (a + b) / (static_cast<T>(2) * ii);
+            if constexpr (i == 0) {
+                A(0, 0) = A(1, 1) = inv_t;
+                A(0, 1) = A(1, 0) = r * inv_t;
+            } else {
+                std::complex<T> delta = result.kz_list[i * num_wl + j] * d_list[i];
+                if (delta.imag() > 35) {
+                    delta = {delta.real(), 35};
+                    opaque_warned = true;
+                }
+                // exp(-1j * delta) / t and exp(1j * delta) / t as ComplexMatrix2Batch::set_layer
+                const std::complex<T> ef = std::exp(std::complex<T>(delta.imag(), -delta.real())) * inv_t;
+                const std::complex<T> eb = std::exp(std::complex<T>(-delta.imag(), delta.real())) * inv_t;
+                M_list[i](0, 0) = ef;
+                M_list[i](0, 1) = ef * r;
+                M_list[i](1, 0) = eb * r;
+                M_list[i](1, 1) = eb;
+            }
+        });
+        Matrix Mtilde = A;
+        static_for<N - 2>([&](auto index) -> void {
+            Mtilde = multiply_2x2(Mtilde, M_list[decltype(index)::value + 1]);
+        });
+        const std::complex<T> r = Mtilde(1, 0) / Mtilde(0, 0);
+        const std::complex<T> t = static_cast<T>(1) / Mtilde(0, 0);
+        result.r[j] = r;
+        result.t[j] = t;
+        result.R[j] = R_from_r(r);
+        // The vectorized T_from_t normalizes by Re(n cos(th)) for both polarizations.
+        result.Tr[j] = std::norm(t) * (n_list.back()[j] * cos_th.back()).real() /
+                       (n_list.front()[j] * cos_th.front()).real();
+        result.power_entering[j] = power_entering_from_r(pol, r, n_list.front()[j], th_0);
+        if (output == CohTmmOutput::RT) {
+            continue;
+        }
+        // The power entering each layer: 1, power_entering, the Poynting vector at the start of the interior layers
+        // (the poyn of position_resolved at distance 0), and Tr, as in absorp_in_each_layer
+        std::array<T, N> entering;
+        entering[0] = 1;
+        entering[1] = result.power_entering[j];
+        entering[N - 1] = result.Tr[j];
+        const T normalization = (n_list.front()[j] * (pol == 's' ? cos_th.front() : std::conj(cos_th.front()))).real();
+        // {v, w} of the last layer is {t, 0} and is propagated backwards by M_list, as in coh_tmm_chain.
+        FixedMatrix<std::complex<T>, 2, 1> vw;
+        vw(0, 0) = t;
+        if (store_amplitudes) {
+            result.v_list[j] = result.w_list[j] = 0;
+            result.v_list[(N - 1) * num_wl + j] = t;
+            result.w_list[(N - 1) * num_wl + j] = 0;
+        }
+        static_for<N - 2>([&](auto index) -> void {
+            constexpr std::size_t i = N - 2 - decltype(index)::value;
+            if (i == 1 and not store_amplitudes) {
+                return;  // the power entering layer 1 is power_entering
+            }
+            vw = multiply_2x2(M_list[i], vw);
+            const std::complex<T> v = vw(0, 0);
+            const std::complex<T> w = vw(1, 0);
+            if (store_amplitudes) {
+                result.v_list[i * num_wl + j] = v;
+                result.w_list[i * num_wl + j] = w;
+            } else {
+                const std::complex<T> n = n_list[i][j];
+                entering[i] = (pol == 's' ? n * cos_th[i] * std::conj(v + w) * (v - w) :
+                               n * std::conj(cos_th[i]) * (v + w) * std::conj(v - w)).real() / normalization;
+            }
+        });
+        if (not store_amplitudes) {
+            // The absorption in layer i is the power entering layer i minus that entering layer i + 1, clipped at 0.
+            for (std::size_t i = 0; i < N; i++) {
+                const T absorp = i < N - 1 ? entering[i] - entering[i + 1] : entering[i];
+                result.absorp_list[i * num_wl + j] = absorp < 0 ? 0 : absorp;
+            }
+        }
     }
-    for (std::size_t i = num_layers - 2; i > 0; --i) {
+    if (opaque_warned) {
+        try {
+            throw std::runtime_error("Warning: Layers that are almost perfectly opaque "
+                                     "are modified to be slightly transmissive, "
+                                     "allowing 1 photon in 10^30 to pass through. It's "
+                                     "for numerical stability. This warning will not "
+                                     "be shown again.");
+        } catch (const std::runtime_error &coh_value_warning) {
+            std::cerr << coh_value_warning.what() << '\n';
+        }
+    }
+}
+
+template<std::floating_point T>
+auto coh_tmm_fixed_dispatch(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                            const std::vector<T> &d_list, const std::complex<T> th_0, const std::valarray<T> &lam_vac,
+                            CohTmmVecResult<T> &result, const CohTmmOutput output) -> bool {
+    if (n_list.size() not_eq d_list.size()) {
+        return false;
+    }
+    const auto run = [&]<std::size_t N>() -> bool {
+        if (n_list.size() not_eq N) {
+            return false;
+        }
+        std::array<std::span<const std::complex<T>>, N> n_array;
+        std::array<T, N> d_array;
+        for (std::size_t i = 0; i < N; i++) {
+            n_array.at(i) = {std::begin(n_list.at(i)), n_list.at(i).size()};
+            d_array.at(i) = d_list.at(i);
+        }
+        coh_tmm_fixed<N>(pol, n_array, d_array, th_0, lam_vac, result, output);
+        return true;
+    };
+    return [&run]<std::size_t... I>(std::index_sequence<I...>) -> bool {
+        return (run.template operator()<coh_tmm_fixed_min_layers + I>() or ...);
+    }(std::make_index_sequence<coh_tmm_fixed_max_layers - coh_tmm_fixed_min_layers + 1>());
+}
+
+template auto coh_tmm_fixed_dispatch(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                                     const std::vector<double> &d_list, std::complex<double> th_0,
+                                     const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                                     CohTmmOutput output) -> bool;
+template auto coh_tmm_fixed_dispatch(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                     const std::vector<float> &d_list, std::complex<float> th_0,
+                                     const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                                     CohTmmOutput output) -> bool;
+template void coh_tmm_fixed<3>(char pol, const std::array<std::span<const std::complex<double>>, 3> &n_list,
+                               const std::array<double, 3> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<4>(char pol, const std::array<std::span<const std::complex<double>>, 4> &n_list,
+                               const std::array<double, 4> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<5>(char pol, const std::array<std::span<const std::complex<double>>, 5> &n_list,
+                               const std::array<double, 5> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<6>(char pol, const std::array<std::span<const std::complex<double>>, 6> &n_list,
+                               const std::array<double, 6> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<7>(char pol, const std::array<std::span<const std::complex<double>>, 7> &n_list,
+                               const std::array<double, 7> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<8>(char pol, const std::array<std::span<const std::complex<double>>, 8> &n_list,
+                               const std::array<double, 8> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<9>(char pol, const std::array<std::span<const std::complex<double>>, 9> &n_list,
+                               const std::array<double, 9> &d_list, std::complex<double> th_0,
+                               const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<10>(char pol, const std::array<std::span<const std::complex<double>>, 10> &n_list,
+                                const std::array<double, 10> &d_list, std::complex<double> th_0,
+                                const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                                CohTmmOutput output);
+template void coh_tmm_fixed<3>(char pol, const std::array<std::span<const std::complex<float>>, 3> &n_list,
+                               const std::array<float, 3> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<4>(char pol, const std::array<std::span<const std::complex<float>>, 4> &n_list,
+                               const std::array<float, 4> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<5>(char pol, const std::array<std::span<const std::complex<float>>, 5> &n_list,
+                               const std::array<float, 5> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<6>(char pol, const std::array<std::span<const std::complex<float>>, 6> &n_list,
+                               const std::array<float, 6> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<7>(char pol, const std::array<std::span<const std::complex<float>>, 7> &n_list,
+                               const std::array<float, 7> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<8>(char pol, const std::array<std::span<const std::complex<float>>, 8> &n_list,
+                               const std::array<float, 8> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<9>(char pol, const std::array<std::span<const std::complex<float>>, 9> &n_list,
+                               const std::array<float, 9> &d_list, std::complex<float> th_0,
+                               const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                               CohTmmOutput output);
+template void coh_tmm_fixed<10>(char pol, const std::array<std::span<const std::complex<float>>, 10> &n_list,
+                                const std::array<float, 10> &d_list, std::complex<float> th_0,
+                                const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                                CohTmmOutput output);
+
+template<std::floating_point T>
+CohTmmIncremental<T>::CohTmmIncremental(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                                        const std::vector<T> &d_list, const std::complex<T> th_0,
+                                        const std::valarray<T> &lam_vac, const std::size_t layer)
+        : layer(layer), n_list(n_list) {
+    coh_tmm_check_inputs(n_list, d_list, th_0, lam_vac);
+    const std::size_t num_layers = n_list.size();
+    if (layer == 0 or layer >= num_layers - 1) {
+        throw std::invalid_argument("The variable layer must be a finite layer between the semi-infinite media.");
+    }
+    const std::size_t num_wl = lam_vac.size();
+    CohTmmWorkspace<T> workspace;
+    coh_tmm_prepare(n_list, d_list, th_0, lam_vac, state, workspace);
+    state.pol = pol;
+    const std::vector<std::valarray<std::complex<T>>> &delta = workspace.delta;
+    const std::vector<std::valarray<std::complex<T>>> &r_list = workspace.r_list;
+    const std::vector<std::valarray<std::complex<T>>> &t_list = workspace.t_list;
+    coh_tmm_interfaces(pol, n_list, workspace.cos_th_list, workspace.r_list, workspace.t_list);
+    r_layer = r_list.at(layer);
+    t_layer = t_list.at(layer);
+    const auto as_span = [](const std::valarray<std::complex<T>> &arr) -> std::span<const std::complex<T>> {
+        return {std::begin(arr), arr.size()};
+    };
+    ComplexMatrix2Batch<T> M(num_wl);
+    head.resize(layer);
+    for (std::size_t i = layer - 1; i > 0; --i) {
+        head.at(i).resize(num_wl);
+        head.at(i).set_layer(as_span(delta.at(i)), as_span(r_list.at(i)), as_span(t_list.at(i)));
+        if (i < layer - 1) {
+            head.at(i).right_multiply(head.at(i + 1));
+        }
+    }
+    prefix.resize(num_wl);
+    prefix.set_interface(as_span(r_list.front()), as_span(t_list.front()));
+    if (layer > 1) {
+        prefix.right_multiply(head.at(1));
+    }
+    suffix.resize(num_wl);
+    suffix.set_identity();
+    tail.resize(num_layers);
+    std::vector<T> vw(4 * num_wl);
+    std::fill_n(vw.begin(), num_wl, static_cast<T>(1));
+    tail.back() = vw;
+    for (std::size_t i = num_layers - 2; i > layer; --i) {
+        M.set_layer(as_span(delta.at(i)), as_span(r_list.at(i)), as_span(t_list.at(i)));
+        suffix.left_multiply(M);
+        M.apply(vw);
+        tail.at(i) = vw;
+    }
+    M_layer.resize(num_wl);
+    set_thickness(d_list.at(layer));
+}
+
+template<std::floating_point T>
+void CohTmmIncremental<T>::set_thickness(const T d) {
+    if (not std::isfinite(d) or d < 0) {
+        throw std::invalid_argument("The thickness must be finite and non-negative.");
+    }
+    const std::size_t num_wl = state.num_wl;
+    const std::size_t num_layers = state.num_layers;
+    std::valarray<std::complex<T>> delta = state.kz_list[std::slice(layer * num_wl, num_wl, 1)];
+    delta *= std::complex<T>(d);
+    // Same clamp of almost perfectly opaque layers as coh_tmm
+    for (std::complex<T> &delta_i : delta) {
+        if (delta_i.imag() > 35) {
+            delta_i = delta_i.real() + 35i;
+        }
+    }
+    M_layer.set_layer({std::begin(delta), num_wl}, {std::begin(r_layer), num_wl}, {std::begin(t_layer), num_wl});
+    ComplexMatrix2Batch<T> Mtilde = prefix;
+    Mtilde.right_multiply(M_layer);
+    Mtilde.right_multiply(suffix);
+    state.d_list.at(layer) = d;
+    state.r.resize(num_wl);
+    state.t.resize(num_wl);
+    for (std::size_t i = 0; i < num_wl; i++) {
+        state.r[i] = Mtilde.get(2, i) / Mtilde.get(0, i);
+        state.t[i] = static_cast<T>(1) / Mtilde.get(0, i);
+    }
+    const std::valarray<std::complex<T>> th_f(state.th_list[std::slice((num_layers - 1) * num_wl, num_wl, 1)]);
+    state.R = R_from_r(state.r);
+    state.Tr = T_from_t(state.pol, state.t, n_list.front(), n_list.back(), state.th_0, th_f);
+    state.power_entering = power_entering_from_r(state.pol, state.r, n_list.front(), state.th_0);
+    vw_valid = false;
+}
+
+template<std::floating_point T>
+auto CohTmmIncremental<T>::thickness() const -> T {
+    return state.d_list.at(layer);
+}
+
+template<std::floating_point T>
+auto CohTmmIncremental<T>::R() const -> const std::valarray<T> & {
+    return state.R;
+}
+
+template<std::floating_point T>
+auto CohTmmIncremental<T>::Tr() const -> const std::valarray<T> & {
+    return state.Tr;
+}
+
+template<std::floating_point T>
+void CohTmmIncremental<T>::update_vw() {
+    const std::size_t num_wl = state.num_wl;
+    const std::size_t num_layers = state.num_layers;
+    state.v_list.resize(num_layers * num_wl);
+    state.w_list.resize(num_layers * num_wl);
+    // {v, w} of layer i is t * (M_i @ ... @ M_{num_layers - 2} @ (1, 0)).
+    const auto store = [this, num_wl](const std::size_t i, const std::vector<T> &x) -> void {
         for (std::size_t j = 0; j < num_wl; j++) {
-            vw[j] = boost::numeric::ublas::prod(M_list[i * num_wl + j], vw[j]);
-            vw_list[i].at(j).at(0) = vw[j](0, 1);
-            vw_list[i].at(j).at(1) = vw[j](1, 1);
+            state.v_list[i * num_wl + j] = state.t[j] * std::complex<T>(x.at(j), x.at(num_wl + j));
+            state.w_list[i * num_wl + j] = state.t[j] * std::complex<T>(x.at(2 * num_wl + j), x.at(3 * num_wl + j));
         }
+    };
+    for (std::size_t i = layer + 1; i < num_layers - 1; i++) {
+        store(i, tail.at(i));
+    }
+    std::vector<T> x = tail.at(layer + 1);
+    M_layer.apply(x);
+    store(layer, x);
+    for (std::size_t i = 1; i < layer; i++) {
+        std::vector<T> y = x;
+        head.at(i).apply(y);
+        store(i, y);
+    }
+    state.v_list[std::slice((num_layers - 1) * num_wl, num_wl, 1)] = state.t;
+    vw_valid = true;
+}
+
+template<std::floating_point T>
+auto CohTmmIncremental<T>::result() -> const CohTmmVecResult<T> & {
+    if (not vw_valid) {
+        update_vw();
     }
-    std::ranges::transform(vw_list[num_layers - 1], vw_list[num_layers - 1].begin(), [](std::array<std::complex<T>, 2> &subarray) -> std::array<std::complex<T>, 2> {
-        subarray.at(1) = 0;
-        return subarray;
-    });
-    const std::valarray<T> R = R_from_r(r);
-    const std::valarray<T> Tr = T_from_t(pol, t, n_list.front(), n_list.at(num_layers - 1), th_0, th_list.at(num_layers - 1));
-    const std::valarray<T> power_entering = power_entering_from_r(pol, r, n_list.front(), th_0);
-    return {{"r", r},
-            {"t", t},
-            {"R", R},
-            {"T", Tr},
-            {"power_entering", power_entering},
-            {"vw_list", vw_list},
-            {"kz_list", kz_list},
-            {"th_list", th_list},
-            {"pol", pol},
-            {"n_list", n_list},
-            {"d_list", d_list},
-            {"th_0", th_0},
-            {"lam_vac", lam_vac}};
+    return state;
+}
+
+template<std::floating_point T>
+auto CohTmmIncremental<T>::A_per_layer() -> std::valarray<std::valarray<T>> {
+    return absorp_in_each_layer(result());
+}
+
+template class CohTmmIncremental<double>;
+
+template<std::floating_point T>
+void coh_tmm_angles(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                    const std::vector<T> &d_list, const std::valarray<std::complex<T>> &th_0,
+                    const std::valarray<T> &lam_vac, CohTmmVecResult<T> &result) {
+    const std::size_t num_angles = th_0.size();
+    const std::size_t num_wl = lam_vac.size();
+    if (num_angles == 0) {
+        throw std::invalid_argument("th_0 must not be empty.");
+    }
+    if (std::ranges::any_of(n_list, [num_wl](const std::valarray<std::complex<T>> &n) -> bool {
+        return n.size() not_eq num_wl;
+    })) {
+        throw std::invalid_argument("n_list elements and lam_vac have different sizes.");
+    }
+    // Flatten angle x wavelength into one angle-major batch, so that a single coh_tmm pass covers all angles.
+    const std::size_t batch_size = num_angles * num_wl;
+    std::vector<std::valarray<std::complex<T>>> batch_n_list(n_list.size(), std::valarray<std::complex<T>>(batch_size));
+    std::valarray<std::complex<T>> batch_th_0(batch_size);
+    std::valarray<T> batch_lam_vac(batch_size);
+    for (std::size_t a = 0; a < num_angles; a++) {
+        const std::slice angle_slice(a * num_wl, num_wl, 1);
+        for (std::size_t i = 0; i < n_list.size(); i++) {
+            batch_n_list.at(i)[angle_slice] = n_list.at(i);
+        }
+        batch_th_0[angle_slice] = th_0[a];
+        batch_lam_vac[angle_slice] = lam_vac;
+    }
+    coh_tmm(pol, batch_n_list, d_list, batch_th_0, batch_lam_vac, result);
+    result.num_angles = num_angles;
+}
+
+template void coh_tmm_angles(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                             const std::vector<double> &d_list, const std::valarray<std::complex<double>> &th_0,
+                             const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result);
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+auto coh_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::vector<T> &d_list,
+             const TH_T &th_0, const std::valarray<T> &lam_vac) -> coh_tmm_vecn_dict<T> {
+    CohTmmVecResult<T> result;
+    coh_tmm(pol, n_list, d_list, th_0, lam_vac, result);
+    coh_tmm_vecn_dict<T> coh_tmm_data = result.to_dict();
+    coh_tmm_data.insert_or_assign("th_0", th_0);
+    return coh_tmm_data;
 }
 
 template auto coh_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
@@ -1036,6 +2039,145 @@ auto coh_tmm_reverse(const char pol, const std::vector<std::valarray<std::comple
     return coh_tmm(pol, reversed_n_list, reversed_d_list, th_f, lam_vac);
 }
 
+/*
+ * Reverse pass of coh_tmm_forward_reverse, from the forward pass in result and workspace. With the characteristic
+ * matrices of the forward stack, light incident from the last layer has [0, t'] = Mtilde @ [r', 1] in layer 0, so
+ * r' = -Mtilde[0, 1] / Mtilde[0, 0] and t' = det(Mtilde) / Mtilde[0, 0], where det(Mtilde) is the product of the
+ * determinants (1 - r_i ** 2) / t_i ** 2 of the interfaces and is free of the phase factors. The amplitudes are
+ * propagated from layer 0 onwards with the inverse layer matrices, i.e., from the exit side of the reversed stack
+ * as coh_tmm does, and the -z and +z waves at the back of layer i are the v and w of the reversed layer.
+ */
+template<typename T>
+void coh_tmm_reverse_chain(const std::vector<std::valarray<std::complex<T>>> &n_list, const CohTmmVecResult<T> &result,
+                           CohTmmWorkspace<T> &workspace, CohTmmVecResult<T> &reverse) {
+    const std::size_t num_wl = result.num_wl;
+    const std::size_t num_layers = result.num_layers;
+    const std::size_t num_elems = num_layers * num_wl;
+    const std::vector<std::valarray<std::complex<T>>> &r_list = workspace.r_list;
+    const std::vector<std::valarray<std::complex<T>>> &t_list = workspace.t_list;
+    const ComplexMatrix2Batch<T> &Mtilde = workspace.Mtilde;
+    reverse.pol = result.pol;
+    reverse.output = CohTmmOutput::Fields;
+    reverse.num_layers = num_layers;
+    reverse.num_wl = num_wl;
+    reverse.num_angles = result.num_angles;
+    fit(reverse.n_list, num_elems);
+    fit(reverse.th_list, num_elems);
+    fit(reverse.kz_list, num_elems);
+    for (std::size_t i = 0; i < num_layers; i++) {
+        const std::slice from(i * num_wl, num_wl, 1);
+        const std::slice to((num_layers - 1 - i) * num_wl, num_wl, 1);
+        reverse.n_list[to] = result.n_list[from];
+        reverse.th_list[to] = result.th_list[from];
+        reverse.kz_list[to] = result.kz_list[from];
+    }
+    reverse.d_list.assign(result.d_list.rbegin(), result.d_list.rend());
+    fit(reverse.th_0, num_wl);
+    reverse.th_0 = result.th_list[std::slice((num_layers - 1) * num_wl, num_wl, 1)];
+    reverse.lam_vac = result.lam_vac;
+    fit(reverse.r, num_wl);
+    fit(reverse.t, num_wl);
+    for (std::size_t j = 0; j < num_wl; j++) {
+        std::complex<T> det = 1;
+        for (std::size_t i = 0; i < num_layers - 1; i++) {
+            det *= (static_cast<T>(1) - r_list.at(i)[j] * r_list.at(i)[j]) / (t_list.at(i)[j] * t_list.at(i)[j]);
+        }
+        reverse.r[j] = -Mtilde.get(1, j) / Mtilde.get(0, j);
+        reverse.t[j] = det / Mtilde.get(0, j);
+    }
+    fit(reverse.v_list, num_elems);
+    fit(reverse.w_list, num_elems);
+    std::fill_n(std::begin(reverse.v_list), num_wl, std::complex<T>());
+    std::fill_n(std::begin(reverse.w_list), num_wl, std::complex<T>());
+    std::fill_n(std::begin(reverse.w_list) + (num_layers - 1) * num_wl, num_wl, std::complex<T>());
+    // vw = [re(v) | im(v) | re(w) | im(w)] of the forward layer i, starting from [0, t'] in layer 0
+    std::vector<T> &vw = workspace.vw;
+    vw.assign(4 * num_wl, 0);
+    for (std::size_t j = 0; j < num_wl; j++) {
+        vw.at(2 * num_wl + j) = reverse.t[j].real();
+        vw.at(3 * num_wl + j) = reverse.t[j].imag();
+        reverse.v_list[(num_layers - 1) * num_wl + j] = reverse.t[j];
+    }
+    // [v, w] = inv(M) @ [v, w], where inv(M) = [[M11, -M01], [-M10, M00]] / det(M) and det(M) = (1 - r ** 2) / t ** 2
+    const auto apply_inverse = [&vw, num_wl](const ComplexMatrix2Batch<T> &M, const std::valarray<std::complex<T>> &r,
+                                            const std::valarray<std::complex<T>> &t) {
+        for (std::size_t j = 0; j < num_wl; j++) {
+            const std::complex<T> v(vw[j], vw[num_wl + j]);
+            const std::complex<T> w(vw[2 * num_wl + j], vw[3 * num_wl + j]);
+            const std::complex<T> inv_det = t[j] * t[j] / (static_cast<T>(1) - r[j] * r[j]);
+            const std::complex<T> next_v = (M.get(3, j) * v - M.get(1, j) * w) * inv_det;
+            const std::complex<T> next_w = (M.get(0, j) * w - M.get(2, j) * v) * inv_det;
+            vw[j] = next_v.real();
+            vw[num_wl + j] = next_v.imag();
+            vw[2 * num_wl + j] = next_w.real();
+            vw[3 * num_wl + j] = next_w.imag();
+        }
+    };
+    apply_inverse(workspace.A, r_list.front(), t_list.front());
+    for (std::size_t i = 1; i < num_layers - 1; i++) {
+        const ComplexMatrix2Batch<T> &M = workspace.M_list.at(i);
+        const std::size_t k = num_layers - 1 - i;  // layer of the reversed stack
+        for (std::size_t j = 0; j < num_wl; j++) {
+            // exp(-1j * delta) and exp(1j * delta) of layer i, recovered from M without another exp
+            const std::complex<T> v(vw[j], vw[num_wl + j]);
+            const std::complex<T> w(vw[2 * num_wl + j], vw[3 * num_wl + j]);
+            reverse.v_list[k * num_wl + j] = w * M.get(0, j) * t_list.at(i)[j];
+            reverse.w_list[k * num_wl + j] = v * M.get(3, j) * t_list.at(i)[j];
+        }
+        apply_inverse(M, r_list.at(i), t_list.at(i));
+    }
+    // R, T, and power_entering of the reversed stack, incident from the last layer of the forward one
+    fit(reverse.R, num_wl);
+    fit(reverse.Tr, num_wl);
+    fit(reverse.power_entering, num_wl);
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const std::complex<T> r = reverse.r[j];
+        const std::complex<T> cos_th_i = workspace.cos_th_list.back()[j];
+        const std::complex<T> cos_th_f = workspace.cos_th_list.front()[j];
+        reverse.R[j] = std::norm(r);
+        reverse.Tr[j] = std::norm(reverse.t[j]) * (n_list.front()[j] * cos_th_f).real() /
+                        (n_list.back()[j] * cos_th_i).real();
+        if (result.pol == 's') {
+            const std::complex<T> denominator = n_list.back()[j] * cos_th_i;
+            reverse.power_entering[j] = (denominator * (static_cast<T>(1) + std::conj(r)) *
+                                         (static_cast<T>(1) - r)).real() / denominator.real();
+        } else {
+            const std::complex<T> denominator = n_list.back()[j] * std::conj(cos_th_i);
+            reverse.power_entering[j] = (denominator * (static_cast<T>(1) + r) *
+                                         (static_cast<T>(1) - std::conj(r))).real() / denominator.real();
+        }
+    }
+}
+
+template<typename T, typename TH_T>
+requires std::is_same_v<TH_T, std::valarray<std::complex<T>>> || std::is_same_v<TH_T, std::complex<T>>
+void coh_tmm_forward_reverse(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list,
+                             const std::vector<T> &d_list, const TH_T &th_0, const std::valarray<T> &lam_vac,
+                             CohTmmVecResult<T> &result, CohTmmVecResult<T> &reverse_result,
+                             CohTmmWorkspace<T> &workspace) {
+    coh_tmm(pol, n_list, d_list, th_0, lam_vac, result, workspace);
+    coh_tmm_reverse_chain(n_list, result, workspace, reverse_result);
+}
+
+template void coh_tmm_forward_reverse(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                                      const std::vector<double> &d_list, const std::complex<double> &th_0,
+                                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                                      CohTmmVecResult<double> &reverse_result, CohTmmWorkspace<double> &workspace);
+template void coh_tmm_forward_reverse(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                                      const std::vector<double> &d_list,
+                                      const std::valarray<std::complex<double>> &th_0,
+                                      const std::valarray<double> &lam_vac, CohTmmVecResult<double> &result,
+                                      CohTmmVecResult<double> &reverse_result, CohTmmWorkspace<double> &workspace);
+template void coh_tmm_forward_reverse(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                      const std::vector<float> &d_list, const std::complex<float> &th_0,
+                                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                                      CohTmmVecResult<float> &reverse_result, CohTmmWorkspace<float> &workspace);
+template void coh_tmm_forward_reverse(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                                      const std::vector<float> &d_list,
+                                      const std::valarray<std::complex<float>> &th_0,
+                                      const std::valarray<float> &lam_vac, CohTmmVecResult<float> &result,
+                                      CohTmmVecResult<float> &reverse_result, CohTmmWorkspace<float> &workspace);
+
 template<typename T>
 auto ellips(const std::valarray<std::complex<T>> &n_list, const std::valarray<T> &d_list, const std::complex<T> th_0,
             const std::valarray<T> &lam_vac) -> std::unordered_map<std::string, std::valarray<T>> {
@@ -1316,35 +2458,38 @@ auto position_resolved(const std::size_t layer, const T distance,
     const std::valarray<std::complex<T>> th = std::get<std::vector<std::valarray<std::complex<T>>>>(coh_tmm_data.at("th_list")).at(layer);
     const std::valarray<std::complex<T>> n = std::get<std::vector<std::valarray<std::complex<T>>>>(coh_tmm_data.at("n_list")).at(layer);
     const std::valarray<std::complex<T>> n_0 = std::get<std::vector<std::valarray<std::complex<T>>>>(coh_tmm_data.at("n_list")).front();
-    const std::complex<T> th_0 = std::get<std::complex<T>>(coh_tmm_data.at("th_0"));
+    // th_0 is std::complex<T> from coh_tmm but std::valarray<std::complex<T>> from coh_tmm_reverse and inc_tmm.
+    const std::valarray<std::complex<T>> th_0 = std::holds_alternative<std::complex<T>>(coh_tmm_data.at("th_0")) ?
+                                                std::valarray<std::complex<T>>(std::get<std::complex<T>>(coh_tmm_data.at("th_0")), num_wl) :
+                                                std::get<std::valarray<std::complex<T>>>(coh_tmm_data.at("th_0"));
     const char pol = std::get<char>(coh_tmm_data.at("pol"));
-    if ((layer < 1 or 0 > distance or distance > std::get<std::valarray<T>>(coh_tmm_data.at("d_list"))[layer]) and (layer not_eq 0 or distance > 0)) {
+    if ((layer < 1 or 0 > distance or distance > std::get<std::vector<T>>(coh_tmm_data.at("d_list")).at(layer)) and (layer not_eq 0 or distance > 0)) {
         throw std::runtime_error("Position cannot be resolved at layer " + std::to_string(layer));
     }
-    const std::valarray<std::complex<T>> Ef = v * std::exp(1i * kz * distance);
-    const std::valarray<std::complex<T>> Eb = w * std::exp(-1i * kz * distance);
+    const std::valarray<std::complex<T>> Ef = v * std::exp(std::complex<T>(0, 1) * kz * distance);
+    const std::valarray<std::complex<T>> Eb = w * std::exp(-std::complex<T>(0, 1) * kz * distance);
     std::valarray<T> poyn(num_wl);
     if (pol == 's') {
         for (std::size_t i = 0; i < num_wl; i++) {
             poyn[i] = (n[i] * std::cos(th[i]) * std::conj(Ef[i] + Eb[i]) * (Ef[i] - Eb[i])).real() /
-                      (n_0[i] * std::cos(th_0)).real();
+                      (n_0[i] * std::cos(th_0[i])).real();
         }
     } else if (pol == 'p') {
         for (std::size_t i = 0; i < num_wl; i++) {
             poyn[i] = (n[i] * std::conj(std::cos(th[i])) * (Ef[i] + Eb[i]) * std::conj(Ef[i] - Eb[i])).real() /
-                      (n_0[i] * std::conj(std::cos(th_0))).real();
+                      (n_0[i] * std::conj(std::cos(th_0[i]))).real();
         }
     }
     std::valarray<T> absor(num_wl);
     if (pol == 's') {
         for (std::size_t i = 0; i < num_wl; i++) {
             absor[i] = (n[i] * std::cos(th[i]) * kz[i] * std::norm(Ef[i] + Eb[i])).imag() /
-                       (n_0[i] * std::cos(th_0)).real();
+                       (n_0[i] * std::cos(th_0[i])).real();
         }
     } else if (pol == 'p') {
         for (std::size_t i = 0; i < num_wl; i++) {
             absor[i] = (n[i] * std::conj(std::cos(th[i])) * (kz[i] * std::norm(Ef[i] - Eb[i]) - std::conj(kz[i]) * std::norm(Ef[i] + Eb[i]))).imag() /
-                       (n_0[i] * std::conj(std::cos(th_0))).real();
+                       (n_0[i] * std::conj(std::cos(th_0[i]))).real();
         }
     }
     const std::valarray<std::complex<T>> Ex = pol == 's' ? std::valarray<std::complex<T>>{0} : (Ef - Eb) * std::cos(th);
@@ -1353,6 +2498,75 @@ auto position_resolved(const std::size_t layer, const T distance,
     return {{"poyn", poyn}, {"absor", absor}, {"Ex", Ex}, {"Ey", Ey}, {"Ez", Ez}};
 }
 
+template<typename T>
+void position_resolved(const std::size_t layer, const T distance, const CohTmmVecResult<T> &coh_tmm_data,
+                       PositionResolvedVecResult<T> &result) {
+    if (coh_tmm_data.output not_eq CohTmmOutput::Fields) {
+        throw std::invalid_argument("position_resolved needs coh_tmm with CohTmmOutput::Fields.");
+    }
+    if ((layer < 1 or 0 > distance or distance > coh_tmm_data.d_list.at(layer)) and (layer not_eq 0 or distance > 0)) {
+        throw std::runtime_error("Position cannot be resolved at layer " + std::to_string(layer));
+    }
+    const std::size_t num_wl = coh_tmm_data.num_wl;
+    const std::span<const std::complex<T>> kz = coh_tmm_data.layer(coh_tmm_data.kz_list, layer);
+    const std::span<const std::complex<T>> th = coh_tmm_data.layer(coh_tmm_data.th_list, layer);
+    const std::span<const std::complex<T>> n = coh_tmm_data.layer(coh_tmm_data.n_list, layer);
+    const std::span<const std::complex<T>> n_0 = coh_tmm_data.layer(coh_tmm_data.n_list, 0);
+    const std::valarray<std::complex<T>> &th_0 = coh_tmm_data.th_0;
+    const char pol = coh_tmm_data.pol;
+    fit(result.poyn, num_wl);
+    fit(result.absor, num_wl);
+    fit(result.Ex, num_wl);
+    fit(result.Ey, num_wl);
+    fit(result.Ez, num_wl);
+    for (std::size_t i = 0; i < num_wl; i++) {
+        const std::complex<T> v = layer > 0 ? coh_tmm_data.v_list[layer * num_wl + i] : 1;
+        const std::complex<T> w = layer > 0 ? coh_tmm_data.w_list[layer * num_wl + i] : coh_tmm_data.r[i];
+        const std::complex<T> Ef = v * std::exp(std::complex<T>(0, 1) * kz[i] * distance);
+        const std::complex<T> Eb = w * std::exp(-std::complex<T>(0, 1) * kz[i] * distance);
+        if (pol == 's') {
+            result.poyn[i] = (n[i] * std::cos(th[i]) * std::conj(Ef + Eb) * (Ef - Eb)).real() /
+                             (n_0[i] * std::cos(th_0[i])).real();
+            result.absor[i] = (n[i] * std::cos(th[i]) * kz[i] * std::norm(Ef + Eb)).imag() /
+                              (n_0[i] * std::cos(th_0[i])).real();
+            result.Ex[i] = 0;
+            result.Ey[i] = Ef + Eb;
+            result.Ez[i] = 0;
+        } else {
+            result.poyn[i] = (n[i] * std::conj(std::cos(th[i])) * (Ef + Eb) * std::conj(Ef - Eb)).real() /
+                             (n_0[i] * std::conj(std::cos(th_0[i]))).real();
+            result.absor[i] = (n[i] * std::conj(std::cos(th[i])) * (kz[i] * std::norm(Ef - Eb) - std::conj(kz[i]) * std::norm(Ef + Eb))).imag() /
+                              (n_0[i] * std::conj(std::cos(th_0[i]))).real();
+            result.Ex[i] = (Ef - Eb) * std::cos(th[i]);
+            result.Ey[i] = 0;
+            result.Ez[i] = -(Ef + Eb) * std::sin(th[i]);
+        }
+    }
+}
+
+template void position_resolved(std::size_t layer, double distance, const CohTmmVecResult<double> &coh_tmm_data,
+                                PositionResolvedVecResult<double> &result);
+template void position_resolved(std::size_t layer, float distance, const CohTmmVecResult<float> &coh_tmm_data,
+                                PositionResolvedVecResult<float> &result);
+
+template<typename T>
+auto position_resolved(const std::size_t layer, const T distance,
+                       const CohTmmVecResult<T> &coh_tmm_data) -> std::unordered_map<std::string, std::variant<std::valarray<T>, std::valarray<std::complex<T>>>> {
+    PositionResolvedVecResult<T> result;
+    position_resolved(layer, distance, coh_tmm_data, result);
+    // The zero components are a single 0, as in the dictionary form of coh_tmm.
+    if (coh_tmm_data.pol == 's') {
+        result.Ex = result.Ez = std::valarray<std::complex<T>>{0};
+    } else {
+        result.Ey = std::valarray<std::complex<T>>{0};
+    }
+    return {{"poyn", std::move(result.poyn)}, {"absor", std::move(result.absor)}, {"Ex", std::move(result.Ex)},
+            {"Ey", std::move(result.Ey)}, {"Ez", std::move(result.Ez)}};
+}
+
+template auto position_resolved(std::size_t layer, double distance,
+                                const CohTmmVecResult<double> &coh_tmm_data) -> std::unordered_map<std::string, std::variant<std::valarray<double>, std::valarray<std::complex<double>>>>;
+
 /*
  * This function is vectorized.
  * d_list is a list of thicknesses of layers, all of which are finite.
@@ -1539,7 +2753,7 @@ auto absorp_in_each_layer(const coh_tmm_vecn_dict<T> &coh_tmm_data) -> std::vala
     power_entering_each_layer[1] = std::get<std::valarray<T>>(coh_tmm_data.at("power_entering"));
     power_entering_each_layer[num_layers - 1] = std::get<std::valarray<T>>(coh_tmm_data.at("T"));
     for (std::size_t i = 2; i < num_layers - 1; i++) {
-        power_entering_each_layer[i] = std::get<std::valarray<T>>(position_resolved(i, 0.0, coh_tmm_data).at("poyn"));
+        power_entering_each_layer[i] = std::get<std::valarray<T>>(position_resolved(i, static_cast<T>(0), coh_tmm_data).at("poyn"));
     }
     std::valarray<std::valarray<T>> final_answer(std::valarray<T>(num_lam_vac), num_layers);
     std::adjacent_difference(std::next(std::begin(power_entering_each_layer)), std::end(power_entering_each_layer),
@@ -1555,6 +2769,221 @@ auto absorp_in_each_layer(const coh_tmm_vecn_dict<T> &coh_tmm_data) -> std::vala
 }
 
 template auto absorp_in_each_layer(const coh_tmm_vecn_dict<double> &coh_tmm_data) -> std::valarray<std::valarray<double>>;
+template auto absorp_in_each_layer(const coh_tmm_vecn_dict<float> &coh_tmm_data) -> std::valarray<std::valarray<float>>;
+
+template<typename T>
+auto absorp_in_each_layer(const CohTmmVecResult<T> &coh_tmm_data) -> std::valarray<std::valarray<T>> {
+    const std::size_t num_layers = coh_tmm_data.num_layers;
+    const std::size_t num_lam_vac = coh_tmm_data.num_wl;
+    if (coh_tmm_data.output == CohTmmOutput::RT) {
+        throw std::invalid_argument("absorp_in_each_layer needs coh_tmm with CohTmmOutput::Absorption or Fields.");
+    }
+    if (coh_tmm_data.output == CohTmmOutput::Absorption) {
+        std::valarray<std::valarray<T>> absorp(std::valarray<T>(num_lam_vac), num_layers);
+        for (std::size_t i = 0; i < num_layers; i++) {
+            absorp[i] = coh_tmm_data.absorp_list[std::slice(i * num_lam_vac, num_lam_vac, 1)];
+        }
+        return absorp;
+    }
+    std::valarray<std::valarray<T>> power_entering_each_layer(std::valarray<T>(num_lam_vac), num_layers);
+    power_entering_each_layer[0] = 1;
+    power_entering_each_layer[1] = coh_tmm_data.power_entering;
+    power_entering_each_layer[num_layers - 1] = coh_tmm_data.Tr;
+    for (std::size_t i = 2; i < num_layers - 1; i++) {
+        power_entering_each_layer[i] = std::get<std::valarray<T>>(position_resolved(i, static_cast<T>(0), coh_tmm_data).at("poyn"));
+    }
+    std::valarray<std::valarray<T>> final_answer(std::valarray<T>(num_lam_vac), num_layers);
+    for (std::size_t i = 0; i < num_layers - 1; i++) {
+        final_answer[i] = power_entering_each_layer[i] - power_entering_each_layer[i + 1];
+    }
+    final_answer[num_layers - 1] = power_entering_each_layer[num_layers - 1];
+    for (std::size_t i = 0; i < num_layers; i++) {
+        final_answer[i][final_answer[i] < std::valarray<T>(0.0, num_lam_vac)] = 0;
+    }
+    return final_answer;
+}
+
+template auto absorp_in_each_layer(const CohTmmVecResult<double> &coh_tmm_data) -> std::valarray<std::valarray<double>>;
+template auto absorp_in_each_layer(const CohTmmVecResult<float> &coh_tmm_data) -> std::valarray<std::valarray<float>>;
+
+template<typename T>
+auto generation_profile(const CohTmmVecResult<T> &coh_tmm_data, const std::valarray<T> &photon_flux,
+                        const std::valarray<T> &x) -> std::valarray<T> {
+    const std::size_t num_layers = coh_tmm_data.num_layers;
+    const std::size_t num_wl = coh_tmm_data.num_wl;
+    if (photon_flux.size() not_eq num_wl) {
+        throw std::invalid_argument("photon_flux and lam_vac must have the same size");
+    }
+    if (coh_tmm_data.output not_eq CohTmmOutput::Fields) {
+        throw std::invalid_argument("generation_profile needs coh_tmm with CohTmmOutput::Fields.");
+    }
+    std::valarray<T> G(0.0, x.size());
+    // Points of x grouped by layer with their depth z into the layer
+    std::vector<std::vector<std::pair<std::size_t, T>>> points(num_layers);
+    {
+        std::vector<T> starts(num_layers - 1);  // starts[i - 1] is the start of layer i
+        for (std::size_t i = 1; i < num_layers - 1; i++) {
+            starts.at(i) = starts.at(i - 1) + coh_tmm_data.d_list.at(i);
+        }
+        for (std::size_t m = 0; m < x.size(); m++) {
+            if (x[m] < 0 or x[m] > starts.back()) {
+                continue;
+            }
+            // The last layer whose start is <= x; a point on an interface belongs to the layer before it.
+            const std::size_t layer = std::max<std::size_t>(
+                    std::ranges::lower_bound(starts, x[m]) - starts.begin(), 1);
+            points.at(layer).emplace_back(m, x[m] - starts.at(layer - 1));
+        }
+    }
+    const char pol = coh_tmm_data.pol;
+    const std::span<const std::complex<T>> n_0 = coh_tmm_data.layer(coh_tmm_data.n_list, 0);
+    const std::valarray<std::complex<T>> &th_0 = coh_tmm_data.th_0;
+    for (std::size_t layer = 1; layer < num_layers - 1; layer++) {
+        if (points.at(layer).empty()) {
+            continue;
+        }
+        const std::span<const std::complex<T>> kz = coh_tmm_data.layer(coh_tmm_data.kz_list, layer);
+        const std::span<const std::complex<T>> th = coh_tmm_data.layer(coh_tmm_data.th_list, layer);
+        const std::span<const std::complex<T>> n = coh_tmm_data.layer(coh_tmm_data.n_list, layer);
+        for (std::size_t j = 0; j < num_wl; j++) {
+            if (photon_flux[j] == 0) {
+                continue;
+            }
+            // Same coefficients as AbsorpAnalyticVecFn::fill_in, weighted by the photon flux
+            const std::complex<T> v = coh_tmm_data.v_list[layer * num_wl + j];
+            const std::complex<T> w = coh_tmm_data.w_list[layer * num_wl + j];
+            const T a1 = 2 * kz[j].imag() < 1e-30 ? 0 : 2 * kz[j].imag();
+            const T a3 = 2 * kz[j].real() < 1e-30 ? 0 : 2 * kz[j].real();
+            T A1, A2;
+            std::complex<T> A3;
+            if (pol == 's') {
+                const T temp = photon_flux[j] * (n[j] * std::cos(th[j]) * kz[j]).imag() /
+                               (n_0[j] * std::cos(th_0[j])).real();
+                A1 = temp * std::norm(w);
+                A2 = temp * std::norm(v);
+                A3 = temp * std::conj(w) * v;
+            } else {
+                const T denominator = (n_0[j] * std::conj(std::cos(th_0[j]))).real();
+                const T temp = photon_flux[j] * 2 * kz[j].imag() * (n[j] * std::cos(std::conj(th[j]))).real() /
+                               denominator;
+                A1 = temp * std::norm(w);
+                A2 = temp * std::norm(v);
+                A3 = photon_flux[j] * v * std::conj(w) * -2.0 * kz[j].real() *
+                     (n[j] * std::cos(std::conj(th[j]))).imag() / denominator;
+            }
+            for (const auto &[m, z] : points.at(layer)) {
+                // A3 exp(1j a3 z) + conj(A3) exp(-1j a3 z) = 2 Re(A3 exp(1j a3 z))
+                G[m] += A1 * std::exp(a1 * z) + A2 * std::exp(-a1 * z) +
+                        2 * (A3 * std::exp(std::complex<T>(0, a3 * z))).real();
+            }
+        }
+    }
+    return G;
+}
+
+template auto generation_profile(const CohTmmVecResult<double> &coh_tmm_data, const std::valarray<double> &photon_flux,
+                                 const std::valarray<double> &x) -> std::valarray<double>;
+
+template<typename T>
+void position_resolved_map(const CohTmmVecResult<T> &coh_tmm_data, const std::valarray<T> &x,
+                           const FieldMapSink<T> &sink, const std::size_t tile_z, const std::size_t tile_wl) {
+    if (coh_tmm_data.output not_eq CohTmmOutput::Fields) {
+        throw std::invalid_argument("position_resolved_map needs coh_tmm with CohTmmOutput::Fields.");
+    }
+    if (tile_z == 0 or tile_wl == 0) {
+        throw std::invalid_argument("The tile sizes must be positive.");
+    }
+    const std::size_t num_layers = coh_tmm_data.num_layers;
+    const std::size_t num_wl = coh_tmm_data.num_wl;
+    std::vector<T> starts(num_layers - 1);  // starts[i - 1] is the start of layer i
+    for (std::size_t i = 1; i < num_layers - 1; i++) {
+        starts.at(i) = starts.at(i - 1) + coh_tmm_data.d_list.at(i);
+    }
+    const std::size_t max_z = std::min(tile_z, x.size());
+    const std::size_t max_wl = std::min(tile_wl, num_wl);
+    // Tile buffers, reused for every tile
+    std::vector<std::size_t> point_layer(max_z);
+    std::vector<T> point_depth(max_z);
+    std::vector<T> poyn(max_z * max_wl), absor(max_z * max_wl);
+    std::vector<std::complex<T>> Ex(max_z * max_wl), Ey(max_z * max_wl), Ez(max_z * max_wl);
+    std::vector<std::complex<T>> cos_th(max_wl), sin_th(max_wl);  // of the layer of the previous point
+    std::vector<T> normalization(max_wl);
+    const char pol = coh_tmm_data.pol;
+    const std::span<const std::complex<T>> n_0 = coh_tmm_data.layer(coh_tmm_data.n_list, 0);
+    const std::valarray<std::complex<T>> &th_0 = coh_tmm_data.th_0;
+    for (std::size_t z_begin = 0; z_begin < x.size(); z_begin += tile_z) {
+        const std::size_t num_z = std::min(tile_z, x.size() - z_begin);
+        for (std::size_t m = 0; m < num_z; m++) {
+            const T xm = x[z_begin + m];
+            if (xm <= 0) {
+                point_layer[m] = 0;
+                point_depth[m] = xm;
+            } else if (xm > starts.back()) {
+                point_layer[m] = num_layers - 1;
+                point_depth[m] = xm - starts.back();
+            } else {
+                // The last layer whose start is <= x; a point on an interface belongs to the layer before it.
+                point_layer[m] = std::max<std::size_t>(std::ranges::lower_bound(starts, xm) - starts.begin(), 1);
+                point_depth[m] = xm - starts.at(point_layer[m] - 1);
+            }
+        }
+        for (std::size_t wl_begin = 0; wl_begin < num_wl; wl_begin += tile_wl) {
+            const std::size_t tile_num_wl = std::min(tile_wl, num_wl - wl_begin);
+            for (std::size_t j = 0; j < tile_num_wl; j++) {
+                const std::size_t k = wl_begin + j;
+                normalization[j] = pol == 's' ? (n_0[k] * std::cos(th_0[k])).real() :
+                                   (n_0[k] * std::conj(std::cos(th_0[k]))).real();
+            }
+            std::size_t cached_layer = num_layers;  // none
+            for (std::size_t m = 0; m < num_z; m++) {
+                const std::size_t layer = point_layer[m];
+                const T distance = point_depth[m];
+                const std::span<const std::complex<T>> kz = coh_tmm_data.layer(coh_tmm_data.kz_list, layer);
+                const std::span<const std::complex<T>> n = coh_tmm_data.layer(coh_tmm_data.n_list, layer);
+                if (layer not_eq cached_layer) {
+                    const std::span<const std::complex<T>> th = coh_tmm_data.layer(coh_tmm_data.th_list, layer);
+                    for (std::size_t j = 0; j < tile_num_wl; j++) {
+                        cos_th[j] = std::cos(th[wl_begin + j]);
+                        sin_th[j] = std::sin(th[wl_begin + j]);
+                    }
+                    cached_layer = layer;
+                }
+                // Same formulas as position_resolved
+                for (std::size_t j = 0; j < tile_num_wl; j++) {
+                    const std::size_t k = wl_begin + j;
+                    const std::size_t index = m * tile_num_wl + j;
+                    const std::complex<T> v = layer > 0 ? coh_tmm_data.v_list[layer * num_wl + k] : 1;
+                    const std::complex<T> w = layer > 0 ? coh_tmm_data.w_list[layer * num_wl + k] : coh_tmm_data.r[k];
+                    const std::complex<T> Ef = v * std::exp(std::complex<T>(0, 1) * kz[k] * distance);
+                    const std::complex<T> Eb = w * std::exp(-std::complex<T>(0, 1) * kz[k] * distance);
+                    if (pol == 's') {
+                        poyn[index] = (n[k] * cos_th[j] * std::conj(Ef + Eb) * (Ef - Eb)).real() / normalization[j];
+                        absor[index] = (n[k] * cos_th[j] * kz[k] * std::norm(Ef + Eb)).imag() / normalization[j];
+                        Ex[index] = 0;
+                        Ey[index] = Ef + Eb;
+                        Ez[index] = 0;
+                    } else {
+                        poyn[index] = (n[k] * std::conj(cos_th[j]) * (Ef + Eb) * std::conj(Ef - Eb)).real() /
+                                      normalization[j];
+                        absor[index] = (n[k] * std::conj(cos_th[j]) * (kz[k] * std::norm(Ef - Eb) - std::conj(kz[k]) * std::norm(Ef + Eb))).imag() /
+                                       normalization[j];
+                        Ex[index] = (Ef - Eb) * cos_th[j];
+                        Ey[index] = 0;
+                        Ez[index] = -(Ef + Eb) * sin_th[j];
+                    }
+                }
+            }
+            const std::size_t size = num_z * tile_num_wl;
+            sink({z_begin, num_z, wl_begin, tile_num_wl, std::span(poyn).first(size), std::span(absor).first(size),
+                  std::span(Ex).first(size), std::span(Ey).first(size), std::span(Ez).first(size)});
+        }
+    }
+}
+
+template void position_resolved_map(const CohTmmVecResult<double> &coh_tmm_data, const std::valarray<double> &x,
+                                    const FieldMapSink<double> &sink, std::size_t tile_z, std::size_t tile_wl);
+template void position_resolved_map(const CohTmmVecResult<float> &coh_tmm_data, const std::valarray<float> &x,
+                                    const FieldMapSink<float> &sink, std::size_t tile_z, std::size_t tile_wl);
 
 template<typename T>
 auto inc_group_layers(const std::vector<std::valarray<std::complex<T>>> &n_list, const std::valarray<T> &d_list,
@@ -1677,8 +3106,8 @@ template auto inc_group_layers(const std::vector<std::valarray<std::complex<doub
  */
 template<std::floating_point T>
 auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::valarray<T> &d_list,
-             const std::valarray<LayerType> &c_list, const std::complex<T> th_0,
-             const std::valarray<T> &lam_vac) -> inc_tmm_vec_dict<T> {
+             const std::valarray<LayerType> &c_list, const std::complex<T> th_0, const std::valarray<T> &lam_vac,
+             CohTmmWorkspace<T> &workspace) -> inc_tmm_vec_dict<T> {
     const std::size_t num_layers = n_list.size();
     const std::size_t num_wl = lam_vac.size();
     if (std::holds_alternative<std::valarray<std::complex<T>>>(Utils::Math::real_if_close<std::complex<T>, T>(std::valarray<std::complex<T>>(n_list.front() * std::sin(th_0))))) {
@@ -1696,11 +3125,10 @@ auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
 
     std::vector<std::valarray<std::complex<T>>> th_list = list_snell(n_list, th_0);
 
-    std::vector<coh_tmm_vecn_dict<T>> coh_tmm_data_list;
-    std::vector<coh_tmm_vecn_dict<T>> coh_tmm_bdata_list;
+    std::vector<CohTmmVecResult<T>> coh_tmm_data_list(num_stacks);
+    std::vector<CohTmmVecResult<T>> coh_tmm_bdata_list(num_stacks);
     for (std::size_t i : std::views::iota(0U, num_stacks)) {
-        coh_tmm_data_list.emplace_back(coh_tmm(pol, stack_n_list.at(i), stack_d_list.at(i), th_list.at(all_from_stack.at(i).front()), lam_vac));
-        coh_tmm_bdata_list.emplace_back(coh_tmm_reverse(pol, stack_n_list.at(i), stack_d_list.at(i), th_list.at(all_from_stack.at(i).front()), lam_vac));
+        coh_tmm_forward_reverse(pol, stack_n_list.at(i), stack_d_list.at(i), th_list.at(all_from_stack.at(i).front()), lam_vac, coh_tmm_data_list.at(i), coh_tmm_bdata_list.at(i), workspace);
     }
     std::vector<std::valarray<T>> P_list(num_inc_layers, std::valarray<T>(num_wl));
     std::size_t all_inc_i = 0;
@@ -1713,44 +3141,52 @@ auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
     for (std::valarray<T> &Pv : P_list) {
         Pv[Pv < 1e-30] = 1e-30;
     }
-    std::vector<std::vector<std::valarray<T>>> T_list(num_inc_layers, std::vector<std::valarray<T>>(num_inc_layers, std::valarray<T>(num_wl)));
-    std::vector<std::vector<std::valarray<T>>> R_list(num_inc_layers, std::vector<std::valarray<T>>(num_inc_layers, std::valarray<T>(num_wl)));
+    // Only adjacent incoherent layers are connected, so the interface intensities are kept as contiguous blocks of
+    // num_wl values per interface i (between incoherent layers i and i + 1) instead of num_inc_layers^2 tables:
+    // R_forward/T_forward for light going from i to i + 1 and R_backward/T_backward from i + 1 to i.
+    std::valarray<T> R_forward((num_inc_layers - 1) * num_wl);
+    std::valarray<T> T_forward((num_inc_layers - 1) * num_wl);
+    std::valarray<T> R_backward((num_inc_layers - 1) * num_wl);
+    std::valarray<T> T_backward((num_inc_layers - 1) * num_wl);
+    const auto interface = [num_wl](const std::size_t i) -> std::slice {
+        return {i * num_wl, num_wl, 1};
+    };
     std::size_t alllayer_index = 0;
     std::ptrdiff_t nextstack_index = 0;
     for (std::size_t inc_index : std::views::iota(0U, num_inc_layers - 1)) {
         alllayer_index = all_from_inc.at(inc_index);
         nextstack_index = stack_from_inc.at(inc_index + 1);
         if (nextstack_index == -1) {
-            R_list.at(inc_index).at(inc_index + 1) = interface_R(pol, n_list.at(alllayer_index),
-                                                                 n_list.at(alllayer_index + 1),
-                                                                 th_list.at(alllayer_index),
-                                                                 th_list.at(alllayer_index + 1));
-            T_list.at(inc_index).at(inc_index + 1) = interface_T(pol, n_list.at(alllayer_index),
-                                                                 n_list.at(alllayer_index + 1),
-                                                                 th_list.at(alllayer_index),
-                                                                 th_list.at(alllayer_index + 1));
-            R_list.at(inc_index + 1).at(inc_index) = interface_R(pol, n_list.at(alllayer_index + 1),
-                                                                 n_list.at(alllayer_index),
-                                                                 th_list.at(alllayer_index + 1),
-                                                                 th_list.at(alllayer_index));
-            T_list.at(inc_index + 1).at(inc_index) = interface_T(pol, n_list.at(alllayer_index + 1),
-                                                                 n_list.at(alllayer_index),
-                                                                 th_list.at(alllayer_index + 1),
-                                                                 th_list.at(alllayer_index));
+            R_forward[interface(inc_index)] = interface_R(pol, n_list.at(alllayer_index),
+                                                          n_list.at(alllayer_index + 1),
+                                                          th_list.at(alllayer_index),
+                                                          th_list.at(alllayer_index + 1));
+            T_forward[interface(inc_index)] = interface_T(pol, n_list.at(alllayer_index),
+                                                          n_list.at(alllayer_index + 1),
+                                                          th_list.at(alllayer_index),
+                                                          th_list.at(alllayer_index + 1));
+            R_backward[interface(inc_index)] = interface_R(pol, n_list.at(alllayer_index + 1),
+                                                           n_list.at(alllayer_index),
+                                                           th_list.at(alllayer_index + 1),
+                                                           th_list.at(alllayer_index));
+            T_backward[interface(inc_index)] = interface_T(pol, n_list.at(alllayer_index + 1),
+                                                           n_list.at(alllayer_index),
+                                                           th_list.at(alllayer_index + 1),
+                                                           th_list.at(alllayer_index));
         } else {
-            R_list.at(inc_index).at(inc_index + 1) = std::get<std::valarray<T>>(coh_tmm_data_list.at(nextstack_index).at("R"));
-            T_list.at(inc_index).at(inc_index + 1) = std::get<std::valarray<T>>(coh_tmm_data_list.at(nextstack_index).at("T"));
-            R_list.at(inc_index + 1).at(inc_index) = std::get<std::valarray<T>>(coh_tmm_bdata_list.at(nextstack_index).at("R"));
-            T_list.at(inc_index + 1).at(inc_index) = std::get<std::valarray<T>>(coh_tmm_bdata_list.at(nextstack_index).at("T"));
+            R_forward[interface(inc_index)] = coh_tmm_data_list.at(nextstack_index).R;
+            T_forward[interface(inc_index)] = coh_tmm_data_list.at(nextstack_index).Tr;
+            R_backward[interface(inc_index)] = coh_tmm_bdata_list.at(nextstack_index).R;
+            T_backward[interface(inc_index)] = coh_tmm_bdata_list.at(nextstack_index).Tr;
         }
     }
     std::valarray<boost::numeric::ublas::matrix<T>> L0(boost::numeric::ublas::matrix<T>(2, 2, NAN), num_wl);
     std::vector<std::valarray<boost::numeric::ublas::matrix<T>>> L_list{std::move(L0)};
     std::valarray<boost::numeric::ublas::matrix<T>> Ltilde(boost::numeric::ublas::zero_matrix<T>(2, 2), num_wl);
     for (std::size_t i : std::views::iota(0U, num_wl)) {
-        Ltilde[i] <<= 1 / T_list[0][1][i]              , -R_list[1][0][i] / T_list[0][1][i],
-                      R_list[0][1][i] / T_list[0][1][i], (T_list[1][0][i] * T_list[0][1][i] - R_list[1][0][i] * R_list[0][1][i]) / T_list[0][1][i];
-        // We can write Ltilde[i] = Ltilde[i] / T_list[0][1][i] but not Ltilde = Ltilde / T_list[0][1]
+        Ltilde[i] <<= 1 / T_forward[i]              , -R_backward[i] / T_forward[i],
+                      R_forward[i] / T_forward[i], (T_backward[i] * T_forward[i] - R_backward[i] * R_forward[i]) / T_forward[i];
+        // We can write Ltilde[i] = Ltilde[i] / T_forward[i] but not Ltilde = Ltilde / T_forward
     }
     boost::numeric::ublas::matrix<T> L(2, 2);
     boost::numeric::ublas::matrix<T> L1(2, 2);
@@ -1794,10 +3230,14 @@ auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
         for (std::size_t j : std::views::iota(0U, num_wl)) {
             L1 <<= 1 / P_list.at(i)[j], 0,
                    0                     , P_list.at(i)[j];
-            L2 <<= 1                              , -R_list.at(i + 1).at(i)[j],
-                   R_list.at(i).at(i + 1)[j], T_list.at(i + 1).at(i)[j] * T_list.at(i).at(i + 1)[j] - R_list.at(i + 1).at(i)[j] * R_list.at(i).at(i + 1)[j];
+            const T R_f = R_forward[i * num_wl + j];
+            const T T_f = T_forward[i * num_wl + j];
+            const T R_b = R_backward[i * num_wl + j];
+            const T T_b = T_backward[i * num_wl + j];
+            L2 <<= 1  , -R_b,
+                   R_f, T_b * T_f - R_b * R_f;
             L = boost::numeric::ublas::prod(L1, L2);
-            L /= T_list.at(i).at(i + 1)[j];
+            L /= T_f;
             Li[j] = L;
             Ltilde[j] = boost::numeric::ublas::prod(Ltilde[j], L);
         }
@@ -1853,38 +3293,62 @@ auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &
         auto prev_stack_index = stack_from_inc[i + 1];
 #endif
         if (prev_stack_index == -1) {
-#ifdef _MSC_VER
-            power_entering_list.emplace_back(i == 0 ? T_list[0][1] - VW_list[1][1] * T_list[1][0] :
-                                             VW_list[i][0] * P_list[i] * T_list[i][i + 1] -
-                                             VW_list[i + 1][1] * T_list[i + 1][i]);
-#else
-            power_entering_list.emplace_back(i == 0 ? std::valarray<T>(T_list[0][1] - VW_list[1][1] * T_list[1][0]) :
-                                             std::valarray<T>(VW_list[i][0] * P_list[i] * T_list[i][i + 1] -
-                                             VW_list[i + 1][1] * T_list[i + 1][i]));
-#endif
+            const std::valarray<T> T_f = T_forward[interface(i)];
+            const std::valarray<T> T_b = T_backward[interface(i)];
+            power_entering_list.emplace_back(i == 0 ? std::valarray<T>(T_f - VW_list[1][1] * T_b) :
+                                             std::valarray<T>(VW_list[i][0] * P_list[i] * T_f -
+                                             VW_list[i + 1][1] * T_b));
         } else {
-            power_entering_list.emplace_back(stackFB_list[prev_stack_index][0] * std::get<std::valarray<T>>(coh_tmm_data_list.at(prev_stack_index).at("T")) -
-                    stackFB_list[prev_stack_index][1] * std::get<std::valarray<T>>(coh_tmm_bdata_list.at(prev_stack_index).at("power_entering")));
+            power_entering_list.emplace_back(stackFB_list[prev_stack_index][0] * coh_tmm_data_list.at(prev_stack_index).Tr -
+                    stackFB_list[prev_stack_index][1] * coh_tmm_bdata_list.at(prev_stack_index).power_entering);
         }
     }
     // despite checking in interface_T and interface_R, still sometimes end up with
     // unphysical R or T values of incident from medium with n > 1
     R[R > 1] = 1;
     Tr[Tr < 0] = 0;
+    // The dictionary output keeps the coh_tmm_vecn_dict form of the stack results for compatibility.
+    std::vector<coh_tmm_vecn_dict<T>> coh_tmm_data_dicts;
+    std::vector<coh_tmm_vecn_dict<T>> coh_tmm_bdata_dicts;
+    for (std::size_t i : std::views::iota(0U, num_stacks)) {
+        coh_tmm_data_dicts.emplace_back(coh_tmm_data_list.at(i).to_dict());
+        coh_tmm_bdata_dicts.emplace_back(coh_tmm_bdata_list.at(i).to_dict());
+    }
     group_layer_data.merge(inc_tmm_vec_dict<T>{{"T", Tr},
                                                {"R", R},
                                                {"VW_list", VW_list},
-                                               {"coh_tmm_data_list", coh_tmm_data_list},
-                                               {"coh_tmm_bdata_list", coh_tmm_bdata_list},
+                                               {"coh_tmm_data_list", std::move(coh_tmm_data_dicts)},
+                                               {"coh_tmm_bdata_list", std::move(coh_tmm_bdata_dicts)},
                                                {"stackFB_list", stackFB_list},
                                                {"power_entering_list", power_entering_list}});
     return group_layer_data;
 }
 
+template auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
+                      const std::valarray<double> &d_list, const std::valarray<LayerType> &c_list,
+                      std::complex<double> th_0, const std::valarray<double> &lam_vac,
+                      CohTmmWorkspace<double> &workspace) -> inc_tmm_vec_dict<double>;
+template auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::valarray<float> &d_list, const std::valarray<LayerType> &c_list,
+                      std::complex<float> th_0, const std::valarray<float> &lam_vac,
+                      CohTmmWorkspace<float> &workspace) -> inc_tmm_vec_dict<float>;
+
+template<std::floating_point T>
+auto inc_tmm(const char pol, const std::vector<std::valarray<std::complex<T>>> &n_list, const std::valarray<T> &d_list,
+             const std::valarray<LayerType> &c_list, const std::complex<T> th_0,
+             const std::valarray<T> &lam_vac) -> inc_tmm_vec_dict<T> {
+    CohTmmWorkspace<T> workspace;
+    return inc_tmm(pol, n_list, d_list, c_list, th_0, lam_vac, workspace);
+}
+
 template auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<double>>> &n_list,
                       const std::valarray<double> &d_list, const std::valarray<LayerType> &c_list,
                       std::complex<double> th_0,
                       const std::valarray<double> &lam_vac) -> inc_tmm_vec_dict<double>;
+template auto inc_tmm(char pol, const std::vector<std::valarray<std::complex<float>>> &n_list,
+                      const std::valarray<float> &d_list, const std::valarray<LayerType> &c_list,
+                      std::complex<float> th_0,
+                      const std::valarray<float> &lam_vac) -> inc_tmm_vec_dict<float>;
 
 template<typename T>
 auto inc_absorp_in_each_layer(const inc_tmm_vec_dict<T> &inc_data) -> std::vector<std::valarray<T>> {
@@ -1921,6 +3385,7 @@ auto inc_absorp_in_each_layer(const inc_tmm_vec_dict<T> &inc_data) -> std::vecto
 }
 
 template auto inc_absorp_in_each_layer(const inc_tmm_vec_dict<double> &inc_data) -> std::vector<std::valarray<double>>;
+template auto inc_absorp_in_each_layer(const inc_tmm_vec_dict<float> &inc_data) -> std::vector<std::valarray<float>>;
 
 template<typename T>
 auto inc_find_absorp_analytic_fn(const std::size_t layer, const inc_tmm_vec_dict<T> &inc_data) -> AbsorpAnalyticVecFn<T> {
@@ -2041,18 +3506,119 @@ template auto inc_position_resolved(std::valarray<std::size_t> &&layer, const st
                                     const std::valarray<std::valarray<double>> &alphas,
                                     double zero_threshold) -> std::valarray<std::valarray<double>>;
 
+template<typename T>
+void inc_position_resolved_map(const std::valarray<std::size_t> &layer, const std::valarray<T> &dist,
+                               const inc_tmm_vec_dict<T> &inc_tmm_data, const std::valarray<LayerType> &coherency_list,
+                               const std::valarray<std::valarray<T>> &alphas, const FieldMapSink<T> &sink,
+                               const std::size_t tile_z, const T zero_threshold) {
+    if (layer.size() not_eq dist.size()) {
+        throw std::invalid_argument("layer and dist must have the same size");
+    }
+    if (tile_z == 0) {
+        throw std::invalid_argument("The tile sizes must be positive.");
+    }
+    const std::vector<std::valarray<T>> A_per_layer = inc_absorp_in_each_layer(inc_tmm_data);
+    const std::size_t num_layers = A_per_layer.size();
+    const std::size_t num_wl = A_per_layer.front().size();
+    // Same cumulative sums and layer indexing as inc_position_resolved: the fraction reaching entry i of the
+    // consecutive-unique layers of the whole map is used for the last such entry of each layer.
+    std::vector<std::valarray<T>> fraction_reaching(num_layers, std::valarray<T>(num_wl));
+    fraction_reaching.front() = 1 - A_per_layer.front();
+    for (std::size_t i = 1; i < num_layers; i++) {
+        for (std::size_t j = 0; j < num_wl; j++) {
+            T cumsum_axis0 = A_per_layer.front()[j];
+            for (std::size_t k = 1; k < i + 1; k++) {
+                cumsum_axis0 += A_per_layer.at(k)[j];
+            }
+            fraction_reaching.at(i)[j] = 1 - cumsum_axis0;
+        }
+    }
+    std::vector<std::size_t> layers;
+    std::ranges::unique_copy(layer, std::back_inserter(layers));
+    std::vector<std::size_t> fraction_index(num_layers);
+    for (std::size_t i = 0; i < layers.size(); i++) {
+        fraction_index.at(layers[i]) = i;
+    }
+    // Per-layer coefficients of the whole map: the analytic function of a coherent layer, and the factor of
+    // beer_lambert of an incoherent layer, whose normalization depends on the deepest point of the layer.
+    std::vector<std::optional<AbsorpAnalyticVecFn<T>>> fns(num_layers);
+    std::vector<std::valarray<T>> factors(num_layers);
+    std::vector<T> max_dist(num_layers, -INFINITY);
+    for (std::size_t m = 0; m < layer.size(); m++) {
+        max_dist.at(layer[m]) = std::max(max_dist.at(layer[m]), static_cast<T>(dist[m] * 1e9));
+    }
+    for (const std::size_t l : layers) {
+        if (coherency_list[l] == LayerType::Coherent) {
+            if (not fns.at(l)) {
+                fns.at(l).emplace(inc_find_absorp_analytic_fn(l, inc_tmm_data));
+            }
+        } else if (factors.at(l).size() == 0) {
+            const std::valarray<T> &fraction = fraction_reaching.at(fraction_index.at(l));
+            const std::valarray<T> A_integrated = fraction * (1 - std::exp(-alphas[l] * max_dist.at(l)));
+            std::valarray<T> scale = A_per_layer.at(l) / A_integrated;
+            std::ranges::replace_if(scale, [](const T sc) -> bool {
+                return std::isnan(sc) or std::isinf(sc);
+            }, 0);
+            factors.at(l) = scale * fraction * alphas[l];
+        }
+    }
+    const std::size_t max_z = std::min(tile_z, dist.size());
+    std::vector<T> absor(max_z * num_wl);
+    std::valarray<T> z;  // depths of the points of a coherent layer in the tile
+    for (std::size_t z_begin = 0; z_begin < dist.size(); z_begin += tile_z) {
+        const std::size_t num_z = std::min(tile_z, dist.size() - z_begin);
+        const std::valarray<std::size_t> tile_layer = layer[std::slice(z_begin, num_z, 1)];
+        const std::valarray<T> tile_dist = dist[std::slice(z_begin, num_z, 1)];
+        for (std::size_t l = 0; l < num_layers; l++) {
+            if (not fns.at(l)) {
+                continue;
+            }
+            z = tile_dist[tile_layer == l];
+            if (z.size() == 0) {
+                continue;
+            }
+            const std::valarray<std::valarray<std::complex<T>>> A_layer = fns.at(l)->run(z);
+            std::size_t p = 0;
+            for (std::size_t m = 0; m < num_z; m++) {
+                if (tile_layer[m] not_eq l) {
+                    continue;
+                }
+                for (std::size_t k = 0; k < num_wl; k++) {
+                    absor[m * num_wl + k] = A_layer[p][k].real();
+                }
+                p++;
+            }
+        }
+        for (std::size_t m = 0; m < num_z; m++) {
+            const std::size_t l = tile_layer[m];
+            if (coherency_list[l] not_eq LayerType::Coherent) {
+                const T depth = dist[z_begin + m] * 1e9;
+                for (std::size_t k = 0; k < num_wl; k++) {
+                    absor[m * num_wl + k] = factors.at(l)[k] * std::exp(-alphas[l][k] * depth);
+                }
+            }
+            const std::valarray<T> &fraction = fraction_reaching.at(fraction_index.at(l));
+            for (std::size_t k = 0; k < num_wl; k++) {
+                if (fraction[k] < zero_threshold) {
+                    absor[m * num_wl + k] = 0;
+                }
+            }
+        }
+        sink({z_begin, num_z, 0, num_wl, {}, std::span(absor).first(num_z * num_wl), {}, {}, {}});
+    }
+}
+
+template void inc_position_resolved_map(const std::valarray<std::size_t> &layer, const std::valarray<double> &dist,
+                                        const inc_tmm_vec_dict<double> &inc_tmm_data,
+                                        const std::valarray<LayerType> &coherency_list,
+                                        const std::valarray<std::valarray<double>> &alphas,
+                                        const FieldMapSink<double> &sink, std::size_t tile_z, double zero_threshold);
+
 template<typename T>
 auto beer_lambert(const std::valarray<T> &alphas, const std::valarray<T> &fraction, const std::valarray<T> &dist,
                   const std::valarray<T> &A_total) -> std::valarray<std::valarray<T>> {
     const std::size_t sz_d = dist.size();
     const std::size_t sz_alpha = alphas.size();
-    std::valarray<std::valarray<T>> expn(std::valarray<T>(sz_d), sz_alpha);
-    // We are doing outer products here, similar to AbsorpAnalyticVecFn<T>::run()
-    for (std::size_t i = 0; i < sz_alpha; i++) {
-        for (std::size_t j = 0; j < sz_d; j++) {
-            expn[i][j] = std::exp(-alphas[i] * dist[j]);
-        }
-    }
     const std::valarray<T> A_integrated = fraction * (1 - std::exp(-alphas * std::ranges::max(dist)));
     // Check std::ranges::contains(A_integrated, 0))
     std::valarray<T> scale = A_total / A_integrated;
@@ -2060,8 +3626,11 @@ auto beer_lambert(const std::valarray<T> &alphas, const std::valarray<T> &fracti
         return std::isnan(sc) or std::isinf(sc);  // 0/0 is nan; otherwise /0 is inf.
     }, 0);
     std::valarray<std::valarray<T>> output(std::valarray<T>(sz_d), sz_alpha);
+    // Outer product, similar to AbsorpAnalyticVecFn<T>::run(), as one vector exponential of the whole dist per
+    // wavelength
     for (std::size_t i = 0; i < sz_alpha; i++) {
-        output[i] = scale[i] * fraction[i] * alphas[i] * expn[i];  // Not dividing 1e9 here
+        Utils::Math::exp_scaled<T>({std::begin(dist), sz_d}, -alphas[i], {std::begin(output[i]), sz_d});
+        output[i] *= scale[i] * fraction[i] * alphas[i];  // Not dividing 1e9 here
     }
     return output;
 }
@@ -2069,3 +3638,78 @@ auto beer_lambert(const std::valarray<T> &alphas, const std::valarray<T> &fracti
 template auto beer_lambert(const std::valarray<double> &alphas, const std::valarray<double> &fraction,
                            const std::valarray<double> &dist,
                            const std::valarray<double> &A_total) -> std::valarray<std::valarray<double>>;
+
+template<typename T>
+BeerLambertGeneration<T>::BeerLambertGeneration(const std::valarray<T> &x, const std::vector<T> &d_list,
+                                                const std::vector<std::valarray<T>> &alphas,
+                                                const std::valarray<T> &photon_flux) {
+    const std::size_t num_layers = d_list.size();
+    const std::size_t num_wl = photon_flux.size();
+    if (num_layers == 0 or alphas.size() not_eq num_layers) {
+        throw std::invalid_argument("alphas must have one absorption spectrum for each layer of d_list");
+    }
+    if (std::ranges::any_of(alphas, [num_wl](const std::valarray<T> &alpha) { return alpha.size() not_eq num_wl; })) {
+        throw std::invalid_argument("alphas and photon_flux must have the same number of wavelengths");
+    }
+    std::vector<T> ends(num_layers);  // ends[l] is the end of layer l
+    std::partial_sum(d_list.cbegin(), d_list.cend(), ends.begin());
+    // Points grouped by layer with their distance from the start of the layer
+    std::vector<std::vector<std::pair<std::size_t, T>>> points(num_layers);
+    for (std::size_t m = 0; m < x.size(); m++) {
+        if (x[m] < 0 or x[m] > ends.back()) {
+            continue;
+        }
+        // The first layer whose end is >= x; a point on an interface belongs to the layer before it.
+        const std::size_t layer = std::ranges::lower_bound(ends, x[m]) - ends.begin();
+        points.at(layer).emplace_back(m, x[m] - (ends.at(layer) - d_list.at(layer)));
+    }
+    std::vector<T> transmission(num_wl), weight(num_wl), attenuation(num_wl);
+    for (const bool side : {false, true}) {
+        std::valarray<T> &G = unit.at(side);
+        G.resize(x.size(), 0);
+        std::ranges::fill(transmission, 1);
+        for (std::size_t i = 0; i < num_layers; i++) {
+            const std::size_t layer = side ? num_layers - 1 - i : i;
+            const std::valarray<T> &alpha = alphas.at(layer);
+            const std::span<const T> alpha_span(std::begin(alpha), num_wl);
+            const T d = d_list.at(layer);
+            // The per-layer factors: everything but the exponential of the depth
+            for (std::size_t j = 0; j < num_wl; j++) {
+                weight[j] = photon_flux[j] * transmission[j] * alpha[j];
+            }
+            for (const auto &[m, z_left] : points.at(layer)) {
+                const T z = side ? d - z_left : z_left;
+                Utils::Math::exp_scaled<T>(alpha_span, -z, attenuation);
+                G[m] = std::inner_product(weight.cbegin(), weight.cend(), attenuation.cbegin(), static_cast<T>(0));
+            }
+            Utils::Math::exp_scaled<T>(alpha_span, -d, attenuation);
+            for (std::size_t j = 0; j < num_wl; j++) {
+                transmission[j] *= attenuation[j];
+            }
+        }
+    }
+}
+
+template<typename T>
+void BeerLambertGeneration<T>::generation(const T intensity, const bool side, std::valarray<T> &G) const {
+    const std::valarray<T> &unit_G = unit.at(side);
+    if (G.size() not_eq unit_G.size()) {
+        G.resize(unit_G.size());
+    }
+    for (std::size_t m = 0; m < unit_G.size(); m++) {
+        G[m] = intensity * unit_G[m];
+    }
+}
+
+template<typename T>
+auto BeerLambertGeneration<T>::generation(const T intensity, const bool side) const -> std::valarray<T> {
+    return intensity * unit.at(side);
+}
+
+template<typename T>
+auto BeerLambertGeneration<T>::unit_generation(const bool side) const -> const std::valarray<T> & {
+    return unit.at(side);
+}
+
+template class BeerLambertGeneration<double>;
+template class BeerLambertGeneration<float>;
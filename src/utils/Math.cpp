@@ -61,6 +61,8 @@ auto Utils::Math::real_if_close(const std::valarray<T1> &a, T2 tol) -> std::vari
 // member function templates, and member functions of class templates when the class is implicitly instantiated.
 template auto Utils::Math::real_if_close(const std::valarray<std::complex<double>> &a,
                                          double tol) -> std::variant<std::valarray<std::complex<double>>, std::valarray<double>>;
+template auto Utils::Math::real_if_close(const std::valarray<std::complex<float>> &a,
+                                         float tol) -> std::variant<std::valarray<std::complex<float>>, std::valarray<float>>;
 
 // real_if_close for singleton
 // The compiler takes responsibility to match only std::complex<T>template<typename T>
@@ -5,15 +5,24 @@
 #ifndef UTILS_MATH_H
 #define UTILS_MATH_H
 
+#include <algorithm>
 #include <complex>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
+#include <list>
 #include <ranges>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
 #include <valarray>
 #include <variant>
 #include <vector>
 #include <QList>
 
 #include "Global.h"
+#include "VectorMath.h"
 
 namespace Utils::Math {
     constexpr float TOL = 100;
@@ -44,37 +53,163 @@ namespace Utils::Math {
     template<typename T>
     auto linspace(T start, T stop, T step) -> std::vector<T>;
 
+    /*
+     * Brackets of the query points of a linear interpolation on an ascending x:
+     * yi[i] = (1 - weight[i]) * y[index[i]] + weight[i] * y[index[i] + 1] for any y of num_x values.
+     * They depend on x and xi only, so tables on the same x (e.g., n and k of a material) share them.
+     */
+    template<std::floating_point T>
+    struct Interp1Brackets {
+        std::size_t num_x = 0;
+        std::vector<std::size_t> index;
+        std::vector<T> weight;
+    };
+
+    /*
+     * A sorted xi is bracketed by one merge walk along x, O(N + M); otherwise every point is bracketed by binary
+     * search, O(M log N). Points outside x are clamped to the end values, as in numpy.interp.
+     */
+    template<FloatingList X, FloatingList XI>
+    auto interp1_brackets(const X &x,
+                          const XI &xi) -> Interp1Brackets<typename std::remove_reference_t<X>::value_type> {
+        using T = typename std::remove_reference_t<X>::value_type;
+        const std::size_t num_x = x.size();
+        const std::size_t num_xi = xi.size();
+        if (num_x < 2) {
+            throw std::invalid_argument("x and y must have at least two elements");
+        }
+        Interp1Brackets<T> brackets{num_x, std::vector<std::size_t>(num_xi), std::vector<T>(num_xi)};
+        const bool sorted = std::is_sorted(std::begin(xi), std::end(xi));
+        std::size_t j = 0;  // x[j] < xi[i] <= x[j + 1]
+        for (std::size_t i = 0; i < num_xi; i++) {
+            const T xi_val = xi[i];
+            if (xi_val <= x[0]) {
+                brackets.index[i] = 0;
+                brackets.weight[i] = 0;
+                continue;
+            }
+            if (xi_val >= x[num_x - 1]) {
+                brackets.index[i] = num_x - 2;
+                brackets.weight[i] = 1;
+                continue;
+            }
+            if (sorted) {
+                while (x[j + 1] < xi_val) {
+                    j++;
+                }
+            } else {
+                const std::size_t upper = std::lower_bound(std::begin(x), std::end(x), xi_val) - std::begin(x);
+                j = std::max<std::size_t>(upper, 1) - 1;  // a NaN finds no bracket and interpolates to NaN
+            }
+            brackets.index[i] = j;
+            brackets.weight[i] = (xi_val - x[j]) / (x[j + 1] - x[j]);
+        }
+        return brackets;
+    }
+
+    /*
+     * One gather pass over precomputed brackets; yi is resized to the number of query points if necessary.
+     * The weights are exactly 0 or 1 at the ends and the knots, so the values of y are reproduced there.
+     * Contiguous y and yi of T take the vectorized lerp_gather; other lists take the scalar loop.
+     */
+    template<std::floating_point T, FloatingList Y, FloatingList YI>
+    void interp1_apply(const Interp1Brackets<T> &brackets, const Y &y, YI &yi) {
+        if (static_cast<std::size_t>(y.size()) not_eq brackets.num_x) {
+            throw std::invalid_argument("x and y must have the same length");
+        }
+        const std::size_t num_xi = brackets.index.size();
+        if (static_cast<std::size_t>(yi.size()) not_eq num_xi) {
+            yi.resize(num_xi);
+        }
+        if constexpr (std::ranges::contiguous_range<const Y &> and std::ranges::contiguous_range<YI &> and
+                      std::same_as<std::ranges::range_value_t<const Y &>, T> and
+                      std::same_as<std::ranges::range_value_t<YI &>, T>) {
+            lerp_gather<T>(brackets.index, brackets.weight, {std::ranges::data(y), brackets.num_x},
+                           {std::ranges::data(yi), num_xi});
+            return;
+        }
+        for (std::size_t i = 0; i < num_xi; i++) {
+            const std::size_t j = brackets.index[i];
+            const T w = brackets.weight[i];
+            yi[i] = (1 - w) * y[j] + w * y[j + 1];
+        }
+    }
+
+    /*
+     * Rows computed on a grid, e.g., the indices of a material interpolated on a wavelength grid, keyed by the grid
+     * values themselves so that two grids never collide. The rows are valid for one version of the data they are
+     * computed from: a lookup or insertion with another version drops them all. At most capacity grids are kept, and
+     * an insertion beyond that evicts the least recently used one.
+     */
+    template<std::floating_point T, typename Row>
+    class GridCache {
+    public:
+        explicit GridCache(const std::size_t capacity = 8) : capacity(std::max<std::size_t>(capacity, 1)) {}
+
+        // The row of grid, which becomes the most recently used one, or nullptr
+        auto find(const std::span<const T> grid, const std::uint64_t version) -> const Row * {
+            if (version not_eq data_version) {
+                clear();
+                data_version = version;
+                return nullptr;
+            }
+            const auto it = std::ranges::find_if(entries, [grid](const Entry &entry) -> bool {
+                return std::ranges::equal(entry.first, grid);
+            });
+            if (it == entries.end()) {
+                return nullptr;
+            }
+            entries.splice(entries.begin(), entries, it);
+            return &entries.front().second;
+        }
+
+        auto insert(std::vector<T> grid, const std::uint64_t version, Row row) -> const Row & {
+            if (version not_eq data_version) {
+                clear();
+                data_version = version;
+            }
+            std::erase_if(entries, [&grid](const Entry &entry) -> bool { return entry.first == grid; });
+            entries.emplace_front(std::move(grid), std::move(row));
+            if (entries.size() > capacity) {
+                entries.pop_back();
+            }
+            return entries.front().second;
+        }
+
+        void clear() {
+            entries.clear();
+        }
+
+        [[nodiscard]] auto size() const -> std::size_t {
+            return entries.size();
+        }
+
+        // Bytes held by the grids and the rows
+        [[nodiscard]] auto bytes() const -> std::size_t {
+            std::size_t total = 0;
+            for (const auto &[grid, row] : entries) {
+                total += grid.size() * sizeof(T) + std::size(row) * sizeof(typename Row::value_type);
+            }
+            return total;
+        }
+
+    private:
+        using Entry = std::pair<std::vector<T>, Row>;
+
+        std::size_t capacity;
+        std::uint64_t data_version = 0;
+        std::list<Entry> entries;  // most recently used first
+    };
+
     // If you do not want to import a heap of headers of instances list QList, put the definition here.
     // Note that the parameter order is different from numpy.interp!
     template<FloatingList U, FloatingList V>
-    auto interp1_linear(U &&x, U &&y, V &&xi) -> std::remove_reference_t<U> {
+    auto interp1_linear(U &&x, U &&y, V &&xi) -> std::remove_cvref_t<U> {
         if (x.size() not_eq y.size()) {
             throw std::invalid_argument("x and y must have the same length");
         }
-        if (x.size() < 2) {
-            throw std::invalid_argument("x and y must have at least two elements");
-        }
-        std::remove_reference_t<U> yi(static_cast<typename std::remove_reference_t<U>::value_type>(xi.size()));
-        // const typename std::remove_reference_t<V>::value_type xi_val
-#ifdef __cpp_lib_ranges_enumerate
-        for (const auto [i, xi_val] : std::views::enumerate(xi)) {
-#else
-        for (auto i = 0; i < xi.size(); ++i) {
-            auto xi_val = xi[i];
-#endif
-            if (xi_val <= x.front()) {
-                yi[i] = y.front();
-            } else if (xi_val >= x.back()) {
-                yi[i] = y.back();
-            } else {
-                for (size_t j = 0; j < x.size() - 1; ++j) {
-                    if (xi_val >= x[j] && xi_val <= x[j + 1]) {
-                        yi[i] = std::lerp(y[j], y[j + 1], (xi_val - x[j]) / (x[j + 1] - x[j]));
-                        break;
-                    }
-                }
-            }
-        }
+        std::remove_cvref_t<U> yi(xi.size());
+        interp1_apply(interp1_brackets(x, xi), y, yi);
         return yi;
     }
 }
@@ -0,0 +1,209 @@
+#include <cmath>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(_M_X64)
+#define VECTOR_MATH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "VectorMath.h"
+
+namespace {
+#ifdef VECTOR_MATH_X86
+    const bool use_avx2 = Utils::Math::has_avx2_fma();
+
+// The AVX2 kernels are compiled for AVX2 and FMA regardless of the compiler flags and only called if use_avx2.
+// MSVC accepts the intrinsics in any function.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+    // 2^k for integral k of normal range
+    auto pow2(const __m256d k) -> __m256d {
+        const __m256i biased = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)),
+                                                _mm256_set1_epi64x(1023));
+        return _mm256_castsi256_pd(_mm256_slli_epi64(biased, 52));
+    }
+
+    auto pow2(const __m256 k) -> __m256 {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k),
+                                                                      _mm256_set1_epi32(127)), 23));
+    }
+
+    /*
+     * exp(x) = 2^n * exp(r) with n = round(x / ln(2)) and |r| <= ln(2) / 2, where ln(2) is split into a high part
+     * exact in n * ln(2) and a low part (Cephes). exp(r) is its Taylor series up to r^13, whose truncation error is
+     * below 1e-17. 2^n is applied as 2^(n / 2) * 2^(n - n / 2), so that both factors stay normal down to the
+     * subnormal results.
+     */
+    auto exp_avx2(const __m256d x) -> __m256d {
+        const __m256d max_x = _mm256_set1_pd(709.782712893384);  // ln(DBL_MAX)
+        const __m256d min_x = _mm256_set1_pd(-745.1332191019411);  // ln of the smallest subnormal
+        // The operand order keeps NaN, as max and min return their second operand if either is NaN.
+        const __m256d xc = _mm256_min_pd(max_x, _mm256_max_pd(min_x, x));
+        const __m256d n = _mm256_round_pd(_mm256_mul_pd(xc, _mm256_set1_pd(1.4426950408889634)),
+                                          _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(6.93145751953125e-1), xc);
+        r = _mm256_fnmadd_pd(n, _mm256_set1_pd(1.42860682030941723212e-6), r);
+        constexpr double coefficients[] = {1.0 / 6227020800, 1.0 / 479001600, 1.0 / 39916800, 1.0 / 3628800,
+                                           1.0 / 362880, 1.0 / 40320, 1.0 / 5040, 1.0 / 720, 1.0 / 120, 1.0 / 24,
+                                           1.0 / 6, 1.0 / 2, 1, 1};
+        __m256d p = _mm256_set1_pd(coefficients[0]);
+        for (std::size_t i = 1; i < std::size(coefficients); i++) {
+            p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(coefficients[i]));
+        }
+        const __m256d n_half = _mm256_floor_pd(_mm256_mul_pd(n, _mm256_set1_pd(0.5)));
+        __m256d y = _mm256_mul_pd(_mm256_mul_pd(p, pow2(n_half)), pow2(_mm256_sub_pd(n, n_half)));
+        y = _mm256_blendv_pd(y, _mm256_setzero_pd(), _mm256_cmp_pd(x, min_x, _CMP_LT_OQ));
+        return _mm256_blendv_pd(y, _mm256_set1_pd(INFINITY), _mm256_cmp_pd(x, max_x, _CMP_GT_OQ));
+    }
+
+    // As above, with the minimax polynomial of Cephes expf for exp(r)
+    auto exp_avx2(const __m256 x) -> __m256 {
+        const __m256 max_x = _mm256_set1_ps(88.7228391F);  // ln(FLT_MAX)
+        const __m256 min_x = _mm256_set1_ps(-103.972084F);  // ln of half the smallest subnormal
+        const __m256 xc = _mm256_min_ps(max_x, _mm256_max_ps(min_x, x));
+        const __m256 n = _mm256_round_ps(_mm256_mul_ps(xc, _mm256_set1_ps(1.44269504088896341F)),
+                                         _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375F), xc);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4F), r);
+        constexpr float coefficients[] = {1.9875691500e-4F, 1.3981999507e-3F, 8.3334519073e-3F, 4.1665795894e-2F,
+                                          1.6666665459e-1F, 5.0000001201e-1F};
+        __m256 p = _mm256_set1_ps(coefficients[0]);
+        for (std::size_t i = 1; i < std::size(coefficients); i++) {
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(coefficients[i]));
+        }
+        // 1 + r + r^2 * p
+        p = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(r, r), p, r), _mm256_set1_ps(1));
+        const __m256 n_half = _mm256_floor_ps(_mm256_mul_ps(n, _mm256_set1_ps(0.5F)));
+        __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, pow2(n_half)), pow2(_mm256_sub_ps(n, n_half)));
+        y = _mm256_blendv_ps(y, _mm256_setzero_ps(), _mm256_cmp_ps(x, min_x, _CMP_LT_OQ));
+        return _mm256_blendv_ps(y, _mm256_set1_ps(INFINITY), _mm256_cmp_ps(x, max_x, _CMP_GT_OQ));
+    }
+
+    // Returns the number of elements done, a multiple of the lane width.
+    auto exp_scaled_avx2(const double *x, const double scale, double *y, const std::size_t n) -> std::size_t {
+        const __m256d s = _mm256_set1_pd(scale);
+        std::size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            _mm256_storeu_pd(y + j, exp_avx2(_mm256_mul_pd(s, _mm256_loadu_pd(x + j))));
+        }
+        return j;
+    }
+
+    auto exp_scaled_avx2(const float *x, const float scale, float *y, const std::size_t n) -> std::size_t {
+        const __m256 s = _mm256_set1_ps(scale);
+        std::size_t j = 0;
+        for (; j + 8 <= n; j += 8) {
+            _mm256_storeu_ps(y + j, exp_avx2(_mm256_mul_ps(s, _mm256_loadu_ps(x + j))));
+        }
+        return j;
+    }
+
+    // Returns the number of points done, a multiple of the lane width.
+    auto lerp_gather_avx2(const std::size_t *index, const double *weight, const double *y, double *yi,
+                          const std::size_t n) -> std::size_t {
+        static_assert(sizeof(std::size_t) == sizeof(long long));
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256i j = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + i));
+            const __m256d y0 = _mm256_i64gather_pd(y, j, 8);
+            const __m256d y1 = _mm256_i64gather_pd(y + 1, j, 8);
+            const __m256d w = _mm256_loadu_pd(weight + i);
+            _mm256_storeu_pd(yi + i, _mm256_fmadd_pd(w, y1, _mm256_fnmadd_pd(w, y0, y0)));
+        }
+        return i;
+    }
+
+    auto lerp_gather_avx2(const std::size_t *index, const float *weight, const float *y, float *yi,
+                          const std::size_t n) -> std::size_t {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            // The 64-bit indices gather 4 floats at a time.
+            const __m256i j_low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + i));
+            const __m256i j_high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + i + 4));
+            const __m256 y0 = _mm256_set_m128(_mm256_i64gather_ps(y, j_high, 4), _mm256_i64gather_ps(y, j_low, 4));
+            const __m256 y1 = _mm256_set_m128(_mm256_i64gather_ps(y + 1, j_high, 4),
+                                              _mm256_i64gather_ps(y + 1, j_low, 4));
+            const __m256 w = _mm256_loadu_ps(weight + i);
+            _mm256_storeu_ps(yi + i, _mm256_fmadd_ps(w, y1, _mm256_fnmadd_ps(w, y0, y0)));
+        }
+        return i;
+    }
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
+}
+
+auto Utils::Math::has_avx2_fma() -> bool {
+#ifdef VECTOR_MATH_X86
+#if defined(_MSC_VER) && not defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    constexpr int fma = 1 << 12, osxsave = 1 << 27, avx = 1 << 28;
+    if ((info[2] & (fma | osxsave | avx)) not_eq (fma | osxsave | avx) or (_xgetbv(0) & 6) not_eq 6) {
+        return false;  // the OS must also save the YMM registers
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) not_eq 0;
+#else
+    return __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma");
+#endif
+#else
+    return false;
+#endif
+}
+
+template<std::floating_point T>
+void Utils::Math::exp_scaled(const std::span<const T> x, const T scale, const std::span<T> y) {
+    if (x.size() not_eq y.size()) {
+        throw std::invalid_argument("x and y must have the same size.");
+    }
+    std::size_t simd_end = 0;
+#ifdef VECTOR_MATH_X86
+    if (use_avx2) {
+        simd_end = exp_scaled_avx2(x.data(), scale, y.data(), x.size());
+    }
+#endif
+    for (std::size_t j = simd_end; j < x.size(); j++) {
+        y[j] = std::exp(scale * x[j]);
+    }
+}
+
+template void Utils::Math::exp_scaled(std::span<const double> x, double scale, std::span<double> y);
+template void Utils::Math::exp_scaled(std::span<const float> x, float scale, std::span<float> y);
+
+template<std::floating_point T>
+void Utils::Math::lerp_gather(const std::span<const std::size_t> index, const std::span<const T> weight,
+                              const std::span<const T> y, const std::span<T> yi) {
+    if (index.size() not_eq yi.size() or weight.size() not_eq yi.size()) {
+        throw std::invalid_argument("index, weight, and yi must have the same size.");
+    }
+    std::size_t simd_end = 0;
+#ifdef VECTOR_MATH_X86
+    if (use_avx2) {
+        simd_end = lerp_gather_avx2(index.data(), weight.data(), y.data(), yi.data(), yi.size());
+    }
+#endif
+    for (std::size_t i = simd_end; i < yi.size(); i++) {
+        const std::size_t j = index[i];
+        const T w = weight[i];
+        yi[i] = (1 - w) * y[j] + w * y[j + 1];
+    }
+}
+
+template void Utils::Math::lerp_gather(std::span<const std::size_t> index, std::span<const double> weight,
+                                       std::span<const double> y, std::span<double> yi);
+template void Utils::Math::lerp_gather(std::span<const std::size_t> index, std::span<const float> weight,
+                                       std::span<const float> y, std::span<float> yi);
@@ -0,0 +1,39 @@
+#ifndef UTILS_VECTORMATH_H
+#define UTILS_VECTORMATH_H
+
+#include <concepts>
+#include <cstddef>
+#include <span>
+
+/*
+ * Element-wise kernels over contiguous arrays, evaluated with AVX2 and FMA on x86-64 CPUs that support them, detected
+ * at run time as for ComplexMatrix2Batch, and with a portable scalar loop otherwise, so the binary needs no
+ * CPU-specific compiler flags. Unlike Math.h, this does not depend on Qt.
+ */
+namespace Utils::Math {
+    /*
+     * Whether the CPU and the OS support AVX2 and FMA, checked once at run time (always false off x86-64)
+     */
+    [[nodiscard]] auto has_avx2_fma() -> bool;
+
+    /*
+     * y[j] = exp(scale * x[j]). The AVX2 path reduces the argument by multiples of ln(2) and evaluates a polynomial,
+     * which agrees with std::exp to a few ulps, underflows gradually to 0, overflows to inf, and propagates NaN.
+     * x and y must have the same size; y may alias x.
+     */
+    template<std::floating_point T>
+    void exp_scaled(std::span<const T> x, T scale, std::span<T> y);
+
+    /*
+     * yi[i] = (1 - weight[i]) * y[index[i]] + weight[i] * y[index[i] + 1], the gather pass of a linear interpolation
+     * over precomputed brackets (see Interp1Brackets). The AVX2 path gathers both knots of 4 (double) or 8 (float)
+     * points at once and evaluates y0 - weight * y0 + weight * y1 with FMA, which agrees with the scalar loop to a
+     * few ulps and, like it, reproduces y exactly where the weight is 0 or 1.
+     * index and weight must have the size of yi, and every index[i] + 1 must be in y.
+     */
+    template<std::floating_point T>
+    void lerp_gather(std::span<const std::size_t> index, std::span<const T> weight, std::span<const T> y,
+                     std::span<T> yi);
+}
+
+#endif  // UTILS_VECTORMATH_H
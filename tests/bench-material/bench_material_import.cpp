@@ -0,0 +1,163 @@
+/*
+ * Timing benchmark of loading the n/k data of an imported Solcore database, on a fixture database of num_materials
+ * materials of num_points points each, generated in the temporary directory. It compares the first use of every
+ * material after a lazy import (what a calculation pays later), preload_nk on one and on all hardware threads,
+ * preload_nk under a MaterialResidency budget of a quarter of the data (which stops early), and the first use of
+ * every material served from a MaterialStore built from the fixture. The fixture is read once before timing, so that
+ * every run reads it from the page cache.
+ * Usage: bench-material-import [num_materials] [num_points]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+#include "MaterialResidency.h"
+#include "MaterialStore.h"
+#include "OpticMaterial.h"
+#include "ParameterSystem.h"
+
+namespace {
+    using Material = OpticMaterial<QList<double>>;
+
+    /*
+     * Writes <root>/mat_<i>/n.txt and k.txt in the Solcore format, two whitespace-separated columns of the
+     * wavelength and n or k, and returns the material directories.
+     */
+    auto make_fixture(const QDir &root, const std::size_t num_materials, const std::size_t num_points) -> QStringList {
+        QStringList mat_paths;
+        for (std::size_t i = 0; i < num_materials; i++) {
+            const QString mat_path = root.filePath(QString("mat_%1").arg(i));
+            QDir().mkpath(mat_path);
+            for (const QString &column : {QString("n"), QString("k")}) {
+                QFile file(QDir(mat_path).filePath(column + ".txt"));
+                if (not file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                    std::fprintf(stderr, "Cannot write %s\n", qUtf8Printable(file.fileName()));
+                    std::exit(1);
+                }
+                QTextStream stream(&file);
+                for (std::size_t j = 0; j < num_points; j++) {
+                    const double wl = 200e-9 + 1e-9 * static_cast<double>(j);
+                    const double value = column == "n" ? 1.5 + 1e-3 * static_cast<double>(i) + wl * 1e5 : wl * 1e4;
+                    stream << QString::number(wl, 'e', 6) << ' ' << QString::number(value, 'e', 6);
+                    if (j + 1 < num_points) {
+                        stream << '\n';
+                    }
+                }
+            }
+            mat_paths.append(mat_path);
+        }
+        return mat_paths;
+    }
+
+    auto make_materials(const QStringList &mat_paths) -> std::vector<std::unique_ptr<Material>> {
+        std::vector<std::unique_ptr<Material>> materials;
+        for (qsizetype i = 0; i < mat_paths.size(); i++) {
+            materials.push_back(std::make_unique<Material>(QString("Mat%1").arg(i), DbType::SOLCORE, mat_paths.at(i)));
+        }
+        return materials;
+    }
+
+    auto pointers(const std::vector<std::unique_ptr<Material>> &materials) -> std::vector<Material *> {
+        std::vector<Material *> ptrs;
+        for (const std::unique_ptr<Material> &material : materials) {
+            ptrs.push_back(material.get());
+        }
+        return ptrs;
+    }
+
+    /*
+     * Wall time of func, in milliseconds
+     */
+    template<typename F>
+    auto elapsed_ms(F func) -> double {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        const auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    auto first_use_all(const std::vector<std::unique_ptr<Material>> &materials) -> std::size_t {
+        std::size_t num_loaded = 0;
+        for (const std::unique_ptr<Material> &material : materials) {
+            num_loaded += material->nData().empty() ? 0 : 1;
+        }
+        return num_loaded;
+    }
+}
+
+auto main(int argc, char *argv[]) -> int {
+    const QCoreApplication app(argc, argv);
+    const std::size_t num_materials = argc > 1 ? std::stoul(argv[1]) : 200;
+    const std::size_t num_points = argc > 2 ? std::stoul(argv[2]) : 2000;
+    const std::size_t num_threads = std::max(1U, std::thread::hardware_concurrency());
+    QDir root(QDir::temp().filePath("bench_material_import"));
+    root.removeRecursively();
+    QDir().mkpath(root.path());
+    const QStringList mat_paths = make_fixture(root, num_materials, num_points);
+    ParameterSystem::SetInstance({}, root.path());  // no composition materials
+    MaterialResidency<Material> &residency = MaterialResidency<Material>::instance();
+    residency.set_budget(std::numeric_limits<std::size_t>::max());
+    const std::atomic_bool cancel = false;
+    static_cast<void>(first_use_all(make_materials(mat_paths)));  // warm up the page cache
+
+    std::printf("%zu materials x %zu points, %zu threads\n", num_materials, num_points, num_threads);
+    std::printf("%-26s %10s %8s\n", "mode", "time [ms]", "loaded");
+    const auto report = [](const char *mode, const double time, const std::size_t num_loaded) {
+        std::printf("%-26s %10.1f %8zu\n", mode, time, num_loaded);
+    };
+    {
+        const std::vector<std::unique_ptr<Material>> materials = make_materials(mat_paths);
+        std::size_t num_loaded = 0;
+        const double time = elapsed_ms([&] { num_loaded = first_use_all(materials); });
+        report("lazy, first use", time, num_loaded);
+    }
+    for (const std::size_t threads : {std::size_t{1}, num_threads}) {
+        const std::vector<std::unique_ptr<Material>> materials = make_materials(mat_paths);
+        const std::vector<Material *> ptrs = pointers(materials);
+        std::size_t num_loaded = 0;
+        const double time = elapsed_ms([&] { num_loaded = preload_nk<QList<double>>(ptrs, threads, cancel); });
+        report(threads == 1 ? "preload, 1 thread" : "preload, all threads", time, num_loaded);
+    }
+    {
+        // Wavelengths, n, and k of every material
+        residency.set_budget(num_materials * num_points * 3 * sizeof(double) / 4);
+        const std::vector<std::unique_ptr<Material>> materials = make_materials(mat_paths);
+        const std::vector<Material *> ptrs = pointers(materials);
+        std::size_t num_loaded = 0;
+        const double time = elapsed_ms([&] { num_loaded = preload_nk<QList<double>>(ptrs, num_threads, cancel); });
+        report("preload, 1/4 budget", time, num_loaded);
+        residency.set_budget(std::numeric_limits<std::size_t>::max());
+    }
+    {
+        const QString store_path = root.filePath("fixture.nkdb");
+        {
+            const std::vector<std::unique_ptr<Material>> materials = make_materials(mat_paths);
+            const std::vector<Material *> ptrs = pointers(materials);
+            if (MaterialStore::build(store_path, QList<Material *>(ptrs.begin(), ptrs.end())) < 0 or
+                not MaterialStore::instance().open(store_path)) {
+                std::fprintf(stderr, "Cannot build the material store\n");
+                return 1;
+            }
+        }
+        const std::vector<std::unique_ptr<Material>> materials = make_materials(mat_paths);
+        std::size_t num_loaded = 0;
+        const double time = elapsed_ms([&] { num_loaded = first_use_all(materials); });
+        report("store, first use", time, num_loaded);
+        MaterialStore::instance().close();
+    }
+    root.removeRecursively();
+}
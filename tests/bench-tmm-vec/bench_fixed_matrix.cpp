@@ -0,0 +1,117 @@
+/*
+ * Microbenchmark of the 2x2 complex matrix products of the transfer-matrix chain: the generic (bounds-checked)
+ * dot of FixedMatrix, the specialized multiply_2x2 and multiply_2x2_batch, and boost::numeric::ublas::prod of
+ * bounded_matrix. Each method chains num_factors products for every one of num_chains independent chains, like
+ * Mtilde = A @ M_1 @ ... @ M_{num_layers - 2} at every wavelength, and reports the time per 2x2 product.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <vector>
+#ifdef _MSC_VER  // Silence the warning from boost uBLAS
+#define _SILENCE_CXX17_ITERATOR_BASE_CLASS_DEPRECATION_WARNING
+#endif
+#include <boost/numeric/ublas/matrix.hpp>
+#include "../../src/optics/FixedMatrix.h"
+
+using Matrix = FixedMatrix<std::complex<double>, 2, 2>;
+using UblasMatrix = boost::numeric::ublas::bounded_matrix<std::complex<double>, 2, 2>;
+
+namespace {
+    constexpr std::size_t num_chains = 4096;
+    constexpr std::size_t num_factors = 8;
+    constexpr int num_repeats = 50;
+
+    /*
+     * Best time over num_repeats runs of func, in nanoseconds per 2x2 product
+     */
+    template<typename F>
+    auto best_ns(F func) -> double {
+        double best = INFINITY;
+        for (int repeat = 0; repeat < num_repeats; repeat++) {
+            const auto start = std::chrono::steady_clock::now();
+            func();
+            const auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count());
+        }
+        return best / (num_chains * num_factors);
+    }
+}
+
+auto main() -> int {
+    std::mt19937_64 engine(42);
+    std::uniform_real_distribution<double> distribution(-1, 1);
+    // factors[f * num_chains + k] is factor f of chain k.
+    std::vector<Matrix> factors(num_factors * num_chains);
+    std::vector<UblasMatrix> ublas_factors(num_factors * num_chains);
+    for (std::size_t m = 0; m < factors.size(); m++) {
+        for (std::size_t i = 0; i < 2; i++) {
+            for (std::size_t j = 0; j < 2; j++) {
+                // Close to unitary in magnitude, so that the chains neither overflow nor underflow
+                const std::complex<double> z(0.5 * distribution(engine), 0.5 * distribution(engine));
+                factors.at(m)(i, j) = z;
+                ublas_factors.at(m)(i, j) = z;
+            }
+        }
+    }
+    const auto identity = [] {
+        Matrix eye;
+        eye(0, 0) = eye(1, 1) = 1;
+        return eye;
+    };
+    std::vector<Matrix> dot_out(num_chains, identity());
+    std::vector<Matrix> fixed_out(num_chains, identity());
+    std::vector<Matrix> batch_out(num_chains, identity());
+    std::vector<UblasMatrix> ublas_out(num_chains, boost::numeric::ublas::identity_matrix<std::complex<double>>(2));
+    const double dot_ns = best_ns([&] {
+        std::ranges::fill(dot_out, identity());
+        for (std::size_t k = 0; k < num_chains; k++) {
+            for (std::size_t f = 0; f < num_factors; f++) {
+                dot_out[k] = dot(dot_out[k], factors[f * num_chains + k]);
+            }
+        }
+    });
+    const double fixed_ns = best_ns([&] {
+        std::ranges::fill(fixed_out, identity());
+        for (std::size_t k = 0; k < num_chains; k++) {
+            for (std::size_t f = 0; f < num_factors; f++) {
+                fixed_out[k] = multiply_2x2(fixed_out[k], factors[f * num_chains + k]);
+            }
+        }
+    });
+    const double batch_ns = best_ns([&] {
+        std::ranges::fill(batch_out, identity());
+        for (std::size_t f = 0; f < num_factors; f++) {
+            multiply_2x2_batch<double>(batch_out, std::span(factors).subspan(f * num_chains, num_chains), batch_out);
+        }
+    });
+    const double ublas_ns = best_ns([&] {
+        std::ranges::fill(ublas_out, boost::numeric::ublas::identity_matrix<std::complex<double>>(2));
+        for (std::size_t k = 0; k < num_chains; k++) {
+            for (std::size_t f = 0; f < num_factors; f++) {
+                ublas_out[k] = boost::numeric::ublas::prod(ublas_out[k], ublas_factors[f * num_chains + k]);
+            }
+        }
+    });
+    double max_difference = 0;
+    for (std::size_t k = 0; k < num_chains; k++) {
+        for (std::size_t i = 0; i < 2; i++) {
+            for (std::size_t j = 0; j < 2; j++) {
+                max_difference = std::max({max_difference, std::abs(fixed_out[k](i, j) - dot_out[k](i, j)),
+                                           std::abs(batch_out[k](i, j) - dot_out[k](i, j)),
+                                           std::abs(ublas_out[k](i, j) - dot_out[k](i, j))});
+            }
+        }
+    }
+    std::printf("%-20s %10s\n", "method", "[ns/product]");
+    std::printf("%-20s %10.2f\n", "dot", dot_ns);
+    std::printf("%-20s %10.2f\n", "multiply_2x2", fixed_ns);
+    std::printf("%-20s %10.2f\n", "multiply_2x2_batch", batch_ns);
+    std::printf("%-20s %10.2f\n", "ublas::prod", ublas_ns);
+    std::printf("max |difference| from dot: %g\n", max_difference);
+    return 0;
+}
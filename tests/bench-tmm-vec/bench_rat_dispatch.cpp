@@ -0,0 +1,80 @@
+/*
+ * Timing benchmark of the coherent dispatch of calculate_rat_indices over the precompiled layer counts of
+ * coh_tmm_fixed. For 's', the automatic dispatch (coh_tmm_fixed) is compared with coh_tmm on the SIMD matrix batch;
+ * for 'u', the automatic dispatch (the fused coh_tmm_unpolarized) is compared with one coh_tmm_fixed pass per
+ * polarization. All kernels run with CohTmmOutput::Absorption. Every time is the best of num_repeats calls, and the
+ * last column is the speedup of the automatic dispatch over the alternative.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdio>
+#include <valarray>
+#include <vector>
+#include "../../src/optics/RatKernels.h"
+
+namespace {
+    constexpr int num_repeats = 20;
+
+    /*
+     * Best wall time of func over num_repeats runs, in microseconds
+     */
+    template<typename F>
+    auto best_us(F func) -> double {
+        double best = INFINITY;
+        for (int repeat = 0; repeat < num_repeats; repeat++) {
+            const auto start = std::chrono::steady_clock::now();
+            func();
+            const auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::micro>(stop - start).count());
+        }
+        return best;
+    }
+}
+
+auto main() -> int {
+    constexpr std::complex<double> th_0 = 0.3;
+    std::printf("%4s %8s %6s %16s %16s %9s\n", "pol", "layers", "wl", "automatic [us]", "alternative [us]", "speedup");
+    for (std::size_t num_layers = coh_tmm_fixed_min_layers; num_layers <= coh_tmm_fixed_max_layers; num_layers++) {
+        for (const std::size_t num_wl : {rat_chunk_size, std::size_t{2000}}) {
+            std::vector<std::valarray<std::complex<double>>> n_list(num_layers,
+                                                                    std::valarray<std::complex<double>>(num_wl));
+            std::vector<double> d_list(num_layers, 100);
+            d_list.front() = d_list.back() = INFINITY;
+            std::valarray<double> lam_vac(num_wl);
+            for (std::size_t j = 0; j < num_wl; j++) {
+                lam_vac[j] = 400 + 0.5 * static_cast<double>(j);
+                n_list.front()[j] = 1;
+                for (std::size_t i = 1; i < num_layers; i++) {
+                    n_list.at(i)[j] = {1.5 + 0.1 * static_cast<double>(i),
+                                       0.01 * static_cast<double>(i) + 1e-3 * static_cast<double>(j) / num_wl};
+                }
+            }
+            const std::valarray<LayerType> coherency_va(LayerType::Coherent, num_layers);
+            for (const char pol : {'s', 'u'}) {
+                const double automatic = best_us([&] {
+                    calculate_rat_indices(n_list, d_list, coherency_va, th_0, lam_vac, pol, true);
+                });
+                // The alternative kernels with the same allocations and post-processing as calculate_rat_indices
+                const double alternative = best_us([&] {
+                    CohTmmVecResult<double> out_s;
+                    CohTmmVecResult<double> out_p;
+                    if (pol == 's') {
+                        coh_tmm(pol, n_list, d_list, th_0, lam_vac, out_s, CohTmmOutput::Absorption);
+                        static_cast<void>(absorp_in_each_layer(out_s));
+                    } else {
+                        coh_tmm_fixed_dispatch('s', n_list, d_list, th_0, lam_vac, out_s, CohTmmOutput::Absorption);
+                        coh_tmm_fixed_dispatch('p', n_list, d_list, th_0, lam_vac, out_p, CohTmmOutput::Absorption);
+                        static_cast<void>((absorp_in_each_layer(out_p) + absorp_in_each_layer(out_s)) /
+                                          std::valarray<double>(2, num_wl));
+                    }
+                });
+                std::printf("%4c %8zu %6zu %16.1f %16.1f %9.2f\n", pol, num_layers, num_wl, automatic, alternative,
+                            alternative / automatic);
+            }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Memory benchmark of the vectorized coh_tmm and inc_tmm on large stacks.
+ * The global operator new and operator delete are replaced to count the bytes allocated on the heap, so the peak
+ * heap usage of a single call can be compared with the size of a num_layers x num_layers coefficient table, which
+ * grows quadratically with the number of layers, while the interface coefficients only need num_layers - 1 blocks.
+ * The "reused" column is a repeated coh_tmm call with the same CohTmmWorkspace and CohTmmVecResult, which should not
+ * allocate at all.
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <valarray>
+#include <vector>
+#include "../../src/optics/tmm.h"
+
+namespace {
+    std::size_t current_bytes = 0;
+    std::size_t peak_bytes = 0;
+    // Each allocation is prefixed by its size, keeping the default alignment of the allocation.
+    constexpr std::size_t header = alignof(std::max_align_t);
+}
+
+void *operator new(const std::size_t size) {
+    void *block = std::malloc(size + header);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t *>(block) = size;
+    current_bytes += size;
+    if (current_bytes > peak_bytes) {
+        peak_bytes = current_bytes;
+    }
+    return static_cast<char *>(block) + header;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    void *block = static_cast<char *>(ptr) - header;
+    current_bytes -= *static_cast<std::size_t *>(block);
+    std::free(block);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+/*
+ * Peak heap bytes allocated by func on top of what was already allocated, and the wall time in milliseconds
+ */
+template<typename F>
+auto measure(F func) -> std::pair<std::size_t, double> {
+    const std::size_t baseline = current_bytes;
+    peak_bytes = current_bytes;
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const auto stop = std::chrono::steady_clock::now();
+    return {peak_bytes - baseline, std::chrono::duration<double, std::milli>(stop - start).count()};
+}
+
+auto main() -> int {
+    constexpr std::size_t num_wl = 4000;
+    std::valarray<double> lam_vac(num_wl);
+    for (std::size_t j = 0; j < num_wl; j++) {
+        lam_vac[j] = 300 + 0.2 * static_cast<double>(j);
+    }
+    std::printf("%8s %10s %14s %14s %10s %14s %10s %14s %10s\n", "layers", "wl", "L*L table [B]", "coh_tmm [B]", "[ms]",
+                "reused [B]", "[ms]", "inc_tmm [B]", "[ms]");
+    for (const std::size_t num_layers : {10UZ, 20UZ, 40UZ, 80UZ}) {
+        // Alternating absorbing layers between semi-infinite air and glass
+        std::valarray<std::complex<double>> n_flat(num_layers * num_wl);
+        std::vector<std::valarray<std::complex<double>>> n_list(num_layers, std::valarray<std::complex<double>>(num_wl));
+        std::valarray<double> d_list(num_layers);
+        std::valarray<LayerType> c_list(LayerType::Coherent, num_layers);
+        for (std::size_t i = 0; i < num_layers; i++) {
+            const std::complex<double> n = i == 0 ? 1 : i == num_layers - 1 ? 1.5 :
+                                           i % 2 ? std::complex<double>(2.2, 0.01) : std::complex<double>(1.4, 0.001);
+            for (std::size_t j = 0; j < num_wl; j++) {
+                n_flat[i * num_wl + j] = n;
+                n_list.at(i)[j] = n;
+            }
+            d_list[i] = i == 0 or i == num_layers - 1 ? INFINITY : 100;
+        }
+        c_list[0] = c_list[num_layers - 1] = LayerType::Incoherent;
+        c_list[num_layers / 2] = LayerType::Incoherent;  // splits the stack into two coherent stacks
+        d_list[num_layers / 2] = 5000;
+        const std::size_t table_bytes = 2 * num_layers * num_layers * num_wl * sizeof(std::complex<double>);
+        const auto [coh_bytes, coh_ms] = measure([&] {
+            const coh_tmm_vec_dict<double> coh_tmm_data = coh_tmm('s', n_flat, d_list, std::complex<double>(0.3),
+                                                                  lam_vac);
+        });
+        const std::vector<double> d_vector(std::begin(d_list), std::end(d_list));
+        CohTmmWorkspace<double> workspace;
+        CohTmmVecResult<double> result;
+        coh_tmm('s', n_list, d_vector, std::complex<double>(0.3), lam_vac, result, workspace);
+        const auto [reused_bytes, reused_ms] = measure([&] {
+            coh_tmm('s', n_list, d_vector, std::complex<double>(0.3), lam_vac, result, workspace);
+        });
+        const auto [inc_bytes, inc_ms] = measure([&] {
+            const inc_tmm_vec_dict<double> inc_tmm_data = inc_tmm('s', n_list, d_list, c_list,
+                                                                  std::complex<double>(0.3), lam_vac);
+        });
+        std::printf("%8zu %10zu %14zu %14zu %10.1f %14zu %10.1f %14zu %10.1f\n", num_layers, num_wl, table_bytes,
+                    coh_bytes, coh_ms, reused_bytes, reused_ms, inc_bytes, inc_ms);
+    }
+    return 0;
+}
@@ -5,12 +5,23 @@
 // GCC/Clang has already forwarded <algorithm> from <valarray>, but it is not the case for MSVC.
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <numbers>
 #include <functional>
+#include "../../src/material/MaterialResidency.h"
+#include "../../src/material/MaterialStoreFile.h"
+#include "../../src/optics/FixedMatrix.h"
+#include "../../src/optics/MatrixBatch.h"
+#include "../../src/optics/RatCache.h"
+#include "../../src/optics/RatKernels.h"
+#include "../../src/optics/Spectrum.h"
 #include "../../src/optics/tmm.h"
 #include "../../src/utils/Approx.h"
 #include "../../src/utils/Math.h"
 #include "../../src/utils/Range.h"
+#include "../../src/utils/VectorMath.h"
 
 using namespace std::complex_literals;
 
@@ -380,6 +391,1213 @@ void test_coh_tmm_reverse() {
     assert(std::get<std::valarray<std::complex<double>>>(result.at("kz_list")) == kzl_approx);
 }
 
+void test_coh_tmm_result() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770};
+    CohTmmVecResult<double> result;
+    coh_tmm('s', n_list, d_list, th_0, lam_vac, result);
+    const ApproxSequenceLike<std::valarray<std::complex<double>>, double> r_approx = approx<std::valarray<std::complex<double>>, double>({0.14017645 - 0.2132843i, 0.22307786 - 0.10704008i});
+    const ApproxSequenceLike<std::valarray<double>, double> R_approx = approx<std::valarray<double>, double>({0.06513963, 0.06122131});
+    const ApproxSequenceLike<std::valarray<double>, double> T_approx = approx<std::valarray<double>, double>({1.15234466e-09, 4.13619185e-01});
+    const ApproxSequenceLike<std::valarray<double>, double> power_approx = approx<std::valarray<double>, double>({0.93486037, 0.93877869});
+    const ApproxSequenceLike<std::vector<std::complex<double>>, double> v1_approx = approx<std::vector<std::complex<double>>, double>({1.18358724 - 0.233272105i, 1.03160316 - 0.0728921467i});
+    assert(result.r == r_approx);
+    assert(result.R == R_approx);
+    assert(result.Tr == T_approx);
+    assert(result.power_entering == power_approx);
+    const std::span<const std::complex<double>> v1 = result.layer(result.v_list, 1);
+    assert(std::vector<std::complex<double>>(v1.begin(), v1.end()) == v1_approx);
+    const std::vector<double> ab_result = Utils::Range::vv_flatten<std::valarray<std::valarray<double>>, double>(absorp_in_each_layer(result));
+    const ApproxSequenceLike<std::vector<double>, double> ab_approx = approx<std::vector<double>, double>({
+            6.51396300e-02, 6.12213100e-02,
+            9.08895166e-01, 3.25991032e-01,
+            2.59652025e-02, 1.99168474e-01,
+            0, 0,
+            1.15234466e-09, 4.13619185e-01
+        }, 1e-6, 1e-10);
+    assert(ab_approx == ab_result);
+    const coh_tmm_vecn_dict<double> dict = coh_tmm('s', n_list, d_list, th_0, lam_vac);
+    assert(std::get<std::valarray<double>>(dict.at("R")) == R_approx);
+    assert(std::get<std::complex<double>>(dict.at("th_0")) == th_0);
+}
+
+void test_coh_tmm_unpolarized() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770};
+    CohTmmVecResult<double> fused_s;
+    CohTmmVecResult<double> fused_p;
+    coh_tmm_unpolarized(n_list, d_list, th_0, lam_vac, fused_s, fused_p);
+    // The reference is the separate per-polarization coh_tmm_vec_dict path, which shares no code with the fused one.
+    std::valarray<std::complex<double>> flat_n_list = {1.5, 1.0 + 0.4i, 2.0 + 3i, 5, 4.0 + 1i,
+                                                       1.3, 1.2 + 0.2i, 1.5 + 0.3i, 4, 3.0 + 0.1i};
+    flat_n_list = Utils::Range::rng2d_transpose(flat_n_list, 2);
+    const std::valarray<double> d_va(d_list.data(), d_list.size());
+    for (const char pol : {'s', 'p'}) {
+        const coh_tmm_vec_dict<double> single = coh_tmm(pol, flat_n_list, d_va, th_0, lam_vac);
+        const CohTmmVecResult<double> &fused = pol == 's' ? fused_s : fused_p;
+        assert(fused.pol == pol);
+        const std::valarray<std::complex<double>> &r = std::get<std::valarray<std::complex<double>>>(single.at("r"));
+        const std::valarray<std::complex<double>> &t = std::get<std::valarray<std::complex<double>>>(single.at("t"));
+        const std::valarray<double> &R = std::get<std::valarray<double>>(single.at("R"));
+        const std::valarray<double> &Tr = std::get<std::valarray<double>>(single.at("T"));
+        const std::valarray<double> &power_entering = std::get<std::valarray<double>>(single.at("power_entering"));
+        const auto &vw_list = std::get<std::valarray<std::vector<std::array<std::complex<double>, 2>>>>(single.at("vw_list"));
+        for (std::size_t j = 0; j < lam_vac.size(); j++) {
+            assert(std::abs(fused.r[j] - r[j]) < 1e-12);
+            assert(std::abs(fused.t[j] - t[j]) < 1e-12);
+            assert(std::abs(fused.R[j] - R[j]) < 1e-12);
+            assert(std::abs(fused.Tr[j] - Tr[j]) < 1e-12);
+            assert(std::abs(fused.power_entering[j] - power_entering[j]) < 1e-12);
+            for (std::size_t i = 1; i < d_list.size(); i++) {
+                assert(std::abs(fused.v_list[i * lam_vac.size() + j] - vw_list[i].at(j).at(0)) < 1e-12);
+                assert(std::abs(fused.w_list[i * lam_vac.size() + j] - vw_list[i].at(j).at(1)) < 1e-12);
+            }
+        }
+    }
+    // Unpolarized R of tmm.unpolarized_RT for the same stack (see test_unpolarized_RT_R).
+    const std::valarray<double> R_u = (fused_s.R + fused_p.R) / 2.0;
+    const ApproxSequenceLike<std::valarray<double>, double> R_u_approx = approx<std::valarray<double>, double>({0.05134487, 0.05564057});
+    assert(R_u == R_u_approx);
+}
+
+void test_coh_tmm_incremental() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770};
+    for (const std::size_t layer : {1U, 2U, 3U}) {
+        CohTmmIncremental<double> sweep('p', n_list, d_list, th_0, lam_vac, layer);
+        for (const double d : {10.0, 95.5, 1200.0}) {
+            sweep.set_thickness(d);
+            std::vector<double> swept_d_list = d_list;
+            swept_d_list.at(layer) = d;
+            CohTmmVecResult<double> full;
+            coh_tmm('p', n_list, swept_d_list, th_0, lam_vac, full);
+            const CohTmmVecResult<double> &incremental = sweep.result();
+            const std::valarray<std::valarray<double>> A_full = absorp_in_each_layer(full);
+            const std::valarray<std::valarray<double>> A_incremental = sweep.A_per_layer();
+            for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                assert(std::abs(sweep.R()[j] - full.R[j]) < 1e-12);
+                assert(std::abs(sweep.Tr()[j] - full.Tr[j]) < 1e-12);
+                for (std::size_t i = 0; i < d_list.size(); i++) {
+                    assert(std::abs(incremental.v_list[i * lam_vac.size() + j] - full.v_list[i * lam_vac.size() + j]) < 1e-9);
+                    assert(std::abs(incremental.w_list[i * lam_vac.size() + j] - full.w_list[i * lam_vac.size() + j]) < 1e-9);
+                    assert(std::abs(A_incremental[i][j] - A_full[i][j]) < 1e-9);
+                }
+            }
+        }
+    }
+    CohTmmIncremental<double> sweep('s', n_list, d_list, th_0, lam_vac, 2);
+    for (const double d : {-1.0, static_cast<double>(INFINITY), static_cast<double>(NAN)}) {
+        bool thrown = false;
+        try {
+            sweep.set_thickness(d);
+        } catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(sweep.thickness() == 187.3);
+    }
+}
+
+void test_coh_tmm_gradient() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770};
+    const std::size_t num_wl = lam_vac.size();
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> result;
+        CohTmmVecGradient<double> gradient;
+        coh_tmm(pol, n_list, d_list, th_0, lam_vac, result, gradient);
+        // Central finite differences of R, T, and absorp_in_each_layer
+        const auto check = [&](const std::size_t k, const std::valarray<double> &dR, const std::valarray<double> &dT,
+                               const std::valarray<std::valarray<double>> &dA, const double step,
+                               const auto &perturb) -> void {
+            std::vector<std::valarray<std::complex<double>>> n_plus = n_list, n_minus = n_list;
+            std::vector<double> d_plus = d_list, d_minus = d_list;
+            perturb(n_plus.at(k), d_plus.at(k), step);
+            perturb(n_minus.at(k), d_minus.at(k), -step);
+            CohTmmVecResult<double> plus, minus;
+            coh_tmm(pol, n_plus, d_plus, th_0, lam_vac, plus);
+            coh_tmm(pol, n_minus, d_minus, th_0, lam_vac, minus);
+            const std::valarray<std::valarray<double>> A_plus = absorp_in_each_layer(plus);
+            const std::valarray<std::valarray<double>> A_minus = absorp_in_each_layer(minus);
+            for (std::size_t j = 0; j < num_wl; j++) {
+                assert(std::abs(dR[k * num_wl + j] - (plus.R[j] - minus.R[j]) / (2 * step)) < 1e-6);
+                assert(std::abs(dT[k * num_wl + j] - (plus.Tr[j] - minus.Tr[j]) / (2 * step)) < 1e-6);
+                for (std::size_t i = 0; i < d_list.size(); i++) {
+                    // absorp_in_each_layer clamps negative values to 0, where the difference quotient is one-sided.
+                    if (A_plus[i][j] == 0 or A_minus[i][j] == 0) {
+                        continue;
+                    }
+                    assert(std::abs(dA[i][j] - (A_plus[i][j] - A_minus[i][j]) / (2 * step)) < 1e-6);
+                }
+            }
+        };
+        for (std::size_t k = 1; k < d_list.size() - 1; k++) {
+            check(k, gradient.dR_dd, gradient.dT_dd, gradient.dA_dd.at(k), 1e-4,
+                  [](std::valarray<std::complex<double>> &, double &d, const double h) -> void { d += h; });
+            check(k, gradient.dR_dn, gradient.dT_dn, gradient.dA_dn.at(k), 1e-6,
+                  [](std::valarray<std::complex<double>> &n, double &, const double h) -> void { n += h; });
+            check(k, gradient.dR_dk, gradient.dT_dk, gradient.dA_dk.at(k), 1e-6,
+                  [](std::valarray<std::complex<double>> &n, double &, const double h) -> void {
+                      n += std::complex<double>(0, h);
+                  });
+        }
+    }
+}
+
+void test_generation_profile() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770};
+    const std::valarray<double> photon_flux = {2.5, 0.7};
+    const std::valarray<double> x = {-1, 0, 50, 200, 250.5, 387.3, 1000, 2360.8, 2400};
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> result;
+        coh_tmm(pol, n_list, d_list, th_0, lam_vac, result);
+        const std::valarray<double> G = generation_profile(result, photon_flux, x);
+        assert(G[0] == 0 and G[x.size() - 1] == 0);
+        const std::valarray<std::size_t> layers = {1, 1, 1, 2, 2, 3, 3};
+        const std::valarray<double> z = {0, 50, 200, 50.5, 187.3, 612.7, 1973.5};
+        for (std::size_t m = 0; m < layers.size(); m++) {
+            const std::valarray<double> absor = std::get<std::valarray<double>>(
+                    position_resolved(layers[m], z[m], result).at("absor"));
+            assert(std::abs(G[m + 1] - (photon_flux * absor).sum()) < 1e-12);
+        }
+    }
+}
+
+void test_position_resolved_map() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3, 1.2}, {1.0 + 0.4i, 1.2 + 0.2i, 1.1},
+                                                                     {2.0 + 3i, 1.5 + 0.3i, 1.8 + 0.01i}, {5, 4, 3},
+                                                                     {4.0 + 1i, 3.0 + 0.1i, 2.5}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    constexpr std::complex<double> th_0 = 0.3;
+    const std::valarray<double> lam_vac = {400, 1770, 900};
+    const std::valarray<double> x = {-1, 0, 50, 200, 250.5, 387.3, 1000, 2360.8, 2400};
+    const std::valarray<std::size_t> layers = {0, 0, 1, 1, 2, 2, 3, 3, 4};
+    const std::valarray<double> z = {-1, 0, 50, 200, 50.5, 187.3, 612.7, 1973.5, 39.2};
+    const auto close = [](const auto a, const auto b) -> bool {
+        return std::abs(a - b) <= 1e-12 * (1 + std::abs(b));
+    };
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> result;
+        coh_tmm(pol, n_list, d_list, th_0, lam_vac, result);
+        for (const auto [tile_z, tile_wl] : {std::pair{map_tile_z, map_tile_wl}, std::pair{2UZ, 2UZ}}) {
+            // In-memory sink assembling the whole map
+            std::vector<PositionResolvedVecResult<double>> map(x.size());
+            std::size_t num_tiles = 0;
+            position_resolved_map<double>(result, x, [&map, &num_tiles](const FieldMapTile<double> &tile) {
+                assert(tile.num_z <= 2 or tile.num_z == 9);
+                for (std::size_t m = 0; m < tile.num_z; m++) {
+                    PositionResolvedVecResult<double> &point = map.at(tile.z_begin + m);
+                    if (tile.wl_begin == 0) {
+                        point = {std::valarray<double>(3), std::valarray<double>(3),
+                                 std::valarray<std::complex<double>>(3), std::valarray<std::complex<double>>(3),
+                                 std::valarray<std::complex<double>>(3)};
+                    }
+                    for (std::size_t j = 0; j < tile.num_wl; j++) {
+                        const std::size_t index = m * tile.num_wl + j;
+                        point.poyn[tile.wl_begin + j] = tile.poyn[index];
+                        point.absor[tile.wl_begin + j] = tile.absor[index];
+                        point.Ex[tile.wl_begin + j] = tile.Ex[index];
+                        point.Ey[tile.wl_begin + j] = tile.Ey[index];
+                        point.Ez[tile.wl_begin + j] = tile.Ez[index];
+                    }
+                }
+                num_tiles++;
+            }, tile_z, tile_wl);
+            assert(num_tiles == (tile_z == 2 ? 10 : 1));
+            PositionResolvedVecResult<double> expected;
+            for (std::size_t m = 0; m < x.size(); m++) {
+                position_resolved(layers[m], z[m], result, expected);
+                for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                    assert(close(map.at(m).poyn[j], expected.poyn[j]) and close(map.at(m).absor[j], expected.absor[j]));
+                    assert(close(map.at(m).Ex[j], expected.Ex[j]) and close(map.at(m).Ey[j], expected.Ey[j]) and
+                           close(map.at(m).Ez[j], expected.Ez[j]));
+                }
+            }
+        }
+        // Reduction sink: the absorption summed over the wavelengths, one wavelength per tile
+        std::valarray<double> absor_sum(0.0, x.size());
+        position_resolved_map<double>(result, x, [&absor_sum](const FieldMapTile<double> &tile) {
+            for (std::size_t m = 0; m < tile.num_z; m++) {
+                for (std::size_t j = 0; j < tile.num_wl; j++) {
+                    absor_sum[tile.z_begin + m] += tile.absor[m * tile.num_wl + j];
+                }
+            }
+        }, 4, 1);
+        for (std::size_t m = 0; m < x.size(); m++) {
+            PositionResolvedVecResult<double> expected;
+            position_resolved(layers[m], z[m], result, expected);
+            assert(close(absor_sum[m], expected.absor.sum()));
+        }
+    }
+    CohTmmVecResult<double> rt_result;
+    coh_tmm('s', n_list, d_list, th_0, lam_vac, rt_result, CohTmmOutput::RT);
+    bool thrown = false;
+    try {
+        position_resolved_map<double>(rt_result, x, [](const FieldMapTile<double> &) {});
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_exp_scaled() {
+    // 4003 points are not a multiple of any SIMD width, so both the vectorized lanes and the scalar tail are covered.
+    std::vector<double> x(4003);
+    for (std::size_t j = 0; j < x.size(); j++) {
+        x.at(j) = -750 + 1460 * static_cast<double>(j) / static_cast<double>(x.size() - 1);
+    }
+    x.at(0) = NAN;
+    x.at(1) = -INFINITY;
+    x.at(2) = INFINITY;
+    x.at(3) = 0;
+    x.at(4) = -746;  // below the smallest subnormal
+    x.at(5) = -740;  // a subnormal result
+    x.at(6) = 710;  // beyond DBL_MAX
+    for (const double scale : {1.0, -0.5}) {
+        std::vector<double> y(x.size());
+        Utils::Math::exp_scaled<double>(x, scale, y);
+        for (std::size_t j = 0; j < x.size(); j++) {
+            const double expected = std::exp(scale * x.at(j));
+            if (std::isnan(expected)) {
+                assert(std::isnan(y.at(j)));
+            } else if (expected < std::numeric_limits<double>::min() or std::isinf(expected)) {
+                assert(std::abs(y.at(j) - expected) <= std::numeric_limits<double>::denorm_min() or
+                       y.at(j) == expected);
+            } else {
+                assert(std::abs(y.at(j) - expected) <= 4 * std::numeric_limits<double>::epsilon() * expected);
+            }
+        }
+    }
+    std::vector<float> xf(1003);
+    for (std::size_t j = 0; j < xf.size(); j++) {
+        xf.at(j) = -105 + 195 * static_cast<float>(j) / static_cast<float>(xf.size() - 1);
+    }
+    std::vector<float> yf(xf.size());
+    Utils::Math::exp_scaled<float>(xf, 1, yf);
+    for (std::size_t j = 0; j < xf.size(); j++) {
+        const float expected = std::exp(xf.at(j));
+        if (expected < std::numeric_limits<float>::min() or std::isinf(expected)) {
+            assert(std::abs(yf.at(j) - expected) <= std::numeric_limits<float>::denorm_min() or yf.at(j) == expected);
+        } else {
+            assert(std::abs(yf.at(j) - expected) <= 4 * std::numeric_limits<float>::epsilon() * expected);
+        }
+    }
+    // In place
+    std::vector<float> zf = xf;
+    Utils::Math::exp_scaled<float>(zf, 1, zf);
+    assert(zf == yf);
+    bool thrown = false;
+    try {
+        Utils::Math::exp_scaled<float>(xf, 1, std::span<float>(yf).first(10));
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_beer_lambert_generation() {
+    const std::vector<double> d_list = {100, 200};
+    const std::vector<std::valarray<double>> alphas = {{1e-2, 1e-3}, {5e-3, 0}};
+    const std::valarray<double> photon_flux = {2, 3};
+    const std::valarray<double> x = {-1, 0, 40, 100, 250, 300, 301};
+    const BeerLambertGeneration<double> generation(x, d_list, alphas, photon_flux);
+    // Depth from the illuminated side of the layer and transmission of the layers in front of it
+    const auto expected = [&](const std::size_t layer, const double z, const std::valarray<double> &transmission) {
+        double G = 0;
+        for (std::size_t j = 0; j < photon_flux.size(); j++) {
+            G += photon_flux[j] * transmission[j] * alphas.at(layer)[j] * std::exp(-alphas.at(layer)[j] * z);
+        }
+        return G;
+    };
+    const std::valarray<double> one = {1, 1};
+    const std::valarray<double> through_0 = std::exp(-alphas.front() * d_list.front());
+    const std::valarray<double> through_1 = std::exp(-alphas.back() * d_list.back());
+    const std::valarray<double> left = {0, expected(0, 0, one), expected(0, 40, one), expected(0, 100, one),
+                                        expected(1, 150, through_0), expected(1, 200, through_0), 0};
+    const std::valarray<double> right = {0, expected(0, 100, through_1), expected(0, 60, through_1),
+                                         expected(0, 0, through_1), expected(1, 50, one), expected(1, 0, one), 0};
+    for (std::size_t m = 0; m < x.size(); m++) {
+        assert(std::abs(generation.unit_generation(false)[m] - left[m]) <= 1e-15 * left[m]);
+        assert(std::abs(generation.unit_generation(true)[m] - right[m]) <= 1e-15 * right[m]);
+    }
+    std::valarray<double> G;
+    generation.generation(2.5, true, G);
+    assert(G.size() == x.size());
+    for (std::size_t m = 0; m < x.size(); m++) {
+        assert(G[m] == 2.5 * generation.unit_generation(true)[m]);
+        assert(generation.generation(0.5, false)[m] == 0.5 * generation.unit_generation(false)[m]);
+    }
+    bool thrown = false;
+    try {
+        const BeerLambertGeneration<double> mismatched(x, d_list, {{1e-2, 1e-3}}, photon_flux);
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_grid_cache() {
+    using Row = std::valarray<std::complex<double>>;
+    Utils::Math::GridCache<double, Row> cache;
+    const auto grid_of = [](const std::size_t g) -> std::vector<double> {
+        return {300.0 + static_cast<double>(g), 400, 500};
+    };
+    // Miss, insert, and hit
+    assert(cache.find(grid_of(0), 1) == nullptr);
+    const Row &inserted = cache.insert(grid_of(0), 1, Row(1.5, 3));
+    assert(inserted.size() == 3 and inserted[0] == 1.5);
+    const Row *hit = cache.find(grid_of(0), 1);
+    assert(hit not_eq nullptr and (*hit)[2] == 1.5);
+    // A grid of the same size but other values, and a prefix of a cached grid, are other keys.
+    assert(cache.find(grid_of(1), 1) == nullptr);
+    assert(cache.find(std::vector<double>{300, 400}, 1) == nullptr);
+    assert(cache.size() == 1 and cache.bytes() == 3 * sizeof(double) + 3 * sizeof(std::complex<double>));
+    // Eviction at 8 grids: after a hit on grid 0, grid 1 is the least recently used one and makes room for grid 8.
+    for (std::size_t g = 1; g < 8; g++) {
+        cache.insert(grid_of(g), 1, Row(static_cast<double>(g), 3));
+    }
+    assert(cache.size() == 8);
+    assert(cache.find(grid_of(0), 1) not_eq nullptr);
+    cache.insert(grid_of(8), 1, Row(8.0, 3));
+    assert(cache.size() == 8);
+    assert(cache.find(grid_of(1), 1) == nullptr);
+    assert(cache.find(grid_of(0), 1) not_eq nullptr and cache.find(grid_of(8), 1) not_eq nullptr);
+    assert(cache.find(grid_of(2), 1) not_eq nullptr);
+    // A new data version drops every row, on lookup as well as on insertion.
+    assert(cache.find(grid_of(0), 2) == nullptr);
+    assert(cache.size() == 0);
+    cache.insert(grid_of(0), 2, Row(2.5, 3));
+    cache.insert(grid_of(1), 3, Row(3.5, 3));
+    assert(cache.size() == 1 and cache.find(grid_of(0), 3) == nullptr);
+    assert((*cache.find(grid_of(1), 3))[0] == 3.5);
+    cache.clear();
+    assert(cache.size() == 0 and cache.bytes() == 0);
+}
+
+void test_interp1_linear() {
+    const std::vector<double> x = {300, 310, 330, 360, 400};
+    const std::vector<double> n = {2.0, 2.5, 2.25, 1.5, 1.25};
+    const std::vector<double> k = {0.5, 0.25, 0.125, 0, 0};
+    // Sorted (merge walk) and unsorted (binary search) queries, with the ends, the knots, and points outside x
+    const std::vector<double> sorted_xi = {250, 300, 305, 310, 329, 330, 345, 399, 400, 450};
+    const std::vector<double> unsorted_xi = {345, 250, 400, 305, 330, 450, 310, 399, 329, 300};
+    for (const std::vector<double> &xi : {sorted_xi, unsorted_xi}) {
+        const std::vector<double> yi = Utils::Math::interp1_linear(x, n, xi);
+        assert(yi.size() == xi.size());
+        for (std::size_t i = 0; i < xi.size(); i++) {
+            if (const auto it = std::ranges::find(x, xi.at(i)); it not_eq x.end()) {
+                assert(yi.at(i) == n.at(it - x.begin()));  // exact at the knots
+            } else if (xi.at(i) < x.front() or xi.at(i) > x.back()) {
+                assert(yi.at(i) == (xi.at(i) < x.front() ? n.front() : n.back()));
+            } else {
+                const std::size_t j = std::ranges::upper_bound(x, xi.at(i)) - x.begin() - 1;
+                const double expected = std::lerp(n.at(j), n.at(j + 1), (xi.at(i) - x.at(j)) / (x.at(j + 1) - x.at(j)));
+                assert(std::abs(yi.at(i) - expected) < 1e-15);
+            }
+        }
+    }
+    // The brackets of one grid serve n and k alike.
+    const Utils::Math::Interp1Brackets<double> brackets = Utils::Math::interp1_brackets(x, unsorted_xi);
+    std::valarray<double> ni, ki;
+    Utils::Math::interp1_apply(brackets, n, ni);
+    Utils::Math::interp1_apply(brackets, k, ki);
+    const std::vector<double> n_expected = Utils::Math::interp1_linear(x, n, unsorted_xi);
+    const std::vector<double> k_expected = Utils::Math::interp1_linear(x, k, unsorted_xi);
+    assert(std::ranges::equal(ni, n_expected) and std::ranges::equal(ki, k_expected));
+    bool thrown = false;
+    try {
+        Utils::Math::interp1_apply(brackets, std::vector<double>{1, 2}, ni);
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+    // The vectorized gather against the scalar lerp, over 1003 points (not a multiple of any SIMD width), with
+    // weights of exactly 0 and 1 every few points
+    const auto check_lerp_gather = []<std::floating_point T>(const T tolerance) {
+        std::vector<T> y(200);
+        for (std::size_t j = 0; j < y.size(); j++) {
+            y.at(j) = std::sin(static_cast<T>(j)) + 2;
+        }
+        std::vector<std::size_t> index(1003);
+        std::vector<T> weight(index.size());
+        for (std::size_t i = 0; i < index.size(); i++) {
+            index.at(i) = i * 37 % (y.size() - 1);
+            weight.at(i) = i % 5 == 0 ? 0 : i % 5 == 1 ? 1 : static_cast<T>(i % 97) / 97;
+        }
+        std::vector<T> yi(index.size());
+        Utils::Math::lerp_gather<T>(index, weight, y, yi);
+        for (std::size_t i = 0; i < index.size(); i++) {
+            const T y0 = y.at(index.at(i));
+            const T y1 = y.at(index.at(i) + 1);
+            if (weight.at(i) == 0 or weight.at(i) == 1) {
+                assert(yi.at(i) == (weight.at(i) == 0 ? y0 : y1));
+            } else {
+                assert(std::abs(yi.at(i) - ((1 - weight.at(i)) * y0 + weight.at(i) * y1)) < tolerance);
+            }
+        }
+    };
+    check_lerp_gather(1e-15);
+    check_lerp_gather(1e-6F);
+}
+
+void test_spectrum_library() {
+    SpectrumLibrary library;
+    // Linear irradiance over 300 to 900 nm so that the photon flux is quadratic in the wavelength
+    std::vector<double> wavelength(61);
+    std::vector<double> irradiance(61);
+    for (std::size_t i = 0; i < wavelength.size(); i++) {
+        wavelength.at(i) = 300 + 10.0 * static_cast<double>(i);
+        irradiance.at(i) = 1.5 - wavelength.at(i) / 1000;
+    }
+    library.add_irradiance("AM15", wavelength, irradiance);
+    library.add_line("laser", 638, 10);
+    const std::valarray<double> lam_vac = {400, 500, 638, 700};
+    const std::valarray<double> weights = library.photon_flux("AM15", lam_vac);
+    // Bins are [400, 450], [450, 569], [569, 669], [669, 700]; the running integral is exact at the source points.
+    const auto flux = [](const double a, const double b) -> double {
+        const auto F = [](const double x) -> double {
+            return (1.5 * x * x / 2 - x * x * x / 3000) * 1e-9 / (SpectrumLibrary::h * SpectrumLibrary::c);
+        };
+        return F(b) - F(a);
+    };
+    assert(std::abs(weights.sum() - flux(400, 700)) / flux(400, 700) < 1e-4);
+    assert(std::abs(weights[0] - flux(400, 450)) / weights[0] < 1e-3);
+    assert(std::abs(weights[1] - flux(450, 569)) / weights[1] < 1e-3);
+    // Cached grid
+    assert((library.photon_flux("AM15", lam_vac) == weights).min());
+    const std::valarray<double> line = library.photon_flux("laser", lam_vac);
+    assert(line[0] == 0 and line[1] == 0 and line[3] == 0);
+    assert(std::abs(line[2] - 10 * 638e-9 / (SpectrumLibrary::h * SpectrumLibrary::c)) / line[2] < 1e-12);
+    const std::valarray<double> A = {0.5, 1, 0.25, 0};
+    assert(std::abs(SpectrumLibrary::jsc(line, A) - SpectrumLibrary::q * line[2] / 4) < 1e-12);
+    const std::valarray<std::valarray<double>> A_per_layer = {A, 1 - A};
+    const std::valarray<double> absorbed = SpectrumLibrary::absorbed_photon_flux(weights, A_per_layer);
+    assert(std::abs(absorbed.sum() - weights.sum()) / weights.sum() < 1e-12);
+    // Binary round trip
+    const std::string filename = "test_spectrum_library.bin";
+    library.save_binary("AM15", filename);
+    SpectrumLibrary loaded;
+    loaded.load_binary("AM15", filename);
+    std::remove(filename.c_str());
+    assert((loaded.photon_flux("AM15", lam_vac) == weights).min());
+    // LRU of the resampled weights
+    SpectrumLibrary bounded(2);
+    bounded.add_irradiance("AM15", wavelength, irradiance);
+    const std::valarray<double> lam_vac_2 = {400, 600};
+    const std::valarray<double> lam_vac_3 = {500, 800};
+    bounded.photon_flux("AM15", lam_vac);
+    bounded.photon_flux("AM15", lam_vac_2);
+    bounded.photon_flux("AM15", lam_vac);  // lam_vac_2 is now the least recently used grid
+    bounded.photon_flux("AM15", lam_vac_3);
+    assert(bounded.cache_size() == 2);
+    assert((bounded.photon_flux("AM15", lam_vac) == weights).min());  // still cached
+    assert((bounded.photon_flux("AM15", lam_vac_2) == library.photon_flux("AM15", lam_vac_2)).min());  // recomputed
+    assert(bounded.cache_size() == 2);
+    bounded.set_cache_capacity(1);
+    assert(bounded.cache_size() == 1);
+    bounded.add_irradiance("AM15", wavelength, irradiance);  // replacing a spectrum drops its weights
+    assert(bounded.cache_size() == 0);
+    bounded.set_cache_capacity(0);
+    assert((bounded.photon_flux("AM15", lam_vac) == weights).min());
+    assert(bounded.cache_size() == 0);
+}
+
+void test_calculate_jsc() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3, 1.4}, {1.0 + 0.4i, 1.2 + 0.2i, 1.1 + 0.3i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i, 1.8 + 1i}, {5, 4, 4.5},
+                                                                     {4.0 + 1i, 3.0 + 0.1i, 3.5 + 0.5i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<LayerType> c_list = {LayerType::Incoherent, LayerType::Coherent, LayerType::Coherent,
+                                             LayerType::Incoherent, LayerType::Incoherent};
+    const std::valarray<double> lam_vac = {400, 1000, 1770};
+    SpectrumLibrary library;
+    library.add_irradiance("flat", {300, 2000}, {1, 1});
+    const std::valarray<double> weights = library.photon_flux("flat", lam_vac);
+    for (const bool coherent : {true, false}) {
+        const rat_dict<double> rat = calculate_rat_indices(n_list, d_list, c_list, 0.3 + 0i, lam_vac, 'u', coherent);
+        const std::valarray<double> &A = std::get<std::valarray<double>>(rat.at("A"));
+        const double jsc = calculate_jsc(rat, weights);
+        assert(std::abs(jsc - SpectrumLibrary::q * (weights * A).sum()) <= 1e-12 * jsc);
+        // The absorbed photon flux of the finite layers adds up to that of A; the first and the last entries of
+        // A_per_layer are the reflected and the transmitted light.
+        const std::valarray<double> absorbed = calculate_absorbed_photon_flux(rat, weights);
+        const double absorbed_sum = std::valarray<double>(absorbed[std::slice(1, absorbed.size() - 2, 1)]).sum();
+        assert(std::abs(SpectrumLibrary::q * absorbed_sum - jsc) <= 1e-9 * jsc);
+    }
+    const std::valarray<std::complex<double>> th_0 = {0, 0.3, 0.7};
+    const std::vector<rat_dict<double>> angles = calculate_rat_angles_indices(n_list, d_list, c_list, th_0, lam_vac,
+                                                                              's', true);
+    const std::valarray<double> jsc_angles = calculate_jsc(angles, weights);
+    assert(jsc_angles.size() == th_0.size());
+    for (std::size_t a = 0; a < th_0.size(); a++) {
+        assert(jsc_angles[a] == calculate_jsc(angles.at(a), weights));
+    }
+    bool thrown = false;
+    try {
+        calculate_jsc(angles.front(), std::valarray<double>(1.0, 2));
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_coh_tmm_precision() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<double> lam_vac = {400, 1770};
+    const auto to_float = [](const std::vector<std::valarray<std::complex<double>>> &n_list_double) {
+        std::vector<std::valarray<std::complex<float>>> n_list_float;
+        for (const std::valarray<std::complex<double>> &n : n_list_double) {
+            std::valarray<std::complex<float>> &n_float = n_list_float.emplace_back(n.size());
+            for (std::size_t j = 0; j < n.size(); j++) {
+                n_float[j] = {static_cast<float>(n[j].real()), static_cast<float>(n[j].imag())};
+            }
+        }
+        return n_list_float;
+    };
+    const std::vector<std::valarray<std::complex<float>>> n_list_f = to_float(n_list);
+    const std::vector<float> d_list_f(d_list.begin(), d_list.end());
+    const std::valarray<float> lam_vac_f = {400, 1770};
+    // Accuracy envelope on this stack (phases up to ~150 rad): single and mixed precision agree with double to 1e-6
+    // in R, T, and absorp_in_each_layer.
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> reference;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, reference);
+        CohTmmVecResult<float> single;
+        coh_tmm(pol, n_list_f, d_list_f, std::complex<float>(0.3F), lam_vac_f, single);
+        CohTmmVecResult<float> mixed;
+        coh_tmm_mixed<float, double>(pol, n_list_f, d_list_f, std::complex<float>(0.3F), lam_vac_f, mixed);
+        const std::valarray<std::valarray<double>> A_reference = absorp_in_each_layer(reference);
+        for (const CohTmmVecResult<float> *result : {&single, &mixed}) {
+            const std::valarray<std::valarray<float>> A = absorp_in_each_layer(*result);
+            for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                assert(std::abs(result->R[j] - reference.R[j]) < 1e-6);
+                assert(std::abs(result->Tr[j] - reference.Tr[j]) < 1e-6);
+                for (std::size_t i = 0; i < d_list.size(); i++) {
+                    assert(std::abs(A[i][j] - A_reference[i][j]) < 1e-6);
+                }
+            }
+        }
+        const std::valarray<LayerType> c_list = {LayerType::Incoherent, LayerType::Coherent, LayerType::Coherent,
+                                                 LayerType::Incoherent, LayerType::Incoherent};
+        const std::valarray<double> d_va(d_list.data(), d_list.size());
+        const std::valarray<float> d_va_f(d_list_f.data(), d_list_f.size());
+        const std::vector<std::valarray<double>> inc_reference = inc_absorp_in_each_layer(
+                inc_tmm(pol, n_list, d_va, c_list, std::complex<double>(0.3), lam_vac));
+        const std::vector<std::valarray<float>> inc_single = inc_absorp_in_each_layer(
+                inc_tmm(pol, n_list_f, d_va_f, c_list, std::complex<float>(0.3F), lam_vac_f));
+        for (std::size_t i = 0; i < inc_reference.size(); i++) {
+            for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                assert(std::abs(inc_single.at(i)[j] - inc_reference.at(i)[j]) < 1e-6);
+            }
+        }
+    }
+    // Three opaque layers: the matrix chain overflows float (exp(35) per layer) and pure float gives NaN, while
+    // mixed precision does not.
+    const std::vector<std::valarray<std::complex<double>>> opaque_n_list = {{1}, {2.0 + 1i}, {3.0 + 1i}, {2.5 + 1i},
+                                                                            {1.5}};
+    const std::vector<float> opaque_d_list = {INFINITY, 5000, 5000, 5000, INFINITY};
+    CohTmmVecResult<double> opaque_reference;
+    coh_tmm('s', opaque_n_list, std::vector<double>(opaque_d_list.begin(), opaque_d_list.end()),
+            std::complex<double>(0), std::valarray<double>{500}, opaque_reference);
+    CohTmmVecResult<float> opaque_mixed;
+    coh_tmm_mixed<float, double>('s', to_float(opaque_n_list), opaque_d_list, std::complex<float>(0),
+                                 std::valarray<float>{500}, opaque_mixed);
+    assert(std::abs(opaque_mixed.R[0] - opaque_reference.R[0]) < 1e-6);
+    CohTmmVecResult<float> opaque_single;
+    coh_tmm('s', to_float(opaque_n_list), opaque_d_list, std::complex<float>(0), std::valarray<float>{500},
+            opaque_single);
+    assert(std::isnan(opaque_single.R[0]));
+    assert(std::isfinite(opaque_mixed.R[0]) and std::isfinite(opaque_mixed.Tr[0]));
+}
+
+void test_fixed_matrix_multiply() {
+    FixedMatrix<std::complex<double>, 2, 2> a;
+    FixedMatrix<std::complex<double>, 2, 2> b;
+    a(0, 0) = 1.0 + 2i;
+    a(0, 1) = -0.5 + 0.25i;
+    a(1, 0) = 3;
+    a(1, 1) = -1i;
+    b(0, 0) = 0.5 - 1i;
+    b(0, 1) = 2.0 + 2i;
+    b(1, 0) = -1.5 + 0.5i;
+    b(1, 1) = 4;
+    const FixedMatrix<std::complex<double>, 2, 2> expected = dot(a, b);
+    const FixedMatrix<std::complex<double>, 2, 2> product = multiply_2x2(a, b);
+    std::vector<FixedMatrix<std::complex<double>, 2, 2>> batch = {a, b, a};
+    const std::vector<FixedMatrix<std::complex<double>, 2, 2>> rhs = {b, b, b};
+    multiply_2x2_batch<double>(batch, rhs, batch);
+    FixedMatrix<std::complex<double>, 2, 1> x;
+    x(0, 0) = 1.0 - 1i;
+    x(1, 0) = 2i;
+    const FixedMatrix<std::complex<double>, 2, 1> y = multiply_2x2(a, x);
+    const FixedMatrix<std::complex<double>, 2, 1> y_expected = dot(a, x);
+    for (std::size_t i = 0; i < 2; i++) {
+        for (std::size_t j = 0; j < 2; j++) {
+            assert(std::abs(product(i, j) - expected[i][j]) < 1e-14);
+            assert(std::abs(batch.at(0)(i, j) - expected[i][j]) < 1e-14);
+            assert(std::abs(batch.at(2)(i, j) - expected[i][j]) < 1e-14);
+        }
+        assert(std::abs(y(i, 0) - y_expected[i][0]) < 1e-14);
+    }
+    // The unchecked path is usable in constant expressions.
+    constexpr auto constant_product = [] {
+        FixedMatrix<std::complex<double>, 2, 2> m;
+        m(0, 0) = m(1, 1) = {0, 1};
+        return multiply_2x2(m, m);
+    }();
+    static_assert(constant_product(0, 0) == std::complex<double>(-1) and constant_product(0, 1) == 0.0);
+}
+
+void test_coh_tmm_fixed() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<double> lam_vac = {400, 1770};
+    const auto close = [](const auto &a, const auto &b) -> bool {
+        if (a.size() not_eq b.size()) {
+            return false;
+        }
+        for (std::size_t j = 0; j < a.size(); j++) {
+            if (std::abs(a[j] - b[j]) > 1e-10 * std::max(1.0, std::abs(b[j]))) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> reference;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, reference);
+        CohTmmVecResult<double> fixed;
+        assert(coh_tmm_fixed_dispatch(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, fixed));
+        assert(fixed.num_layers == 5 and fixed.num_wl == 2);
+        assert(close(fixed.r, reference.r) and close(fixed.t, reference.t));
+        assert(close(fixed.R, reference.R) and close(fixed.Tr, reference.Tr));
+        assert(close(fixed.power_entering, reference.power_entering));
+        assert(close(fixed.v_list, reference.v_list) and close(fixed.w_list, reference.w_list));
+        assert(close(fixed.kz_list, reference.kz_list) and close(fixed.th_list, reference.th_list));
+        const std::valarray<std::valarray<double>> A = absorp_in_each_layer(fixed);
+        const std::valarray<std::valarray<double>> A_reference = absorp_in_each_layer(reference);
+        for (std::size_t i = 0; i < d_list.size(); i++) {
+            assert(close(A[i], A_reference[i]));
+        }
+        // The absorption is reduced without storing the amplitudes, into a reused result.
+        assert(coh_tmm_fixed_dispatch(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, fixed,
+                                      CohTmmOutput::Absorption));
+        assert(fixed.output == CohTmmOutput::Absorption and fixed.v_list.size() == 0 and fixed.w_list.size() == 0);
+        assert(close(fixed.R, reference.R) and close(fixed.Tr, reference.Tr));
+        const std::valarray<std::valarray<double>> A_reduced = absorp_in_each_layer(fixed);
+        for (std::size_t i = 0; i < d_list.size(); i++) {
+            assert(close(A_reduced[i], A_reference[i]));
+        }
+        assert(coh_tmm_fixed_dispatch(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, fixed,
+                                      CohTmmOutput::RT));
+        assert(fixed.output == CohTmmOutput::RT and fixed.absorp_list.size() == 0 and fixed.v_list.size() == 0);
+        assert(close(fixed.r, reference.r) and close(fixed.power_entering, reference.power_entering));
+    }
+    // calculate_rat_indices takes coh_tmm_fixed with CohTmmOutput::Absorption for stacks of this size.
+    static_assert(coh_tmm_fixed_min_layers <= 5 and 5 <= rat_fixed_max_layers);
+    const std::valarray<LayerType> c_list(LayerType::Coherent, d_list.size());
+    for (const char pol : {'s', 'p'}) {
+        const rat_dict<double> rat = calculate_rat_indices(n_list, d_list, c_list, std::complex<double>(0.3), lam_vac,
+                                                           pol, true);
+        CohTmmVecResult<double> reference;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, reference);
+        const std::valarray<std::valarray<double>> A_reference = absorp_in_each_layer(reference);
+        const auto &A_per_layer = std::get<std::valarray<std::valarray<double>>>(rat.at("A_per_layer"));
+        assert(close(std::get<std::valarray<double>>(rat.at("R")), reference.R));
+        assert(close(std::get<std::valarray<double>>(rat.at("T")), reference.Tr));
+        assert(A_per_layer.size() == d_list.size());
+        for (std::size_t i = 0; i < d_list.size(); i++) {
+            assert(close(A_per_layer[i], A_reference[i]));
+        }
+    }
+    // Outside the precompiled layer counts the caller falls back to coh_tmm.
+    std::vector<std::valarray<std::complex<double>>> long_n_list(coh_tmm_fixed_max_layers + 1, {2.0 + 0.1i, 2.0 + 0.1i});
+    std::vector<double> long_d_list(coh_tmm_fixed_max_layers + 1, 50);
+    long_d_list.front() = long_d_list.back() = INFINITY;
+    CohTmmVecResult<double> unchanged;
+    assert(not coh_tmm_fixed_dispatch('s', long_n_list, long_d_list, std::complex<double>(0), lam_vac, unchanged));
+    assert(unchanged.num_layers == 0);
+}
+
+void test_rat_cache() {
+    const auto make_key = [](const double thickness) -> RatCacheKey {
+        RatCacheKey key;
+        key.append_string("ITO");
+        key.append(std::uint64_t{42});  // n/k data version
+        key.append(thickness);
+        key.append_range(std::vector<double>{400e-9, 500e-9, 600e-9});
+        key.append('s');
+        return key;
+    };
+    const auto make_rat = [](const double R) -> rat_dict<double> {
+        return {{"R", std::valarray<double>{R, R / 2, R / 4}}, {"A", std::valarray<double>{0.5, 0.5, 0.5}},
+                {"A_per_layer", std::valarray<std::valarray<double>>{{0.1, 0.2, 0.3}, {0.4, 0.3, 0.2}}}};
+    };
+    assert(make_key(1e-7).str() == make_key(1e-7).str() and make_key(1e-7).digest() == make_key(1e-7).digest());
+    assert(make_key(1e-7).digest() not_eq make_key(2e-7).digest());
+    RatCache<double> cache(2);
+    assert(not cache.find(make_key(1e-7)));
+    cache.insert(make_key(1e-7), make_rat(0.1));
+    cache.insert(make_key(2e-7), make_rat(0.2));
+    const std::optional<rat_dict<double>> hit = cache.find(make_key(1e-7));
+    assert(hit and std::get<std::valarray<double>>(hit->at("R"))[1] == 0.05);
+    // 1e-7 is now the most recently used entry, so 2e-7 is evicted.
+    cache.insert(make_key(3e-7), make_rat(0.3));
+    assert(not cache.find(make_key(2e-7)) and cache.find(make_key(1e-7)) and cache.find(make_key(3e-7)));
+    RatCacheStats stats = cache.stats();
+    assert(stats.hits == 3 and stats.misses == 2 and stats.evictions == 1 and stats.size == 2);
+    // On-disk tier: a second cache with the same directory serves the result after the first one is gone.
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "test_rat_cache";
+    std::filesystem::remove_all(directory);
+    {
+        RatCache<double> disk_cache(1, directory);
+        rat_dict<double> inc_rat = make_rat(0.4);
+        inc_rat.insert_or_assign("A_per_layer", std::vector<std::valarray<double>>{{0.1, 0.2}, {}});
+        disk_cache.insert(make_key(4e-7), inc_rat);
+    }
+    RatCache<double> disk_cache(1, directory);
+    const std::optional<rat_dict<double>> disk_hit = disk_cache.find(make_key(4e-7));
+    assert(disk_hit and std::get<std::valarray<double>>(disk_hit->at("R"))[2] == 0.1);
+    const auto &A_per_layer = std::get<std::vector<std::valarray<double>>>(disk_hit->at("A_per_layer"));
+    assert(A_per_layer.size() == 2 and A_per_layer.front()[1] == 0.2 and A_per_layer.back().size() == 0);
+    assert(disk_cache.find(make_key(4e-7)));  // promoted to memory
+    // A single-precision cache never reads a double-precision file.
+    RatCache<float> float_cache(1, directory);
+    assert(not float_cache.find(make_key(4e-7)));
+    stats = disk_cache.stats();
+    assert(stats.disk_hits == 1 and stats.hits == 1 and stats.misses == 0 and stats.disk_errors == 0);
+    assert(float_cache.stats().misses == 1 and float_cache.stats().disk_errors == 1);
+    std::filesystem::remove_all(directory);
+}
+
+void test_material_store() {
+    const std::filesystem::path filename = std::filesystem::temp_directory_path() / "test_material_store.nkdb";
+    const std::vector<double> wl = {300e-9, 400e-9, 500e-9};
+    const std::vector<double> n = {1.5, 1.4, 1.3};
+    const std::vector<double> k = {0.1, 0.01, 0};
+    const std::vector<double> wl_x = {300e-9, 600e-9};
+    const std::vector<double> n_x0 = {3.5, 3.4};
+    const std::vector<double> n_x1 = {3.6, 3.5};
+    const std::vector<double> k_x0 = {0.2, 0};
+    const std::vector<double> k_x1 = {0.3, 0.1};
+    {
+        MaterialStoreWriter writer(filename);
+        bool ok = writer.add("SOLCORE/GaAs", {42, {{1, wl}}, {{1, n}}, {{1, k}}});
+        ok = ok and writer.add("SOLCORE/AlGaAs", {7, {{0, wl_x}, {0.5, wl_x}}, {{0, n_x0}, {0.5, n_x1}},
+                                                  {{0, k_x0}, {0.5, k_x1}}});
+        ok = ok and writer.add("DF/Empty", {});
+        ok = ok and writer.finish();
+        assert(ok and writer.size() == 3);
+    }
+    // Read the file into an 8-byte aligned buffer, as a memory map would be.
+    const std::size_t file_size = std::filesystem::file_size(filename);
+    std::vector<double> buffer((file_size + sizeof(double) - 1) / sizeof(double));
+    {
+        std::ifstream file(filename, std::ios::binary);
+        file.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(file_size));
+    }
+    const std::span<const std::byte> data = std::as_bytes(std::span(buffer)).first(file_size);
+    const std::optional<MaterialStoreIndex> index = parse_material_store(data);
+    assert(index and index->size() == 3);
+    const MaterialStoreEntry &gaas = index->at("SOLCORE/GaAs");
+    assert(gaas.fingerprint == 42 and gaas.wavelengths.size() == 1 and gaas.n_data.front().fraction == 1);
+    assert(std::ranges::equal(gaas.wavelengths.front().values, wl) and std::ranges::equal(gaas.n_data.front().values, n));
+    assert(std::ranges::equal(gaas.k_data.front().values, k));
+    const MaterialStoreEntry &algaas = index->at("SOLCORE/AlGaAs");
+    assert(algaas.fingerprint == 7 and algaas.n_data.size() == 2 and algaas.k_data.back().fraction == 0.5);
+    assert(std::ranges::equal(algaas.n_data.front().values, n_x0) and std::ranges::equal(algaas.k_data.back().values, k_x1));
+    assert(index->at("DF/Empty").wavelengths.empty() and index->at("DF/Empty").n_data.empty());
+    // Corrupted files are rejected rather than read out of bounds.
+    const auto parse_corrupted = [&buffer, file_size](const std::size_t pos, const std::byte value) {
+        std::vector<double> corrupted = buffer;
+        std::as_writable_bytes(std::span(corrupted))[pos] = value;
+        return parse_material_store(std::as_bytes(std::span(corrupted)).first(file_size));
+    };
+    assert(not parse_material_store(data.first(file_size - 1)));  // truncated index
+    assert(not parse_material_store(data.first(16)));  // truncated header
+    assert(not parse_corrupted(0, std::byte{'X'}));  // magic
+    assert(not parse_corrupted(8, std::byte{1}));  // version 1 has no fingerprints
+    assert(not parse_corrupted(12, std::byte{0}));  // byte-order mark
+    assert(not parse_corrupted(16, std::byte{4}));  // more materials than in the index
+    assert(not parse_corrupted(31, std::byte{0x7f}));  // index offset past the end
+    std::vector<double> shifted(buffer.size() + 1);
+    std::ranges::copy(data, std::as_writable_bytes(std::span(shifted)).begin() + 1);
+    assert(not parse_material_store(std::as_bytes(std::span(shifted)).subspan(1, file_size)));  // misaligned
+    // A writer that does not finish, or cannot write, leaves no file behind.
+    const std::filesystem::path unfinished = std::filesystem::temp_directory_path() / "test_material_store_2.nkdb";
+    {
+        MaterialStoreWriter writer(unfinished);
+        const bool ok = writer.add("SOLCORE/GaAs", {42, {{1, wl}}, {{1, n}}, {{1, k}}});
+        assert(ok);
+    }
+    assert(not std::filesystem::exists(unfinished));
+    MaterialStoreWriter writer(std::filesystem::temp_directory_path() / "no_such_directory" / "store.nkdb");
+    const bool ok = writer.add("SOLCORE/GaAs", {42, {{1, wl}}, {{1, n}}, {{1, k}}});
+    assert(not ok and not writer.finish());
+    std::filesystem::remove(filename);
+}
+
+/*
+ * Stand-in for OpticMaterial in MaterialResidency: loads bytes of data, hashed to content, on use, keeps its data
+ * version when unloaded, and cannot be unloaded while in_use, as if its lock were held by another thread.
+ */
+class MockResident {
+public:
+    MockResident(MaterialResidency<MockResident> &residency, const std::size_t bytes, const std::uint64_t content)
+            : residency(residency), bytes(bytes), content(content) {}
+    ~MockResident() {
+        residency.forget(this);
+    }
+    MockResident(const MockResident &) = delete;
+    auto operator=(const MockResident &) -> MockResident & = delete;
+
+    void use() {
+        if (not loaded) {
+            num_loads++;
+            loaded = true;
+            version = content;
+        }
+        residency.touch(this, bytes);
+    }
+
+    auto try_unload_nk() -> bool {
+        if (in_use) {
+            return false;
+        }
+        loaded = false;
+        return true;
+    }
+
+    [[nodiscard]] auto data_version() const -> std::uint64_t {
+        return version;
+    }
+
+    bool loaded = false;
+    bool in_use = false;
+    std::size_t num_loads = 0;
+
+private:
+    MaterialResidency<MockResident> &residency;
+    std::size_t bytes;
+    std::uint64_t content;
+    std::uint64_t version = 0;
+};
+
+void test_material_residency() {
+    MaterialResidency<MockResident> residency(100);
+    {
+        MockResident a(residency, 40, 1);
+        MockResident b(residency, 40, 2);
+        MockResident c(residency, 40, 3);
+        a.use();
+        b.use();
+        assert(a.loaded and b.loaded and residency.stats().resident_bytes == 80);
+        // Least recently used first: a is evicted.
+        c.use();
+        assert(not a.loaded and b.loaded and c.loaded);
+        MaterialResidencyStats stats = residency.stats();
+        assert(stats.resident_bytes == 80 and stats.num_resident == 2 and stats.loads == 3 and stats.evictions == 1);
+        // An evicted material keeps its data version, and reloading it counts as a load.
+        assert(a.data_version() == 1);
+        b.use();
+        a.use();  // c is now the least recently used.
+        assert(a.loaded and b.loaded and not c.loaded and a.data_version() == 1 and a.num_loads == 2);
+        stats = residency.stats();
+        assert(stats.loads == 4 and stats.evictions == 2 and stats.resident_bytes == 80);
+        // A material in use is skipped rather than waited for, and the next colder one is evicted instead.
+        b.in_use = true;
+        c.use();  // c, a, b
+        assert(b.loaded and not a.loaded and c.loaded and residency.stats().evictions == 3);
+        // Nothing else can be evicted: the budget is exceeded rather than b waited for or c evicted.
+        residency.set_budget(10);
+        assert(b.loaded and c.loaded and residency.stats().resident_bytes == 80);
+        b.in_use = false;
+        residency.set_budget(10);
+        // The most recently used material stays even beyond the budget.
+        assert(not b.loaded and c.loaded and residency.stats().num_resident == 1);
+        {
+            MockResident d(residency, 40, 4);
+            d.use();
+            assert(d.loaded and not c.loaded and residency.stats().num_resident == 1);
+        }
+        // A destroyed material is forgotten, so it is neither counted nor ever unloaded later.
+        stats = residency.stats();
+        assert(stats.num_resident == 0 and stats.resident_bytes == 0);
+        residency.set_budget(100);
+        a.use();
+        b.use();
+        c.use();
+        assert(not a.loaded and b.loaded and c.loaded and residency.stats().num_resident == 2);
+    }
+    const MaterialResidencyStats stats = residency.stats();
+    assert(stats.num_resident == 0 and stats.resident_bytes == 0 and stats.loads == 9 and stats.evictions == 6);
+}
+
+void test_coh_tmm_workspace() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<double> lam_vac = {400, 1770};
+    const auto same = [](const auto &a, const auto &b) -> bool {
+        return a.size() == b.size() and std::ranges::equal(a, b);
+    };
+    CohTmmWorkspace<double> workspace;
+    CohTmmVecResult<double> result;
+    PositionResolvedVecResult<double> fields;
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> reference;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, reference);
+        // A workspace and a result left over from a stack of another size are resized.
+        coh_tmm(pol, std::vector<std::valarray<std::complex<double>>>(3, {1.5, 1.5, 1.5}),
+                std::vector<double>{INFINITY, 100, INFINITY}, std::complex<double>(0), std::valarray<double>{1, 2, 3},
+                result, workspace);
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, result, workspace);
+        assert(result.pol == pol and result.num_layers == 5 and result.num_wl == 2);
+        assert(same(result.r, reference.r) and same(result.t, reference.t));
+        assert(same(result.R, reference.R) and same(result.Tr, reference.Tr));
+        assert(same(result.power_entering, reference.power_entering));
+        assert(same(result.v_list, reference.v_list) and same(result.w_list, reference.w_list));
+        assert(same(result.kz_list, reference.kz_list) and same(result.th_list, reference.th_list));
+        position_resolved(2, 100.0, result, fields);
+        const auto dict = position_resolved(2, 100.0, reference);
+        assert(same(fields.poyn, std::get<std::valarray<double>>(dict.at("poyn"))));
+        assert(same(fields.absor, std::get<std::valarray<double>>(dict.at("absor"))));
+        const std::valarray<std::complex<double>> &E = pol == 's' ? fields.Ey : fields.Ex;
+        assert(same(E, std::get<std::valarray<std::complex<double>>>(dict.at(pol == 's' ? "Ey" : "Ex"))));
+        assert(fields.Ex.size() == 2 and fields.Ey.size() == 2 and fields.Ez.size() == 2);
+    }
+    // inc_tmm with a reused workspace gives the same result as without one.
+    const std::valarray<double> inc_d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<LayerType> c_list = {LayerType::Incoherent, LayerType::Coherent, LayerType::Coherent,
+                                             LayerType::Incoherent, LayerType::Incoherent};
+    const inc_tmm_vec_dict<double> inc_reference = inc_tmm('s', n_list, inc_d_list, c_list, std::complex<double>(0.3),
+                                                           lam_vac);
+    const inc_tmm_vec_dict<double> inc_data = inc_tmm('s', n_list, inc_d_list, c_list, std::complex<double>(0.3),
+                                                      lam_vac, workspace);
+    assert(same(std::get<std::valarray<double>>(inc_data.at("R")),
+                std::get<std::valarray<double>>(inc_reference.at("R"))));
+    assert(same(std::get<std::valarray<double>>(inc_data.at("T")),
+                std::get<std::valarray<double>>(inc_reference.at("T"))));
+}
+
+void test_coh_tmm_forward_reverse() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<double> lam_vac = {400, 1770};
+    const auto close = [](const auto &a, const auto &b) -> bool {
+        if (a.size() not_eq b.size()) {
+            return false;
+        }
+        for (std::size_t j = 0; j < a.size(); j++) {
+            if (std::abs(a[j] - b[j]) > 1e-10 * std::max(1e-10, std::abs(b[j]))) {
+                return false;
+            }
+        }
+        return true;
+    };
+    CohTmmWorkspace<double> workspace;
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> result;
+        CohTmmVecResult<double> reverse_result;
+        coh_tmm_forward_reverse(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, result, reverse_result,
+                                workspace);
+        CohTmmVecResult<double> forward;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, forward);
+        assert(close(result.r, forward.r) and close(result.v_list, forward.v_list));
+        // The reference reverse pass is coh_tmm on the reversed stack, incident at the exit angle.
+        const std::vector<std::valarray<std::complex<double>>> reversed_n_list(n_list.rbegin(), n_list.rend());
+        const std::vector<double> reversed_d_list(d_list.rbegin(), d_list.rend());
+        const std::valarray<std::complex<double>> th_f = forward.th_list[std::slice(4 * 2, 2, 1)];
+        CohTmmVecResult<double> reference;
+        coh_tmm(pol, reversed_n_list, reversed_d_list, th_f, lam_vac, reference);
+        assert(reverse_result.pol == pol and reverse_result.num_layers == 5 and reverse_result.num_wl == 2);
+        assert(close(reverse_result.r, reference.r) and close(reverse_result.t, reference.t));
+        assert(close(reverse_result.R, reference.R) and close(reverse_result.Tr, reference.Tr));
+        assert(close(reverse_result.power_entering, reference.power_entering));
+        assert(close(reverse_result.v_list, reference.v_list) and close(reverse_result.w_list, reference.w_list));
+        assert(close(reverse_result.th_list, reference.th_list) and close(reverse_result.kz_list, reference.kz_list));
+        assert(close(reverse_result.th_0, reference.th_0) and reverse_result.d_list == reference.d_list);
+        // Single precision with a scalar th_0
+        std::vector<std::valarray<std::complex<float>>> n_list_f;
+        for (const std::valarray<std::complex<double>> &n : n_list) {
+            n_list_f.emplace_back(n.size());
+            std::ranges::transform(n, std::begin(n_list_f.back()), [](const std::complex<double> &z) {
+                return std::complex<float>(z);
+            });
+        }
+        const std::vector<float> d_list_f(d_list.begin(), d_list.end());
+        const std::valarray<float> lam_vac_f = {400, 1770};
+        CohTmmWorkspace<float> workspace_f;
+        CohTmmVecResult<float> result_f;
+        CohTmmVecResult<float> reverse_result_f;
+        coh_tmm_forward_reverse(pol, n_list_f, d_list_f, std::complex<float>(0.3F), lam_vac_f, result_f,
+                                reverse_result_f, workspace_f);
+        for (std::size_t j = 0; j < 2; j++) {
+            assert(std::abs(result_f.R[j] - result.R[j]) < 1e-4);
+            assert(std::abs(reverse_result_f.R[j] - reverse_result.R[j]) < 1e-4);
+            assert(std::abs(reverse_result_f.Tr[j] - reverse_result.Tr[j]) < 1e-4);
+        }
+    }
+}
+
+void test_coh_tmm_output() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<double> lam_vac = {400, 1770};
+    const auto same = [](const auto &a, const auto &b) -> bool {
+        return a.size() == b.size() and std::ranges::equal(a, b);
+    };
+    CohTmmWorkspace<double> workspace;
+    for (const char pol : {'s', 'p'}) {
+        CohTmmVecResult<double> fields;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, fields, workspace);
+        CohTmmVecResult<double> rt;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, rt, workspace, CohTmmOutput::RT);
+        assert(rt.output == CohTmmOutput::RT and rt.v_list.size() == 0 and rt.w_list.size() == 0);
+        assert(same(rt.r, fields.r) and same(rt.t, fields.t) and same(rt.R, fields.R) and same(rt.Tr, fields.Tr));
+        assert(same(rt.power_entering, fields.power_entering));
+        assert(not rt.to_dict().contains("vw_list"));
+        bool thrown = false;
+        try {
+            absorp_in_each_layer(rt);
+        } catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        assert(thrown);
+        // Reusing a result of another output level resizes the amplitudes and the absorption as needed.
+        CohTmmVecResult<double> absorption = fields;
+        coh_tmm(pol, n_list, d_list, std::complex<double>(0.3), lam_vac, absorption, workspace,
+                CohTmmOutput::Absorption);
+        assert(absorption.v_list.size() == 0 and absorption.absorp_list.size() == 5 * 2);
+        assert(same(absorption.R, fields.R) and same(absorption.Tr, fields.Tr));
+        const std::valarray<std::valarray<double>> A = absorp_in_each_layer(absorption);
+        const std::valarray<std::valarray<double>> A_fields = absorp_in_each_layer(fields);
+        for (std::size_t i = 0; i < d_list.size(); i++) {
+            for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                assert(std::abs(A[i][j] - A_fields[i][j]) < 1e-14);
+            }
+        }
+    }
+}
+
+void test_coh_tmm_angles() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3}, {1.0 + 0.4i, 1.2 + 0.2i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i}, {5, 4},
+                                                                     {4.0 + 1i, 3.0 + 0.1i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<std::complex<double>> th_0 = {0, 0.3, 0.7};
+    const std::valarray<double> lam_vac = {400, 1770};
+    CohTmmVecResult<double> batch;
+    coh_tmm_angles('p', n_list, d_list, th_0, lam_vac, batch);
+    assert(batch.num_angles == 3);
+    assert(batch.num_wl == 6);
+    const std::valarray<std::valarray<double>> batch_ab = absorp_in_each_layer(batch);
+    for (std::size_t a = 0; a < th_0.size(); a++) {
+        CohTmmVecResult<double> single;
+        coh_tmm('p', n_list, d_list, th_0[a], lam_vac, single);
+        const std::valarray<std::valarray<double>> single_ab = absorp_in_each_layer(single);
+        for (std::size_t j = 0; j < lam_vac.size(); j++) {
+            assert(std::abs(batch.R[a * lam_vac.size() + j] - single.R[j]) < 1e-12);
+            assert(std::abs(batch.Tr[a * lam_vac.size() + j] - single.Tr[j]) < 1e-12);
+            for (std::size_t i = 0; i < d_list.size(); i++) {
+                assert(std::abs(batch_ab[i][a * lam_vac.size() + j] - single_ab[i][j]) < 1e-12);
+            }
+        }
+    }
+}
+
+void test_matrix_batch() {
+    // 11 is not a multiple of any SIMD width, so both the vectorized lanes and the scalar tail are covered.
+    constexpr std::size_t n = 11;
+    ComplexMatrix2Batch<double> A(n);
+    ComplexMatrix2Batch<double> B(n);
+    std::vector<std::array<std::complex<double>, 4>> a(n);
+    std::vector<std::array<std::complex<double>, 4>> b(n);
+    std::vector<double> x(4 * n);
+    for (std::size_t j = 0; j < n; j++) {
+        const auto jd = static_cast<double>(j);
+        a.at(j) = {1.0 + jd * 1i, 0.5 - 0.1 * jd * 1i, -0.3 + 2i, 2.0 - jd};
+        b.at(j) = {0.2 * jd - 1i, 1.5 + 0.5i, jd + 0.25i, -1.0 - 0.1 * jd * 1i};
+        for (std::size_t e = 0; e < 4; e++) {
+            A.set(e, j, a.at(j).at(e));
+            B.set(e, j, b.at(j).at(e));
+        }
+        x.at(j) = 1;
+        x.at(3 * n + j) = jd;
+    }
+    ComplexMatrix2Batch<double> C = A;
+    C.right_multiply(B);
+    B.left_multiply(A);
+    A.apply(x);
+    for (std::size_t j = 0; j < n; j++) {
+        const std::array<std::complex<double>, 4> &aj = a.at(j);
+        const std::array<std::complex<double>, 4> &bj = b.at(j);
+        const std::array<std::complex<double>, 4> cj{aj[0] * bj[0] + aj[1] * bj[2], aj[0] * bj[1] + aj[1] * bj[3],
+                                                     aj[2] * bj[0] + aj[3] * bj[2], aj[2] * bj[1] + aj[3] * bj[3]};
+        for (std::size_t e = 0; e < 4; e++) {
+            assert(std::abs(C.get(e, j) - cj.at(e)) < 1e-12);
+            assert(std::abs(B.get(e, j) - cj.at(e)) < 1e-12);
+        }
+        const std::complex<double> x1 = static_cast<double>(j) * 1i;
+        assert(std::abs(std::complex<double>(x.at(j), x.at(n + j)) - (aj[0] + aj[1] * x1)) < 1e-12);
+        assert(std::abs(std::complex<double>(x.at(2 * n + j), x.at(3 * n + j)) - (aj[2] + aj[3] * x1)) < 1e-12);
+    }
+    // The single-precision lanes are twice as wide; 19 again leaves a scalar tail.
+    constexpr std::size_t n_f = 19;
+    ComplexMatrix2Batch<float> A_f(n_f);
+    ComplexMatrix2Batch<float> B_f(n_f);
+    for (std::size_t j = 0; j < n_f; j++) {
+        const auto jf = static_cast<float>(j);
+        for (std::size_t e = 0; e < 4; e++) {
+            const auto ef = static_cast<float>(e);
+            A_f.set(e, j, {0.1f * jf - ef, 1.0f + 0.2f * ef});
+            B_f.set(e, j, {ef - 0.5f, 0.05f * jf});
+        }
+    }
+    ComplexMatrix2Batch<float> C_f = A_f;
+    C_f.right_multiply(B_f);
+    for (std::size_t j = 0; j < n_f; j++) {
+        for (std::size_t row = 0; row < 2; row++) {
+            for (std::size_t col = 0; col < 2; col++) {
+                const std::complex<float> expected = A_f.get(2 * row, j) * B_f.get(col, j) +
+                                                     A_f.get(2 * row + 1, j) * B_f.get(2 + col, j);
+                assert(std::abs(C_f.get(2 * row + col, j) - expected) < 1e-5f * (1 + std::abs(expected)));
+            }
+        }
+    }
+}
+
 void test_ellips_psi() {
     std::valarray<std::complex<double>> n_list = {1.5, 1.0 + 0.4i, 2.0 + 3i, 5, 4.0 + 1i,
                                                   1.3, 1.2 + 0.2i, 1.5 + 0.3i, 4, 3.0 + 0.1i};
@@ -1424,6 +2642,262 @@ void test_inc_position_resolved() {
          0, 0, 0, 0,
          0, 0, 0, 1.74764534e-13}}));
     assert(inc_position_resolved(std::forward<std::valarray<std::size_t>>(layer), d_in_layer, inc_tmm_data, c_list, alphas) == incpr_approx);
+    // The tiles of the map assemble into the same absorption
+    const std::valarray<std::size_t> map_layer = find_in_structure_inf(d_list, dist).first;
+    const std::valarray<std::valarray<double>> expected = inc_position_resolved(std::valarray<std::size_t>(map_layer),
+                                                                                d_in_layer, inc_tmm_data, c_list,
+                                                                                alphas);
+    std::size_t num_points = 0;
+    inc_position_resolved_map<double>(map_layer, d_in_layer, inc_tmm_data, c_list, alphas,
+                                      [&expected, &num_points](const FieldMapTile<double> &tile) {
+        assert(tile.num_z <= 5 and tile.num_wl == 2 and tile.poyn.empty());
+        for (std::size_t m = 0; m < tile.num_z; m++) {
+            for (std::size_t j = 0; j < tile.num_wl; j++) {
+                const double value = expected[tile.z_begin + m][j];
+                assert(std::abs(tile.absor[m * tile.num_wl + j] - value) <= 1e-12 * std::abs(value));
+            }
+        }
+        num_points += tile.num_z;
+    }, 5);
+    assert(num_points == dist.size());
+}
+
+void test_calculate_rat_angles_indices() {
+    const std::vector<std::valarray<std::complex<double>>> n_list = {{1.5, 1.3, 1.4}, {1.0 + 0.4i, 1.2 + 0.2i, 1.1 + 0.3i},
+                                                                     {2.0 + 3i, 1.5 + 0.3i, 1.8 + 1i}, {5, 4, 4.5},
+                                                                     {4.0 + 1i, 3.0 + 0.1i, 3.5 + 0.5i}};
+    const std::vector<double> d_list = {INFINITY, 200, 187.3, 1973.5, INFINITY};
+    const std::valarray<LayerType> c_list = {LayerType::Incoherent, LayerType::Coherent, LayerType::Coherent,
+                                             LayerType::Incoherent, LayerType::Incoherent};
+    const std::valarray<std::complex<double>> th_0 = {0, 0.3, 0.7};
+    const std::valarray<double> lam_vac = {400, 1000, 1770};
+    for (const bool coherent : {true, false}) {
+        for (const char pol : {'s', 'p', 'u'}) {
+            const std::vector<rat_dict<double>> angles = calculate_rat_angles_indices(n_list, d_list, c_list, th_0,
+                                                                                      lam_vac, pol, coherent);
+            assert(angles.size() == th_0.size());
+            for (std::size_t a = 0; a < th_0.size(); a++) {
+                // Every angle has the keys and layouts of calculate_rat_indices, A_per_layer included.
+                const rat_dict<double> single = calculate_rat_indices(n_list, d_list, c_list, th_0[a], lam_vac, pol,
+                                                                      coherent);
+                for (const char *key : {"R", "A", "T"}) {
+                    const std::valarray<double> &expected = std::get<std::valarray<double>>(single.at(key));
+                    const std::valarray<double> &actual = std::get<std::valarray<double>>(angles.at(a).at(key));
+                    assert(actual.size() == lam_vac.size());
+                    for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                        assert(std::abs(actual[j] - expected[j]) < 1e-12);
+                    }
+                }
+                std::visit([&]<typename V>(const V &expected) {
+                    if constexpr (std::is_same_v<V, std::valarray<double>>) {
+                        assert(false);  // A_per_layer is per layer
+                    } else {
+                        const V &actual = std::get<V>(angles.at(a).at("A_per_layer"));
+                        assert(actual.size() == expected.size());
+                        for (std::size_t i = 0; i < expected.size(); i++) {
+                            assert(actual[i].size() == lam_vac.size());
+                            for (std::size_t j = 0; j < lam_vac.size(); j++) {
+                                assert(std::abs(actual[i][j] - expected[i][j]) < 1e-12);
+                            }
+                        }
+                    }
+                }, single.at("A_per_layer"));
+            }
+        }
+    }
+}
+
+void assert_rat_close(const rat_dict<double> &actual, const rat_dict<double> &expected, const double tolerance) {
+    for (const char *key : {"R", "A", "T"}) {
+        const std::valarray<double> &a = std::get<std::valarray<double>>(actual.at(key));
+        const std::valarray<double> &e = std::get<std::valarray<double>>(expected.at(key));
+        assert(a.size() == e.size());
+        for (std::size_t j = 0; j < e.size(); j++) {
+            assert(std::abs(a[j] - e[j]) < tolerance);
+        }
+    }
+    assert(actual.at("A_per_layer").index() == expected.at("A_per_layer").index());
+    std::visit([&]<typename V>(const V &e) {
+        if constexpr (std::is_same_v<V, std::valarray<double>>) {
+            assert(false);  // A_per_layer is per layer
+        } else {
+            const V &a = std::get<V>(actual.at("A_per_layer"));
+            assert(a.size() == e.size());
+            for (std::size_t i = 0; i < e.size(); i++) {
+                assert(a[i].size() == e[i].size());
+                for (std::size_t j = 0; j < e[i].size(); j++) {
+                    assert(std::abs(a[i][j] - e[i][j]) < tolerance);
+                }
+            }
+        }
+    }, expected.at("A_per_layer"));
+}
+
+void test_calculate_rat_parallel() {
+    // 300 wavelengths: two full chunks of rat_chunk_size and a partial one.
+    constexpr std::size_t num_wl = 300;
+    static_assert(num_wl % rat_chunk_size not_eq 0);
+    const std::valarray<double> lam_vac = Utils::Math::linspace_va(400.0, 1700.0, num_wl);
+    std::vector<std::valarray<std::complex<double>>> n_list(5, std::valarray<std::complex<double>>(num_wl));
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const double x = static_cast<double>(j) / num_wl;
+        n_list.at(0)[j] = 1.0;
+        n_list.at(1)[j] = {1.8 + 0.4 * x, 0.3 * (1 - x)};
+        n_list.at(2)[j] = {3.5 - x, 0.5 * x};
+        n_list.at(3)[j] = {2.2, 0.01};
+        n_list.at(4)[j] = {1.5, 0.0};
+    }
+    const std::vector<double> d_list = {INFINITY, 80, 350, 2000, INFINITY};
+    const std::valarray<LayerType> c_list = {LayerType::Incoherent, LayerType::Coherent, LayerType::Coherent,
+                                             LayerType::Incoherent, LayerType::Incoherent};
+    constexpr std::complex<double> th_0 = 0.4;
+    for (const bool coherent : {true, false}) {
+        for (const char pol : {'s', 'p', 'u'}) {
+            const rat_dict<double> serial = calculate_rat_parallel(n_list, d_list, c_list, th_0, lam_vac, pol,
+                                                                   coherent, 1);
+            for (const std::size_t num_threads : {2UZ, 3UZ, 8UZ}) {
+                const rat_dict<double> parallel = calculate_rat_parallel(n_list, d_list, c_list, th_0, lam_vac, pol,
+                                                                         coherent, num_threads);
+                assert_rat_close(parallel, serial, 1e-12);
+            }
+        }
+    }
+}
+
+void test_calculate_rat_batch_indices() {
+    // 300 wavelengths: two full chunks of rat_chunk_size and a partial one.
+    constexpr std::size_t num_wl = 300;
+    const std::valarray<double> lam_vac = Utils::Math::linspace_va(400.0, 1700.0, num_wl);
+    std::vector<std::valarray<std::complex<double>>> n_pool(5, std::valarray<std::complex<double>>(num_wl));
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const double x = static_cast<double>(j) / num_wl;
+        n_pool.at(0)[j] = 1.0;
+        n_pool.at(1)[j] = {1.8 + 0.4 * x, 0.3 * (1 - x)};
+        n_pool.at(2)[j] = {3.5 - x, 0.5 * x};
+        n_pool.at(3)[j] = {2.2, 0.01};
+        n_pool.at(4)[j] = {1.5, 0.0};
+    }
+    // Three stacks of 3, 5, and 12 layers, i.e., within and beyond the layer counts of coh_tmm_fixed
+    const std::vector<std::vector<std::size_t>> n_rows = {{0, 2, 4}, {0, 1, 2, 3, 4},
+                                                          {0, 1, 2, 1, 2, 1, 2, 1, 2, 3, 2, 4}};
+    const std::vector<std::vector<double>> d_lists = {{INFINITY, 300, INFINITY},
+                                                      {INFINITY, 80, 350, 2000, INFINITY},
+                                                      {INFINITY, 60, 90, 60, 90, 60, 90, 60, 90, 1500, 400, INFINITY}};
+    std::vector<std::valarray<LayerType>> coherency_vas;
+    for (const std::vector<double> &d_list : d_lists) {
+        std::valarray<LayerType> c_list(LayerType::Coherent, d_list.size());
+        c_list[0] = c_list[d_list.size() - 1] = LayerType::Incoherent;
+        c_list[d_list.size() - 2] = LayerType::Incoherent;  // the thick substrate-side layer
+        coherency_vas.push_back(c_list);
+    }
+    constexpr std::complex<double> th_0 = 0.4;
+    for (const bool coherent : {true, false}) {
+        for (const char pol : {'s', 'p', 'u'}) {
+            std::vector<rat_dict<double>> expected;
+            for (std::size_t s = 0; s < n_rows.size(); s++) {
+                std::vector<std::valarray<std::complex<double>>> n_list;
+                for (const std::size_t row : n_rows.at(s)) {
+                    n_list.push_back(n_pool.at(row));
+                }
+                expected.push_back(calculate_rat_indices(n_list, d_lists.at(s), coherency_vas.at(s), th_0, lam_vac,
+                                                         pol, coherent));
+            }
+            // 1 and 2 threads take whole-spectrum tiles; 4 and 8 threads take chunks of rat_chunk_size.
+            for (const std::size_t num_threads : {1UZ, 2UZ, 4UZ, 8UZ}) {
+                const RatBatchResult<double> batch = calculate_rat_batch_indices(n_pool, n_rows, d_lists,
+                                                                                 coherency_vas, th_0, lam_vac, pol,
+                                                                                 coherent, num_threads);
+                assert(batch.num_stacks == n_rows.size() and batch.num_wl == num_wl);
+                for (std::size_t s = 0; s < n_rows.size(); s++) {
+                    const rat_dict<double> &rat = expected.at(s);
+                    for (std::size_t j = 0; j < num_wl; j++) {
+                        const std::size_t k = s * num_wl + j;
+                        assert(std::abs(batch.R[k] - std::get<std::valarray<double>>(rat.at("R"))[j]) < 1e-12);
+                        assert(std::abs(batch.A[k] - std::get<std::valarray<double>>(rat.at("A"))[j]) < 1e-12);
+                        assert(std::abs(batch.Tr[k] - std::get<std::valarray<double>>(rat.at("T"))[j]) < 1e-12);
+                    }
+                    std::visit([&]<typename V>(const V &A_per_layer) {
+                        if constexpr (std::is_same_v<V, std::valarray<double>>) {
+                            assert(false);  // A_per_layer is per layer
+                        } else {
+                            assert(batch.A_per_layer.at(s).size() == A_per_layer.size() * num_wl);
+                            for (std::size_t i = 0; i < A_per_layer.size(); i++) {
+                                for (std::size_t j = 0; j < num_wl; j++) {
+                                    assert(std::abs(batch.A_per_layer.at(s)[i * num_wl + j] - A_per_layer[i][j]) <
+                                           1e-12);
+                                }
+                            }
+                        }
+                    }, rat.at("A_per_layer"));
+                }
+            }
+        }
+    }
+}
+
+void test_calculate_rat_derivatives() {
+    // 200 wavelengths: a full chunk of rat_chunk_size and a partial one.
+    constexpr std::size_t num_wl = 200;
+    const std::valarray<double> lam_vac = Utils::Math::linspace_va(400.0, 1200.0, num_wl);
+    std::vector<std::valarray<std::complex<double>>> n_list(5, std::valarray<std::complex<double>>(num_wl));
+    for (std::size_t j = 0; j < num_wl; j++) {
+        const double x = static_cast<double>(j) / num_wl;
+        n_list.at(0)[j] = 1.0;
+        n_list.at(1)[j] = {1.8 + 0.4 * x, 0.3 * (1 - x)};
+        n_list.at(2)[j] = {3.5 - x, 0.5 * x};
+        n_list.at(3)[j] = {2.2, 0.01};
+        n_list.at(4)[j] = {1.5, 0.0};
+    }
+    const std::vector<double> d_list = {INFINITY, 80, 350, 200, INFINITY};
+    const std::valarray<LayerType> c_list(LayerType::Coherent, d_list.size());
+    constexpr std::complex<double> th_0 = 0.4;
+    const auto assert_gradient_close = [](const CohTmmVecGradient<double> &actual,
+                                          const CohTmmVecGradient<double> &expected) {
+        assert(actual.num_layers == expected.num_layers and actual.num_wl == expected.num_wl);
+        for (const auto field : {&CohTmmVecGradient<double>::dR_dd, &CohTmmVecGradient<double>::dR_dn,
+                                 &CohTmmVecGradient<double>::dR_dk, &CohTmmVecGradient<double>::dT_dd,
+                                 &CohTmmVecGradient<double>::dT_dn, &CohTmmVecGradient<double>::dT_dk}) {
+            assert((actual.*field).size() == (expected.*field).size());
+            for (std::size_t k = 0; k < (expected.*field).size(); k++) {
+                assert(std::abs((actual.*field)[k] - (expected.*field)[k]) < 1e-12);
+            }
+        }
+        for (const auto field : {&CohTmmVecGradient<double>::dA_dd, &CohTmmVecGradient<double>::dA_dn,
+                                 &CohTmmVecGradient<double>::dA_dk}) {
+            for (std::size_t p = 0; p < expected.num_layers; p++) {
+                for (std::size_t i = 0; i < expected.num_layers; i++) {
+                    for (std::size_t j = 0; j < expected.num_wl; j++) {
+                        assert(std::abs((actual.*field).at(p)[i][j] - (expected.*field).at(p)[i][j]) < 1e-12);
+                    }
+                }
+            }
+        }
+    };
+    CohTmmVecResult<double> result;
+    CohTmmVecGradient<double> expected_s;
+    CohTmmVecGradient<double> expected_p;
+    coh_tmm('s', n_list, d_list, th_0, lam_vac, result, expected_s);
+    coh_tmm('p', n_list, d_list, th_0, lam_vac, result, expected_p);
+    CohTmmVecGradient<double> expected_u = expected_s;
+    average_gradient(expected_u, expected_p);
+    for (const char pol : {'s', 'p', 'u'}) {
+        const CohTmmVecGradient<double> &expected = pol == 's' ? expected_s : pol == 'p' ? expected_p : expected_u;
+        for (const std::size_t num_threads : {1UZ, 2UZ}) {
+            CohTmmVecGradient<double> derivatives;
+            const rat_dict<double> rat = calculate_rat_parallel(n_list, d_list, c_list, th_0, lam_vac, pol, true,
+                                                                num_threads, &derivatives);
+            assert_rat_close(rat, calculate_rat_indices(n_list, d_list, c_list, th_0, lam_vac, pol, true), 1e-12);
+            assert_gradient_close(derivatives, expected);
+        }
+    }
+    CohTmmVecGradient<double> derivatives;
+    bool thrown = false;
+    try {
+        calculate_rat_indices(n_list, d_list, c_list, th_0, lam_vac, 's', false, &derivatives);
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
 }
 
 void test_beer_lambert() {
@@ -1461,6 +2935,33 @@ void runall() {
     test_coh_tmm_th_list();
     test_coh_tmm_inputs();
     test_coh_tmm_reverse();
+    test_coh_tmm_result();
+    test_coh_tmm_unpolarized();
+    test_coh_tmm_angles();
+    test_calculate_rat_angles_indices();
+    test_calculate_rat_parallel();
+    test_calculate_rat_batch_indices();
+    test_calculate_rat_derivatives();
+    test_coh_tmm_incremental();
+    test_coh_tmm_gradient();
+    test_generation_profile();
+    test_position_resolved_map();
+    test_exp_scaled();
+    test_beer_lambert_generation();
+    test_interp1_linear();
+    test_grid_cache();
+    test_spectrum_library();
+    test_calculate_jsc();
+    test_coh_tmm_precision();
+    test_fixed_matrix_multiply();
+    test_coh_tmm_fixed();
+    test_rat_cache();
+    test_material_store();
+    test_material_residency();
+    test_coh_tmm_workspace();
+    test_coh_tmm_forward_reverse();
+    test_coh_tmm_output();
+    test_matrix_batch();
     test_ellips_psi();
     test_ellips_Delta();
     test_unpolarized_RT_R();